@@ -108,10 +108,17 @@ function bridge:new (conf)
       add_port(port)
    end
 
-   -- Add split horizon groups
+   -- Add split horizon groups in the order of their names, so that
+   -- bridges with the same configuration assign the same handles
+   -- (required by apps.bridge.shared_mac_table)
    if conf.split_horizon_groups then
-      for group, ports in pairs(conf.split_horizon_groups) do
-         for _, port in ipairs(ports) do
+      local names = {}
+      for group in pairs(conf.split_horizon_groups) do
+         table.insert(names, group)
+      end
+      table.sort(names)
+      for _, group in ipairs(names) do
+         for _, port in ipairs(conf.split_horizon_groups[group]) do
             add_port(port, group)
          end
       end
@@ -68,3 +68,85 @@ lookup_result_t *mac_table_lookup(uint64_t mac, mac_entry_t *bucket);
 void mac_table_lookup_pft(uint64_t mac, mac_entry_t *bucket,
                           handle_t port, handle_t group, struct packet *p,
                           pft_t **pfts, port_list_t *flood_pl);
+
+/* Shared MAC table (apps/bridge/shared_mac_table.lua).  The table
+   lives in shared memory and is read by all workers of a bridge
+   without locking, while a single owner applies updates.  An entry
+   is a single 64-bit word that holds the MAC address in its lower 48
+   bits and the port handle in its upper 16 bits, so that readers
+   never see a partially written entry.  An empty slot is zero.  A
+   bucket fills exactly one cache line and is always searched
+   completely, which allows the owner to remove entries without
+   compacting the bucket. */
+enum { SHARED_BUCKET_SIZE = 8 };
+typedef struct {
+  uint64_t slots[SHARED_BUCKET_SIZE];
+} shared_bucket_t;
+
+/* This fixed-sized declaration is used in mac_table.c and must match
+   the ctype for shared_mac_table_t in shared_mac_table.lua. */
+typedef struct {
+  uint32_t shift;    /* 64 minus log2 of the number of buckets */
+  uint32_t entries;  /* Number of stored addresses */
+  uint8_t  overflow; /* Flag to indicate overflow in at least one bucket */
+  uint8_t  pad[55];
+  shared_bucket_t buckets[1];
+} shared_mac_table_t;
+
+/* Each worker passes the addresses it learns to the owner through a
+   single-producer/single-consumer queue in shared memory.  Both
+   cursors run freely and are reduced modulo LEARN_QUEUE_SIZE. */
+enum { LEARN_QUEUE_SIZE = 4096 };
+typedef struct {
+  uint32_t write;
+  uint8_t  pad1[60];
+  uint32_t read;
+  uint8_t  pad2[60];
+  uint64_t entries[LEARN_QUEUE_SIZE];
+} learn_queue_t;
+
+/* Private state of a worker's end of a learn queue.  Entries become
+   visible to the owner only after learner_commit().  The cache holds
+   the entries reported since the owner's last aging tick, so that an
+   active address is reported about once per tick instead of once per
+   packet. */
+typedef struct {
+  learn_queue_t *queue;
+  uint64_t *cache;
+  uint32_t cache_mask;
+  uint32_t write;
+  uint32_t read;
+  uint32_t dropped;
+} learner_t;
+
+/* The owner ages entries with a timing wheel of WHEEL_SIZE slots.  An
+   entry expires WHEEL_SIZE ticks after it was last refreshed.  Each
+   wheel slot is a list of table positions (bucket*SHARED_BUCKET_SIZE
+   + slot) linked through next[], and expire[] holds the expiry tick
+   of each position.  Refreshing an entry only updates its expiry
+   tick; the entry is moved to the right wheel slot once its old slot
+   comes up. */
+enum { WHEEL_SIZE = 64 };
+typedef struct {
+  uint32_t *expire;
+  uint32_t *next;
+  uint32_t head[WHEEL_SIZE];
+  uint32_t tick;
+} mac_wheel_t;
+
+void shared_mac_table_lookup_pft(uint64_t mac, shared_mac_table_t *table,
+                                 handle_t *p2group,
+                                 handle_t port, handle_t group,
+                                 struct packet *p,
+                                 pft_t **pfts, port_list_t *flood_pl);
+handle_t shared_mac_table_lookup(uint64_t mac, shared_mac_table_t *table);
+void shared_mac_table_learn(uint64_t mac, handle_t port, learner_t *l);
+void learner_commit(learner_t *l);
+uint32_t learn_queue_drain(learn_queue_t *q, uint64_t *entries, uint32_t max);
+uint32_t shared_mac_table_update(shared_mac_table_t *table, mac_wheel_t *w,
+                                 uint64_t *entries, uint32_t n,
+                                 shared_mac_table_t *from, uint32_t cursor);
+uint32_t shared_mac_table_migrate(shared_mac_table_t *from, mac_wheel_t *wf,
+                                  shared_mac_table_t *to, mac_wheel_t *wt,
+                                  uint32_t cursor, uint32_t n);
+uint32_t mac_wheel_advance(shared_mac_table_t *table, mac_wheel_t *w);
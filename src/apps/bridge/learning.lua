@@ -42,6 +42,14 @@
 --     override the default settings of the MAC table used by the
 --     bridge.
 --
+--     If the mac_table table has the key "shared", the bridge uses
+--     the shared MAC table of that name provided by
+--     apps.bridge.shared_mac_table instead, which allows several
+--     instances of the bridge in different worker processes to
+--     forward packets based on the same set of learned addresses.
+--     Exactly one of these instances must set the key "owner" to
+--     true.
+--
 -- Notes on performance and implementation choices:
 --
 -- The different forwarding decisions depending on the results of the
@@ -80,6 +88,7 @@ local packet = require("core.packet")
 local link = require("core.link")
 local bridge_base = require("apps.bridge.base").bridge
 local mac_table = require("apps.bridge.mac_table")
+local shared_mac_table = require("apps.bridge.shared_mac_table")
 require("apps.bridge.learning_h")
 local ethernet = require("lib.protocol.ethernet")
 local logger = require("lib.logger")
@@ -153,7 +162,6 @@ end
 
 function bridge:new (arg)
    local o = bridge:superClass().new(self, arg)
-   o._mac_table = mac_table:new(o._conf.config.mac_table)
 
    -- Note: the indices of arrays accessed via port handles start at
    -- 1.  All other arrays start at 0.
@@ -164,6 +172,14 @@ function bridge:new (arg)
       o._p2group[i] = o._ports[i].group
    end
 
+   local mac_table_conf = o._conf.config.mac_table
+   if mac_table_conf and mac_table_conf.shared then
+      o._mac_table = shared_mac_table:new(mac_table_conf, o._p2group)
+      o._shared = true
+   else
+      o._mac_table = mac_table:new(mac_table_conf)
+   end
+
    -- cdata version of egress port lists used for flooding.
    local flood_pl = { anchor = {} }
    for sp, dst in ipairs(o._dst_ports) do
@@ -194,6 +210,7 @@ function bridge:push()
    pft.discard.length = 0
    local ip = 1   -- ingress port
    local packets = 0
+   if self._shared then mac_table:sync() end
    while ports[ip] do
       local ig = self._p2group[ip] -- ingress split-horizon group
       local l_in = ports[ip].l_in
@@ -231,6 +248,7 @@ function bridge:push()
       ip = ip + 1
    end
    ::BREAK::
+   if self._shared then mac_table:commit() end
 
    -- Unicast forwarding.
    for i = 0, pft.ucast.length-1 do
@@ -257,3 +275,7 @@ function bridge:push()
       packet.free(pfe.p)
    end
 end
+
+function bridge:stop ()
+   if self._shared then self._mac_table:stop() end
+end
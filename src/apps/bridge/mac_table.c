@@ -1,6 +1,7 @@
 /* Use of this source code is governed by the Apache 2.0 license; see COPYING. */
 
 #include <inttypes.h>
+#include "core/packet.h"
 #include "learning.h"
 
 /* Insert a MAC address into the main and shadow hash tables. */
@@ -115,3 +116,230 @@ void mac_table_lookup_pft(uint64_t mac, mac_entry_t *bucket,
   pfe->plist = flood_pl;
   pft->length++;
 }
+
+/* Shared MAC table, see learning.h and shared_mac_table.lua. */
+
+#define MAC_MASK 0xFFFFFFFFFFFFULL
+#define NIL 0xFFFFFFFFU
+
+/* Finalizer of MurmurHash3 (x64).  The bucket index is taken from the
+   upper bits of the hash. */
+static inline uint64_t mac_hash(uint64_t mac) {
+  mac ^= mac >> 33;
+  mac *= 0xff51afd7ed558ccdULL;
+  mac ^= mac >> 33;
+  mac *= 0xc4ceb9fe1a85ec53ULL;
+  mac ^= mac >> 33;
+  return mac;
+}
+
+static inline shared_bucket_t *shared_bucket(shared_mac_table_t *table,
+                                             uint64_t mac) {
+  return &table->buckets[mac_hash(mac) >> table->shift];
+}
+
+/* Like mac_table_lookup_pft(), but for the shared table.  The group
+   of the egress port is taken from p2group.  Slots are read
+   atomically because the owner may update them concurrently. */
+void shared_mac_table_lookup_pft(uint64_t mac, shared_mac_table_t *table,
+                                 handle_t *p2group,
+                                 handle_t port, handle_t group,
+                                 struct packet *p,
+                                 pft_t **pfts, port_list_t *flood_pl) {
+  int i;
+  uint64_t entry;
+  handle_t eport;
+  pft_t *pft;
+  pft_entry_t *pfe;
+  shared_bucket_t *bucket = shared_bucket(table, mac);
+
+  for (i = 0; i<SHARED_BUCKET_SIZE; i++) {
+    entry = __atomic_load_n(&bucket->slots[i], __ATOMIC_RELAXED);
+    if ((entry & MAC_MASK) == mac && entry != 0ULL) {
+      eport = entry >> 48;
+      if ((group != 0 && group == p2group[eport]) || port == eport) {
+        pft = pfts[2];
+        pfe = &pft->entries[pft->length];
+        pfe->p = p;
+        pft->length++;
+        return;
+      }
+      pft = pfts[0];
+      pfe = &pft->entries[pft->length];
+      pfe->p = p;
+      pfe->plist->ports[0] = eport;
+      pft->length++;
+      return;
+    }
+  }
+  pft = pfts[1];
+  pfe = &pft->entries[pft->length];
+  pfe->p = p;
+  pfe->plist = flood_pl;
+  pft->length++;
+}
+
+/* Return the port handle associated with mac in the shared table or
+   0 if the address is not stored. */
+handle_t shared_mac_table_lookup(uint64_t mac, shared_mac_table_t *table) {
+  int i;
+  uint64_t entry;
+  shared_bucket_t *bucket = shared_bucket(table, mac);
+
+  for (i = 0; i<SHARED_BUCKET_SIZE; i++) {
+    entry = __atomic_load_n(&bucket->slots[i], __ATOMIC_RELAXED);
+    if ((entry & MAC_MASK) == mac && entry != 0ULL) {
+      return entry >> 48;
+    }
+  }
+  return 0;
+}
+
+/* Report that a packet from the address mac has been received on
+   port.  Addresses that have already been reported since the cache
+   was last cleared are skipped.  If the queue is full, the address is
+   dropped and will be reported again with one of the next packets. */
+void shared_mac_table_learn(uint64_t mac, handle_t port, learner_t *l) {
+  uint64_t entry = mac | ((uint64_t)port << 48);
+  uint64_t *cached = &l->cache[mac_hash(entry) & l->cache_mask];
+
+  if (*cached == entry) return;
+  if (l->write - l->read >= LEARN_QUEUE_SIZE) {
+    l->read = __atomic_load_n(&l->queue->read, __ATOMIC_ACQUIRE);
+    if (l->write - l->read >= LEARN_QUEUE_SIZE) {
+      l->dropped++;
+      return;
+    }
+  }
+  l->queue->entries[l->write % LEARN_QUEUE_SIZE] = entry;
+  l->write++;
+  *cached = entry;
+}
+
+/* Make the entries queued by shared_mac_table_learn() visible to the
+   owner. */
+void learner_commit(learner_t *l) {
+  __atomic_store_n(&l->queue->write, l->write, __ATOMIC_RELEASE);
+}
+
+/* Move up to max entries from a learn queue to the array entries and
+   return their number. */
+uint32_t learn_queue_drain(learn_queue_t *q, uint64_t *entries, uint32_t max) {
+  uint32_t read = q->read;
+  uint32_t n = __atomic_load_n(&q->write, __ATOMIC_ACQUIRE) - read;
+  uint32_t i;
+
+  if (n > max) n = max;
+  for (i = 0; i < n; i++) {
+    entries[i] = q->entries[(read + i) % LEARN_QUEUE_SIZE];
+  }
+  __atomic_store_n(&q->read, read + n, __ATOMIC_RELEASE);
+  return n;
+}
+
+static inline void wheel_file(mac_wheel_t *w, uint32_t pos) {
+  uint32_t slot = w->expire[pos] % WHEEL_SIZE;
+  w->next[pos] = w->head[slot];
+  w->head[slot] = pos;
+}
+
+/* Store an entry with the given expiry tick.  An existing entry for
+   the same address is updated in place.  Returns 0 if the bucket is
+   full. */
+static int shared_insert(shared_mac_table_t *table, mac_wheel_t *w,
+                         uint64_t entry, uint32_t expire) {
+  uint64_t mac = entry & MAC_MASK;
+  shared_bucket_t *bucket = shared_bucket(table, mac);
+  uint32_t base = (bucket - table->buckets) * SHARED_BUCKET_SIZE;
+  int i, empty = -1;
+
+  for (i = 0; i < SHARED_BUCKET_SIZE; i++) {
+    uint64_t slot = bucket->slots[i];
+    if (slot == 0ULL) {
+      if (empty < 0) empty = i;
+    } else if ((slot & MAC_MASK) == mac) {
+      if (slot != entry) {
+        __atomic_store_n(&bucket->slots[i], entry, __ATOMIC_RELAXED);
+      }
+      w->expire[base + i] = expire;
+      return 1;
+    }
+  }
+  if (empty < 0) {
+    table->overflow = 1;
+    return 0;
+  }
+  w->expire[base + empty] = expire;
+  wheel_file(w, base + empty);
+  table->entries++;
+  __atomic_store_n(&bucket->slots[empty], entry, __ATOMIC_RELEASE);
+  return 1;
+}
+
+/* Apply n learned entries to the table, refreshing them for a full
+   turn of the wheel.  While the table is being migrated from another
+   table, only entries whose bucket in the old table has already been
+   migrated (index below cursor) are applied; the others reach the new
+   table through migration.  Returns the number of entries that could
+   not be stored. */
+uint32_t shared_mac_table_update(shared_mac_table_t *table, mac_wheel_t *w,
+                                 uint64_t *entries, uint32_t n,
+                                 shared_mac_table_t *from, uint32_t cursor) {
+  uint32_t i, dropped = 0;
+  uint32_t expire = w->tick + WHEEL_SIZE;
+
+  for (i = 0; i < n; i++) {
+    if (from &&
+        (mac_hash(entries[i] & MAC_MASK) >> from->shift) >= cursor) {
+      continue;
+    }
+    if (!shared_insert(table, w, entries[i], expire)) dropped++;
+  }
+  return dropped;
+}
+
+/* Copy the entries of n buckets of a table, starting at cursor, to a
+   new table, keeping their expiry ticks.  Returns the new cursor. */
+uint32_t shared_mac_table_migrate(shared_mac_table_t *from, mac_wheel_t *wf,
+                                  shared_mac_table_t *to, mac_wheel_t *wt,
+                                  uint32_t cursor, uint32_t n) {
+  uint32_t buckets = 1U << (64 - from->shift);
+  uint32_t end = cursor + n > buckets ? buckets : cursor + n;
+  uint32_t b;
+  int i;
+
+  for (b = cursor; b < end; b++) {
+    for (i = 0; i < SHARED_BUCKET_SIZE; i++) {
+      uint64_t entry = from->buckets[b].slots[i];
+      if (entry != 0ULL) {
+        shared_insert(to, wt, entry, wf->expire[b*SHARED_BUCKET_SIZE + i]);
+      }
+    }
+  }
+  return end;
+}
+
+/* Advance the timing wheel by one tick and remove the entries that
+   expire at the new tick.  Entries that have been refreshed since
+   they were filed are moved to the slot of their new expiry tick.
+   Returns the number of removed entries. */
+uint32_t mac_wheel_advance(shared_mac_table_t *table, mac_wheel_t *w) {
+  uint32_t tick = ++w->tick;
+  uint32_t slot = tick % WHEEL_SIZE;
+  uint32_t pos = w->head[slot], next, expired = 0;
+
+  w->head[slot] = NIL;
+  for (; pos != NIL; pos = next) {
+    next = w->next[pos];
+    if ((int32_t)(w->expire[pos] - tick) > 0) {
+      wheel_file(w, pos);
+    } else {
+      __atomic_store_n(&table->buckets[pos / SHARED_BUCKET_SIZE]
+                       .slots[pos % SHARED_BUCKET_SIZE],
+                       0ULL, __ATOMIC_RELAXED);
+      table->entries--;
+      expired++;
+    }
+  }
+  return expired;
+}
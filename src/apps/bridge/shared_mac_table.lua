@@ -0,0 +1,610 @@
+-- Use of this source code is governed by the Apache 2.0 license; see COPYING.
+--
+-- This module implements a MAC address table for the learning bridge
+-- (apps.bridge.learning) that is shared between several instances of
+-- the bridge, typically running in separate worker processes that
+-- each serve a subset of the receive queues of the bridged ports.  It
+-- provides the same lookup and insert methods as apps.bridge.mac_table
+-- and is selected by setting the "shared" key of the MAC table
+-- configuration to the name of the table.
+--
+-- Exactly one of the bridge instances that share a table is its
+-- "owner" (configuration key "owner").  The owner creates the table
+-- in shared memory and is the only process that modifies it.  All
+-- other instances map the table and perform their lookups without
+-- any locking.  The objects of a table named <name> live in the
+-- process group:
+--
+--   group/bridge/<name>/control
+--   group/bridge/<name>/table-<generation>
+--   group/bridge/<name>/learn/<pid>-<instance>
+--
+-- The table is a hash table with buckets of 8 slots, each bucket
+-- filling one cache line.  A slot holds the MAC address and the
+-- handle of the port on which it has been learned as a single 64-bit
+-- word, which is read and written atomically, so that a lookup never
+-- sees a partially updated entry.  Lookups always search the whole
+-- bucket, which allows the owner to remove entries in place.  The
+-- number of buckets is the next power of 2 of the target size, which
+-- makes overflowing a bucket very unlikely before the table is full.
+-- The split-horizon group of the egress port is not stored in the
+-- table, it is looked up in the port-to-group mapping of the bridge,
+-- which is the same for all bridge instances sharing a table.
+--
+-- Learning
+--
+-- The insert() method does not modify the table.  It appends the
+-- source address and ingress port to a learn queue private to the
+-- bridge instance, which the owner drains on each breath and applies
+-- to the table in a batch.  Entries are published to the owner once
+-- per breath by the commit() method.  To keep the queue traffic
+-- proportional to the number of active addresses rather than to the
+-- packet rate, each instance remembers the addresses it has reported
+-- in a small direct-mapped cache, which is cleared on every tick of
+-- the aging clock (see below).  If the queue is full, the address is
+-- dropped and reported again with one of the following packets.
+--
+-- Aging
+--
+-- Instead of sweeping the table, the owner ages entries with a timing
+-- wheel of 64 slots that completes one turn per timeout interval.
+-- Every learned entry is filed in the wheel slot of the tick at which
+-- it expires.  Refreshing an entry only moves its expiry tick; when
+-- its slot comes up, an entry that has been refreshed in the meantime
+-- is filed again in the slot of its new expiry tick, all others are
+-- removed from the table.  The cost of aging is thus proportional to
+-- the number of entries that are expiring or have been refreshed,
+-- and it is spread evenly over the timeout interval.  As every bridge
+-- instance reports each active address once per tick, an address
+-- expires between 63 and 64 ticks after the last packet from it has
+-- been seen.
+--
+-- Resizing
+--
+-- If an address can not be stored because its bucket is full or the
+-- number of entries exceeds the target size, the owner grows the
+-- table like apps.bridge.mac_table does.  The new table is created as
+-- a new "generation" in shared memory and filled incrementally, a
+-- fixed number of buckets per breath, while all instances keep using
+-- the old table.  During the migration, updates are applied to the
+-- old table as well as to the already migrated part of the new one.
+-- Aging is suspended until the migration has completed.  The owner
+-- then publishes the new generation, which the other instances pick
+-- up by the sync() method at the start of their next breath, and
+-- unlinks the old table.  Forwarding never waits for a resize.
+
+module(...,package.seeall)
+
+local ffi = require("ffi")
+local C = ffi.C
+local S = require("syscall")
+local shm = require("core.shm")
+local sync = require("core.sync")
+local logger = require("lib.logger")
+local band = require("bit").band
+require("apps.bridge.learning_h")
+
+local shared_mac_table = subClass(nil)
+
+local default_config = {
+   shared = nil,
+   owner = false,
+   size = 256,
+   timeout = 60,
+   verbose = false,
+   resize_max = 2^16,
+}
+
+local shared_mac_table_t = ffi.typeof([[
+  struct {
+    uint32_t shift;
+    uint32_t entries;
+    uint8_t  overflow;
+    uint8_t  pad[55];
+    shared_bucket_t buckets[?];
+  }]])
+local header_size = 64
+local bucket_size = ffi.sizeof("shared_bucket_t")
+
+local control_t = ffi.typeof[[
+   struct {
+      uint32_t generation; // current table
+      uint32_t tick;       // aging clock, advanced by the owner
+      uint32_t queues[1];  // incremented when a learn queue comes or goes
+   }
+]]
+
+local wheel_size = C.WHEEL_SIZE
+local queue_size = C.LEARN_QUEUE_SIZE
+-- Number of entries in the cache of reported addresses of each
+-- instance.
+local cache_size = 4096
+-- Number of buckets migrated per breath during a resize.
+local resize_step = 1024
+
+-- Number of bridge instances in this process, used to name their
+-- learn queues.
+local instances = 0
+
+local function atomic_add (ptr, delta)
+   repeat
+      local old = ptr[0]
+   until sync.cas(ptr, old, old + delta)
+end
+
+-- Round up a number to the next power of 2, but at least 2.
+local function buckets_from_size (size)
+   return math.max(2, 2^math.ceil(math.log(size)/math.log(2)))
+end
+
+local function table_path (self, generation)
+   return self._path.."table-"..generation
+end
+
+local function create_table (self, generation, buckets)
+   local t = shm.create(table_path(self, generation), shared_mac_table_t,
+                        buckets)
+   t.shift = 64 - math.log(buckets)/math.log(2)
+   return t
+end
+
+-- Map the table of the given generation, or return nil if it has been
+-- unlinked by a newer generation in the meantime.
+local function open_table (self, generation)
+   local name = table_path(self, generation)
+   local stat = S.stat(shm.path(name))
+   if not stat then return nil end
+   local buckets = (stat.size - header_size) / bucket_size
+   local ok, t = pcall(shm.open, name, shared_mac_table_t, 'read-only',
+                       buckets)
+   if ok then return t, buckets end
+end
+
+-- Make t the table used for lookups.  Generation 0 is a private,
+-- empty table used by an instance until the owner has created the
+-- shared table.
+local function set_table (self, t, buckets, generation)
+   if self._generation and self._generation > 0 then
+      shm.unmap(self._table)
+   end
+   self._table = t
+   self._table_C = ffi.cast("shared_mac_table_t *", t)
+   self._buckets = buckets
+   self._generation = generation
+end
+
+local function alloc_wheel (buckets, tick)
+   local slots = buckets * C.SHARED_BUCKET_SIZE
+   local wheel = {
+      wheel = ffi.new("mac_wheel_t"),
+      expire = ffi.new("uint32_t[?]", slots),
+      next = ffi.new("uint32_t[?]", slots)
+   }
+   wheel.wheel.expire = wheel.expire
+   wheel.wheel.next = wheel.next
+   ffi.fill(wheel.wheel.head, ffi.sizeof(wheel.wheel.head), 0xFF)
+   wheel.wheel.tick = tick
+   return wheel
+end
+
+local function attach_queue (self)
+   instances = instances + 1
+   local name = self._path.."learn/"..S.getpid().."-"..instances
+   local learner = ffi.new("learner_t")
+   self._queue = shm.create(name, "learn_queue_t")
+   self._queue_name = name
+   self._cache = ffi.new("uint64_t[?]", cache_size)
+   learner.queue = self._queue
+   learner.cache = self._cache
+   learner.cache_mask = cache_size - 1
+   self._learner = learner
+end
+
+local function detach (self)
+   local t = shared_mac_table_t(2)
+   t.shift = 63
+   set_table(self, t, 2, 0)
+   if self._control then
+      atomic_add(self._control.queues, 1)
+      shm.unmap(self._control)
+      self._control = nil
+   end
+end
+
+-- Attach to the control object created by the owner and announce the
+-- learn queue of this instance.
+local function attach (self)
+   local name = self._path.."control"
+   if not shm.exists(name) then return false end
+   local ok, control = pcall(shm.open, name, control_t)
+   if not ok or control.generation == 0 then return false end
+   self._control = control
+   atomic_add(control.queues, 1)
+   return true
+end
+
+function shared_mac_table:new (config, p2group)
+   local config = config or {}
+   for k, v in pairs(default_config) do
+      if config[k] == nil then
+         config[k] = v
+      end
+   end
+   assert(type(config.shared) == 'string', "shared MAC table needs a name")
+   local o = shared_mac_table:superClass().new(self)
+   o._config = config
+   o._path = "group/bridge/"..config.shared.."/"
+   o._p2group = p2group
+   o._logger = logger.new({ module = "shared_mac_table" })
+   if config.owner then
+      local size = config.size
+      assert(type(size) == 'number' and size > 0)
+      o._size = math.min(size, config.resize_max)
+      local buckets = buckets_from_size(o._size)
+      o._control = shm.create(o._path.."control", control_t)
+      set_table(o, create_table(o, 1, buckets), buckets, 1)
+      o._wheel = alloc_wheel(buckets, 0)
+      o._queues = {}
+      o._queues_version = nil
+      o._entries = ffi.new("uint64_t[?]", queue_size)
+      o._tick_interval = config.timeout / wheel_size
+      o._next_tick = engine.now() + o._tick_interval
+      attach_queue(o)
+      o._control.generation = 1
+      atomic_add(o._control.queues, 1)
+   else
+      attach_queue(o)
+      detach(o)
+      o:sync()
+   end
+   return o
+end
+
+-- Convert a 6-byte MAC address stored at the given location in
+-- network-byte order to a 64-bit number, see apps.bridge.mac_table.
+local function mac2u64 (mem)
+   return band(ffi.cast("uint64_t*", mem[0])[0], 0xFFFFFFFFFFFFULL)
+end
+
+-- API
+--
+-- Report that a packet from the MAC address stored at the location
+-- pointed to by mem[0] in network byte order has been received on
+-- port <port>.  The address is stored by the owner of the table after
+-- the next call to commit().  The group is implied by the port.  mem
+-- must be of type uint8_t *[1].
+function shared_mac_table:insert (mem, port, group)
+   C.shared_mac_table_learn(mac2u64(mem), port, self._learner)
+end
+
+-- API
+--
+-- Look up the MAC address stored at the location pointed to by mem[0]
+-- in network byte order and return the handles of the port and
+-- split-horizon group associated with it or nil if the address was
+-- not found in the table. mem must be of type uint8_t *[1].
+function shared_mac_table:lookup (mem)
+   local port = C.shared_mac_table_lookup(mac2u64(mem), self._table_C)
+   if port == 0 then
+      return nil, nil
+   else
+      return port, self._p2group[port]
+   end
+end
+
+-- API
+--
+-- Same as mac_table:lookup_pft().
+function shared_mac_table:lookup_pft (mem, port, group, p, pft_C, flood_pl)
+   C.shared_mac_table_lookup_pft(mac2u64(mem), self._table_C, self._p2group,
+                                 port, group, p, pft_C, flood_pl)
+end
+
+-- API
+--
+-- Move to the current generation of the table and clear the cache of
+-- reported addresses if the aging clock has advanced.  Must be called
+-- at the start of each breath.  Until the owner has created the
+-- table, all lookups miss.
+function shared_mac_table:sync ()
+   local control = self._control
+   if not control then
+      if not attach(self) then return end
+      control = self._control
+   end
+   if control.tick ~= self._tick then
+      self._tick = control.tick
+      ffi.fill(self._cache, ffi.sizeof("uint64_t") * cache_size)
+   end
+   while control.generation ~= self._generation do
+      local generation = control.generation
+      if generation == 0 then
+         -- The owner has stopped.
+         return detach(self)
+      end
+      local t, buckets = open_table(self, generation)
+      if t then set_table(self, t, buckets, generation) end
+   end
+end
+
+-- Map the learn queues of all bridge instances that share the table.
+local function scan_queues (self)
+   local dir = self._path.."learn"
+   local present = {}
+   for _, name in ipairs(shm.children(dir)) do
+      present[name] = true
+      if not self._queues[name] then
+         local ok, q = pcall(shm.open, dir.."/"..name, "learn_queue_t")
+         if ok then self._queues[name] = q end
+      end
+   end
+   for name, q in pairs(self._queues) do
+      if not present[name] then
+         shm.unmap(q)
+         self._queues[name] = nil
+      end
+   end
+end
+
+local function start_resize (self)
+   local info = self:info()
+   local max = self._config.resize_max
+   local size, buckets = self._size, self._buckets
+   while (buckets < 2*self._buckets or info.entries > size)
+         and size < max do
+      size = math.min(size*2, max)
+      buckets = buckets_from_size(size)
+   end
+   if buckets == self._buckets then
+      if not self._resize_limit then
+         self._logger:log(("can't grow table beyond resize limit %d "
+                              .."(size/bucket overflow: %s/%s)")
+               :format(max, info.entries > info.size, info.overflow))
+         self._resize_limit = true
+      end
+      return
+   end
+   self._logger:log(("resizing from %d to %d hash buckets, new target "
+                        .."size %d (%d MAC entries, old target size %d, "
+                        .."size/bucket overflow: %s/%s)")
+         :format(self._buckets, buckets, size, info.entries, info.size,
+                 info.entries > info.size, info.overflow))
+   local generation = self._generation + 1
+   local t = create_table(self, generation, buckets)
+   self._migration = {
+      table = t,
+      table_C = ffi.cast("shared_mac_table_t *", t),
+      wheel = alloc_wheel(buckets, self._wheel.wheel.tick),
+      buckets = buckets,
+      size = size,
+      generation = generation,
+      cursor = 0
+   }
+end
+
+local function finish_resize (self)
+   local m = self._migration
+   local old = self._generation
+   set_table(self, m.table, m.buckets, m.generation)
+   self._wheel = m.wheel
+   self._size = m.size
+   self._migration = nil
+   self._control.generation = m.generation
+   shm.unlink(table_path(self, old))
+end
+
+local function update (self, n)
+   local entries = self._entries
+   C.shared_mac_table_update(self._table_C, self._wheel.wheel, entries, n,
+                             nil, 0)
+   local m = self._migration
+   if m then
+      C.shared_mac_table_update(m.table_C, m.wheel.wheel, entries, n,
+                                self._table_C, m.cursor)
+   end
+end
+
+-- Drain the learn queues, advance a pending resize and run the aging
+-- clock.  Called by the owner on each breath.
+local function maintain (self)
+   local control = self._control
+   if control.queues[0] ~= self._queues_version then
+      self._queues_version = control.queues[0]
+      scan_queues(self)
+   end
+   for _, q in pairs(self._queues) do
+      local n = C.learn_queue_drain(q, self._entries, queue_size)
+      if n > 0 then update(self, n) end
+   end
+   local m = self._migration
+   if m then
+      m.cursor = C.shared_mac_table_migrate(self._table_C, self._wheel.wheel,
+                                            m.table_C, m.wheel.wheel,
+                                            m.cursor, resize_step)
+      if m.cursor == self._buckets then finish_resize(self) end
+   else
+      local t = self._table
+      if t.overflow == 1 or t.entries > self._size then
+         start_resize(self)
+      end
+   end
+   local now = engine.now()
+   while now >= self._next_tick and not self._migration do
+      self:tick()
+      self._next_tick = self._next_tick + self._tick_interval
+   end
+end
+
+-- API
+--
+-- Advance the aging clock by one tick.  This is called by the owner
+-- every timeout/64 seconds.
+function shared_mac_table:tick ()
+   assert(self._config.owner)
+   C.mac_wheel_advance(self._table_C, self._wheel.wheel)
+   self._control.tick = self._wheel.wheel.tick
+   if self._config.verbose and self._control.tick % wheel_size == 0 then
+      local info = self:info()
+      self._logger:log(("%d MAC entries in %d hash buckets, target size %d, "
+                           .."size/bucket overflow: %s/%s")
+            :format(info.entries, info.buckets, info.size,
+                    info.entries > info.size, info.overflow))
+   end
+end
+
+-- API
+--
+-- Publish the addresses reported by insert() since the last call to
+-- the owner.  The owner also applies the updates from all instances.
+-- Must be called at the end of each breath.
+function shared_mac_table:commit ()
+   C.learner_commit(self._learner)
+   if self._config.owner then maintain(self) end
+end
+
+-- API
+--
+-- Release the shared objects of this instance.  The owner removes the
+-- table.
+function shared_mac_table:stop ()
+   shm.unmap(self._queue)
+   shm.unlink(self._queue_name)
+   if self._config.owner then
+      for _, q in pairs(self._queues) do shm.unmap(q) end
+      local m = self._migration
+      if m then
+         shm.unmap(m.table)
+         shm.unlink(table_path(self, m.generation))
+      end
+      shm.unlink(table_path(self, self._generation))
+      shm.unlink(self._path.."control")
+      self._control.generation = 0
+   end
+   detach(self)
+end
+
+-- API
+--
+-- Return a table with information about the table
+--
+--  size       The target size of the table (owner only)
+--  buckets    The number of hash buckets
+--  entries    The number of stored MAC addresses
+--  overflow   Whether an address did not fit into its bucket
+--  generation The generation of the table, incremented by each resize
+--  dropped    The number of addresses this instance could not report
+--             because its learn queue was full
+function shared_mac_table:info ()
+   local t = self._table
+   return {
+      size = self._size,
+      buckets = self._buckets,
+      entries = t.entries,
+      overflow = t.overflow == 1,
+      generation = self._generation,
+      dropped = self._learner.dropped
+   }
+end
+
+function selftest ()
+   local mac = ffi.new[[
+     union {
+       uint64_t u64;
+       uint8_t mac[6];
+       uint8_t pad[2];
+     }]]
+   local box = ffi.new("uint8_t *[1]")
+   box[0] = mac.mac
+   local p2group = ffi.new("handle_t[4]", {0, 0, 0, 1})
+   local name = "selftest-"..S.getpid()
+
+   -- An instance can be created before the owner.
+   local worker = shared_mac_table:new({ shared = name }, p2group)
+   mac.u64 = 0x010203040506ULL -- not a multicast address
+   worker:sync()
+   worker:insert(box, 2, 0)
+   worker:commit()
+   assert(not worker:lookup(box))
+   local owner = shared_mac_table:new({ shared = name, owner = true,
+                                        size = 64, timeout = 1e9 },
+                                      p2group)
+   local function breath ()
+      owner:sync(); worker:sync()
+      worker:commit(); owner:commit()
+   end
+
+   -- Addresses learned by either instance become visible to both
+   -- after a breath.
+   breath()
+   assert(worker:lookup(box) == 2 and owner:lookup(box) == 2)
+   owner:insert(box, 3, 1)
+   breath()
+   local port, group = worker:lookup(box)
+   assert(port == 3 and group == 1)
+   assert(owner:info().entries == 1)
+
+   -- Entries expire a full turn of the wheel after their last refresh.
+   local function tick (n)
+      for _ = 1, n do owner:tick(); breath() end
+   end
+   tick(wheel_size/2)
+   worker:insert(box, 3, 1)
+   breath()
+   tick(wheel_size/2 + 1)
+   assert(worker:lookup(box) == 3)
+   -- Reporting the same address again in the same tick is a no-op.
+   local queue = worker._queue
+   worker:insert(box, 3, 1)
+   breath()
+   local write = queue.write
+   worker:insert(box, 3, 1)
+   breath()
+   assert(queue.write == write)
+   tick(wheel_size)
+   assert(not worker:lookup(box))
+   assert(owner:info().entries == 0)
+
+   -- Grow the table while both instances keep looking up addresses.
+   local macs = {}
+   local n = 3000
+   for i = 1, n do
+      mac.u64 = i * 0x100
+      macs[i] = mac.u64
+      worker:insert(box, 1 + i % 3, 0)
+      if i % 500 == 0 then breath() end
+   end
+   for _ = 1, 100 do breath() end
+   local info = worker:info()
+   assert(info.generation > 1, "table did not grow")
+   assert(owner._migration == nil)
+   -- Addresses dropped due to overflow are learned again with the
+   -- next tick.
+   tick(1)
+   for i = 1, n do
+      mac.u64 = macs[i]
+      worker:insert(box, 1 + i % 3, 0)
+      if i % 500 == 0 then breath() end
+   end
+   for _ = 1, 10 do breath() end
+   for i = 1, n do
+      mac.u64 = macs[i]
+      assert(worker:lookup(box) == 1 + i % 3)
+      assert(owner:lookup(box) == 1 + i % 3)
+   end
+   assert(owner:info().entries == n)
+   assert(owner:info().buckets == worker:info().buckets)
+   -- All entries expire eventually.
+   tick(wheel_size + 1)
+   assert(owner:info().entries == 0)
+
+   -- Instances detach when the owner stops.
+   owner:stop()
+   assert(not shm.exists("group/bridge/"..name.."/control"))
+   worker:sync()
+   assert(worker:info().generation == 0)
+   worker:stop()
+end
+
+shared_mac_table.selftest = selftest
+
+return shared_mac_table
@@ -0,0 +1,539 @@
+-- Use of this source code is governed by the Apache 2.0 license; see COPYING.
+
+-- Generic receive offload: coalesce consecutive TCP segments (and runs of
+-- full-sized UDP datagrams) of a flow received within a breath into larger
+-- packets.
+
+module(..., package.seeall)
+
+local ffi = require("ffi")
+local bit = require("bit")
+local lib = require("core.lib")
+local packet = require("core.packet")
+local counter = require("core.counter")
+local link = require("core.link")
+local headers = require("apps.gro.headers")
+
+local C = ffi.C
+local band, bor, bxor, bnot, rshift = bit.band, bit.bor, bit.bxor, bit.bnot,
+   bit.rshift
+local receive, transmit = link.receive, link.transmit
+local get16, set16, get32 = headers.get16, headers.set16, headers.get32
+local csum_add, csum_sum, csum_swap = headers.csum_add, headers.csum_sum,
+   headers.csum_swap
+local pseudo_sum, set_ip_length = headers.pseudo_sum, headers.set_ip_length
+
+local ether_header_len = headers.ether_header_len
+local udp_header_len = headers.udp_header_len
+local proto_tcp, proto_udp = headers.proto_tcp, headers.proto_udp
+local tcp_ack, tcp_psh = headers.tcp_ack, headers.tcp_psh
+local o_tcp_seq, o_tcp_ack = headers.o_tcp_seq, headers.o_tcp_ack
+local o_tcp_data_offset = headers.o_tcp_data_offset
+local o_tcp_flags, o_tcp_checksum = headers.o_tcp_flags, headers.o_tcp_checksum
+local o_udp_length, o_udp_checksum = headers.o_udp_length,
+   headers.o_udp_checksum
+local o_ipv4_tos, o_ipv4_flags, o_ipv4_ttl = headers.o_ipv4_tos,
+   headers.o_ipv4_flags, headers.o_ipv4_ttl
+local o_ipv4_addrs, o_ipv6_addrs = headers.o_ipv4_addrs, headers.o_ipv6_addrs
+local o_ipv6_hop_limit = headers.o_ipv6_hop_limit
+
+-- A flow being coalesced: the packet segments are appended to, and what we
+-- need to know to append the next segment and to finish the packet.
+local flow_t = ffi.typeof[[
+   struct {
+      struct packet *p;
+      uint32_t next_seq;  // TCP: sequence number of the next segment
+      uint16_t l4;        // offset of the L4 header in p
+      uint16_t payload;   // offset of the L4 payload in p
+      uint16_t segment;   // payload length of the first segment
+      uint16_t sum;       // ones-complement sum of the payload so far
+      uint16_t count;     // number of segments in p
+      uint8_t version, proto;
+      uint8_t checksum;   // nonzero if the L4 checksum is in use
+      uint8_t closed;     // nonzero if no more segments can be appended
+   }
+]]
+
+GRO = {
+   config = {
+      -- Number of flows that can be coalesced at the same time.
+      flows = {default=64},
+      -- Coalesce runs of UDP datagrams too?
+      udp = {default=false},
+      -- IP MTU of the UDP datagrams to coalesce.
+      mtu = {default=1500},
+      -- Verify the L4 checksum of each segment before coalescing it?
+      verify_checksum = {default=true}
+   },
+   shm = {
+      ["coalesced"] = {counter},
+      ["coalesced-segments"] = {counter},
+      ["bad-checksum"] = {counter}
+   }
+}
+
+function GRO:new (conf)
+   assert(band(conf.flows, conf.flows - 1) == 0,
+          "flows must be a power of two")
+   local o = {
+      flows = ffi.new(ffi.typeof("$[?]", flow_t), conf.flows),
+      flow_mask = conf.flows - 1,
+      udp = conf.udp,
+      mtu = conf.mtu,
+      verify_checksum = conf.verify_checksum
+   }
+   return setmetatable(o, {__index=GRO})
+end
+
+local function flow_hash (l3, version, l4)
+   local a, b
+   if version == 4 then
+      a, b = get32(l3 + o_ipv4_addrs), get32(l3 + o_ipv4_addrs + 4)
+   else
+      a, b = get32(l3 + o_ipv6_addrs + 12), get32(l3 + o_ipv6_addrs + 28)
+   end
+   local h = bxor(a, b, get32(l4))
+   h = bxor(h, rshift(h, 16))
+   return bxor(h, rshift(h, 8))
+end
+
+-- Return true if the IP and L4 headers of p at l3 and l4 match those of the
+-- flow f closely enough for the payload of p to be appended to it.
+local function same_flow (f, l3, l4, version, proto)
+   if f.version ~= version or f.proto ~= proto then return false end
+   local data = f.p.data
+   local fl3, fl4 = data + ether_header_len, data + f.l4
+   -- Ethernet header, and source/destination ports.
+   if C.memcmp(data, l3 - ether_header_len, ether_header_len) ~= 0
+   or C.memcmp(fl4, l4, 4) ~= 0 then
+      return false
+   end
+   if version == 4 then
+      return fl3[o_ipv4_tos] == l3[o_ipv4_tos]
+         and fl3[o_ipv4_ttl] == l3[o_ipv4_ttl]
+         and get16(fl3 + o_ipv4_flags) == get16(l3 + o_ipv4_flags)
+         and C.memcmp(fl3 + o_ipv4_addrs, l3 + o_ipv4_addrs, 8) == 0
+   else
+      return fl3[o_ipv6_hop_limit] == l3[o_ipv6_hop_limit]
+         and C.memcmp(fl3, l3, 4) == 0
+         and C.memcmp(fl3 + o_ipv6_addrs, l3 + o_ipv6_addrs, 32) == 0
+   end
+end
+
+-- Return the L4 header length of a segment that can be coalesced, or nil.
+function GRO:segment_header_length (proto, l4, l4_length)
+   if proto == proto_tcp then
+      if l4_length < 20 then return end
+      local hlen = rshift(l4[o_tcp_data_offset], 4) * 4
+      -- Only plain ACK (and PSH) segments that carry data.
+      if hlen < 20 or hlen >= l4_length then return end
+      if band(l4[o_tcp_flags], bnot(tcp_psh)) ~= tcp_ack then return end
+      return hlen
+   elseif proto == proto_udp and self.udp then
+      if l4_length <= udp_header_len then return end
+      if get16(l4 + o_udp_length) ~= l4_length then return end
+      return udp_header_len
+   end
+end
+
+-- Return the sum of the payload of a segment, or nil if its checksum is
+-- incorrect. The segment must use its L4 checksum.
+function GRO:payload_sum (l3, version, proto, l4, l4_length, hlen)
+   local partial = csum_add(pseudo_sum(l3, version, proto, l4_length),
+                            csum_sum(l4, hlen))
+   if self.verify_checksum then
+      local payload = csum_sum(l4 + hlen, l4_length - hlen)
+      if csum_add(partial, payload) ~= 0xffff then return end
+      return payload
+   else
+      -- Trust the checksum, and derive the payload sum from it.
+      return band(bnot(partial), 0xffff)
+   end
+end
+
+-- Start coalescing the segment p into the (free) flow f.
+function GRO:hold (f, p, version, proto, l4, l4_length, hlen, checksum, sum)
+   local l3 = p.data + ether_header_len
+   f.p = p
+   f.version, f.proto = version, proto
+   f.l4 = l4 - p.data
+   f.payload = f.l4 + hlen
+   f.segment = l4_length - hlen
+   f.checksum = checksum and 1 or 0
+   f.sum = sum or 0
+   f.count = 1
+   if proto == proto_tcp then
+      f.next_seq = (get32(l4 + o_tcp_seq) + f.segment) % 2^32
+      f.closed = band(l4[o_tcp_flags], tcp_psh) ~= 0 and 1 or 0
+   else
+      -- Only full-sized datagrams are followed by further datagrams.
+      local ip_length = p.length - ether_header_len
+      f.closed = ip_length ~= self.mtu and 1 or 0
+   end
+end
+
+-- Return true if segment p can be appended to the flow f.
+local function can_append (f, p, l4, l4_length, hlen, checksum)
+   local length = l4_length - hlen
+   if f.closed ~= 0 or length > f.segment
+   or f.p.length + length > packet.max_payload then
+      return false
+   end
+   if f.proto == proto_tcp then
+      local fl4 = f.p.data + f.l4
+      return f.payload - f.l4 == hlen
+         and get32(l4 + o_tcp_seq) == f.next_seq
+         and C.memcmp(fl4 + o_tcp_ack, l4 + o_tcp_ack, 4) == 0
+         and C.memcmp(fl4 + 20, l4 + 20, hlen - 20) == 0
+   else
+      return (f.checksum ~= 0) == checksum
+   end
+end
+
+-- Append the payload of segment p to the flow f, and free p.
+local function append (f, p, l4, l4_length, hlen, sum)
+   local length = l4_length - hlen
+   local offset = f.p.length - f.payload
+   ffi.copy(f.p.data + f.p.length, l4 + hlen, length)
+   f.p.length = f.p.length + length
+   if f.checksum ~= 0 then
+      -- The sum of data at an odd offset is byte-swapped.
+      if band(offset, 1) ~= 0 then sum = csum_swap(sum) end
+      f.sum = csum_add(f.sum, sum)
+   end
+   f.count = f.count + 1
+   -- A short segment ends the run.
+   if length < f.segment then f.closed = 1 end
+   if f.proto == proto_tcp then
+      f.next_seq = (f.next_seq + length) % 2^32
+      if band(l4[o_tcp_flags], tcp_psh) ~= 0 then
+         local fl4 = f.p.data + f.l4
+         fl4[o_tcp_flags] = bor(fl4[o_tcp_flags], tcp_psh)
+         f.closed = 1
+      end
+   end
+   packet.free(p)
+end
+
+-- Finish the headers of the packet coalesced by flow f, and transmit it.
+function GRO:flush (f)
+   local p = f.p
+   if f.count > 1 then
+      local l3, l4 = p.data + ether_header_len, p.data + f.l4
+      local l4_length = p.length - f.l4
+      local hlen = f.payload - f.l4
+      set_ip_length(l3, f.version, l4_length)
+      local o_checksum = o_tcp_checksum
+      if f.proto == proto_udp then
+         set16(l4 + o_udp_length, l4_length)
+         o_checksum = o_udp_checksum
+      end
+      if f.checksum ~= 0 then
+         set16(l4 + o_checksum, 0)
+         local sum = csum_add(pseudo_sum(l3, f.version, f.proto, l4_length),
+                              csum_add(csum_sum(l4, hlen), f.sum))
+         local checksum = band(bnot(sum), 0xffff)
+         if checksum == 0 and f.proto == proto_udp then checksum = 0xffff end
+         set16(l4 + o_checksum, checksum)
+      end
+      counter.add(self.shm["coalesced"])
+      counter.add(self.shm["coalesced-segments"], f.count)
+   end
+   f.p = nil
+   transmit(self.output.output, p)
+end
+
+function GRO:process (p)
+   local version, proto, l4_length = headers.parse(p)
+   if not (proto == proto_tcp or proto == proto_udp) then
+      transmit(self.output.output, p)
+      return
+   end
+   local l3 = p.data + ether_header_len
+   local l4 = l3 + headers.ip_header_len(version)
+   local f = self.flows[band(flow_hash(l3, version, l4), self.flow_mask)]
+   local hlen = self:segment_header_length(proto, l4, l4_length)
+   local checksum, sum
+   if hlen then
+      checksum = proto == proto_tcp or version == 6
+         or get16(l4 + o_udp_checksum) ~= 0
+      if checksum then
+         sum = self:payload_sum(l3, version, proto, l4, l4_length, hlen)
+         if not sum then
+            counter.add(self.shm["bad-checksum"])
+            hlen = nil
+         end
+      end
+   end
+   if f.p ~= nil then
+      local same = same_flow(f, l3, l4, version, proto)
+      if same and hlen and can_append(f, p, l4, l4_length, hlen, checksum) then
+         append(f, p, l4, l4_length, hlen, sum)
+         return
+      elseif same or hlen then
+         -- Keep segments of the flow in order / make room.
+         self:flush(f)
+      end
+   end
+   if hlen then
+      self:hold(f, p, version, proto, l4, l4_length, hlen, checksum, sum)
+   else
+      transmit(self.output.output, p)
+   end
+end
+
+function GRO:push ()
+   local input = self.input.input
+   for _ = 1, link.nreadable(input) do
+      self:process(receive(input))
+   end
+   -- Transmit everything coalesced during this breath.
+   for i = 0, self.flow_mask do
+      if self.flows[i].p ~= nil then self:flush(self.flows[i]) end
+   end
+end
+
+function selftest ()
+   print("selftest: apps.gro.gro")
+   local shm = require("core.shm")
+   local verify_packet = require("lib.checksum").verify_packet
+   local ipsum = require("lib.checksum").ipsum
+   local GSO = require("apps.gro.gso").GSO
+   local set32 = headers.set32
+
+   -- Return a segment of a stream (payload byte at seq is seq % 251.)
+   local function make_segment (version, proto, seq, length, opt)
+      opt = opt or {}
+      local hlen = proto == proto_tcp and 32 or udp_header_len
+      local p = packet.allocate()
+      local data = p.data
+      ffi.fill(data, 12, 0x02)
+      set16(data + 12, version == 4 and 0x0800 or 0x86dd)
+      local l3 = data + ether_header_len
+      local l4 = l3 + headers.ip_header_len(version)
+      if version == 4 then
+         ffi.fill(l3, 20)
+         l3[0], l3[o_ipv4_ttl], l3[headers.o_ipv4_proto] = 0x45, 64, proto
+         set16(l3 + headers.o_ipv4_id, opt.id or 0)
+         set16(l3 + o_ipv4_flags, 0x4000)
+         set32(l3 + o_ipv4_addrs, 0x0a000001)
+         set32(l3 + o_ipv4_addrs + 4, 0x0a000002)
+      else
+         ffi.fill(l3, 40, 0x11)
+         l3[0], l3[headers.o_ipv6_next_header] = 0x60, proto
+         l3[o_ipv6_hop_limit] = 64
+      end
+      set_ip_length(l3, version, hlen + length)
+      set16(l4, opt.port or 1000)
+      set16(l4 + 2, 80)
+      if proto == proto_tcp then
+         set32(l4 + o_tcp_seq, seq)
+         set32(l4 + o_tcp_ack, 0x12345678)
+         l4[o_tcp_data_offset] = 0x80
+         l4[o_tcp_flags] = opt.flags or tcp_ack
+         set16(l4 + 14, 0xffff)
+         set32(l4 + 16, 0)
+         -- NOP, NOP, timestamps
+         set32(l4 + 20, 0x0101080a)
+         set32(l4 + 24, 1)
+         set32(l4 + 28, 2)
+      else
+         set16(l4 + o_udp_length, hlen + length)
+         set16(l4 + o_udp_checksum, 0)
+      end
+      for i = 0, length - 1 do l4[hlen + i] = (seq + i) % 251 end
+      p.length = l4 + hlen + length - data
+      if opt.checksum ~= false then
+         local o_checksum = proto == proto_tcp and o_tcp_checksum
+            or o_udp_checksum
+         set16(l4 + o_checksum,
+               ipsum(l4, hlen + length,
+                     pseudo_sum(l3, version, proto, hlen + length)))
+      end
+      return p
+   end
+
+   local gro_frame = shm.create_frame("apps/gro", GRO.shm)
+   local gso_frame = shm.create_frame("apps/gso", GSO.shm)
+   local input, middle, output =
+      link.new("gro input"), link.new("gro output"), link.new("gso output")
+
+   local function run (app, input, output, packets)
+      app.input, app.output = {input=input}, {output=output}
+      for _, p in ipairs(packets) do transmit(input, p) end
+      app:push()
+      local ret = {}
+      while not link.empty(output) do
+         table.insert(ret, receive(output))
+      end
+      return ret
+   end
+
+   local function coalesce (packets, conf)
+      local gro = GRO:new(lib.parse(conf or {}, GRO.config))
+      gro.shm = gro_frame
+      return run(gro, input, middle, packets)
+   end
+
+   local function segment (packets, mtu, udp)
+      local gso = GSO:new{mtu=mtu or 1500, udp=udp}
+      gso.shm = gso_frame
+      return run(gso, middle, output, packets)
+   end
+
+   local function check (p, payload_length)
+      local version, proto, l4_length = headers.parse(p)
+      assert(version)
+      local l3 = p.data + ether_header_len
+      assert(verify_packet(l3, p.length - ether_header_len))
+      if payload_length then
+         local hlen = proto == proto_tcp and 32 or udp_header_len
+         assert(l4_length - hlen == payload_length,
+                "payload length "..(l4_length - hlen))
+      end
+   end
+
+   local function same (a, b)
+      return a.length == b.length and C.memcmp(a.data, b.data, a.length) == 0
+   end
+
+   local function free_all (packets)
+      for _, p in ipairs(packets) do packet.free(p) end
+   end
+
+   local mss = 1448
+   for _, version in ipairs({4, 6}) do
+      local mss = version == 4 and mss or mss - 20
+      -- Two interleaved bulk flows; the last segment of each is short and
+      -- pushed.
+      local segments, originals = {}, {}
+      for i = 0, 19 do
+         for _, port in ipairs({1000, 2000}) do
+            local opt = {id=i, port=port}
+            local length = mss
+            if i == 19 then
+               opt.flags, length = tcp_ack + tcp_psh, 500
+            end
+            local p = make_segment(version, proto_tcp, 7 + i * mss, length, opt)
+            table.insert(segments, p)
+            table.insert(originals, packet.clone(p))
+         end
+      end
+      local coalesced = coalesce(segments)
+      -- Up to seven segments fit into a packet.
+      local per_packet = math.floor((packet.max_payload - ether_header_len
+                                        - headers.ip_header_len(version) - 32)
+                                       / mss)
+      assert(#coalesced == 2 * math.ceil(20 / per_packet))
+      for _, p in ipairs(coalesced) do check(p) end
+      check(coalesced[1], per_packet * mss)
+      -- Segmenting restores the original segments.
+      local segmented = segment(coalesced)
+      assert(#segmented == #originals)
+      local flows = {}
+      for _, p in ipairs(segmented) do
+         local port = get16(p.data + ether_header_len
+                               + headers.ip_header_len(version))
+         flows[port] = flows[port] or {}
+         table.insert(flows[port], p)
+      end
+      for i, p in ipairs(originals) do
+         local port = i % 2 == 1 and 1000 or 2000
+         assert(same(p, flows[port][math.ceil(i / 2)]))
+      end
+      free_all(segmented)
+      free_all(originals)
+   end
+
+   -- Out of order segments are not coalesced, but passed on in order.
+   local seqs = {0, 1, 3, 2}
+   local segments = {}
+   for _, n in ipairs(seqs) do
+      table.insert(segments, make_segment(4, proto_tcp, n * mss, mss))
+   end
+   local coalesced = coalesce(segments)
+   assert(#coalesced == 3)
+   check(coalesced[1], 2 * mss)
+   assert(get32(coalesced[2].data + 38) == 3 * mss)
+   assert(get32(coalesced[3].data + 38) == 2 * mss)
+   free_all(coalesced)
+
+   -- Segments with bad checksums are passed on untouched.
+   local bad = counter.read(gro_frame["bad-checksum"])
+   segments = {}
+   for n = 0, 2 do
+      table.insert(segments, make_segment(4, proto_tcp, n * mss, mss))
+   end
+   segments[2].data[100] = segments[2].data[100] + 1
+   local corrupted = packet.clone(segments[2])
+   coalesced = coalesce(segments)
+   assert(#coalesced == 3 and same(coalesced[2], corrupted))
+   assert(counter.read(gro_frame["bad-checksum"]) == bad + 1)
+   free_all(coalesced)
+   packet.free(corrupted)
+
+   -- Trusting checksums yields the same result as verifying them.
+   segments = {}
+   for n = 0, 3 do
+      table.insert(segments, make_segment(6, proto_tcp, n * mss, mss))
+   end
+   coalesced = coalesce(segments, {verify_checksum=false})
+   assert(#coalesced == 1)
+   check(coalesced[1], 4 * mss)
+   free_all(coalesced)
+
+   -- Runs of full-sized UDP datagrams, only if enabled. Odd payload
+   -- lengths exercise checksum byte swapping.
+   for _, version in ipairs({4, 6}) do
+      for _, mtu in ipairs({1500, 1401}) do
+         local length = mtu - headers.ip_header_len(version) - udp_header_len
+         local originals = {}
+         local function datagrams ()
+            local ret = {}
+            for n = 0, 4 do
+               table.insert(ret, make_segment(version, proto_udp, n * length,
+                                              n < 4 and length or 99,
+                                              {id=n}))
+            end
+            for _, p in ipairs(ret) do table.insert(originals, packet.clone(p)) end
+            return ret
+         end
+         coalesced = coalesce(datagrams(), {mtu=mtu})
+         assert(#coalesced == 5)
+         free_all(coalesced)
+         coalesced = coalesce(datagrams(), {udp=true, mtu=mtu})
+         assert(#coalesced == 1)
+         check(coalesced[1], 4 * length + 99)
+         local unsegmented = segment({packet.clone(coalesced[1])}, mtu)
+         assert(#unsegmented == 1 and same(unsegmented[1], coalesced[1]))
+         free_all(unsegmented)
+         local segmented = segment(coalesced, mtu, true)
+         assert(#segmented == 5)
+         for i, p in ipairs(segmented) do
+            assert(same(p, originals[5 + i]))
+         end
+         free_all(segmented)
+         free_all(originals)
+      end
+   end
+   -- UDP without checksum (IPv4.)
+   segments = {}
+   for n = 0, 1 do
+      table.insert(segments, make_segment(4, proto_udp, n * 1472, 1472,
+                                          {checksum=false}))
+   end
+   coalesced = coalesce(segments, {udp=true})
+   assert(#coalesced == 1)
+   assert(get16(coalesced[1].data + 34 + o_udp_checksum) == 0)
+   free_all(segment(coalesced, 1500, true))
+
+   -- Other packets pass through.
+   local p = packet.from_string(("x"):rep(60))
+   coalesced = coalesce({p})
+   assert(#coalesced == 1 and coalesced[1] == p)
+   packet.free(p)
+
+   shm.delete_frame(gro_frame)
+   shm.delete_frame(gso_frame)
+   print("selftest: ok")
+end
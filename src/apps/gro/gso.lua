@@ -0,0 +1,127 @@
+-- Use of this source code is governed by the Apache 2.0 license; see COPYING.
+
+-- Generic segmentation offload: split TCP segments that exceed the MTU
+-- (e.g., those coalesced by apps.gro.gro) into MTU-sized segments.  UDP
+-- datagrams are only split if enabled, since a UDP datagram that was
+-- not coalesced by GRO must not be split into several datagrams.
+
+module(..., package.seeall)
+
+local ffi = require("ffi")
+local bit = require("bit")
+local packet = require("core.packet")
+local counter = require("core.counter")
+local link = require("core.link")
+local ipsum = require("lib.checksum").ipsum
+local headers = require("apps.gro.headers")
+
+local band, bnot, rshift = bit.band, bit.bnot, bit.rshift
+local receive, transmit = link.receive, link.transmit
+local get16, set16, get32, set32 = headers.get16, headers.set16,
+   headers.get32, headers.set32
+local pseudo_sum, set_ip_length = headers.pseudo_sum, headers.set_ip_length
+
+local ether_header_len = headers.ether_header_len
+local udp_header_len = headers.udp_header_len
+local proto_tcp, proto_udp = headers.proto_tcp, headers.proto_udp
+local tcp_fin, tcp_psh, tcp_cwr = headers.tcp_fin, headers.tcp_psh,
+   headers.tcp_cwr
+local o_tcp_seq, o_tcp_data_offset = headers.o_tcp_seq,
+   headers.o_tcp_data_offset
+local o_tcp_flags, o_tcp_checksum = headers.o_tcp_flags, headers.o_tcp_checksum
+local o_udp_length, o_udp_checksum = headers.o_udp_length,
+   headers.o_udp_checksum
+local o_ipv4_id = headers.o_ipv4_id
+
+GSO = {
+   config = {
+      -- Maximum transmission unit, in bytes, not including the ethernet
+      -- header.
+      mtu = {default=1500},
+      -- Split UDP datagrams too (see apps.gro.gro.)
+      udp = {default=false}
+   },
+   shm = {
+      ["segmented"] = {counter},
+      ["segments"] = {counter}
+   }
+}
+
+function GSO:new (conf)
+   return setmetatable({mtu=conf.mtu, udp=conf.udp}, {__index=GSO})
+end
+
+function GSO:segment (p)
+   local output = self.output.output
+   local version, proto, l4_length = headers.parse(p)
+   local l3 = p.data + ether_header_len
+   local ip_hlen = headers.ip_header_len(version or 4)
+   local l4 = l3 + ip_hlen
+   local hlen, o_checksum
+   if proto == proto_tcp then
+      hlen, o_checksum = rshift(l4[o_tcp_data_offset], 4) * 4, o_tcp_checksum
+      if hlen < 20 or hlen >= l4_length then hlen = nil end
+   elseif proto == proto_udp and self.udp then
+      hlen, o_checksum = udp_header_len, o_udp_checksum
+   end
+   local mss = self.mtu - ip_hlen - (hlen or 0)
+   if not hlen or mss <= 0 then
+      -- Not ours to segment (IP fragmentation may apply.)
+      transmit(output, p)
+      return
+   end
+   local checksum = proto == proto_tcp or version == 6
+      or get16(l4 + o_udp_checksum) ~= 0
+   local headers_len = ether_header_len + ip_hlen + hlen
+   local payload_length = l4_length - hlen
+   local id = version == 4 and get16(l3 + o_ipv4_id)
+   local seq = proto == proto_tcp and get32(l4 + o_tcp_seq)
+   local flags = proto == proto_tcp and l4[o_tcp_flags]
+   local n = 0
+   for offset = 0, payload_length - 1, mss do
+      local length = math.min(mss, payload_length - offset)
+      local last = offset + length == payload_length
+      local q = packet.allocate()
+      ffi.copy(q.data, p.data, headers_len)
+      ffi.copy(q.data + headers_len, p.data + headers_len + offset, length)
+      q.length = headers_len + length
+      local ql3, ql4 = q.data + ether_header_len, q.data + ether_header_len
+         + ip_hlen
+      if version == 4 then set16(ql3 + o_ipv4_id, (id + n) % 2^16) end
+      set_ip_length(ql3, version, hlen + length)
+      if proto == proto_tcp then
+         set32(ql4 + o_tcp_seq, (seq + offset) % 2^32)
+         -- FIN and PSH only on the last segment, CWR only on the first.
+         local f = flags
+         if not last then f = band(f, bnot(tcp_fin + tcp_psh)) end
+         if n > 0 then f = band(f, bnot(tcp_cwr)) end
+         ql4[o_tcp_flags] = f
+      else
+         set16(ql4 + o_udp_length, hlen + length)
+      end
+      if checksum then
+         set16(ql4 + o_checksum, 0)
+         local csum = ipsum(ql4, hlen + length,
+                            pseudo_sum(ql3, version, proto, hlen + length))
+         if csum == 0 and proto == proto_udp then csum = 0xffff end
+         set16(ql4 + o_checksum, csum)
+      end
+      transmit(output, q)
+      n = n + 1
+   end
+   packet.free(p)
+   counter.add(self.shm["segmented"])
+   counter.add(self.shm["segments"], n)
+end
+
+function GSO:push ()
+   local input, output = self.input.input, self.output.output
+   for _ = 1, link.nreadable(input) do
+      local p = receive(input)
+      if p.length - ether_header_len <= self.mtu then
+         transmit(output, p)
+      else
+         self:segment(p)
+      end
+   end
+end
@@ -0,0 +1,128 @@
+-- Use of this source code is governed by the Apache 2.0 license; see COPYING.
+
+-- Header parsing and checksum arithmetic shared by the GRO and GSO apps.
+
+module(..., package.seeall)
+
+local ffi = require("ffi")
+local bit = require("bit")
+local lib = require("core.lib")
+local ipsum = require("lib.checksum").ipsum
+
+local band, bor, bnot = bit.band, bit.bor, bit.bnot
+local lshift, rshift = bit.lshift, bit.rshift
+local ntohs, htons, ntohl, htonl = lib.ntohs, lib.htons, lib.ntohl, lib.htonl
+
+local uint16_ptr_t = ffi.typeof("uint16_t *")
+local uint32_ptr_t = ffi.typeof("uint32_t *")
+
+ether_header_len = 14
+ipv4_header_len = 20
+ipv6_header_len = 40
+udp_header_len = 8
+
+local ethertype_ipv4 = 0x0800
+local ethertype_ipv6 = 0x86dd
+proto_tcp = 6
+proto_udp = 17
+
+-- Header field offsets.
+o_ether_type = 12
+o_ipv4_tos = 1
+o_ipv4_total_length = 2
+o_ipv4_id = 4
+o_ipv4_flags = 6
+o_ipv4_ttl = 8
+o_ipv4_proto = 9
+o_ipv4_checksum = 10
+o_ipv4_addrs = 12
+o_ipv6_payload_length = 4
+o_ipv6_next_header = 6
+o_ipv6_hop_limit = 7
+o_ipv6_addrs = 8
+o_tcp_seq = 4
+o_tcp_ack = 8
+o_tcp_data_offset = 12
+o_tcp_flags = 13
+o_tcp_checksum = 16
+o_udp_length = 4
+o_udp_checksum = 6
+
+tcp_fin, tcp_syn, tcp_rst, tcp_psh, tcp_ack, tcp_urg, tcp_ece, tcp_cwr =
+   0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80
+
+function get16 (ptr) return ntohs(ffi.cast(uint16_ptr_t, ptr)[0]) end
+function set16 (ptr, v) ffi.cast(uint16_ptr_t, ptr)[0] = htons(v) end
+function get32 (ptr) return ntohl(ffi.cast(uint32_ptr_t, ptr)[0]) end
+function set32 (ptr, v) ffi.cast(uint32_ptr_t, ptr)[0] = htonl(v) end
+
+-- Locate the L4 header of an Ethernet frame carrying an unfragmented
+-- IPv4 (without options) or IPv6 (without extension headers) datagram that
+-- fills the frame exactly. Returns the IP version (4 or 6), the L4
+-- protocol, and the L4 length; or nil if the frame does not qualify.
+function parse (p)
+   local data, length = p.data, p.length
+   if length < ether_header_len + ipv4_header_len then return end
+   local l3 = data + ether_header_len
+   local ethertype = get16(data + o_ether_type)
+   if ethertype == ethertype_ipv4 then
+      if l3[0] ~= 0x45 then return end
+      -- Neither MF nor a fragment offset.
+      if band(get16(l3 + o_ipv4_flags), 0x3fff) ~= 0 then return end
+      local total_length = get16(l3 + o_ipv4_total_length)
+      if total_length ~= length - ether_header_len then return end
+      return 4, l3[o_ipv4_proto], total_length - ipv4_header_len
+   elseif ethertype == ethertype_ipv6 then
+      if length < ether_header_len + ipv6_header_len then return end
+      local payload_length = get16(l3 + o_ipv6_payload_length)
+      if payload_length ~= length - ether_header_len - ipv6_header_len then
+         return
+      end
+      return 6, l3[o_ipv6_next_header], payload_length
+   end
+end
+
+-- Return the length of the IP header of version.
+function ip_header_len (version)
+   return version == 4 and ipv4_header_len or ipv6_header_len
+end
+
+-- Ones-complement arithmetic on 16-bit sums (host byte order.)
+
+function csum_add (a, b)
+   local s = a + b
+   return band(s, 0xffff) + rshift(s, 16)
+end
+
+-- Return the ones-complement sum (not its complement) of len bytes at ptr.
+function csum_sum (ptr, len)
+   return band(bnot(ipsum(ptr, len, 0)), 0xffff)
+end
+
+-- Swap the bytes of sum s (for data that starts at an odd offset.)
+function csum_swap (s)
+   return bor(rshift(s, 8), band(lshift(s, 8), 0xff00))
+end
+
+-- Return the sum of the L4 pseudo-header of the IP datagram at l3.
+function pseudo_sum (l3, version, proto, l4_length)
+   local addrs
+   if version == 4 then
+      addrs = csum_sum(l3 + o_ipv4_addrs, 8)
+   else
+      addrs = csum_sum(l3 + o_ipv6_addrs, 32)
+   end
+   return csum_add(csum_add(addrs, proto), l4_length)
+end
+
+-- Set the IP length fields of the datagram at l3 for an L4 length of
+-- l4_length, and update the IPv4 header checksum.
+function set_ip_length (l3, version, l4_length)
+   if version == 4 then
+      set16(l3 + o_ipv4_total_length, ipv4_header_len + l4_length)
+      set16(l3 + o_ipv4_checksum, 0)
+      set16(l3 + o_ipv4_checksum, ipsum(l3, ipv4_header_len, 0))
+   else
+      set16(l3 + o_ipv6_payload_length, l4_length)
+   end
+end
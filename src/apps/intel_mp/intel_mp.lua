@@ -28,6 +28,7 @@ local counter     = require("core.counter")
 local macaddress  = require("lib.macaddress")
 local shm         = require("core.shm")
 local alarms      = require("lib.yang.alarms")
+local toeplitz    = require("lib.hash.toeplitz")
 local S           = require("syscall")
 
 local CallbackAlarm = alarms.CallbackAlarm
@@ -322,7 +323,8 @@ Intel = {
       wait_for_link = {default=false},
       master_stats = {default=true},
       run_stats = {default=false},
-      mac_loopback = {default=false}
+      mac_loopback = {default=false},
+      rss_key = {default=false}
    },
 }
 Intel1g = setmetatable({}, {__index = Intel })
@@ -411,7 +413,9 @@ function Intel:new (conf)
       -- only used for main process, affects max pool number
       vmdq_queuing_mode = conf.vmdq_queuing_mode,
       -- Enable Tx->Rx MAC Loopback for diagnostics/testing?
-      mac_loopback = conf.mac_loopback
+      mac_loopback = conf.mac_loopback,
+      -- Toeplitz key for RSS (a string of bytes), or false for a random key
+      rss_key_bytes = conf.rss_key and toeplitz.parse_key(conf.rss_key)
    }
 
    local vendor = lib.firstline(self.path .. "/vendor")
@@ -948,8 +952,15 @@ function Intel:rss_enable ()
    self:rss_key()
 end
 function Intel:rss_key ()
+   local key = self.rss_key_bytes
    for i=0,9,1 do
-      self.r.RSSRK[i](math.random(2^32))
+      if key then
+         -- Each register holds four bytes of the key, in little-endian order.
+         local b0, b1, b2, b3 = key:byte(4*i+1, 4*i+4)
+         self.r.RSSRK[i](((b3 * 256 + b2) * 256 + b1) * 256 + b0)
+      else
+         self.r.RSSRK[i](math.random(2^32))
+      end
    end
 end
 
@@ -0,0 +1,84 @@
+-- Use of this source code is governed by the Apache 2.0 license; see COPYING.
+
+module(...,package.seeall)
+
+local shm = require("core.shm")
+local mpsc = require("lib.mpsc_interlink")
+
+local MPSCReceiver = {
+   name = "apps.interlink.MPSCReceiver",
+   config = {
+      queue = {},
+      size = {default=1024},
+      producers = {default=16}
+   }
+}
+
+function MPSCReceiver:new (conf)
+   local self = {
+      attached = false,
+      queue = conf.queue,
+      size = conf.size,
+      producers = conf.producers,
+      -- Slot to start draining from (rotates to share pull_npackets fairly.)
+      first = 0
+   }
+   packet.enable_group_freelist()
+   return setmetatable(self, {__index=MPSCReceiver})
+end
+
+function MPSCReceiver:link ()
+   local queue = self.queue or self.appname
+   if not self.attached then
+      self.shm_name = "group/interlink/"..queue..".mpsc_interlink"
+      self.backlink = "interlink/mpsc_receiver/"..queue..".mpsc_interlink"
+      self.interlink = mpsc.attach_receiver(self.shm_name, self.size,
+                                            self.producers)
+      shm.alias(self.backlink, self.shm_name)
+      self.attached = true
+   end
+end
+
+function MPSCReceiver:pull ()
+   local o, r, n = self.output.output, self.interlink, 0
+   if not o then return end -- don’t forward packets until connected
+   -- Drain all producer slots in one pass, starting at a different slot
+   -- each time so that no producer is starved when we hit pull_npackets.
+   local nslots = mpsc.nslots(r)
+   if nslots == 0 then return end
+   local s = self.first % nslots
+   for _ = 1, nslots do
+      while not mpsc.empty(r, s) and n < engine.pull_npackets do
+         link.transmit(o, mpsc.extract(r, s))
+         n = n + 1
+      end
+      mpsc.pull(r, s)
+      s = s + 1
+      if s == nslots then s = 0 end
+   end
+   self.first = self.first + 1
+end
+
+function MPSCReceiver:stop ()
+   if self.attached then
+      mpsc.detach_receiver(self.interlink, self.shm_name)
+      shm.unlink(self.backlink)
+   end
+end
+
+-- Detach receivers to prevent leaking MPSC interlinks opened by pid.
+--
+-- This is an internal API function provided for cleanup during
+-- process termination.
+function MPSCReceiver.shutdown (pid)
+   for _, queue in ipairs(shm.children("/"..pid.."/interlink/mpsc_receiver")) do
+      local backlink = "/"..pid.."/interlink/mpsc_receiver/"..queue
+      local shm_name = "/"..pid.."/group/interlink/"..queue
+      -- Call protected in case /<pid>/group is already unlinked.
+      local ok, r = pcall(mpsc.open, shm_name)
+      if ok then mpsc.detach_receiver(r, shm_name) end
+      shm.unlink(backlink)
+   end
+end
+
+return MPSCReceiver
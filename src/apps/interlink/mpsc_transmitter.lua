@@ -0,0 +1,77 @@
+-- Use of this source code is governed by the Apache 2.0 license; see COPYING.
+
+module(...,package.seeall)
+
+local shm = require("core.shm")
+local mpsc = require("lib.mpsc_interlink")
+
+local MPSCTransmitter = {
+   name = "apps.interlink.MPSCTransmitter",
+   config = {
+      queue = {},
+      size = {default=1024},
+      producers = {default=16}
+   }
+}
+
+function MPSCTransmitter:new (conf)
+   local self = {
+      attached = false,
+      queue = conf.queue,
+      size = conf.size,
+      producers = conf.producers
+   }
+   packet.enable_group_freelist()
+   return setmetatable(self, {__index=MPSCTransmitter})
+end
+
+function MPSCTransmitter:link ()
+   local queue = self.queue or self.appname
+   if not self.attached then
+      self.shm_name = "group/interlink/"..queue..".mpsc_interlink"
+      self.interlink, self.slot =
+         mpsc.attach_transmitter(self.shm_name, self.size, self.producers)
+      -- Each transmitter app of a process gets its own backlink, because
+      -- one process may feed the same queue from several slots.
+      self.backlink = "interlink/mpsc_transmitter/"..queue..".mpsc_interlink"
+         .."/"..self.slot
+      shm.alias(self.backlink, self.shm_name)
+      self.attached = true
+   end
+end
+
+function MPSCTransmitter:push ()
+   local i, r, s = self.input.input, self.interlink, self.slot
+   while not (mpsc.full(r, s) or link.empty(i)) do
+      local p = link.receive(i)
+      packet.account_free(p) -- stimulate breathing
+      mpsc.insert(r, s, p)
+   end
+   mpsc.push(r, s)
+end
+
+function MPSCTransmitter:stop ()
+   if self.attached then
+      mpsc.detach_transmitter(self.interlink, self.slot, self.shm_name)
+      shm.unlink(self.backlink)
+   end
+end
+
+-- Detach transmitters to prevent leaking MPSC interlinks opened by pid.
+--
+-- This is an internal API function provided for cleanup during
+-- process termination.
+function MPSCTransmitter.shutdown (pid)
+   local dir = "/"..pid.."/interlink/mpsc_transmitter"
+   for _, queue in ipairs(shm.children(dir)) do
+      local shm_name = "/"..pid.."/group/interlink/"..queue
+      for _, slot in ipairs(shm.children(dir.."/"..queue)) do
+         -- Call protected in case /<pid>/group is already unlinked.
+         local ok, r = pcall(mpsc.open, shm_name)
+         if ok then mpsc.detach_transmitter(r, tonumber(slot), shm_name) end
+      end
+      shm.unlink(dir.."/"..queue)
+   end
+end
+
+return MPSCTransmitter
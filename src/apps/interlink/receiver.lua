@@ -3,13 +3,16 @@
 module(...,package.seeall)
 
 local shm = require("core.shm")
+local histogram = require("core.histogram")
 local interlink = require("lib.interlink")
+local tsc = require("lib.tsc")
 
 local Receiver = {
    name = "apps.interlink.Receiver",
    config = {
       queue = {},
-      size = {default=1024}
+      size = {default=1024},
+      latency = {default=false}
    }
 }
 
@@ -17,8 +20,14 @@ function Receiver:new (conf)
    local self = {
       attached = false,
       queue = conf.queue,
-      size = conf.size
+      size = conf.size,
+      tsc = conf.latency and tsc.new()
    }
+   if self.tsc then
+      -- Queue residency in seconds.
+      self.shm = {residency = {histogram, 1e-8, 1e0}}
+      self.spt = 1 / tonumber(self.tsc:tps())
+   end
    packet.enable_group_freelist()
    return setmetatable(self, {__index=Receiver})
 end
@@ -37,9 +46,22 @@ end
 function Receiver:pull ()
    local o, r, n = self.output.output, self.interlink, 0
    if not o then return end -- don’t forward packets until connected
-   while not interlink.empty(r) and n < engine.pull_npackets do
-      link.transmit(o, interlink.extract(r))
-      n = n + 1
+   local now = self.tsc and self.tsc:stamp()
+   while n < engine.pull_npackets do
+      -- Move packets one cache line worth at a time.
+      local m = interlink.avail(r, engine.pull_npackets - n)
+      if m == 0 then break end
+      if now then
+         local ticks = interlink.residency(r, now)
+         if ticks then
+            self.shm.residency:add(tonumber(ticks) * self.spt)
+         end
+      end
+      for _ = 1, m do
+         link.transmit(o, interlink.extract(r))
+      end
+      interlink.pull_early(r)
+      n = n + m
    end
    interlink.pull(r)
 end
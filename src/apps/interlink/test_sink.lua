@@ -6,6 +6,9 @@ local Receiver = require("apps.interlink.receiver")
 local Sink = require("apps.basic.basic_apps").Sink
 local lib = require("core.lib")
 local numa = require("lib.numa")
+local tsc = require("lib.tsc")
+local histogram = require("core.histogram")
+local ffi = require("ffi")
 
 function configure (c, name)
    config.app(c, name, Receiver)
@@ -20,3 +23,63 @@ function start (name, duration, core)
    engine.configure(c)
    engine.main{duration=duration}
 end
+
+-- Sink that records the one-way latency of packets stamped by
+-- test_source.TimestampSource in a histogram (in nanoseconds.)
+LatencySink = {}
+
+function LatencySink:new ()
+   local o = {tsc=tsc.new(), latency=histogram.new(10, 1e9)}
+   assert(o.tsc:source() == 'rdtsc', "LatencySink needs rdtsc")
+   o.nspt = 1e9 / tonumber(o.tsc:tps())
+   return setmetatable(o, {__index=LatencySink})
+end
+
+function LatencySink:push ()
+   local i, latency, nspt = self.input.input, self.latency, self.nspt
+   local now = self.tsc:stamp()
+   while not link.empty(i) do
+      local p = link.receive(i)
+      local stamp = ffi.cast("uint64_t *", p.data)[0]
+      latency:add(tonumber(now - stamp) * nspt)
+      packet.free(p)
+   end
+end
+
+-- Return the upper bounds of the histogram buckets containing the
+-- given quantiles (e.g., 0.5, 0.99).
+function percentiles (h, ...)
+   local result, quantiles, total = {}, {...}, tonumber(h.total)
+   local q, cumulative = 1, 0
+   for count, lo, hi in h:iterate() do
+      cumulative = cumulative + tonumber(count)
+      while quantiles[q] and cumulative >= quantiles[q] * total do
+         result[q], q = hi, q + 1
+      end
+   end
+   return unpack(result)
+end
+
+function start_latency (name, duration, core)
+   numa.bind_to_cpu(core, 'skip')
+   local c = config.new()
+   config.app(c, name, Receiver, {latency=true})
+   config.app(c, "sink", LatencySink)
+   config.link(c, name..".output -> sink.input")
+   engine.configure(c)
+   engine.main{duration=duration, no_report=true}
+   local sink = engine.app_table["sink"]
+   local latency = sink.latency
+   print(("%.3f Mpps"):format(link.stats(sink.input.input).txpackets
+                                 / 1e6 / duration))
+   if latency.total > 0 then
+      print(("latency: p50 %.0f ns, p99 %.0f ns, p99.9 %.0f ns"):format(
+               percentiles(latency, 0.5, 0.99, 0.999)))
+   end
+   local residency = engine.app_table[name].shm.residency
+   if residency.total > 0 then
+      local p50, p99, p999 = percentiles(residency, 0.5, 0.99, 0.999)
+      print(("residency: p50 %.0f ns, p99 %.0f ns, p99.9 %.0f ns"):format(
+               p50 * 1e9, p99 * 1e9, p999 * 1e9))
+   end
+end
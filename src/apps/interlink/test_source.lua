@@ -6,6 +6,8 @@ local Transmitter = require("apps.interlink.transmitter")
 local Source = require("apps.basic.basic_apps").Source
 local lib = require("core.lib")
 local numa = require("lib.numa")
+local tsc = require("lib.tsc")
+local ffi = require("ffi")
 
 function configure (c, name)
    config.app(c, name, Transmitter)
@@ -42,3 +44,49 @@ function txpackets ()
    end
    return txpackets
 end
+
+function start_mpsc (name, duration, producers)
+   local MPSCTransmitter = require("apps.interlink.mpsc_transmitter")
+   local c = config.new()
+   config.app(c, name, MPSCTransmitter, {producers=producers})
+   config.app(c, "source", Source)
+   config.link(c, "source.output -> "..name..".input")
+   engine.configure(c)
+   engine.main{duration=duration}
+end
+
+-- Source that stamps each packet with the TSC at the time it was generated
+-- (see test_sink.LatencySink.)
+TimestampSource = {
+   config = {
+      size = {default=60}
+   }
+}
+
+function TimestampSource:new (conf)
+   local o = {size=conf.size, tsc=tsc.new()}
+   assert(o.tsc:source() == 'rdtsc', "TimestampSource needs rdtsc")
+   return setmetatable(o, {__index=TimestampSource})
+end
+
+function TimestampSource:pull ()
+   local now = self.tsc:stamp()
+   for _, o in ipairs(self.output) do
+      for _ = 1, engine.pull_npackets do
+         local p = packet.allocate()
+         p.length = self.size
+         ffi.cast("uint64_t *", p.data)[0] = now
+         link.transmit(o, p)
+      end
+   end
+end
+
+function start_latency (name, duration, core)
+   numa.bind_to_cpu(core, 'skip')
+   local c = config.new()
+   config.app(c, name, Transmitter, {latency=true})
+   config.app(c, "source", TimestampSource)
+   config.link(c, "source.output -> "..name..".input")
+   engine.configure(c)
+   engine.main{duration=duration}
+end
@@ -4,12 +4,14 @@ module(...,package.seeall)
 
 local shm = require("core.shm")
 local interlink = require("lib.interlink")
+local tsc = require("lib.tsc")
 
 local Transmitter = {
    name = "apps.interlink.Transmitter",
    config = {
       queue = {},
-      size = {default=1024}
+      size = {default=1024},
+      latency = {default=false}
    }
 }
 
@@ -17,7 +19,8 @@ function Transmitter:new (conf)
    local self = {
       attached = false,
       queue = conf.queue,
-      size = conf.size
+      size = conf.size,
+      tsc = conf.latency and tsc.new()
    }
    packet.enable_group_freelist()
    return setmetatable(self, {__index=Transmitter})
@@ -30,22 +33,32 @@ function Transmitter:link ()
       self.backlink = "interlink/transmitter/"..queue..".interlink"
       self.interlink = interlink.attach_transmitter(self.shm_name, self.size)
       shm.alias(self.backlink, self.shm_name)
+      interlink.enable_stamps(self.interlink, self.tsc)
       self.attached = true
    end
 end
 
 function Transmitter:push ()
    local i, r = self.input.input, self.interlink
-   while not (interlink.full(r) or link.empty(i)) do
-      local p = link.receive(i)
-      packet.account_free(p) -- stimulate breathing
-      interlink.insert(r, p)
+   local now = self.tsc and self.tsc:stamp()
+   while not link.empty(i) do
+      -- Move packets one cache line worth at a time.
+      local n = interlink.room(r, link.nreadable(i))
+      if n == 0 then break end
+      if now then interlink.stamp(r, now) end
+      for _ = 1, n do
+         local p = link.receive(i)
+         packet.account_free(p) -- stimulate breathing
+         interlink.insert(r, p)
+      end
+      interlink.push_early(r)
    end
    interlink.push(r)
 end
 
 function Transmitter:stop ()
    if self.attached then
+      interlink.enable_stamps(self.interlink, false)
       interlink.detach_transmitter(self.interlink, self.shm_name)
       shm.unlink(self.backlink)
    end
@@ -9,6 +9,7 @@ local bit      = require("bit")
 local ffi      = require("ffi")
 local template = require("apps.ipfix.template")
 local maps     = require("apps.ipfix.maps")
+local sampling = require("apps.ipfix.sampling")
 local metadata = require("apps.rss.metadata")
 local lib      = require("core.lib")
 local link     = require("core.link")
@@ -22,6 +23,7 @@ local ipv4     = require("lib.protocol.ipv4")
 local ipv6     = require("lib.protocol.ipv6")
 local udp      = require("lib.protocol.udp")
 local ctable   = require("lib.ctable")
+local multi_filter = require("lib.pcap.multi_filter")
 local logger   = require("lib.logger")
 local token_bucket = require("lib.token_bucket")
 local C        = ffi.C
@@ -29,7 +31,7 @@ local S        = require("syscall")
 
 local events = timeline.load_events(engine.timeline(), "apps.ipfix.ipfix")
 
-local htonl, htons = lib.htonl, lib.htons
+local htonl, htons, ntohl, ntohs = lib.htonl, lib.htons, lib.ntohl, lib.ntohs
 local metadata_add, metadata_get = metadata.add, metadata.get
 
 local debug = lib.getenv("FLOW_EXPORT_DEBUG")
@@ -373,9 +375,13 @@ function FlowSet:flush_data_records(out)
    set_header.id = htons(self.template.id)
    set_header.length = htons(pkt.length)
 
-   -- Add headers provided by the IPFIX object that created us
-   pkt = self.parent:add_ipfix_header(pkt, record_count)
-   pkt = self.parent:add_transport_headers(pkt)
+   -- Add headers provided by the IPFIX object that created us, unless
+   -- we are a shard in which case the bare data set is forwarded to a
+   -- Merge app (see below).
+   if not self.parent.shard then
+      pkt = self.parent:add_ipfix_header(pkt, record_count)
+      pkt = self.parent:add_transport_headers(pkt)
+   end
    link.transmit(out, pkt)
    counter.add(self.shm.flow_export_packets)
 
@@ -598,6 +604,7 @@ IPFIX = {
       cache_size = { default = 20000 },
       max_load_factor = { default = 0.4 },
       scan_protection = { default = {} },
+      sampling = { default = {} },
       scan_time = { default = 10 },
       -- RFC 5153 §6.2 recommends a 10-minute template refresh
       -- configurable from 1 minute to 1 day.
@@ -620,7 +627,9 @@ IPFIX = {
       -- process
       instance = { default = 1 },
       add_packet_metadata = { default = true },
-      log_date = { default = true }
+      log_date = { default = true },
+      -- Export bare data sets to be merged by a Merge app
+      shard = { default = false }
    }
 }
 local ipfix_config_params = IPFIX.config
@@ -640,6 +649,18 @@ local scan_protection_params = {
    max_packets_per_flow = { default = 2 }
 }
 
+local function setup_ipfix_header(self)
+   if self.version == 9 then
+      self.header_t = netflow_v9_packet_header_t
+   elseif self.version == 10 then
+      self.header_t = ipfix_packet_header_t
+   else
+      error('unsupported ipfix version: '..self.version)
+   end
+   self.header_ptr_t = ptr_to(self.header_t)
+   self.header_size = ffi.sizeof(self.header_t)
+end
+
 local function setup_transport_header(self, config)
    -- Prepare transport headers to prepend to each export packet
    -- TODO: Support IPv6.
@@ -680,6 +701,10 @@ function IPFIX:new(config)
                   received_packets = { counter },
                   -- Packets not matched by any flow set
                   ignored_packets = { counter },
+                  -- Packets not selected by the sampler
+                  unsampled_packets = { counter },
+                  -- Current sampling interval (1-in-N)
+                  sampling_interval = { counter, 1 },
                   -- Number of template packets sent
                   template_packets = { counter },
                   -- Non-wrapping sequence number (see add_ipfix_header() for a
@@ -700,6 +725,11 @@ function IPFIX:reconfig(config)
    self.observation_domain = config.observation_domain
    self.instance = config.instance
    self.add_packet_metadata = config.add_packet_metadata
+   self.shard = config.shard
+   self.sampler = sampling.new(lib.parse(config.sampling, sampling.params))
+   -- The Merge app exports a single sampling interval for all shards.
+   assert(not (self.shard and self.sampler and self.sampler.adaptive),
+          "Adaptive sampling is not supported for shards")
    self.logger = logger.new({ date = config.log_date,
                                      module = ("[%5d]"):format(S.getpid())
                                         .." IPFIX exporter"})
@@ -707,18 +737,11 @@ function IPFIX:reconfig(config)
    if self.shm.path then -- shm frame initialized?
       counter.set(self.shm.version, self.version)
       counter.set(self.shm.observation_domain, self.observation_domain)
+      counter.set(self.shm.sampling_interval,
+                  self.sampler and self.sampler.interval or 1)
    end
 
-   if self.version == 9 then
-      self.header_t = netflow_v9_packet_header_t
-   elseif self.version == 10 then
-      self.header_t = ipfix_packet_header_t
-   else
-      error('unsupported ipfix version: '..self.version)
-   end
-   self.header_ptr_t = ptr_to(self.header_t)
-   self.header_size = ffi.sizeof(self.header_t)
-
+   setup_ipfix_header(self)
    setup_transport_header(self, config)
 
    -- FIXME: Assuming we export to IPv4 address.
@@ -778,6 +801,15 @@ function IPFIX:reconfig(config)
       end
    end
    self.templates = config.templates
+
+   -- Select the flow set of each packet with a single program for the
+   -- filters of all templates.
+   local filters = {}
+   for i, flow_set in ipairs(self.flow_sets) do
+      filters[i] = flow_set.template.filter
+   end
+   self.match_flow_set = multi_filter.first_match(filters)
+   self.nmatched = ffi.new("uint32_t[?]", #self.flow_sets + 1)
 end
 
 function IPFIX:send_template_records(out)
@@ -785,9 +817,17 @@ function IPFIX:send_template_records(out)
    for _, flow_set in ipairs(self.flow_sets) do
       pkt = flow_set:append_template_record(pkt)
    end
+   local options_count = 0
+   local options_template_id =
+      self.sampler and self.sampler:options_template_id(self.version)
+      or self.sampled
+   if options_template_id then
+      options_count = sampling.append_options_template(
+         pkt, self.version, options_template_id)
+   end
    local record_count
    if self.version == 9 then
-      record_count = #self.flow_sets
+      record_count = #self.flow_sets + options_count
    else
       -- For IPFIX, template records are not accounted for in the
       -- sequence number of the header
@@ -800,6 +840,21 @@ function IPFIX:send_template_records(out)
    events.exported_template_records()
 end
 
+-- Send an options record with the current sampling parameters, which
+-- allows collectors to rescale the flow data (see apps.ipfix.sampling).
+-- Shards send a bare options data set to be exported by the Merge app.
+function IPFIX:send_sampling_options(out)
+   local pkt = packet.allocate()
+   local record_count = self.sampler:append_options_record(
+      pkt, self.version, self.observation_domain)
+   if not self.shard then
+      pkt = self:add_ipfix_header(pkt, record_count)
+      pkt = self:add_transport_headers(pkt)
+   end
+   link.transmit(out, pkt)
+   events.exported_sampling_options(self.sampler.interval)
+end
+
 function IPFIX:add_ipfix_header(pkt, count)
    pkt = packet.shiftright(pkt, self.header_size)
    local header = ffi.cast(self.header_ptr_t, pkt.data)
@@ -811,11 +866,12 @@ function IPFIX:add_ipfix_header(pkt, count)
       -- (template and data)
       header.record_count = htons(count)
       -- sequence_number counts the number of exported packets
-      conter.add(self.shm.sequence_number)
+      counter.add(self.shm.sequence_number)
       header.uptime = htonl(to_milliseconds(engine.now() - self.boot_time))
    elseif self.version == 10 then
-      -- sequence_number counts the cumulative number of data records
-      -- (i.e. excluding template and option records)
+      -- sequence_number counts the cumulative number of data records,
+      -- including options data records but excluding template records
+      -- (RFC 7011 §3.1)
       counter.add(self.shm.sequence_number, count)
       header.byte_length = htons(pkt.length)
    end
@@ -859,20 +915,42 @@ function IPFIX:push1(input)
       events.added_metadata()
    end
 
-   for _,set in ipairs(flow_sets) do
+   local sampler = self.sampler
+   if sampler then
+      local nselected = 0
       for _ = 1, nreadable do
          local p = link.receive(input)
-         local md = metadata_get(p)
-         if set.match(md.filter_start, md.filter_length) then
-            link.transmit(set.incoming, p)
-         else
+         if sampler:select(metadata_get(p)) then
             link.transmit(input, p)
+            nselected = nselected + 1
+         else
+            packet.free(p)
          end
       end
-      events.matched(set.template.id, nreadable)
-      nreadable = link.nreadable(input)
+      sampler:account(nreadable, nselected, engine.now())
+      counter.add(self.shm.unsampled_packets, nreadable - nselected)
+      events.sampled(nreadable, nselected)
+      nreadable = nselected
    end
 
+   local match, nmatched = self.match_flow_set, self.nmatched
+   ffi.fill(nmatched, ffi.sizeof(nmatched))
+   for _ = 1, nreadable do
+      local p = link.receive(input)
+      local md = metadata_get(p)
+      local i = match(md.filter_start, md.filter_length)
+      if i then
+         link.transmit(flow_sets[i].incoming, p)
+         nmatched[i] = nmatched[i] + 1
+      else
+         link.transmit(input, p)
+      end
+   end
+   for i,set in ipairs(flow_sets) do
+      events.matched(set.template.id, nmatched[i])
+   end
+   nreadable = link.nreadable(input)
+
    counter.add(self.shm.ignored_packets, nreadable)
    for _ = 1, nreadable do
       packet.free(link.receive(input))
@@ -894,7 +972,20 @@ function IPFIX:tick()
 
    if self.next_template_refresh < engine.now() then
       self.next_template_refresh = engine.now() + self.template_refresh_interval
-      self:send_template_records(self.output.output)
+      -- Shards leave sending template records to the Merge app.
+      if not self.shard then
+         self:send_template_records(self.output.output)
+      end
+      if self.sampler then
+         self:send_sampling_options(self.output.output)
+      end
+   end
+
+   local sampler = self.sampler
+   if sampler and sampler:adjust() then
+      self.logger:log("Adjusted sampling interval to "..sampler.interval)
+      counter.set(self.shm.sampling_interval, sampler.interval)
+      self:send_sampling_options(self.output.output)
    end
 
    if self.stats_timer() then
@@ -904,6 +995,165 @@ function IPFIX:tick()
    end
 end
 
+-- The Merge app is the exporting half of a sharded flow cache.  IPFIX
+-- apps configured with "shard = true" do not export on their own,
+-- instead they transmit bare data sets on their output.  Any number of
+-- such shards (typically running in separate worker processes fed by
+-- RSS and connected via interlinks) can be linked to the inputs of a
+-- Merge app, which wraps the data sets into IPFIX messages of a
+-- single observation domain with a unified sequence number, and sends
+-- the template records on behalf of all shards.  The shards and the
+-- Merge app must be configured with the same templates and version.
+-- Sampling options data sets of the shards are exported likewise, and
+-- once the first one has been received the Merge app includes the
+-- options template with its template records.  The options records are
+-- rescoped to the observation domain of the Merge app and report the
+-- packet totals of all shards.  Since they describe the sampling of the
+-- merged flow records, all shards must sample alike: options records
+-- that disagree with the first one received are dropped.
+Merge = {
+   config = {}
+}
+for _, key in ipairs({
+      "template_refresh_interval",
+      "ipfix_version",
+      "observation_domain",
+      "exporter_ip",
+      "exporter_eth_src",
+      "exporter_eth_dst",
+      "collector_ip",
+      "collector_port",
+      "templates",
+      "log_date"
+}) do
+   Merge.config[key] = ipfix_config_params[key]
+end
+
+function Merge:new(config)
+   local o = { boot_time = engine.now(),
+               next_template_refresh = -1,
+               template_refresh_interval = config.template_refresh_interval,
+               version = config.ipfix_version,
+               observation_domain = config.observation_domain,
+               flow_sets = {},
+               data_sets = {},
+               -- ID of the options template of the sampling options
+               -- sent by the shards, if any
+               sampled = false,
+               -- Sampling parameters of the shards, and their latest
+               -- packet totals by input
+               sampling = { totals = {} },
+               shm = {
+                  -- Total number of data sets received from shards
+                  received_packets = { counter },
+                  -- Data sets for templates not configured for the merger
+                  ignored_packets = { counter },
+                  -- Options data sets whose sampling parameters differ
+                  -- from those of the other shards
+                  inconsistent_sampling_packets = { counter },
+                  -- Number of template packets sent
+                  template_packets = { counter },
+                  -- Non-wrapping sequence number shared by all shards
+                  sequence_number = { counter, 1 },
+                  version = { counter, config.ipfix_version },
+                  observation_domain = { counter, config.observation_domain },
+               }
+   }
+   setup_ipfix_header(o)
+   setup_transport_header(o, config)
+   local set_id = (o.version == 9 and V9_TEMPLATE_ID) or V10_TEMPLATE_ID
+   for _, spec in ipairs(config.templates) do
+      -- Strip the optional cache size from the template specifier.
+      local name = spec:match("^([^:]+)")
+      assert(template.templates[name], "Undefined template : "..name)
+      local info = template.make_template_info(template.templates[name])
+      local set = { template = info, template_id = set_id }
+      table.insert(o.flow_sets, setmetatable(set, { __index = FlowSet }))
+      o.data_sets[info.id] = set
+   end
+   return setmetatable(o, { __index = Merge })
+end
+
+Merge.add_ipfix_header = IPFIX.add_ipfix_header
+Merge.add_transport_headers = IPFIX.add_transport_headers
+Merge.send_template_records = IPFIX.send_template_records
+
+-- Rescope the options data set of the shard on input I to the
+-- observation domain of the Merge app, with the packet totals of all
+-- shards.  Returns false if the shard samples differently than the
+-- others.
+function Merge:merge_sampling_options (pkt, i)
+   local sampling_state = self.sampling
+   local parameters, observed, selected =
+      sampling.read_options_record(pkt, self.version)
+   if not sampling_state.parameters then
+      sampling_state.parameters = parameters
+   elseif parameters ~= sampling_state.parameters then
+      return false
+   end
+   local totals = sampling_state.totals
+   totals[i] = { observed = observed or 0, selected = selected or 0 }
+   local total_observed, total_selected = 0, 0
+   for _, t in pairs(totals) do
+      total_observed = total_observed + t.observed
+      total_selected = total_selected + t.selected
+   end
+   sampling.rescope_options_record(pkt, self.version, self.observation_domain,
+                                   total_observed, total_selected)
+   return true
+end
+
+function Merge:push ()
+   local output = self.output.output
+   local data_sets, set_header_len = self.data_sets, ffi.sizeof(set_header_t)
+   for i, input in ipairs(self.input) do
+      local nreadable = link.nreadable(input)
+      counter.add(self.shm.received_packets, nreadable)
+      for _ = 1, nreadable do
+         local pkt = link.receive(input)
+         local set_header = ffi.cast(set_header_ptr_t, pkt.data)
+         local id = ntohs(set_header.id)
+         local set = data_sets[id]
+         local options_p = sampling.options_template_id_p[id]
+         if options_p and not self:merge_sampling_options(pkt, i) then
+            counter.add(self.shm.inconsistent_sampling_packets)
+            packet.free(pkt)
+         elseif options_p then
+            if not self.sampled then
+               -- Announce the options template before the first
+               -- options record.
+               self.sampled = id
+               self:send_template_records(output)
+            end
+            -- An options data set holds a single record.
+            pkt = self:add_ipfix_header(pkt, 1)
+            pkt = self:add_transport_headers(pkt)
+            link.transmit(output, pkt)
+         elseif set then
+            -- Data sets are padded to a multiple of four bytes, which
+            -- is always less than the size of a record.
+            local record_count = math.floor(
+               (ntohs(set_header.length) - set_header_len)
+                  / set.template.data_len)
+            pkt = self:add_ipfix_header(pkt, record_count)
+            pkt = self:add_transport_headers(pkt)
+            link.transmit(output, pkt)
+            events.exported_data_records(record_count)
+         else
+            counter.add(self.shm.ignored_packets)
+            packet.free(pkt)
+         end
+      end
+   end
+end
+
+function Merge:tick ()
+   if self.next_template_refresh < engine.now() then
+      self.next_template_refresh = engine.now() + self.template_refresh_interval
+      self:send_template_records(self.output.output)
+   end
+end
+
 function selftest()
    print('selftest: apps.ipfix.ipfix')
    local consts = require("apps.lwaftr.constants")
@@ -1067,5 +1317,181 @@ function selftest()
    link.free(input, input_name)
    link.free(output, output_name)
 
+   -- A shard exports bare data sets and no template records, which
+   -- are wrapped into IPFIX messages by a Merge app.
+   conf.shard = true
+   conf.instance = "shard"
+   local shard = IPFIX:new(lib.parse(conf, IPFIX.config))
+   shard.shm = shm.create_frame("apps/ipfix_shard", shard.shm)
+   local shard_output_name, shard_output = new_internal_link('ipfix selftest shard')
+   shard.output = { [1] = shard_output, output = shard_output }
+   local shard_flows = shard.flow_sets[1]
+   local key = shard_flows.scratch_entry.key
+   key.sourceIPv4Address = ipv4:pton("192.168.2.1")
+   key.destinationIPv4Address = ipv4:pton("192.168.2.25")
+   key.protocolIdentifier = 17
+   key.sourceTransportPort = 9999
+   key.destinationTransportPort = 80
+   local value = shard_flows.scratch_entry.value
+   value.flowStartMilliseconds = to_milliseconds(C.get_unix_time() - 500)
+   value.flowEndMilliseconds = value.flowStartMilliseconds + 30
+   value.packetDeltaCount = 5
+   value.octetDeltaCount = 15
+   shard_flows.table:add(key, value)
+   local now = engine.now()
+   while engine.now() - now < 1 do
+      shard:tick()
+   end
+   assert(link.nreadable(shard_output) == 1)
+   local set_header = ffi.cast(set_header_ptr_t, link.front(shard_output).data)
+   assert(ntohs(set_header.id) == shard_flows.template.id)
+
+   local merge = Merge:new(lib.parse({
+      exporter_ip = conf.exporter_ip,
+      collector_ip = conf.collector_ip,
+      collector_port = conf.collector_port,
+      templates = conf.templates
+   }, Merge.config))
+   merge.shm = shm.create_frame("apps/ipfix_merge", merge.shm)
+   local merge_output_name, merge_output = new_internal_link('ipfix selftest merge')
+   merge.input = { [1] = shard_output, input = shard_output }
+   merge.output = { [1] = merge_output, output = merge_output }
+   merge:push()
+   merge:tick()
+   -- One data message and one template message.
+   assert(link.nreadable(merge_output) == 2)
+   assert(counter.read(merge.shm.sequence_number) == 2)
+   for i=1,link.nreadable(merge_output) do
+      local p = link.receive(merge_output)
+      assert(filter(p.data, p.length), "pf filter failed")
+      packet.free(p)
+   end
+
+   link.free(shard_output, shard_output_name)
+   link.free(merge_output, merge_output_name)
+
+   -- With sampling, the effective rate is reported in an options
+   -- record following the template records.
+   conf.shard = false
+   conf.instance = "sampled"
+   conf.sampling = { mode = 'count', interval = 2 }
+   local sampled = IPFIX:new(lib.parse(conf, IPFIX.config))
+   sampled.shm = shm.create_frame("apps/ipfix_sampled", sampled.shm)
+   input_name, input = new_internal_link('ipfix selftest input')
+   output_name, output = new_internal_link('ipfix selftest output')
+   sampled.input = { [1] = input, input = input }
+   sampled.output = { [1] = output, output = output }
+   ipfix = sampled
+   for i=1, 10 do
+      test("192.168.1.1", "192.168.1.25", 9999, 80)
+   end
+   assert(counter.read(sampled.shm.unsampled_packets) == 5)
+   assert(sampled.flow_sets[1].table.occupancy == 1)
+   sampled:tick()
+   assert(link.nreadable(output) == 2)
+   -- The options data record counts in the sequence number.
+   assert(counter.read(sampled.shm.sequence_number) == 2)
+   for i=1,link.nreadable(output) do
+      local p = link.receive(output)
+      assert(filter(p.data, p.length), "pf filter failed")
+      packet.free(p)
+   end
+   link.free(input, input_name)
+   link.free(output, output_name)
+
+   -- Sampled shards send bare options data sets, which the Merge app
+   -- exports after announcing the options template.
+   conf.shard = true
+   conf.instance = "sampled_shard"
+   shard = IPFIX:new(lib.parse(conf, IPFIX.config))
+   shard.shm = shm.create_frame("apps/ipfix_sampled_shard", shard.shm)
+   shard_output_name, shard_output = new_internal_link('ipfix selftest shard')
+   shard.output = { [1] = shard_output, output = shard_output }
+   shard:tick()
+   assert(link.nreadable(shard_output) == 1)
+   set_header = ffi.cast(set_header_ptr_t, link.front(shard_output).data)
+   assert(ntohs(set_header.id) == sampling.OPTIONS_TEMPLATE_ID)
+   merge = Merge:new(lib.parse({
+      exporter_ip = conf.exporter_ip,
+      collector_ip = conf.collector_ip,
+      collector_port = conf.collector_port,
+      templates = conf.templates
+   }, Merge.config))
+   merge.shm = shm.create_frame("apps/ipfix_sampled_merge", merge.shm)
+   merge_output_name, merge_output = new_internal_link('ipfix selftest merge')
+   merge.input = { [1] = shard_output, input = shard_output }
+   merge.output = { [1] = merge_output, output = merge_output }
+   merge:push()
+   -- One template message, including the options template, and one
+   -- options message.
+   assert(merge.sampled)
+   assert(link.nreadable(merge_output) == 2)
+   assert(counter.read(merge.shm.sequence_number) == 2)
+   for i=1,link.nreadable(merge_output) do
+      local p = link.receive(merge_output)
+      assert(filter(p.data, p.length), "pf filter failed")
+      packet.free(p)
+   end
+
+   -- The Merge app reports the sampling of its shards in its own
+   -- observation domain, with the packet totals of all shards, and
+   -- drops options records of shards that sample differently.
+   merge.observation_domain = 300
+   merge.input = {}
+   local shard_links = {}
+   for i, interval in ipairs({ 2, 2, 4 }) do
+      conf.instance = "sampled_shard"..i
+      conf.observation_domain = 1000 + i
+      conf.sampling = { mode = 'count', interval = interval }
+      local shard = IPFIX:new(lib.parse(conf, IPFIX.config))
+      shard.shm = shm.create_frame("apps/ipfix_sampled_shard"..i, shard.shm)
+      shard.sampler:account(10 * i, 5 * i, 0)
+      shard_links[i] = { new_internal_link('ipfix selftest merge input') }
+      merge.input[i] = shard_links[i][2]
+      shard:send_sampling_options(merge.input[i])
+   end
+   merge:push()
+   assert(counter.read(merge.shm.inconsistent_sampling_packets) == 1)
+   assert(link.nreadable(merge_output) == 2)
+   local headers_len = merge.transport_headers.pkt.length + merge.header_size
+   for _, totals in ipairs({ { 10, 5 }, { 30, 15 } }) do
+      local p = packet.shiftleft(link.receive(merge_output), headers_len)
+      local parameters, observed, selected =
+         sampling.read_options_record(p, merge.version)
+      assert(parameters == merge.sampling.parameters)
+      assert(observed == totals[1] and selected == totals[2])
+      -- The scope follows the set header.
+      local scope = ffi.cast("uint32_t *", p.data + ffi.sizeof(set_header_t))[0]
+      assert(ntohl(scope) == merge.observation_domain)
+      packet.free(p)
+   end
+   for _, l in ipairs(shard_links) do link.free(l[2], l[1]) end
+
+   -- Shards can not adapt their sampling intervals independently.
+   conf.sampling = { mode = 'count', interval = 2, adaptive = true }
+   assert(not pcall(IPFIX.new, IPFIX, lib.parse(conf, IPFIX.config)))
+   link.free(shard_output, shard_output_name)
+   link.free(merge_output, merge_output_name)
+
+   -- Hash-based selection is reported with its own options template.
+   conf.shard = false
+   conf.instance = "hash_sampled"
+   conf.sampling = { mode = 'hash', interval = 2 }
+   local hash_sampled = IPFIX:new(lib.parse(conf, IPFIX.config))
+   hash_sampled.shm = shm.create_frame("apps/ipfix_hash_sampled",
+                                       hash_sampled.shm)
+   output_name, output = new_internal_link('ipfix selftest output')
+   hash_sampled.output = { [1] = output, output = output }
+   hash_sampled:tick()
+   assert(link.nreadable(output) == 2)
+   packet.free(link.receive(output))
+   local p = packet.shiftleft(link.receive(output),
+                              hash_sampled.transport_headers.pkt.length
+                                 + hash_sampled.header_size)
+   set_header = ffi.cast(set_header_ptr_t, p.data)
+   assert(ntohs(set_header.id) == sampling.HASH_OPTIONS_TEMPLATE_ID)
+   packet.free(p)
+   link.free(output, output_name)
+
    print("selftest ok")
 end
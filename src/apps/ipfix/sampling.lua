@@ -0,0 +1,651 @@
+-- Use of this source code is governed by the Apache 2.0 license; see COPYING.
+
+-- This module implements packet selection (sampling) for the IPFIX
+-- app, and the options records by which the effective sampling rate
+-- is reported to collectors so that they can rescale the flow data.
+--
+-- Two selection modes are supported:
+--
+--   count: systematic count-based sampling, i.e. select every Nth
+--          packet (RFC 5475 §5.1).
+--
+--   hash:  hash-based selection on the flow key (RFC 5475 §6.2) using
+--          the BOB hash function.  All packets of a flow are either
+--          selected or not.  The hash is initialised with a
+--          configurable seed, so that all instances of the app
+--          (e.g. in different RSS workers) make the same decision for
+--          a given flow.
+--
+-- With adaptive sampling, the interval N is doubled whenever the app
+-- falls behind during an adjustment period, up to a maximum interval,
+-- and halved again once the overload has passed.  The app falls
+-- behind if the backlog on its input link or the time between
+-- consecutive breaths cross the configured thresholds.
+
+module(..., package.seeall)
+
+local ffi     = require("ffi")
+local bit     = require("bit")
+local lib     = require("core.lib")
+local link    = require("core.link")
+local packet  = require("core.packet")
+
+local htonl, htons, ntohl, ntohs = lib.htonl, lib.htons, lib.ntohl, lib.ntohs
+local bxor, lshift, rshift = bit.bxor, bit.lshift, bit.rshift
+local function htonq(v) return bit.bswap(v + 0ULL) end
+
+params = {
+   -- Valid values: 'none', 'count' or 'hash'.
+   mode = { default = 'none' },
+   interval = { default = 1 },
+   hash_seed = { default = 0 },
+   adaptive = { default = false },
+   max_interval = { default = 1024 },
+   -- Backlog in packets on the input link at the start of a push.
+   backlog_threshold = { default = math.floor(link.max / 2) },
+   -- Time in seconds between consecutive breaths that process packets.
+   breath_threshold = { default = 0.001 },
+   adjust_interval = { default = 1 }
+}
+
+-- Template IDs of the options templates that describe the sampling
+-- parameters of an observation domain, by sampling mode.  NetFlow v9
+-- has no parameters for hash-based selection, so both modes use the
+-- first one.  Must not collide with the IDs of the data templates in
+-- apps.ipfix.template.
+OPTIONS_TEMPLATE_ID = 4096
+HASH_OPTIONS_TEMPLATE_ID = 4097
+options_template_id_p = {
+   [OPTIONS_TEMPLATE_ID] = true,
+   [HASH_OPTIONS_TEMPLATE_ID] = true
+}
+
+-- Selector algorithms as per the IANA PSAMP registry (RFC 5477 §8.2.1):
+-- "Systematic count-based Sampling" and "Hash-based Filtering using BOB".
+local selector_algorithm = { count = 1, hash = 6 }
+-- Sampling algorithms for NetFlow v9 (RFC 3954 §8).  There is none for
+-- hash-based selection, which is reported as deterministic sampling.
+local v9_sampling_algorithm = { count = 1, hash = 1 }
+
+-- RFC 7011 §3.4.2.2.
+local options_template_t = ffi.typeof([[
+   struct {
+      /* Network byte order.  */
+      uint16_t set_id;
+      uint16_t length;
+      uint16_t template_id;
+      uint16_t field_count;
+      uint16_t scope_field_count;
+      uint16_t fields[12];
+      uint8_t padding[2];
+   } __attribute__((packed))
+]])
+local hash_options_template_t = ffi.typeof([[
+   struct {
+      /* Network byte order.  */
+      uint16_t set_id;
+      uint16_t length;
+      uint16_t template_id;
+      uint16_t field_count;
+      uint16_t scope_field_count;
+      uint16_t fields[18];
+      uint8_t padding[2];
+   } __attribute__((packed))
+]])
+local options_record_t = ffi.typeof([[
+   struct {
+      /* Network byte order.  */
+      uint16_t set_id;
+      uint16_t length;
+      uint32_t observationDomainId;
+      uint16_t selectorAlgorithm;
+      uint32_t samplingPacketInterval;
+      uint32_t samplingPacketSpace;
+      uint64_t selectorIdTotalPktsObserved;
+      uint64_t selectorIdTotalPktsSelected;
+      uint8_t padding[2];
+   } __attribute__((packed))
+]])
+local hash_options_record_t = ffi.typeof([[
+   struct {
+      /* Network byte order.  */
+      uint16_t set_id;
+      uint16_t length;
+      uint32_t observationDomainId;
+      uint16_t selectorAlgorithm;
+      uint64_t hashInitialiserValue;
+      uint64_t hashOutputRangeMin;
+      uint64_t hashOutputRangeMax;
+      uint64_t hashSelectedRangeMin;
+      uint64_t hashSelectedRangeMax;
+      uint64_t selectorIdTotalPktsObserved;
+      uint64_t selectorIdTotalPktsSelected;
+      uint8_t padding[2];
+   } __attribute__((packed))
+]])
+-- RFC 3954 §6.1.
+local v9_options_template_t = ffi.typeof([[
+   struct {
+      /* Network byte order.  */
+      uint16_t flowset_id;
+      uint16_t length;
+      uint16_t template_id;
+      uint16_t scope_length;
+      uint16_t option_length;
+      uint16_t fields[6];
+      uint8_t padding[2];
+   } __attribute__((packed))
+]])
+local v9_options_record_t = ffi.typeof([[
+   struct {
+      /* Network byte order.  */
+      uint16_t flowset_id;
+      uint16_t length;
+      uint32_t system;
+      uint32_t samplingInterval;
+      uint8_t samplingAlgorithm;
+      uint8_t padding[3];
+   } __attribute__((packed))
+]])
+
+local IPFIX_OPTIONS_SET_ID = 3
+local V9_OPTIONS_SET_ID = 1
+
+-- Information element IDs and sizes.
+local ipfix_options_fields = {
+   149, 4, -- observationDomainId (scope)
+   304, 2, -- selectorAlgorithm
+   305, 4, -- samplingPacketInterval
+   306, 4, -- samplingPacketSpace
+   318, 8, -- selectorIdTotalPktsObserved
+   319, 8  -- selectorIdTotalPktsSelected
+}
+local ipfix_hash_options_fields = {
+   149, 4, -- observationDomainId (scope)
+   304, 2, -- selectorAlgorithm
+   334, 8, -- hashInitialiserValue
+   329, 8, -- hashOutputRangeMin
+   330, 8, -- hashOutputRangeMax
+   331, 8, -- hashSelectedRangeMin
+   332, 8, -- hashSelectedRangeMax
+   318, 8, -- selectorIdTotalPktsObserved
+   319, 8  -- selectorIdTotalPktsSelected
+}
+local v9_options_fields = {
+   1, 4,  -- System (scope)
+   34, 4, -- samplingInterval
+   35, 1  -- samplingAlgorithm
+}
+
+local transport_proto_p = {
+   -- TCP
+   [6] = true,
+   -- UDP
+   [17] = true,
+   -- SCTP
+   [132] = true
+}
+
+local flow_key_t = ffi.typeof([[
+   struct {
+      uint8_t addrs[32];
+      uint32_t ports;
+      uint8_t proto;
+   } __attribute__((packed))
+]])
+
+-- The BOB hash function of RFC 5475 (Appendix A.2), which is Bob
+-- Jenkins' lookup2, over LENGTH bytes at PTR.  Like the reference
+-- implementation, this reads the input as little-endian words.
+local uint8_ptr_t = ffi.typeof("uint8_t *")
+local uint32_ptr_t = ffi.typeof("uint32_t *")
+local function bob_mix (a, b, c)
+   a = bxor(a - b - c, rshift(c, 13))
+   b = bxor(b - c - a, lshift(a, 8))
+   c = bxor(c - a - b, rshift(b, 13))
+   a = bxor(a - b - c, rshift(c, 12))
+   b = bxor(b - c - a, lshift(a, 16))
+   c = bxor(c - a - b, rshift(b, 5))
+   a = bxor(a - b - c, rshift(c, 3))
+   b = bxor(b - c - a, lshift(a, 10))
+   c = bxor(c - a - b, rshift(b, 15))
+   return a, b, c
+end
+local function bob_hash (ptr, length, initval)
+   local k = ffi.cast(uint8_ptr_t, ptr)
+   local a, b, c = 0x9e3779b9, 0x9e3779b9, initval
+   local len = length
+   while len >= 12 do
+      local w = ffi.cast(uint32_ptr_t, k)
+      a, b, c = bob_mix(a + w[0], b + w[1], c + w[2])
+      k, len = k + 12, len - 12
+   end
+   -- The first byte of c is reserved for the length.
+   c = c + length
+   for i = len - 1, 0, -1 do
+      if i >= 8 then
+         c = c + lshift(k[i], (i - 7) * 8)
+      elseif i >= 4 then
+         b = b + lshift(k[i], (i - 4) * 8)
+      else
+         a = a + lshift(k[i], i * 8)
+      end
+   end
+   a, b, c = bob_mix(a, b, c)
+   return c % 2^32
+end
+
+Sampler = {}
+
+function new (conf)
+   assert(conf.mode == 'none' or selector_algorithm[conf.mode],
+          "Invalid sampling mode: "..tostring(conf.mode))
+   if conf.mode == 'none' then
+      assert(not conf.adaptive, "Adaptive sampling requires a sampling mode")
+      return nil
+   end
+   assert(conf.interval >= 1, "Sampling interval must be at least 1")
+   assert(conf.max_interval >= conf.interval,
+          "Maximum sampling interval is smaller than sampling interval")
+   local o = { mode = conf.mode,
+               base_interval = conf.interval,
+               interval = conf.interval,
+               adaptive = conf.adaptive,
+               max_interval = conf.max_interval,
+               backlog_threshold = conf.backlog_threshold,
+               breath_threshold = conf.breath_threshold,
+               adjust_timer = lib.throttle(conf.adjust_interval),
+               overload = false,
+               last_breath = 0,
+               last_npackets = 0,
+               seen = 0,
+               observed = 0,
+               selected = 0 }
+   if conf.mode == 'hash' then
+      assert(conf.hash_seed >= 0 and conf.hash_seed < 2^32,
+             "Hash seed must be an unsigned 32-bit number")
+      o.key = flow_key_t()
+      o.hash_seed = conf.hash_seed
+   end
+   return setmetatable(o, { __index = Sampler })
+end
+
+function Sampler:select_count ()
+   local seen = self.seen + 1
+   if seen >= self.interval then
+      self.seen = 0
+      return true
+   end
+   self.seen = seen
+   return false
+end
+
+function Sampler:flow_hash (md)
+   local key = self.key
+   if md.ethertype == 0x0800 then
+      ffi.copy(key.addrs, md.l3 + 12, 8)
+      -- Clear what is left of the addresses of a previous IPv6 packet.
+      ffi.fill(key.addrs + 8, 24)
+   elseif md.ethertype == 0x86dd then
+      ffi.copy(key.addrs, md.l3 + 8, 32)
+   else
+      return 0
+   end
+   if transport_proto_p[md.proto] and md.frag_offset == 0 then
+      key.ports = ffi.cast("uint32_t *", md.l4)[0]
+   else
+      key.ports = 0
+   end
+   key.proto = md.proto
+   return bob_hash(key, ffi.sizeof(key), self.hash_seed)
+end
+
+-- Hash-based selection selects the flows whose hash falls into the
+-- range [0, ceil(2^32 / N) - 1], i.e. roughly 1/N of all flows.
+local function hash_selected_range_max (interval)
+   return math.ceil(2^32 / interval) - 1
+end
+
+function Sampler:select_hash (md)
+   return self:flow_hash(md) * self.interval < 2^32
+end
+
+-- Select a packet given its metadata (see apps.rss.metadata).
+function Sampler:select (md)
+   if self.mode == 'count' then
+      return self:select_count()
+   else
+      return self:select_hash(md)
+   end
+end
+
+-- Account for the packets seen and selected during a push.  This is
+-- also where we check for overload if adaptive sampling is enabled.
+function Sampler:account (npackets, nselected, now)
+   self.observed = self.observed + npackets
+   self.selected = self.selected + nselected
+   if self.adaptive then
+      if npackets > self.backlog_threshold then
+         self.overload = true
+      elseif (self.last_npackets > 0 and npackets > 0 and
+              now - self.last_breath > self.breath_threshold) then
+         self.overload = true
+      end
+      self.last_breath, self.last_npackets = now, npackets
+   end
+end
+
+-- Adjust the sampling interval according to the load observed since
+-- the last adjustment.  Returns true if the interval has changed.
+function Sampler:adjust ()
+   if not (self.adaptive and self.adjust_timer()) then return false end
+   local interval = self.interval
+   if self.overload then
+      interval = math.min(interval * 2, self.max_interval)
+   elseif interval > self.base_interval then
+      interval = math.max(math.floor(interval / 2), self.base_interval)
+   end
+   self.overload = false
+   if interval ~= self.interval then
+      self.interval = interval
+      -- Restart the count-based selection sequence.
+      self.seen = 0
+      return true
+   end
+   return false
+end
+
+-- Return the ID of the options template that describes the sampler.
+function Sampler:options_template_id (version)
+   if version == 10 and self.mode == 'hash' then
+      return HASH_OPTIONS_TEMPLATE_ID
+   end
+   return OPTIONS_TEMPLATE_ID
+end
+
+local function append_ipfix_options_template (pkt, template_t, id, fields)
+   local t = template_t()
+   t.set_id = htons(IPFIX_OPTIONS_SET_ID)
+   t.length = htons(ffi.sizeof(t))
+   t.template_id = htons(id)
+   t.field_count = htons(#fields / 2)
+   t.scope_field_count = htons(1)
+   for i, v in ipairs(fields) do t.fields[i-1] = htons(v) end
+   packet.append(pkt, t, ffi.sizeof(t))
+end
+
+-- Append the options template set with the given ID to a template
+-- packet and return the number of records added.
+function append_options_template (pkt, version, id)
+   if version == 9 then
+      local t = v9_options_template_t()
+      t.flowset_id = htons(V9_OPTIONS_SET_ID)
+      t.length = htons(ffi.sizeof(t))
+      t.template_id = htons(OPTIONS_TEMPLATE_ID)
+      t.scope_length = htons(4)
+      t.option_length = htons(8)
+      for i, v in ipairs(v9_options_fields) do t.fields[i-1] = htons(v) end
+      packet.append(pkt, t, ffi.sizeof(t))
+   elseif id == HASH_OPTIONS_TEMPLATE_ID then
+      append_ipfix_options_template(pkt, hash_options_template_t, id,
+                                    ipfix_hash_options_fields)
+   else
+      append_ipfix_options_template(pkt, options_template_t, id,
+                                    ipfix_options_fields)
+   end
+   return 1
+end
+
+-- Append an options data set reporting the current sampling
+-- parameters to a packet and return the number of records added.
+function Sampler:append_options_record (pkt, version, observation_domain)
+   if version == 9 then
+      local r = v9_options_record_t()
+      r.flowset_id = htons(OPTIONS_TEMPLATE_ID)
+      r.length = htons(ffi.sizeof(r))
+      r.system = htonl(observation_domain)
+      r.samplingInterval = htonl(self.interval)
+      r.samplingAlgorithm = v9_sampling_algorithm[self.mode]
+      packet.append(pkt, r, ffi.sizeof(r))
+   elseif self.mode == 'hash' then
+      local r = hash_options_record_t()
+      r.set_id = htons(HASH_OPTIONS_TEMPLATE_ID)
+      r.length = htons(ffi.sizeof(r))
+      r.observationDomainId = htonl(observation_domain)
+      r.selectorAlgorithm = htons(selector_algorithm.hash)
+      r.hashInitialiserValue = htonq(self.hash_seed)
+      r.hashOutputRangeMin = htonq(0)
+      r.hashOutputRangeMax = htonq(2^32 - 1)
+      r.hashSelectedRangeMin = htonq(0)
+      r.hashSelectedRangeMax = htonq(hash_selected_range_max(self.interval))
+      r.selectorIdTotalPktsObserved = htonq(self.observed)
+      r.selectorIdTotalPktsSelected = htonq(self.selected)
+      packet.append(pkt, r, ffi.sizeof(r))
+   else
+      local r = options_record_t()
+      r.set_id = htons(OPTIONS_TEMPLATE_ID)
+      r.length = htons(ffi.sizeof(r))
+      r.observationDomainId = htonl(observation_domain)
+      r.selectorAlgorithm = htons(selector_algorithm.count)
+      r.samplingPacketInterval = htonl(1)
+      r.samplingPacketSpace = htonl(self.interval - 1)
+      r.selectorIdTotalPktsObserved = htonq(self.observed)
+      r.selectorIdTotalPktsSelected = htonq(self.selected)
+      packet.append(pkt, r, ffi.sizeof(r))
+   end
+   return 1
+end
+
+local options_record_ptr_t = ffi.typeof("$*", options_record_t)
+local hash_options_record_ptr_t = ffi.typeof("$*", hash_options_record_t)
+local v9_options_record_ptr_t = ffi.typeof("$*", v9_options_record_t)
+
+-- Return a pointer to the IPFIX options data set at the start of PKT,
+-- and its type.
+local function ipfix_options_record (pkt)
+   local r = ffi.cast(options_record_ptr_t, pkt.data)
+   if ntohs(r.set_id) == HASH_OPTIONS_TEMPLATE_ID then
+      return ffi.cast(hash_options_record_ptr_t, pkt.data),
+         hash_options_record_t
+   end
+   return r, options_record_t
+end
+
+-- Return the selection parameters reported by the options data set at
+-- the start of PKT (see append_options_record) as an opaque string
+-- that is equal for options records of identically configured
+-- samplers, and (for IPFIX) the total numbers of packets observed and
+-- selected.
+function read_options_record (pkt, version)
+   if version == 9 then
+      local offset = ffi.offsetof(v9_options_record_t, 'samplingInterval')
+      return ffi.string(pkt.data + offset,
+                        ffi.offsetof(v9_options_record_t, 'padding')
+                           - offset)
+   else
+      local r, record_t = ipfix_options_record(pkt)
+      local offset = ffi.offsetof(record_t, 'selectorAlgorithm')
+      return ffi.string(pkt.data + offset,
+                        ffi.offsetof(record_t, 'selectorIdTotalPktsObserved')
+                           - offset),
+         tonumber(htonq(r.selectorIdTotalPktsObserved)),
+         tonumber(htonq(r.selectorIdTotalPktsSelected))
+   end
+end
+
+-- Rewrite the options data set at the start of PKT, so that its scope
+-- is OBSERVATION_DOMAIN and (for IPFIX) it reports the given totals.
+-- The Merge app uses this to report the sampling of all its shards.
+function rescope_options_record (pkt, version, observation_domain,
+                                 observed, selected)
+   if version == 9 then
+      local r = ffi.cast(v9_options_record_ptr_t, pkt.data)
+      r.system = htonl(observation_domain)
+   else
+      local r = ipfix_options_record(pkt)
+      r.observationDomainId = htonl(observation_domain)
+      r.selectorIdTotalPktsObserved = htonq(observed)
+      r.selectorIdTotalPktsSelected = htonq(selected)
+   end
+end
+
+function selftest ()
+   print('selftest: apps.ipfix.sampling')
+   local metadata = require("apps.rss.metadata")
+   local datagram = require("lib.protocol.datagram")
+   local ether    = require("lib.protocol.ethernet")
+   local ipv4     = require("lib.protocol.ipv4")
+   local ipv6     = require("lib.protocol.ipv6")
+   local udp      = require("lib.protocol.udp")
+
+   local function parse (conf) return lib.parse(conf, params) end
+
+   assert(new(parse({})) == nil)
+
+   -- Count-based sampling selects every Nth packet.
+   local s = new(parse({ mode = 'count', interval = 4 }))
+   local n = 0
+   for i = 1, 100 do
+      if s:select() then n = n + 1 end
+   end
+   assert(n == 25, n)
+
+   -- Hash-based sampling is consistent per flow and across instances
+   -- using the same seed, and selects roughly 1/N of all flows.
+   local function flow_packet (src, sport)
+      local dg = datagram:new()
+      dg:push(udp:new({ src_port = sport, dst_port = 53 }))
+      dg:push(ipv4:new({ src = ipv4:pton(src), dst = ipv4:pton("10.0.0.1"),
+                         protocol = 17, ttl = 64 }))
+      dg:push(ether:new({ type = 0x0800 }))
+      local p = dg:packet()
+      metadata.add(p)
+      return p
+   end
+   local s1 = new(parse({ mode = 'hash', interval = 8 }))
+   local s2 = new(parse({ mode = 'hash', interval = 8 }))
+   local nflows = 10000
+   local selected = 0
+   for i = 1, nflows do
+      local p = flow_packet(("192.168.%d.%d"):format(i % 256, i % 200),
+                            1024 + i)
+      local md = metadata.get(p)
+      local sel = s1:select(md)
+      assert(sel == s2:select(md))
+      assert(sel == s1:select(md))
+      if sel then selected = selected + 1 end
+      packet.free(p)
+   end
+   assert(math.abs(selected / nflows - 1/8) < 0.02, selected)
+
+   -- The hash of an IPv4 flow does not depend on preceding IPv6 packets.
+   local function flow_packet6 (src)
+      local dg = datagram:new()
+      dg:push(udp:new({ src_port = 1024, dst_port = 53 }))
+      dg:push(ipv6:new({ src = ipv6:pton(src), dst = ipv6:pton("2001:db8::1"),
+                         next_header = 17, hop_limit = 64 }))
+      dg:push(ether:new({ type = 0x86dd }))
+      local p = dg:packet()
+      metadata.add(p)
+      return p
+   end
+   local p4 = flow_packet("192.168.1.1", 1024)
+   local h = s1:flow_hash(metadata.get(p4))
+   local p6 = flow_packet6("2001:db8:ffff:ffff:ffff:ffff:ffff:ffff")
+   s1:flow_hash(metadata.get(p6))
+   assert(s1:flow_hash(metadata.get(p4)) == h)
+   packet.free(p4)
+   packet.free(p6)
+
+   -- Adaptive sampling backs off under overload and recovers.
+   local s = new(parse({ mode = 'count', interval = 2, adaptive = true,
+                         max_interval = 8, backlog_threshold = 100,
+                         adjust_interval = 0 }))
+   for _, expected in ipairs({ 4, 8 }) do
+      s:account(200, 100, 0)
+      assert(s:adjust() and s.interval == expected, s.interval)
+   end
+   s:account(200, 100, 0)
+   assert(not s:adjust() and s.interval == 8)
+   s:account(10, 5, 0)
+   assert(s:adjust() and s.interval == 4)
+   s:account(10, 5, 0)
+   assert(s:adjust() and s.interval == 2)
+   s:account(10, 5, 0)
+   assert(not s:adjust() and s.interval == 2)
+
+   -- Options template and record sizes are multiples of four.
+   local sh = new(parse({ mode = 'hash', interval = 3, hash_seed = 42 }))
+   for _, sampler in ipairs({ s, sh }) do
+      for _, version in ipairs({ 9, 10 }) do
+         local p = packet.allocate()
+         append_options_template(p, version,
+                                 sampler:options_template_id(version))
+         assert(p.length % 4 == 0)
+         local len = p.length
+         sampler:append_options_record(p, version, 256)
+         assert((p.length - len) % 4 == 0)
+         packet.free(p)
+      end
+   end
+
+   -- Hash-based selection is reported with the parameters of the BOB
+   -- hash function.
+   local p = packet.allocate()
+   sh:append_options_record(p, 10, 256)
+   local r = ffi.cast(hash_options_record_ptr_t, p.data)
+   assert(ntohs(r.set_id) == HASH_OPTIONS_TEMPLATE_ID)
+   assert(ntohs(r.selectorAlgorithm) == selector_algorithm.hash)
+   assert(htonq(r.hashInitialiserValue) == 42)
+   assert(htonq(r.hashOutputRangeMax) == 0xffffffff)
+   assert(htonq(r.hashSelectedRangeMax) == 0x55555555)
+   packet.free(p)
+
+   -- Options records can be read back, and rescoped with new totals.
+   -- The selection parameters of identically configured samplers are
+   -- equal.
+   s.observed, s.selected = 40, 20
+   sh.observed, sh.selected = 40, 20
+   local sh2 = new(parse({ mode = 'hash', interval = 3, hash_seed = 43 }))
+   for _, version in ipairs({ 9, 10 }) do
+      local function parameters (sampler)
+         local p = packet.allocate()
+         sampler:append_options_record(p, version, 1)
+         local parameters = read_options_record(p, version)
+         packet.free(p)
+         return parameters
+      end
+      assert(parameters(s) == parameters(s))
+      assert(parameters(s) ~= parameters(sh))
+      if version == 10 then
+         assert(parameters(sh) ~= parameters(sh2))
+      end
+      for _, sampler in ipairs({ s, sh }) do
+         local p = packet.allocate()
+         sampler:append_options_record(p, version, 256)
+         local _, observed, selected = read_options_record(p, version)
+         if version == 10 then
+            assert(observed == 40 and selected == 20)
+            rescope_options_record(p, version, 512, 100, 50)
+            local r = ipfix_options_record(p)
+            assert(ntohl(r.observationDomainId) == 512)
+            assert(select(2, read_options_record(p, version)) == 100)
+            assert(select(3, read_options_record(p, version)) == 50)
+         else
+            rescope_options_record(p, version, 512)
+            local r = ffi.cast(v9_options_record_ptr_t, p.data)
+            assert(ntohl(r.system) == 512)
+         end
+         packet.free(p)
+      end
+   end
+
+   -- Test vectors from the reference implementation of lookup2.
+   local buf = ffi.new("uint8_t[37]")
+   for i = 0, 36 do buf[i] = (i * 37 + 200) % 256 end
+   assert(bob_hash(buf, 0, 0) == 3175731469)
+   assert(bob_hash(buf, 13, 0) == 1605644576)
+   assert(bob_hash(buf, 37, 0xdeadbeef) == 3555417206)
+
+   print("selftest ok")
+end
@@ -280,6 +280,7 @@ function make_template_info(spec)
             record_t = record_t,
             record_ptr_t = ptr_to(record_t),
             swap_fn = gen_swap_fn(),
+            filter = spec.filter,
             match = pf.compile_filter(spec.filter),
             counters = spec.counters,
             counters_names = counters_names,
@@ -5,9 +5,18 @@
 
 module(..., package.seeall)
 local esp = require("lib.ipsec.esp")
+local sadb = require("lib.ipsec.sadb")
+local ffi = require("ffi")
 local counter = require("core.counter")
 local ethernet = require("lib.protocol.ethernet")
 local ipv6 = require("lib.protocol.ipv6")
+local esp_header = require("lib.protocol.esp")
+local lib = require("core.lib")
+
+local ipv6_ptr_t = ffi.typeof("$ *", ipv6:ctype())
+local esp_header_ptr_t = ffi.typeof("$ *", esp_header:ctype())
+local IPV6_OFFSET = ethernet:sizeof()
+local PAYLOAD_OFFSET = ethernet:sizeof() + ipv6:sizeof()
 
 Transport6 = {
    config = {
@@ -45,34 +54,43 @@ function Transport6:new (conf)
       resync_threshold = conf.resync_threshold,
       resync_attempts = conf.resync_attempts,
       auditing = conf.auditing}
+   self.batch = ffi.new("struct packet *[?]", esp.max_batch)
+   self.result = ffi.new("struct packet *[?]", esp.max_batch)
    return setmetatable(self, {__index = Transport6})
 end
 
 function Transport6:push ()
+   local batch, result = self.batch, self.result
    -- Encapsulation path
    local input = self.input.decapsulated
    local output = self.output.encapsulated
-   for _=1,link.nreadable(input) do
-      local p = link.receive(input)
-      local p_enc = self.encrypt:encapsulate_transport6(p)
-      if p_enc then
-         link.transmit(output, p_enc)
-      else
-         packet.free(p)
-         counter.add(self.shm.txerrors)
+   while not link.empty(input) do
+      local n = math.min(link.nreadable(input), esp.max_batch)
+      for i = 0, n - 1 do batch[i] = link.receive(input) end
+      self.encrypt:encapsulate_transport6_batch(batch, result, n)
+      for i = 0, n - 1 do
+         if result[i] ~= nil then
+            link.transmit(output, result[i])
+         else
+            packet.free(batch[i])
+            counter.add(self.shm.txerrors)
+         end
       end
    end
    -- Decapsulation path
    local input = self.input.encapsulated
    local output = self.output.decapsulated
-   for _=1,link.nreadable(input) do
-      local p = link.receive(input)
-      local p_dec = self.decrypt:decapsulate_transport6(p)
-      if p_dec then
-         link.transmit(output, p_dec)
-      else
-         packet.free(p)
-         counter.add(self.shm.rxerrors)
+   while not link.empty(input) do
+      local n = math.min(link.nreadable(input), esp.max_batch)
+      for i = 0, n - 1 do batch[i] = link.receive(input) end
+      self.decrypt:decapsulate_transport6_batch(batch, result, n)
+      for i = 0, n - 1 do
+         if result[i] ~= nil then
+            link.transmit(output, result[i])
+         else
+            packet.free(batch[i])
+            counter.add(self.shm.rxerrors)
+         end
       end
    end
 end
@@ -129,51 +147,214 @@ function Tunnel6:new (conf)
       next_header = esp.PROTOCOL,
       hop_limit = 64
    }
+   self.batch = ffi.new("struct packet *[?]", esp.max_batch)
+   self.result = ffi.new("struct packet *[?]", esp.max_batch)
+   self.next_header = ffi.new("uint8_t[?]", esp.max_batch)
    return setmetatable(self, {__index = Tunnel6})
 end
 
 function Tunnel6:push ()
+   local batch, result = self.batch, self.result
    -- Encapsulation path
    local input = self.input.decapsulated
    local output = self.output.encapsulated
    while not link.empty(input) do
-      local p = link.receive(input)
-      if p.length >= ethernet:sizeof() then
-         -- Strip Ethernet header
-         p = packet.shiftleft(p, ethernet:sizeof())
-         -- Encrypt payload
-         local p_enc = self.encrypt:encapsulate_tunnel(p, self.NextHeaderIPv6)
+      local n = 0
+      for _ = 1, math.min(link.nreadable(input), esp.max_batch) do
+         local p = link.receive(input)
+         if p.length >= ethernet:sizeof() then
+            -- Strip Ethernet header
+            batch[n] = packet.shiftleft(p, ethernet:sizeof())
+            n = n + 1
+         else
+            packet.free(p)
+            counter.add(self.shm.txerrors)
+         end
+      end
+      -- Encrypt payloads
+      self.encrypt:encapsulate_tunnel_batch(
+         batch, result, n, self.NextHeaderIPv6
+      )
+      for i = 0, n - 1 do
          -- Slap on IPv6 and Ethernet headers
+         local p_enc = result[i]
          self.ip:payload_length(p_enc.length)
          p_enc = packet.prepend(p_enc, self.ip:header(), ipv6:sizeof())
          p_enc = packet.prepend(p_enc, self.eth:header(), ethernet:sizeof())
          link.transmit(output, p_enc)
-      else
-         packet.free(p)
-         counter.add(self.shm.txerrors)
       end
    end
    -- Decapsulation path
    local input = self.input.encapsulated
    local output = self.output.decapsulated
+   local next_header = self.next_header
    while not link.empty(input) do
-      local p = link.receive(input)
-      if p.length >= ethernet:sizeof() + ipv6:sizeof() then
-         -- Strip Ethernet and IPv6 headers
-         p = packet.shiftleft(p, ethernet:sizeof() + ipv6:sizeof())
-         -- Decrypt payload
-         local p_dec, nh = self.decrypt:decapsulate_tunnel(p)
-         if p_dec and nh == self.NextHeaderIPv6 then
+      local n = 0
+      for _ = 1, math.min(link.nreadable(input), esp.max_batch) do
+         local p = link.receive(input)
+         if p.length >= ethernet:sizeof() + ipv6:sizeof() then
+            -- Strip Ethernet and IPv6 headers
+            batch[n] = packet.shiftleft(p, ethernet:sizeof() + ipv6:sizeof())
+            n = n + 1
+         else
+            packet.free(p)
+            counter.add(self.shm.rxerrors)
+         end
+      end
+      -- Decrypt payloads
+      self.decrypt:decapsulate_tunnel_batch(batch, result, next_header, n)
+      for i = 0, n - 1 do
+         local p_dec = result[i]
+         if p_dec ~= nil and next_header[i] == self.NextHeaderIPv6 then
             -- Slap on new Ethernet header
             p_dec = packet.prepend(p_dec, self.eth:header(), ethernet:sizeof())
             link.transmit(output, p_dec)
-            goto next
+         else
+            -- Handle error
+            packet.free(p_dec ~= nil and p_dec or batch[i])
+            counter.add(self.shm.rxerrors)
+         end
+      end
+   end
+end
+
+-- Transport6 with any number of SAs, see lib.ipsec.sadb. Outbound packets
+-- are encapsulated using the outbound SA of their destination address, and
+-- inbound packets are decapsulated using the inbound SA of their SPI. Both
+-- directions process packets in batches grouped by SA.
+Transport6SADB = {
+   config = {
+      sa = {required=true},
+      aead = {default="aes-gcm-16-icv"},
+      receive_window = {},
+      resync_threshold = {},
+      resync_attempts = {},
+      auditing = {}
+   },
+   shm = {
+      txerrors = {counter}, rxerrors = {counter},
+      tx_no_sa = {counter}, rx_unknown_spi = {counter}
+   }
+}
+
+function Transport6SADB:new (conf)
+   local self = setmetatable({}, {__index = Transport6SADB})
+   self:configure(conf)
+   self.batch = ffi.new("struct packet *[?]", esp.max_batch)
+   self.group = ffi.new("struct packet *[?]", esp.max_batch)
+   self.result = ffi.new("struct packet *[?]", esp.max_batch)
+   self.sa_index = ffi.new("uint32_t[?]", esp.max_batch)
+   return self
+end
+
+function Transport6SADB:configure (conf)
+   local sa_conf = {
+      aead = conf.aead,
+      window_size = conf.receive_window,
+      resync_threshold = conf.resync_threshold,
+      resync_attempts = conf.resync_attempts,
+      auditing = conf.auditing
+   }
+   -- SAs that remain configured keep their state (see lib.ipsec.sadb)
+   -- unless the parameters they share change.
+   if not (self.sadb and lib.equal(self.sa_conf, sa_conf)) then
+      self.sadb = sadb.new(sa_conf)
+      self.sa_conf = sa_conf
+   end
+   self.sadb:update(conf.sa)
+end
+
+function Transport6SADB:reconfig (conf)
+   self:configure(conf)
+end
+
+-- Process the N packets in self.batch, grouped by the SA indices in
+-- self.sa_index: PROCESS(context, input, output, n) is called for each
+-- group, and the resulting packets are transmitted on OUTPUT. Failures are
+-- counted in ERRORS.
+function Transport6SADB:process_groups (n, process, output, errors)
+   local batch, group, result = self.batch, self.group, self.result
+   local sa_index = self.sa_index
+   for i = 0, n - 1 do
+      local index = sa_index[i]
+      if index ~= 0 then
+         local m = 0
+         for j = i, n - 1 do
+            if sa_index[j] == index then
+               group[m], m = batch[j], m + 1
+               sa_index[j] = 0
+            end
+         end
+         process(self.sadb:get(index), group, result, m)
+         for j = 0, m - 1 do
+            if result[j] ~= nil then
+               link.transmit(output, result[j])
+            else
+               packet.free(group[j])
+               counter.add(errors)
+            end
+         end
+      end
+   end
+end
+
+local function encapsulate (context, input, output, n)
+   context:encapsulate_transport6_batch(input, output, n)
+end
+
+local function decapsulate (context, input, output, n)
+   context:decapsulate_transport6_batch(input, output, n)
+end
+
+function Transport6SADB:push ()
+   local batch, sa_index, sadb = self.batch, self.sa_index, self.sadb
+   -- Encapsulation path
+   local input = self.input.decapsulated
+   local output = self.output.encapsulated
+   while not link.empty(input) do
+      local n = 0
+      for _ = 1, math.min(link.nreadable(input), esp.max_batch) do
+         local p = link.receive(input)
+         if p.length >= PAYLOAD_OFFSET then
+            local ip = ffi.cast(ipv6_ptr_t, p.data + IPV6_OFFSET)
+            local index = sadb:lookup_outbound(ip.dst_ip)
+            if index then
+               batch[n], sa_index[n], n = p, index, n + 1
+            else
+               packet.free(p)
+               counter.add(self.shm.tx_no_sa)
+            end
+         else
+            packet.free(p)
+            counter.add(self.shm.txerrors)
+         end
+      end
+      self:process_groups(n, encapsulate, output, self.shm.txerrors)
+   end
+   -- Decapsulation path
+   local input = self.input.encapsulated
+   local output = self.output.decapsulated
+   while not link.empty(input) do
+      local n = 0
+      for _ = 1, math.min(link.nreadable(input), esp.max_batch) do
+         local p = link.receive(input)
+         local ip = ffi.cast(ipv6_ptr_t, p.data + IPV6_OFFSET)
+         if p.length >= PAYLOAD_OFFSET + esp_header:sizeof()
+            and ip.next_header == esp.PROTOCOL then
+            local h = ffi.cast(esp_header_ptr_t, p.data + PAYLOAD_OFFSET)
+            local index = sadb:lookup_inbound(lib.ntohl(h.spi))
+            if index then
+               batch[n], sa_index[n], n = p, index, n + 1
+            else
+               packet.free(p)
+               counter.add(self.shm.rx_unknown_spi)
+            end
+         else
+            packet.free(p)
+            counter.add(self.shm.rxerrors)
          end
       end
-      -- Handle error
-      packet.free(p)
-      counter.add(self.shm.rxerrors)
-      ::next::
+      self:process_groups(n, decapsulate, output, self.shm.rxerrors)
    end
 end
 
@@ -203,5 +384,82 @@ function selftest ()
    engine.report_links()
    assert(counter.read(engine.app_table.tunnel.shm.rxerrors) == 0,
           "Decapsulation error!")
+
+   -- Transport6SADB: two gateways with an SA pair per peer exchange
+   -- packets for many peers, while one of them is rekeyed.
+   local npeers = 100
+   local Generator = {}
+   function Generator:new (peers)
+      local packets = {}
+      for _, peer in ipairs(peers) do
+         local p = packet.resize(packet.allocate(), 100)
+         local ip = ffi.cast(ipv6_ptr_t, p.data + IPV6_OFFSET)
+         ip.next_header = 17
+         ip.dst_ip = ipv6:pton(peer)
+         table.insert(packets, p)
+      end
+      return setmetatable({packets=packets}, {__index=Generator})
+   end
+   function Generator:pull ()
+      for _, p in ipairs(self.packets) do
+         link.transmit(self.output.output, packet.clone(p))
+      end
+   end
+   local function peer (i) return ("fc00::%x"):format(i) end
+   local function sa (i, generation, direction)
+      return {direction = direction,
+              spi = generation*0x10000 + i,
+              key = "00112233445566778899AABBCCDDEEFF",
+              salt = ("%08x"):format(generation*0x10000 + i),
+              peer = direction == "outbound" and peer(i) or nil}
+   end
+   -- Gateway A sends to all peers with SAs of generation OUT, and accepts
+   -- SAs of the generations in IN (and vice-versa for gateway B.)
+   local function gateway (out, ...)
+      local sas = {}
+      for i = 1, npeers do
+         table.insert(sas, sa(i, out, "outbound"))
+         for _, generation in ipairs{...} do
+            table.insert(sas, sa(i, generation, "inbound"))
+         end
+      end
+      return {sa=sas}
+   end
+   local peers = {}
+   for i = 1, npeers + 1 do table.insert(peers, peer(i)) end
+   local function configure (a, b)
+      local c = config.new()
+      config.app(c, "gen_a", Generator, peers)
+      config.app(c, "gen_b", Generator, peers)
+      config.app(c, "a", Transport6SADB, a)
+      config.app(c, "b", Transport6SADB, b)
+      config.app(c, "sink", basic_apps.Sink)
+      config.link(c, "gen_a.output -> a.decapsulated")
+      config.link(c, "gen_b.output -> b.decapsulated")
+      config.link(c, "a.encapsulated -> b.encapsulated")
+      config.link(c, "b.encapsulated -> a.encapsulated")
+      config.link(c, "a.decapsulated -> sink.a")
+      config.link(c, "b.decapsulated -> sink.b")
+      engine.configure(c)
+      engine.main{duration=0.1, no_report=true}
+   end
+   configure(gateway(1, 1), gateway(1, 1))
+   -- Make-before-break rekey from generation 1 to 2.
+   configure(gateway(1, 1, 2), gateway(1, 1, 2))
+   configure(gateway(2, 1, 2), gateway(1, 1, 2))
+   configure(gateway(2, 1, 2), gateway(2, 1, 2))
+   configure(gateway(2, 2), gateway(2, 2))
+   engine.report_links()
+   for _, name in ipairs{"a", "b"} do
+      local shm = engine.app_table[name].shm
+      assert(counter.read(shm.rxerrors) == 0, "Decapsulation error!")
+      assert(counter.read(shm.rx_unknown_spi) == 0, "Unknown SPI!")
+      assert(counter.read(shm.txerrors) == 0, "Encapsulation error!")
+      -- Packets for the last peer have no SA.
+      assert(counter.read(shm.tx_no_sa) > 0)
+      local sink = engine.app_table.sink.input[name]
+      assert(counter.read(sink.stats.txpackets)
+                >= counter.read(shm.tx_no_sa) * npeers)
+   end
    print("OK")
 end
@@ -10,7 +10,7 @@ local lib        = require("core.lib")
 local packet     = require("core.packet")
 local counter    = require("core.counter")
 local link       = require("core.link")
-local ipsum      = require("lib.checksum").ipsum
+local checksum   = require("lib.checksum")
 local alarms     = require('lib.yang.alarms')
 local S          = require('syscall')
 
@@ -43,6 +43,10 @@ struct {
 } __attribute__((packed))
 ]]
 local ether_header_len = ffi.sizeof(ether_header_t)
+local ipv4_total_length_offset = ffi.offsetof(ipv4_header_t, 'total_length')
+local ipv4_id_offset = ffi.offsetof(ipv4_header_t, 'id')
+local ipv4_flags_offset = ffi.offsetof(ipv4_header_t, 'flags_and_fragment_offset')
+local ipv4_checksum_offset = ffi.offsetof(ipv4_header_t, 'checksum')
 local ether_type_ipv4 = 0x0800
 local ipv4_fragment_offset_bits = 13
 local ipv4_fragment_offset_mask = bit_mask(ipv4_fragment_offset_bits)
@@ -104,6 +108,10 @@ function Fragmenter:new(conf)
    o.outgoing_ipv4_fragments_alarm = CounterAlarm.new(outgoing_fragments_alarm,
       1, 1e4, o, "out-ipv4-frag")
 
+   -- Fragments copied out of the packet being fragmented, waiting to be
+   -- transmitted after the first fragment.
+   o.fragments = ffi.new("struct packet *[?]", packet.max_payload / 8)
+
    return setmetatable(o, {__index=Fragmenter})
 end
 
@@ -121,8 +129,25 @@ end
 function Fragmenter:unfragmentable_packet(p)
    -- Unfragmentable packet that doesn't fit in the MTU; drop it.
    -- TODO: Send an error packet.
+   packet.free(p)
+end
+
+-- The fragment header is a copy of the original one, so its checksum
+-- is updated incrementally (RFC 1624) as the fields change.
+local function write_fragment_header(p, id, offset, flags)
+   local ip = p.data + ether_header_len
+   local csum = ip + ipv4_checksum_offset
+   checksum.update_field16(csum, ip + ipv4_id_offset, id)
+   checksum.update_field16(csum, ip + ipv4_total_length_offset,
+                           p.length - ether_header_len)
+   checksum.update_field16(csum, ip + ipv4_flags_offset,
+      bit.bor(offset / 8, bit.lshift(flags, ipv4_fragment_offset_bits)))
 end
 
+-- Only the fragments after the first one are copied out of IN_PKT into
+-- fresh packets.  IN_PKT itself then becomes the first fragment: it is
+-- truncated and its header is rewritten in place, so that its payload
+-- is never copied.
 function Fragmenter:fragment_and_transmit(in_h, in_pkt)
    local in_flags = bit.rshift(ntohs(in_h.ipv4.flags_and_fragment_offset),
                                ipv4_fragment_offset_bits)
@@ -133,31 +158,35 @@ function Fragmenter:fragment_and_transmit(in_h, in_pkt)
    local mtu_with_l2 = self.mtu + ether_header_len
    local header_size = ether_header_len + ipv4_header_length(in_h.ipv4)
    local total_payload_size = in_pkt.length - header_size
-   local offset, id = 0, self:fresh_fragment_id()
-
-   while offset < total_payload_size do
+   -- Payload size of all fragments but the last, rounded down to the
+   -- nearest multiple of 8.  The packet does not fit the MTU, so there
+   -- are always at least two fragments.
+   local payload_size = bit.band(mtu_with_l2 - header_size, 0xFFF8)
+   local more_flags = bit.bor(in_flags, ipv4_flag_more_fragments)
+   local last_flags = bit.band(in_flags, bit.bnot(ipv4_flag_more_fragments))
+   local id = self:fresh_fragment_id()
+   local fragments, nfragments = self.fragments, 0
+
+   for offset = payload_size, total_payload_size - 1, payload_size do
       local out_pkt = packet.allocate()
-      packet.append(out_pkt, in_pkt.data, header_size)
-      local out_h = ffi.cast(ether_ipv4_header_ptr_t, out_pkt.data)
-      local payload_size, flags = mtu_with_l2 - header_size, in_flags
-      if offset + payload_size < total_payload_size then
-         -- Round down payload size to nearest multiple of 8.
-         payload_size = bit.band(payload_size, 0xFFF8)
-         flags = bit.bor(flags, ipv4_flag_more_fragments)
-      else
-         payload_size = total_payload_size - offset
-         flags = bit.band(flags, bit.bnot(ipv4_flag_more_fragments))
+      local size, flags = payload_size, more_flags
+      if offset + size >= total_payload_size then
+         size, flags = total_payload_size - offset, last_flags
       end
-      packet.append(out_pkt, in_pkt.data + header_size + offset, payload_size)
-      out_h.ipv4.id = htons(id)
-      out_h.ipv4.total_length = htons(out_pkt.length - ether_header_len)
-      out_h.ipv4.flags_and_fragment_offset = htons(
-         bit.bor(offset / 8, bit.lshift(flags, ipv4_fragment_offset_bits)))
-      out_h.ipv4.checksum = 0
-      out_h.ipv4.checksum = htons(ipsum(out_pkt.data + ether_header_len,
-                                        ipv4_header_length(out_h.ipv4), 0))
-      self:transmit_fragment(out_pkt)
-      offset = offset + payload_size
+      ffi.copy(out_pkt.data, in_pkt.data, header_size)
+      ffi.copy(out_pkt.data + header_size,
+               in_pkt.data + header_size + offset, size)
+      out_pkt.length = header_size + size
+      write_fragment_header(out_pkt, id, offset, flags)
+      fragments[nfragments] = out_pkt
+      nfragments = nfragments + 1
+   end
+
+   in_pkt.length = header_size + payload_size
+   write_fragment_header(in_pkt, id, 0, more_flags)
+   self:transmit_fragment(in_pkt)
+   for i = 0, nfragments - 1 do
+      self:transmit_fragment(fragments[i])
    end
 end
 
@@ -184,7 +213,6 @@ function Fragmenter:push ()
       else
          -- Packet doesn't fit into MTU; need to fragment.
          self:fragment_and_transmit(h, pkt)
-         packet.free(pkt)
       end
    end
 end
@@ -254,6 +282,8 @@ function selftest()
             local ipv4 = ipv4:new_from_mem(p.data + ether_header_len,
                                            p.length - ether_header_len)
             assert(p.length == ether_header_len + ipv4:total_length())
+            assert(checksum.ipsum(p.data + ether_header_len,
+                                  ipv4:sizeof(), 0) == 0)
             payload_size = payload_size +
                (p.length - ipv4:sizeof() - ether_header_len)
             packet.free(p)
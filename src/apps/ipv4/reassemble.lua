@@ -7,9 +7,11 @@
 -- RFC 5722, which although it is given specifically for IPv6, it
 -- applies just as well to IPv4.
 --
--- Reassembly failures are currently silent.  We could implement
--- timeouts and then we could issue "timeout exceeded" ICMP errors if
--- needed.
+-- Reassembly failures are currently silent.  We could issue "timeout
+-- exceeded" ICMP errors when reassemblies expire, if needed.
+--
+-- The reassembly state is kept by lib.reassembly, which bounds memory
+-- use and does a constant amount of work per fragment.
 
 module(..., package.seeall)
 
@@ -19,9 +21,8 @@ local lib        = require("core.lib")
 local packet     = require("core.packet")
 local counter    = require("core.counter")
 local link       = require("core.link")
-local ipsum      = require("lib.checksum").ipsum
-local ctable     = require('lib.ctable')
-local ctablew    = require('apps.lwaftr.ctable_wrapper')
+local checksum   = require("lib.checksum")
+local reassembly = require('lib.reassembly')
 local alarms     = require('lib.yang.alarms')
 local S          = require('syscall')
 
@@ -53,6 +54,10 @@ struct {
 } __attribute__((packed))
 ]]
 local ether_header_len = ffi.sizeof(ether_header_t)
+local ipv4_total_length_offset = ffi.offsetof(ipv4_header_t, 'total_length')
+local ipv4_id_offset = ffi.offsetof(ipv4_header_t, 'id')
+local ipv4_flags_offset = ffi.offsetof(ipv4_header_t, 'flags_and_fragment_offset')
+local ipv4_checksum_offset = ffi.offsetof(ipv4_header_t, 'checksum')
 local ether_type_ipv4 = 0x0800
 local ipv4_fragment_offset_bits = 13
 local ipv4_fragment_offset_mask = bit_mask(ipv4_fragment_offset_bits)
@@ -78,41 +83,21 @@ local function ipv4_packet_has_valid_length(h, len)
    return ntohs(h.ipv4.total_length) <= len - ether_header_len
 end
 
--- IPv4 requires recalculating an embedded checksum.
-local function fix_ipv4_checksum(h)
-   local ihl = bit.band(h.version_and_ihl, ipv4_ihl_mask)
-   h.checksum = 0
-   h.checksum = htons(ipsum(ffi.cast('char*', h), ihl * 4, 0))
-end
-
-local function swap(array, i, j)
-   local tmp = array[j]
-   array[j] = array[i]
-   array[i] = tmp
-end
-
--- This is an insertion sort, and only called on 2+ element arrays
-local function sort_array(array, last_index)
-   for i=0,last_index do
-      local j = i
-      while j > 0 and array[j-1] > array[j] do
-         swap(array, j, j-1)
-         j = j - 1
-      end
-   end
+-- IPv4 requires updating an embedded checksum.  The reassembled header
+-- is that of the first fragment, which differs only in the fields set
+-- here, so the checksum is updated incrementally (RFC 1624).
+local function set_ipv4_header_field(h, field, value)
+   checksum.update_field16(ffi.cast('uint8_t*', h) + ipv4_checksum_offset,
+                           ffi.cast('uint8_t*', h) + field, value)
 end
 
-local function verify_valid_offsets(reassembly)
-   if reassembly.fragment_starts[0] ~= 0 then
-      return false
-   end
-   for i=1,reassembly.fragment_count-1 do
-      if reassembly.fragment_starts[i] ~= reassembly.fragment_ends[i-1] then
-         return false
-      end
-   end
-   return true
-end
+local fragment_key_t = ffi.typeof[[
+   struct {
+      uint8_t src_addr[4];
+      uint8_t dst_addr[4];
+      uint32_t fragment_id;
+   } __attribute__((packed))
+]]
 
 Reassembler = {}
 Reassembler.shm = {
@@ -121,46 +106,35 @@ Reassembler.shm = {
    ["in-ipv4-frag-reassembly-unneeded"]   = {counter},
    ["drop-ipv4-frag-invalid-reassembly"]  = {counter},
    ["drop-ipv4-frag-random-evicted"]      = {counter},
+   ["drop-ipv4-frag-quota-exceeded"]      = {counter},
+   ["drop-ipv4-frag-timeout"]             = {counter},
    ["memuse-ipv4-frag-reassembly-buffer"] = {counter}
 }
 local reassembler_config_params = {
    -- Maximum number of in-progress reassemblies.  Each one uses about
-   -- 11 kB of memory.
+   -- 10 kB of memory.
    max_concurrent_reassemblies = { default=20000 },
    -- Maximum number of fragments to reassemble.
    max_fragments_per_reassembly = { default=40 },
+   -- Maximum number of in-progress reassemblies per source address.
+   -- Defaults to a quarter of max_concurrent_reassemblies.
+   max_reassemblies_per_source = { default=false },
+   -- Maximum number of seconds to keep a partially reassembled packet
+   reassembly_timeout = { default = 60 },
 }
 
 
 function Reassembler:new(conf)
    local o = lib.parse(conf, reassembler_config_params)
 
-   local max_occupy = 0.9
-   local params = {
-      key_type = ffi.typeof[[
-         struct {
-            uint8_t src_addr[4];
-            uint8_t dst_addr[4];
-            uint32_t fragment_id;
-         } __attribute__((packed))]],
-      value_type = ffi.typeof([[
-         struct {
-            uint16_t fragment_starts[$];
-            uint16_t fragment_ends[$];
-            uint16_t fragment_count;
-            uint16_t final_start;
-            uint16_t reassembly_base;
-            uint32_t running_length; // bytes copied so far
-            struct packet packet;
-         } __attribute((packed))]],
-         o.max_fragments_per_reassembly,
-         o.max_fragments_per_reassembly),
-      initial_size = math.ceil(o.max_concurrent_reassemblies / max_occupy),
-      max_occupancy_rate = max_occupy,
+   o.reassembly = reassembly.new{
+      key_type = fragment_key_t,
+      max_reassemblies = o.max_concurrent_reassemblies,
+      max_fragments = o.max_fragments_per_reassembly,
+      max_per_source = o.max_reassemblies_per_source or nil,
+      timeout = o.reassembly_timeout
    }
-   o.ctab = ctablew.new(params)
-   o.scratch_fragment_key = params.key_type()
-   o.scratch_reassembly = params.value_type()
+   o.scratch_fragment_key = fragment_key_t()
    o.next_counter_update = -1
 
    alarms.add_to_inventory(
@@ -179,48 +153,33 @@ end
 
 function Reassembler:update_counters()
    counter.set(self.shm["memuse-ipv4-frag-reassembly-buffer"],
-               self.ctab:get_backing_size())
+               self.reassembly:memuse())
 end
 
 function Reassembler:record_eviction()
    counter.add(self.shm["drop-ipv4-frag-random-evicted"])
 end
 
-function Reassembler:reassembly_success(entry, pkt)
-   self.ctab:remove_ptr(entry)
+function Reassembler:reassembly_success(pkt)
    counter.add(self.shm["in-ipv4-frag-reassembled"])
    link.transmit(self.output.output, pkt)
 end
 
-function Reassembler:reassembly_error(entry, icmp_error)
-   self.ctab:remove_ptr(entry)
+function Reassembler:reassembly_error(icmp_error)
    counter.add(self.shm["drop-ipv4-frag-invalid-reassembly"])
    if icmp_error then -- This is an ICMP packet
       link.transmit(self.output.errors, icmp_error)
    end
 end
 
-function Reassembler:lookup_reassembly(h, pkt)
+function Reassembler:lookup_reassembly(h)
    local key = self.scratch_fragment_key
    key.src_addr, key.dst_addr = h.ipv4.src_ip, h.ipv4.dst_ip
    key.fragment_id = ntohs(h.ipv4.id)
-
-   local entry = self.ctab:lookup_ptr(key)
-   if entry then return entry end
-
-   local reassembly = self.scratch_reassembly
-   local ihl = bit.band(h.ipv4.version_and_ihl, ipv4_ihl_mask)
-   local headers_len = ether_header_len + ihl * 4
-
-   ffi.fill(reassembly, ffi.sizeof(reassembly))
-   reassembly.reassembly_base = headers_len
-   reassembly.running_length = headers_len
-   packet.append(reassembly.packet, pkt.data, headers_len)
-
-   local did_evict = false
-   entry, did_evict = self.ctab:add(key, reassembly, false)
-   if did_evict then self:record_eviction() end
-   return entry
+   local slot, evicted = self.reassembly:lookup(
+      key, ffi.cast("uint32_t *", h.ipv4.src_ip)[0], engine.now())
+   if evicted then self:record_eviction() end
+   return slot
 end
 
 function Reassembler:handle_fragment(h, fragment)
@@ -234,62 +193,26 @@ function Reassembler:handle_fragment(h, fragment)
    -- Fragment offset is expressed in 8-octet units.
    local frag_start = fragment_offset * 8
    local frag_size = ntohs(h.ipv4.total_length) - ihl * 4
+   local last = bit.band(flags, ipv4_flag_more_fragments) == 0
 
-   local entry = self:lookup_reassembly(h, fragment)
-   local reassembly = entry.value
-
-   local fcount = reassembly.fragment_count
-   if fcount + 1 > self.max_fragments_per_reassembly then
-      -- Too many fragments to reassembly this packet; fail.
-      return self:reassembly_error(entry)
-   end
-   reassembly.fragment_starts[fcount] = frag_start
-   reassembly.fragment_ends[fcount] = frag_start + frag_size
-   if reassembly.fragment_starts[fcount] <
-      reassembly.fragment_starts[fcount - 1] then
-      sort_array(reassembly.fragment_starts, fcount)
-      sort_array(reassembly.fragment_ends, fcount)
-   end
-   reassembly.fragment_count = fcount + 1
-   if bit.band(flags, ipv4_flag_more_fragments) == 0 then
-      if reassembly.final_start ~= 0 then
-         -- There cannot be more than one final fragment.
-         return self:reassembly_error(entry)
-      else
-         reassembly.final_start = frag_start
-      end
-   end
-
-   local skip_headers = reassembly.reassembly_base
-   local dst_offset = skip_headers + frag_start
-   if dst_offset + frag_size > ffi.sizeof(reassembly.packet.data) then
-      -- Prevent a buffer overflow.  The relevant RFC allows hosts to
-      -- silently discard reassemblies above a certain rather small
-      -- size, smaller than this.
-      return self:reassembly_error(entry)
-   end
-   ffi.copy(reassembly.packet.data + dst_offset, fragment.data + skip_headers,
-            frag_size)
-   local max_data_offset = skip_headers + frag_start + frag_size
-   reassembly.packet.length = math.max(reassembly.packet.length,
-                                       max_data_offset)
-   reassembly.running_length = reassembly.running_length + frag_size
-
-   if reassembly.final_start == 0 then
-      -- Still reassembling.
+   local slot = self:lookup_reassembly(h)
+   if not slot then
+      -- Too many reassemblies in progress for this source.
+      counter.add(self.shm["drop-ipv4-frag-quota-exceeded"])
       return
-   elseif reassembly.running_length ~= reassembly.packet.length then
-      -- Still reassembling.
-      return
-   elseif not verify_valid_offsets(reassembly) then
-      return self:reassembly_error(entry)
-   else
-      local out = packet.clone(reassembly.packet)
+   end
+   local status, out = self.reassembly:add(
+      slot, fragment.data, headers_len, fragment.data + headers_len,
+      frag_start, frag_size, last)
+   if status == reassembly.INVALID then
+      return self:reassembly_error()
+   elseif status == reassembly.COMPLETE then
       local header = ffi.cast(ether_ipv4_header_ptr_t, out.data)
-      header.ipv4.id, header.ipv4.flags_and_fragment_offset = 0, 0
-      header.ipv4.total_length = htons(out.length - ether_header_len)
-      fix_ipv4_checksum(header.ipv4)
-      return self:reassembly_success(entry, out)
+      set_ipv4_header_field(header.ipv4, ipv4_id_offset, 0)
+      set_ipv4_header_field(header.ipv4, ipv4_flags_offset, 0)
+      set_ipv4_header_field(header.ipv4, ipv4_total_length_offset,
+                            out.length - ether_header_len)
+      return self:reassembly_success(out)
    end
 end
 
@@ -325,6 +248,11 @@ end
 function Reassembler:tick ()
    self.incoming_ipv4_fragments_alarm:check()
 
+   local expired = self.reassembly:expire(engine.now())
+   if expired > 0 then
+      counter.add(self.shm["drop-ipv4-frag-timeout"], expired)
+   end
+
    if self.next_counter_update < engine.now() then
       -- Update counters every second, but add a bit of jitter to smooth
       -- things out.
@@ -498,7 +426,8 @@ function selftest()
    assert(link.empty(reassembler.output.output))
    assert(counter.read(reassembler.shm["drop-ipv4-frag-invalid-reassembly"]) == 5)
    shm.delete_frame(reassembler.shm)
-   -- invalid offsets
+   -- overlapping fragments, and a non-final fragment whose size is
+   -- not a multiple of 8
    local pkt = make_test_packet(1500)
    local fragments = fragment(pkt, 768)
    local reassembler = Reassembler:new {
@@ -509,27 +438,53 @@ function selftest()
       "apps/reassembler", reassembler.shm)
    reassembler.input = { input = link.new('reassembly input') }
    reassembler.output = { output = link.new('reassembly output') }
+   local function with_offset_and_length (p, offset, length)
+      p = packet.clone(p)
+      local h = ffi.cast(ether_ipv4_header_ptr_t, p.data)
+      local flags = bit.band(ntohs(h.ipv4.flags_and_fragment_offset),
+                             bit.bnot(ipv4_fragment_offset_mask))
+      h.ipv4.flags_and_fragment_offset = htons(bit.bor(flags, offset / 8))
+      h.ipv4.total_length = htons(ntohs(h.ipv4.total_length) + length)
+      p.length = p.length + length
+      return p
+   end
    link.transmit(reassembler.input.input, packet.clone(fragments[1]))
-   link.transmit(reassembler.input.input, packet.clone(fragments[2]))
-   reassembler:push()
-   local final = fragments[3]
-   local h = ffi.cast(ether_ipv4_header_ptr_t, final.data)
-   local reassembly = reassembler:lookup_reassembly(h, final).value
-   reassembly.fragment_starts[0] = 1
-   link.transmit(reassembler.input.input, packet.clone(final))
-   reassembler:push()
-   link.transmit(reassembler.input.input, packet.clone(fragments[1]))
-   link.transmit(reassembler.input.input, packet.clone(fragments[2]))
+   link.transmit(reassembler.input.input,
+                 with_offset_and_length(fragments[2], 8, 0))
    reassembler:push()
-   local final = fragments[3]
-   local h = ffi.cast(ether_ipv4_header_ptr_t, final.data)
-   local reassembly = reassembler:lookup_reassembly(h, final).value
-   reassembly.fragment_starts[0] = 0
-   reassembly.fragment_ends[0] = 10
-   link.transmit(reassembler.input.input, packet.clone(final))
+   link.transmit(reassembler.input.input,
+                 with_offset_and_length(fragments[1], 0, -4))
    reassembler:push()
    assert(link.empty(reassembler.output.output))
    assert(counter.read(reassembler.shm["drop-ipv4-frag-invalid-reassembly"]) == 2)
+   -- the reassembly state is released
+   assert(reassembler.reassembly.nfree == 100)
+   shm.delete_frame(reassembler.shm)
+
+   -- incomplete reassemblies expire, and a single source cannot use up
+   -- all reassembly slots
+   local reassembler = Reassembler:new {
+         max_concurrent_reassemblies = 100,
+         max_reassemblies_per_source = 10,
+         reassembly_timeout = 1
+   }
+   reassembler.shm = shm.create_frame(
+      "apps/reassembler", reassembler.shm)
+   reassembler.input = { input = link.new('reassembly input') }
+   reassembler.output = { output = link.new('reassembly output') }
+   for id = 1, 20 do
+      local p = packet.clone(fragments[1])
+      local h = ffi.cast(ether_ipv4_header_ptr_t, p.data)
+      h.ipv4.id = htons(id)
+      link.transmit(reassembler.input.input, p)
+   end
+   reassembler:push()
+   assert(counter.read(reassembler.shm["drop-ipv4-frag-quota-exceeded"]) == 10)
+   assert(reassembler.reassembly.nfree == 90)
+   local now = engine.now()
+   assert(reassembler.reassembly:expire(now + 0.5) == 0)
+   assert(reassembler.reassembly:expire(now + 2) == 10)
+   assert(reassembler.reassembly.nfree == 100)
    shm.delete_frame(reassembler.shm)
    print("selftest: ok")
 end
@@ -19,6 +19,8 @@ local ptb        = require('lib.protocol.icmp.ptb')
 local tsc        = require('lib.tsc')
 local S          = require('syscall')
 
+local C = ffi.C
+
 local CounterAlarm = alarms.CounterAlarm
 local receive, transmit = link.receive, link.transmit
 local ntohs, htons = lib.ntohs, lib.htons
@@ -169,6 +171,10 @@ function Fragmenter:new(conf)
    o.outgoing_ipv6_fragments_alarm = CounterAlarm.new(outgoing_fragments_alarm,
       1, 1e4, o, "out-ipv6-frag")
 
+   -- Fragments copied out of the packet being fragmented, waiting to be
+   -- transmitted after the first fragment.
+   o.fragments = ffi.new("struct packet *[?]", packet.max_payload / 8)
+
    return setmetatable(o, {__index=Fragmenter})
 end
 
@@ -188,42 +194,59 @@ function Fragmenter:unfragmentable_packet(p)
    -- TODO: Send an error packet.
 end
 
+local function write_fragment_header(p, next_header, id, offset, flags)
+   local h = ffi.cast(ether_ipv6_header_ptr_t, p.data)
+   local fragment_h = ffi.cast(fragment_header_ptr_t, h.ipv6.payload)
+   h.ipv6.next_header = fragment_proto
+   h.ipv6.payload_length = htons(p.length - ether_ipv6_header_len)
+   fragment_h.next_header = next_header
+   fragment_h.reserved = 0
+   fragment_h.id = htonl(id)
+   fragment_h.fragment_offset_and_flags = htons(bit.bor(offset, flags))
+end
+
+-- Only the fragments after the first one are copied out of the input
+-- packet into fresh packets.  The input packet itself then becomes the
+-- first fragment: its headers are moved to make room for the fragment
+-- header and it is truncated, so that its payload is never copied.
 function Fragmenter:fragment_and_transmit(in_next_header, in_pkt_box, mtu)
    local mtu_with_l2 = mtu + ether_header_len
+   local header_size = ether_ipv6_header_len + fragment_header_len
    local total_payload_size = in_pkt_box[0].length - ether_ipv6_header_len
-   local offset, id = 0, self:fresh_fragment_id()
+   -- Payload size of all fragments but the last, rounded down to the
+   -- nearest multiple of 8.  The packet does not fit the MTU, so there
+   -- are always at least two fragments.
+   local payload_size = bit.band(mtu_with_l2 - header_size, 0xFFF8)
+   local id = self:fresh_fragment_id()
+   local fragments, nfragments = self.fragments, 0
 
    -- Use explicit boxing to avoid garbage when passing the header and
    -- packet pointers in case this loop gets compiled first.
-   while offset < total_payload_size do
+   for offset = payload_size, total_payload_size - 1, payload_size do
       local in_pkt = in_pkt_box[0]
       local out_pkt = packet.allocate()
-      packet.append(out_pkt, ffi.cast("uint8_t *", in_pkt.data),
-                    ether_ipv6_header_len)
-      local out_h = ffi.cast(ether_ipv6_header_ptr_t, out_pkt.data)
-      local fragment_h = ffi.cast(fragment_header_ptr_t, out_h.ipv6.payload)
-      out_pkt.length = out_pkt.length + fragment_header_len
-      local payload_size, flags = mtu_with_l2 - out_pkt.length, 0
-      if offset + payload_size < total_payload_size then
-         -- Round down payload size to nearest multiple of 8.
-         payload_size = bit.band(payload_size, 0xFFF8)
-         flags = bit.bor(flags, fragment_flag_more_fragments)
-      else
-         payload_size = total_payload_size - offset
+      local size, flags = payload_size, fragment_flag_more_fragments
+      if offset + size >= total_payload_size then
+         size, flags = total_payload_size - offset, 0
       end
-      packet.append(out_pkt, ffi.cast("uint8_t *", in_pkt.data +
-                                         ether_ipv6_header_len + offset),
-                    payload_size)
-
-      out_h.ipv6.next_header = fragment_proto
-      out_h.ipv6.payload_length = htons(out_pkt.length - ether_ipv6_header_len)
-      fragment_h.next_header = in_next_header
-      fragment_h.reserved = 0
-      fragment_h.id = htonl(id)
-      fragment_h.fragment_offset_and_flags = htons(bit.bor(offset, flags))
-
-      self:transmit_fragment(out_pkt)
-      offset = offset + payload_size
+      ffi.copy(out_pkt.data, in_pkt.data, ether_ipv6_header_len)
+      ffi.copy(out_pkt.data + header_size,
+               in_pkt.data + ether_ipv6_header_len + offset, size)
+      out_pkt.length = header_size + size
+      write_fragment_header(out_pkt, in_next_header, id, offset, flags)
+      fragments[nfragments] = out_pkt
+      nfragments = nfragments + 1
+   end
+
+   local in_pkt = packet.shiftright(in_pkt_box[0], fragment_header_len)
+   C.memmove(in_pkt.data, in_pkt.data + fragment_header_len,
+             ether_ipv6_header_len)
+   in_pkt.length = header_size + payload_size
+   write_fragment_header(in_pkt, in_next_header, id, 0,
+                         fragment_flag_more_fragments)
+   self:transmit_fragment(in_pkt)
+   for i = 0, nfragments - 1 do
+      self:transmit_fragment(fragments[i])
    end
 end
 
@@ -333,7 +356,6 @@ function Fragmenter:push ()
          ffi.cast(ether_ipv6_header_ptr_t, pkt.data).ipv6.next_header
       pkt_box[0] = pkt
       self:fragment_and_transmit(next_header, pkt_box, mtu)
-      packet.free(pkt_box[0])
    end
 
    if self.pmtud then
@@ -6,12 +6,15 @@
 -- it sees overlapping fragments, following the recommendation of
 -- RFC 5722.
 --
--- Reassembly failures are currently silent.  We could implement
--- timeouts and then we could issue "timeout exceeded" ICMP errors if 60
--- seconds go by without success; we'd need to have received the first
--- fragment though.  Additionally we should emit "parameter problem"
--- code 0 ICMP errors for non-terminal fragments whose sizes aren't a
--- multiple of 8 bytes, or for reassembled packets that are too big.
+-- Reassembly failures are currently silent.  We could issue "timeout
+-- exceeded" ICMP errors when reassemblies expire; we'd need to have
+-- received the first fragment though.  Additionally we should emit
+-- "parameter problem" code 0 ICMP errors for non-terminal fragments
+-- whose sizes aren't a multiple of 8 bytes, or for reassembled packets
+-- that are too big.
+--
+-- The reassembly state is kept by lib.reassembly, which bounds memory
+-- use and does a constant amount of work per fragment.
 
 module(..., package.seeall)
 
@@ -22,10 +25,7 @@ local packet     = require("core.packet")
 local counter    = require("core.counter")
 local link       = require("core.link")
 local ipsum      = require("lib.checksum").ipsum
-local ctable     = require('lib.ctable')
-local ctablew    = require('apps.lwaftr.ctable_wrapper')
-local token_bucket = require('lib.token_bucket')
-local tsc        = require('lib.tsc')
+local reassembly = require('lib.reassembly')
 local alarms     = require('lib.yang.alarms')
 local S          = require('syscall')
 
@@ -93,34 +93,13 @@ local function ipv6_packet_has_valid_length(h, len)
    return payload_length <= len - ether_ipv6_header_len
 end
 
-local function swap(array, i, j)
-   local tmp = array[j]
-   array[j] = array[i]
-   array[i] = tmp
-end
-
--- This is an insertion sort, and only called on 2+ element arrays
-local function sort_array(array, last_index)
-   for i=0,last_index do
-      local j = i
-      while j > 0 and array[j-1] > array[j] do
-         swap(array, j, j-1)
-         j = j - 1
-      end
-   end
-end
-
-local function verify_valid_offsets(reassembly)
-   if reassembly.fragment_starts[0] ~= 0 then
-      return false
-   end
-   for i=1,reassembly.fragment_count-1 do
-      if reassembly.fragment_starts[i] ~= reassembly.fragment_ends[i-1] then
-         return false
-      end
-   end
-   return true
-end
+local fragment_key_t = ffi.typeof[[
+   struct {
+      uint8_t src_addr[16];
+      uint8_t dst_addr[16];
+      uint32_t fragment_id;
+   } __attribute__((packed))
+]]
 
 Reassembler = {}
 Reassembler.shm = {
@@ -129,14 +108,19 @@ Reassembler.shm = {
    ["in-ipv6-frag-reassembly-unneeded"]   = {counter},
    ["drop-ipv6-frag-invalid-reassembly"]  = {counter},
    ["drop-ipv6-frag-random-evicted"]      = {counter},
+   ["drop-ipv6-frag-quota-exceeded"]      = {counter},
+   ["drop-ipv6-frag-timeout"]             = {counter},
    ["memuse-ipv6-frag-reassembly-buffer"] = {counter}
 }
 local reassembler_config_params = {
    -- Maximum number of in-progress reassemblies.  Each one uses about
-   -- 11 kB of memory.
+   -- 10 kB of memory.
    max_concurrent_reassemblies = { default=20000 },
    -- Maximum number of fragments to reassemble.
    max_fragments_per_reassembly = { default=40 },
+   -- Maximum number of in-progress reassemblies per source address.
+   -- Defaults to a quarter of max_concurrent_reassemblies.
+   max_reassemblies_per_source = { default=false },
    -- Maximum number of seconds to keep a partially reassembled packet
    reassembly_timeout = { default = 60 },
 }
@@ -144,45 +128,16 @@ local reassembler_config_params = {
 function Reassembler:new(conf)
    local o = lib.parse(conf, reassembler_config_params)
 
-   local max_occupy = 0.9
-   local params = {
-      key_type = ffi.typeof[[
-         struct {
-            uint8_t src_addr[16];
-            uint8_t dst_addr[16];
-            uint32_t fragment_id;
-         } __attribute__((packed))]],
-      value_type = ffi.typeof([[
-         struct {
-            uint16_t fragment_starts[$];
-            uint16_t fragment_ends[$];
-            uint16_t fragment_count;
-            uint16_t final_start;
-            uint16_t reassembly_base;
-            uint32_t running_length; // bytes copied so far
-            uint64_t tstamp; // creation time in TSC ticks
-            struct packet *packet;
-         } __attribute((packed))]],
-         o.max_fragments_per_reassembly,
-         o.max_fragments_per_reassembly),
-      initial_size = math.ceil(o.max_concurrent_reassemblies / max_occupy),
-      max_occupancy_rate = max_occupy,
+   o.reassembly = reassembly.new{
+      key_type = fragment_key_t,
+      max_reassemblies = o.max_concurrent_reassemblies,
+      max_fragments = o.max_fragments_per_reassembly,
+      max_per_source = o.max_reassemblies_per_source or nil,
+      timeout = o.reassembly_timeout
    }
-   o.ctab = ctablew.new(params)
-   o.scratch_fragment_key = params.key_type()
-   o.scratch_reassembly = params.value_type()
+   o.scratch_fragment_key = fragment_key_t()
    o.next_counter_update = -1
 
-   local scan_time = o.reassembly_timeout / 2
-   local scan_chunks = 100
-   o.scan_tb = token_bucket.new({ rate = math.ceil(o.ctab.size / scan_time),
-                                  burst_size = o.ctab.size / scan_chunks})
-   o.tsc = tsc.new()
-   o.ticks_per_timeout = o.tsc:tps() * o.reassembly_timeout
-   o.scan_cursor = 0
-   o.scan_tstamp = o.tsc:stamp()
-   o.scan_interval = o.tsc:tps() * scan_time / scan_chunks + 0ULL
-
    alarms.add_to_inventory(
       {alarm_type_id='incoming-ipv6-fragments'},
       {resource=tostring(S.getpid()), has_clear=true,
@@ -199,145 +154,65 @@ end
 
 function Reassembler:update_counters()
    counter.set(self.shm["memuse-ipv6-frag-reassembly-buffer"],
-               self.ctab:get_backing_size())
+               self.reassembly:memuse())
 end
 
 function Reassembler:record_eviction()
    counter.add(self.shm["drop-ipv6-frag-random-evicted"])
 end
 
-function Reassembler:reassembly_success(entry)
+function Reassembler:reassembly_success(pkt)
    counter.add(self.shm["in-ipv6-frag-reassembled"])
-   link.transmit(self.output.output, entry.value.packet)
-   self.ctab:remove_ptr(entry)
+   link.transmit(self.output.output, pkt)
 end
 
-function Reassembler:reassembly_error(entry, icmp_error)
-   packet.free(entry.value.packet)
-   self.ctab:remove_ptr(entry)
+function Reassembler:reassembly_error(icmp_error)
    counter.add(self.shm["drop-ipv6-frag-invalid-reassembly"])
    if icmp_error then -- This is an ICMP packet
       link.transmit(self.output.errors, icmp_error)
    end
 end
 
-local function cleanup_evicted_entry (entry)
-   packet.free(entry.value.packet)
-end
-
 function Reassembler:lookup_reassembly(h, fragment)
-   local fragment_id = ntohl(fragment.id)
    local key = self.scratch_fragment_key
    key.src_addr, key.dst_addr, key.fragment_id =
-      h.ipv6.src_ip, h.ipv6.dst_ip, fragment_id
-
-   local entry = self.ctab:lookup_ptr(key)
-   if entry then return entry end
-
-   local reassembly = self.scratch_reassembly
-   ffi.fill(reassembly, ffi.sizeof(reassembly))
-   reassembly.reassembly_base = ether_ipv6_header_len
-   reassembly.running_length = ether_ipv6_header_len
-   reassembly.tstamp = self.tsc:stamp()
-   reassembly.packet = packet.allocate()
-   packet.append(reassembly.packet, ffi.cast("uint8_t *", h),
-                 ether_ipv6_header_len)
-
-   local did_evict = false
-   entry, did_evict = self.ctab:add(key, reassembly, false,
-                                    cleanup_evicted_entry)
-   if did_evict then self:record_eviction() end
-   return entry
+      h.ipv6.src_ip, h.ipv6.dst_ip, ntohl(fragment.id)
+   local src = ffi.cast("uint32_t *", h.ipv6.src_ip)
+   local slot, evicted = self.reassembly:lookup(
+      key, bit.bxor(src[0], src[1], src[2], src[3]), engine.now())
+   if evicted then self:record_eviction() end
+   return slot
 end
 
 function Reassembler:handle_fragment(pkt)
    local h = ffi.cast(ether_ipv6_header_ptr_t, pkt.data)
    local fragment = ffi.cast(fragment_header_ptr_t, h.ipv6.payload)
-   -- Note: keep the number of local variables to a minimum when
-   -- calling lookup_reassembly to avoid "register coalescing too
-   -- complex" trace aborts in ctable.
-   local entry = self:lookup_reassembly(h, fragment)
-   local reassembly = entry.value
+   local slot = self:lookup_reassembly(h, fragment)
+   if not slot then
+      -- Too many reassemblies in progress for this source.
+      counter.add(self.shm["drop-ipv6-frag-quota-exceeded"])
+      return
+   end
    local fragment_offset_and_flags = ntohs(fragment.fragment_offset_and_flags)
    local frag_start = bit.band(fragment_offset_and_flags, fragment_offset_mask)
    local frag_size = ntohs(h.ipv6.payload_length) - fragment_header_len
-
-   local fcount = reassembly.fragment_count
-   if fcount + 1 > self.max_fragments_per_reassembly then
-      -- Too many fragments to reassembly this packet; fail.
-      return self:reassembly_error(entry)
-   end
-   reassembly.fragment_starts[fcount] = frag_start
-   reassembly.fragment_ends[fcount] = frag_start + frag_size
-   if (fcount > 0 and reassembly.fragment_starts[fcount] <
-       reassembly.fragment_starts[fcount - 1]) then
-      sort_array(reassembly.fragment_starts, fcount)
-      sort_array(reassembly.fragment_ends, fcount)
+   local last = bit.band(fragment_offset_and_flags,
+                         fragment_flag_more_fragments) == 0
+   -- Non-final fragments whose size is not a multiple of 8 are
+   -- rejected by lib.reassembly.  Here we should send "ICMP Parameter
+   -- Problem, Code 0 to the source of the fragment, pointing to the
+   -- Payload Length field of the fragment packet".
+   local status, out = self.reassembly:add(
+      slot, pkt.data, ether_ipv6_header_len, fragment.payload,
+      frag_start, frag_size, last)
+   if status == reassembly.INVALID then
+      return self:reassembly_error()
+   elseif status == reassembly.COMPLETE then
+      local header = ffi.cast(ether_ipv6_header_ptr_t, out.data)
+      header.ipv6.payload_length = htons(out.length - ether_ipv6_header_len)
+      header.ipv6.next_header = fragment.next_header
+      return self:reassembly_success(out)
    end
-   reassembly.fragment_count = fcount + 1
-   if bit.band(fragment_offset_and_flags, fragment_flag_more_fragments) == 0 then
-      if reassembly.final_start ~= 0 then
-         -- There cannot be more than one final fragment.
-         return self:reassembly_error(entry)
-      else
-         reassembly.final_start = frag_start
-      end
-   elseif frag_size % 8 ~= 0 then
-      -- The size of all non-terminal fragments must be a multiple of 8.
-      -- Here we should send "ICMP Parameter Problem, Code 0 to the
-      -- source of the fragment, pointing to the Payload Length field of
-      -- the fragment packet".
-      return self:reassembly_error(entry)
-   end
-
-   -- Limit the scope of max_data_offset
-   do
-      local max_data_offset = ether_ipv6_header_len + frag_start + frag_size
-      if max_data_offset > packet.max_payload then
-         -- Snabb packets have a maximum size of 10240 bytes.
-         return self:reassembly_error(entry)
-      end
-      ffi.copy(reassembly.packet.data + reassembly.reassembly_base + frag_start,
-               fragment.payload, frag_size)
-      reassembly.packet.length = math.max(reassembly.packet.length,
-                                          max_data_offset)
-      reassembly.running_length = reassembly.running_length + frag_size
-   end
-
-   if reassembly.final_start == 0 then
-      -- Still reassembling.
-      return
-   elseif reassembly.running_length ~= reassembly.packet.length then
-      -- Still reassembling.
-      return
-   elseif not verify_valid_offsets(reassembly) then
-      return self:reassembly_error(entry)
-   else
-      -- Limit the scope of header
-      do
-         local header = ffi.cast(ether_ipv6_header_ptr_t, reassembly.packet.data)
-         header.ipv6.payload_length = htons(reassembly.packet.length - ether_ipv6_header_len)
-         header.ipv6.next_header = fragment.next_header
-      end
-      return self:reassembly_success(entry)
-   end
-end
-
-function Reassembler:expire (now)
-   local cursor = self.scan_cursor
-   for i = 1, self.scan_tb:take_burst() do
-      local entry
-      cursor, entry = self.ctab:next_entry(cursor, cursor + 1)
-      if entry then
-         if now - entry.value.tstamp > self.ticks_per_timeout then
-            self:reassembly_error(entry)
-         else
-            cursor = cursor + 1
-         end
-      end
-   end
-   self.scan_cursor = cursor
-   self.scan_tstamp = now
 end
 
 function Reassembler:push ()
@@ -376,11 +251,9 @@ end
 function Reassembler:tick ()
    self.incoming_ipv6_fragments_alarm:check()
 
-   do
-      local now = self.tsc:stamp()
-      if now - self.scan_tstamp > self.scan_interval then
-         self:expire(now)
-      end
+   local expired = self.reassembly:expire(engine.now())
+   if expired > 0 then
+      counter.add(self.shm["drop-ipv6-frag-timeout"], expired)
    end
 
    if self.next_counter_update < engine.now() then
@@ -493,5 +366,48 @@ function selftest()
       packet.free(pkt)
    end
 
+   -- overlapping fragments are rejected, incomplete reassemblies
+   -- expire, and a single source cannot use up all reassembly slots
+   local pkt = make_test_packet(3000)
+   local fragments = fragment(pkt, 1280)
+   packet.free(pkt)
+   local reassembler = Reassembler:new {
+      max_concurrent_reassemblies = 100,
+      max_reassemblies_per_source = 10,
+      reassembly_timeout = 1
+   }
+   reassembler.shm = shm.create_frame("apps/reassembler", reassembler.shm)
+   reassembler.input = { input = link.new('reassembly input') }
+   reassembler.output = { output = link.new('reassembly output') }
+   local function with_id_and_offset (p, id, offset)
+      p = packet.clone(p)
+      local h = ffi.cast(ether_ipv6_header_ptr_t, p.data)
+      local f = ffi.cast(fragment_header_ptr_t, h.ipv6.payload)
+      f.id = lib.htonl(id)
+      if offset then
+         local flags = bit.band(ntohs(f.fragment_offset_and_flags), 0x7)
+         f.fragment_offset_and_flags = htons(bit.bor(flags, offset))
+      end
+      return p
+   end
+   link.transmit(reassembler.input.input, with_id_and_offset(fragments[1], 0))
+   link.transmit(reassembler.input.input, with_id_and_offset(fragments[2], 0, 8))
+   reassembler:push()
+   assert(link.empty(reassembler.output.output))
+   assert(counter.read(reassembler.shm["drop-ipv6-frag-invalid-reassembly"]) == 1)
+   for id = 1, 20 do
+      link.transmit(reassembler.input.input, with_id_and_offset(fragments[1], id))
+   end
+   reassembler:push()
+   assert(counter.read(reassembler.shm["drop-ipv6-frag-quota-exceeded"]) == 10)
+   local now = engine.now()
+   assert(reassembler.reassembly:expire(now + 0.5) == 0)
+   assert(reassembler.reassembly:expire(now + 2) == 10)
+   assert(reassembler.reassembly.nfree == 100)
+   for _, p in ipairs(fragments) do packet.free(p) end
+   link.free(reassembler.input.input, 'reassembly input')
+   link.free(reassembler.output.output, 'reassembly output')
+   shm.delete_frame(reassembler.shm)
+
    print("selftest: ok")
 end
@@ -62,6 +62,9 @@ module(..., package.seeall)
 
 local bit = require('bit')
 local ffi = require("ffi")
+local S = require("syscall")
+local shm = require("core.shm")
+local sync = require("core.sync")
 local rangemap = require("apps.lwaftr.rangemap")
 local ctable = require("lib.ctable")
 local ipv6 = require("lib.protocol.ipv6")
@@ -82,6 +85,30 @@ psid_map_key_t = ffi.typeof[[
 psid_map_value_t = ffi.typeof[[
    struct { uint16_t psid_length; uint16_t shift; }
 ]]
+local psid_map_entries_t = rangemap.lookup_batch_type(psid_map_value_t)
+
+-- The PSID info map covers only the addresses that are declared in the
+-- binding table.  Other addresses are recorded as having psid_length ==
+-- shift == 0.
+local function is_managed(psid_info)
+   return psid_info.psid_length + psid_info.shift > 0
+end
+
+-- Return the PSID of PORT on an address with PSID_INFO.
+local function psid_from_info(psid_info, port)
+   local psid_len, shift = psid_info.psid_length, psid_info.shift
+   local psid_mask = lshift(1, psid_len) - 1
+   local psid = band(rshift(port, shift), psid_mask)
+   -- Are there any restricted ports for this address?
+   if psid_len + shift < 16 then
+      local reserved_ports_bit_count = 16 - psid_len - shift
+      local first_allocated_port = lshift(1, reserved_ports_bit_count)
+      -- The port is within the range of restricted ports.  Assign a
+      -- bogus PSID so that lookup will fail.
+      if port < first_allocated_port then psid = psid_mask + 1 end
+   end
+   return psid
+end
 
 BTLookupQueue = {}
 
@@ -95,16 +122,23 @@ function BTLookupQueue.new(binding_table)
    }
    ret.streamer = binding_table.softwires:make_lookup_streamer(BTLookupQueue_size)
    ret.packet_queue = ffi.new("struct packet * [?]", BTLookupQueue_size)
+   ret.addresses = ffi.new("uint32_t[?]", BTLookupQueue_size)
+   ret.psid_info = psid_map_entries_t(BTLookupQueue_size)
    ret.length = 0
    return setmetatable(ret, {__index=BTLookupQueue})
 end
 
+function BTLookupQueue:is_full()
+   return self.length == BTLookupQueue_size
+end
+
 function BTLookupQueue:enqueue_lookup(pkt, ipv4, port)
    assert(self.length < BTLookupQueue_size, "BTLookupQueue overflow")
    local n = self.length
    local streamer = self.streamer
    streamer.entries[n].key.ipv4 = ipv4
    streamer.entries[n].key.psid = port
+   self.addresses[n] = ipv4
    self.packet_queue[n] = pkt
    n = n + 1
    self.length = n
@@ -112,11 +146,12 @@ end
 
 function BTLookupQueue:process_queue()
    if self.length > 0 then
-      local streamer = self.streamer
+      local streamer, psid_info = self.streamer, self.psid_info
+      self.binding_table.psid_map:lookup_batch(
+         self.addresses, self.length, psid_info)
       for n = 0, self.length-1 do
-         local ipv4 = streamer.entries[n].key.ipv4
          local port = streamer.entries[n].key.psid
-         streamer.entries[n].key.psid = self.binding_table:lookup_psid(ipv4, port)
+         streamer.entries[n].key.psid = psid_from_info(psid_info[n].value, port)
       end
       streamer:stream()
    end
@@ -140,6 +175,61 @@ function BTLookupQueue:reset_queue()
    self.length = 0
 end
 
+-- BTManagedQueue batches the question "is this IPv4 address managed by
+-- the binding table?", which decides whether a decapsulated packet or a
+-- locally generated ICMPv4 error has to be hairpinned.  It has the same
+-- width as BTLookupQueue, and each entry carries a small integer tag
+-- that the caller can use to tell different kinds of packets apart.
+BTManagedQueue = {}
+
+function BTManagedQueue.new(binding_table)
+   local ret = {
+      binding_table = assert(binding_table),
+   }
+   ret.packet_queue = ffi.new("struct packet * [?]", BTLookupQueue_size)
+   ret.addresses = ffi.new("uint32_t[?]", BTLookupQueue_size)
+   ret.psid_info = psid_map_entries_t(BTLookupQueue_size)
+   ret.tags = ffi.new("uint8_t[?]", BTLookupQueue_size)
+   ret.managed = ffi.new("uint8_t[?]", BTLookupQueue_size)
+   ret.length = 0
+   return setmetatable(ret, {__index=BTManagedQueue})
+end
+
+function BTManagedQueue:is_full()
+   return self.length == BTLookupQueue_size
+end
+
+function BTManagedQueue:enqueue_lookup(pkt, ipv4, tag)
+   assert(self.length < BTLookupQueue_size, "BTManagedQueue overflow")
+   local n = self.length
+   self.packet_queue[n] = pkt
+   self.addresses[n] = ipv4
+   self.tags[n] = tag or 0
+   self.length = n + 1
+end
+
+function BTManagedQueue:process_queue()
+   local psid_info, managed = self.psid_info, self.managed
+   if self.length > 0 then
+      self.binding_table.psid_map:lookup_batch(
+         self.addresses, self.length, psid_info)
+   end
+   for n = 0, self.length-1 do
+      managed[n] = is_managed(psid_info[n].value) and 1 or 0
+   end
+   return self.length
+end
+
+function BTManagedQueue:get_lookup(n)
+   if n < self.length then
+      return self.packet_queue[n], self.managed[n] == 1, self.tags[n]
+   end
+end
+
+function BTManagedQueue:reset_queue()
+   self.length = 0
+end
+
 local BindingTable = {}
 function BindingTable.new(psid_map, softwires)
    local ret = {
@@ -176,27 +266,11 @@ function BindingTable:lookup(ipv4, port)
 end
 
 function BindingTable:is_managed_ipv4_address(ipv4)
-   -- The PSID info map covers only the addresses that are declared in
-   -- the binding table.  Other addresses are recorded as having
-   -- psid_length == shift == 0.
-   local psid_info = self.psid_map:lookup(ipv4).value
-   return psid_info.psid_length + psid_info.shift > 0
+   return is_managed(self.psid_map:lookup(ipv4).value)
 end
 
 function BindingTable:lookup_psid(ipv4, port)
-   local psid_info = self.psid_map:lookup(ipv4).value
-   local psid_len, shift = psid_info.psid_length, psid_info.shift
-   local psid_mask = lshift(1, psid_len) - 1
-   local psid = band(rshift(port, shift), psid_mask)
-   -- Are there any restricted ports for this address?
-   if psid_len + shift < 16 then
-      local reserved_ports_bit_count = 16 - psid_len - shift
-      local first_allocated_port = lshift(1, reserved_ports_bit_count)
-      -- The port is within the range of restricted ports.  Assign a
-      -- bogus PSID so that lookup will fail.
-      if port < first_allocated_port then psid = psid_mask + 1 end
-   end
-   return psid
+   return psid_from_info(self.psid_map:lookup(ipv4).value, port)
 end
 
 -- Iterate over the set of IPv4 addresses managed by a binding
@@ -248,6 +322,40 @@ function pack_psid_map_entry (softwire)
    return key, value
 end
 
+-- The PSID map is looked up for every packet.  A range map does a
+-- binary search over the ranges of addresses, which is fast enough for
+-- small or scattered sets of addresses.  Dense address pools are
+-- instead compiled to a direct-indexed array, or to a two-level table
+-- of /24 blocks when the pool spans too much address space for a flat
+-- array, so that a lookup costs a single memory access.
+local psid_map_min_direct_count = 64
+local psid_map_min_density = 1/4
+local psid_map_max_direct_span = 2^20
+local psid_map_max_block_span = 2^28
+
+local function build_psid_map (builder)
+   local default = psid_map_value_t()
+   local count, lo, hi, nblocks = builder:stats()
+   local span = hi - lo + 1
+   if count < psid_map_min_direct_count then
+      return builder:build(default)
+   elseif span <= psid_map_max_direct_span
+      and count / span >= psid_map_min_density then
+      return builder:build_direct(default)
+   elseif span <= psid_map_max_block_span
+      and count / (nblocks * 256) >= psid_map_min_density then
+      return builder:build_blocks(default)
+   else
+      return builder:build(default)
+   end
+end
+
+local softwires_params = {
+   key_type = softwire_key_t,
+   value_type = softwire_value_t,
+   max_occupancy_rate = 0.4
+}
+
 function load (conf)
    local psid_builder = rangemap.RangeMapBuilder.new(psid_map_value_t)
 
@@ -269,11 +377,7 @@ function load (conf)
       self.keys[key] = value
    end
 
-   local softwires = ctable.new{
-      key_type = softwire_key_t,
-      value_type = softwire_value_t,
-      max_occupancy_rate = 0.4
-   }
+   local softwires = ctable.new(softwires_params)
 
    local key, value = softwire_key_t(), softwire_value_t()
    for _, entry in ipairs(conf.softwire) do
@@ -293,14 +397,360 @@ function load (conf)
       end
    end
 
-   local psid_map = psid_builder:build(psid_map_value_t(), true)
+   local psid_map = build_psid_map(psid_builder)
 
    return BindingTable.new(psid_map, softwires)
 end
 
+-- Shared binding tables.
+--
+-- When several lwAFTR workers serve the same binding table, they can
+-- share a single copy of it instead of each loading their own.  The
+-- ptree manager publishes the softwires into shared memory, and the
+-- workers map that memory read-only.
+--
+-- The softwire table is kept in up to shared_max_slots slots, each a
+-- ctable view.  Subscribers only ever read the "active" slot, and
+-- count themselves in the readers of the slot they are attached to.
+-- To apply an update, the publisher picks a slot that is neither
+-- active nor read by any subscriber, brings it up to date, applies
+-- the update, and then makes it the active slot and increments the
+-- version number.  If every slot is still being read, it copies the
+-- active slot into a new one instead.  The publisher never waits for
+-- subscribers: they check the version on each breath and move to the
+-- new active slot when it changes, which releases their old slot for a
+-- later update.  To bring a slot up to date, the publisher keeps a log
+-- of the updates that some slot has not seen yet.
+--
+-- Updates that can not be applied in place (the ctable would need to
+-- grow, the set of IPv4 addresses changes, or all slots are in use)
+-- are published as a new "generation" of slots instead.  The PSID map
+-- is small and changes only with a new generation, so each subscriber
+-- builds its own copy.
+--
+-- The shared objects live in the process group:
+--
+--   group/lwaftr/binding-table/control
+--   group/lwaftr/binding-table/<generation>/psid-map
+--   group/lwaftr/binding-table/<generation>/softwires-<slot>
+
+local shared_path = "group/lwaftr/binding-table/"
+local shared_max_slots = 4
+
+local shared_control_t = ffi.typeof([[
+   struct {
+      uint64_t version;     // incremented on every publication
+      uint32_t generation;  // current set of segments
+      uint32_t active;      // slot that subscribers read
+      uint32_t readers[$];  // number of subscribers attached to each slot
+   }
+]], shared_max_slots)
+
+local psid_range_t = ffi.typeof([[
+   struct { uint32_t lo, hi; $ value; }
+]], psid_map_value_t)
+local psid_ranges_t = ffi.typeof([[
+   struct { uint32_t count; $ ranges[?]; }
+]], psid_range_t)
+
+-- How many times a subscriber tries to attach while the publisher
+-- keeps publishing, before it gives up.
+local shared_attach_attempts = 1000
+
+local function atomic_add (ptr, delta)
+   repeat
+      local old = ptr[0]
+   until sync.cas(ptr, old, old + delta)
+end
+
+local function generation_path (generation)
+   return shared_path..generation.."/"
+end
+
+local function slot_path (generation, slot)
+   return generation_path(generation).."softwires-"..slot
+end
+
+-- Map a segment of the given generation, or return nil if it has been
+-- unlinked by a newer publication in the meantime.
+local function open_segment (name, ctype, elt_size, header_size)
+   local stat = S.stat(shm.path(name))
+   if not stat then return nil end
+   local count = (stat.size - (header_size or 0)) / elt_size
+   local ok, ptr = pcall(shm.open, name, ctype, 'read-only', count)
+   if ok then return ptr end
+end
+
+BindingTablePublisher = {}
+
+function BindingTablePublisher.new ()
+   local ret = {
+      generation = 0,
+      published = false,
+      staged = nil,
+      -- Mapped slots, and the version that each of them reflects.
+      slots = {},
+      slot_version = {},
+      -- Updates that some slot has not seen yet: {version, ops}.
+      log = {}
+   }
+   return setmetatable(ret, {__index=BindingTablePublisher})
+end
+
+-- Publish the binding table described by CONF as a new generation.
+function BindingTablePublisher:publish (conf)
+   local bt = load(conf)
+   local generation = self.generation + 1
+   local dir = generation_path(generation)
+
+   local nranges = 0
+   for _ in bt:iterate_psid_map() do nranges = nranges + 1 end
+   local psid_ranges = shm.create(dir.."psid-map", psid_ranges_t, nranges)
+   psid_ranges.count = nranges
+   local i = 0
+   for lo, hi, value in bt:iterate_psid_map() do
+      psid_ranges.ranges[i].lo = lo
+      psid_ranges.ranges[i].hi = hi
+      psid_ranges.ranges[i].value = value
+      i = i + 1
+   end
+   shm.unmap(psid_ranges)
+
+   local size = bt.softwires:get_view_size()
+   local slot = shm.create(slot_path(generation, 0), "uint8_t[?]", size)
+   bt.softwires:save_view(slot)
+
+   if not self.control then
+      self.control = shm.create(shared_path.."control", shared_control_t)
+   end
+   local control = self.control
+   control.generation = generation
+   control.active = 0
+   control.version = control.version + 1
+
+   -- Subscribers still attached to the previous generation keep their
+   -- mappings until they move to this one.
+   for _, old in pairs(self.slots) do shm.unmap(old) end
+   if self.generation > 0 then
+      shm.unlink(generation_path(self.generation))
+   end
+   self.generation, self.size = generation, size
+   self.slots = {[0]=slot}
+   self.slot_version = {[0]=tonumber(control.version)}
+   self.log = {}
+   self.psid_map = bt.psid_map
+   self.published = true
+end
+
+function BindingTablePublisher:is_managed_ipv4_address (ipv4)
+   return is_managed(self.psid_map:lookup(ipv4).value)
+end
+
+local function apply_update (softwires, op)
+   local verb, key, value = unpack(op)
+   if verb == 'add' then
+      softwires:add(key, value, true)
+   else
+      softwires:remove(key, true)
+   end
+end
+
+-- Return a slot that can be modified: one that is not active and that
+-- no subscriber reads, or else a new copy of the active slot.  Returns
+-- nil if all slots are in use.
+function BindingTablePublisher:spare_slot ()
+   local control, nslots = self.control, 0
+   for slot in pairs(self.slots) do
+      if slot ~= control.active and control.readers[slot] == 0 then
+         return slot
+      end
+      nslots = nslots + 1
+   end
+   if nslots == shared_max_slots then return nil end
+   local slot = nslots
+   -- Subscribers of an older generation may still count as readers of
+   -- this slot number, so only take it if it is free.
+   if control.readers[slot] ~= 0 then return nil end
+   local active = control.active
+   self.slots[slot] = shm.create(slot_path(self.generation, slot),
+                                 "uint8_t[?]", self.size)
+   ffi.copy(self.slots[slot], self.slots[active], self.size)
+   self.slot_version[slot] = self.slot_version[active]
+   return slot
+end
+
+-- Apply OPS to a spare slot and make it active.  Returns false if that
+-- is not possible, in which case the caller should publish a new
+-- generation instead.
+function BindingTablePublisher:update (ops)
+   local control = self.control
+   local slot = self:spare_slot()
+   if not slot then return false end
+   local softwires = ctable.load_view(self.slots[slot], softwires_params)
+   local since = self.slot_version[slot]
+   local ok = pcall(function ()
+      for _, entry in ipairs(self.log) do
+         local version, logged = unpack(entry)
+         if version > since then
+            for _, op in ipairs(logged) do apply_update(softwires, op) end
+         end
+      end
+      for _, op in ipairs(ops) do apply_update(softwires, op) end
+   end)
+   if not ok then return false end
+   softwires:sync_view()
+   control.active = slot
+   control.version = control.version + 1
+   local version = tonumber(control.version)
+   self.slot_version[slot] = version
+   table.insert(self.log, {version, ops})
+   -- Forget the updates that every slot has seen.
+   local oldest = version
+   for _, version in pairs(self.slot_version) do
+      oldest = math.min(oldest, version)
+   end
+   while #self.log > 0 and self.log[1][1] <= oldest do
+      table.remove(self.log, 1)
+   end
+   return true
+end
+
+-- The ptree manager records the effect of each configuration update on
+-- the binding table with the stage_* methods, then calls sync() with
+-- the resulting configuration.
+function BindingTablePublisher:begin_update ()
+   self.staged = nil
+end
+
+function BindingTablePublisher:stage_reload ()
+   self.staged = 'reload'
+end
+
+function BindingTablePublisher:stage_add (entries)
+   if self.staged == 'reload' then return end
+   self.staged = self.staged or {}
+   for _, conf in ipairs(entries) do
+      if not (self.published and self:is_managed_ipv4_address(conf.ipv4)) then
+         return self:stage_reload()
+      end
+      local key, value = softwire_key_t(), softwire_value_t()
+      key.ipv4, key.psid = conf.ipv4, conf.psid
+      value.b4_ipv6, value.br_address = conf.b4_ipv6, conf.br_address
+      table.insert(self.staged, {'add', key, value})
+   end
+end
+
+function BindingTablePublisher:stage_remove (key)
+   if self.staged == 'reload' then return end
+   self.staged = self.staged or {}
+   table.insert(self.staged, {'remove', softwire_key_t(key)})
+end
+
+function BindingTablePublisher:sync (conf)
+   local staged = self.staged
+   self.staged = nil
+   if not self.published or staged == 'reload' then
+      self:publish(conf)
+   elseif staged and not self:update(staged) then
+      self:publish(conf)
+   end
+end
+
+-- Forget the current publication, for example because the binding
+-- table stopped being shared.  The next sync() publishes afresh.
+function BindingTablePublisher:invalidate ()
+   self.published = false
+end
+
+local publisher
+function get_publisher ()
+   if not publisher then publisher = BindingTablePublisher.new() end
+   return publisher
+end
+
+BindingTableSubscriber = {}
+
+function BindingTableSubscriber.new ()
+   assert(shm.exists(shared_path.."control"),
+          "shared binding table has not been published")
+   local ret = {
+      control = shm.open(shared_path.."control", shared_control_t),
+      version = nil,
+      generation = nil,
+      slots = {},
+      slot = nil
+   }
+   return setmetatable(ret, {__index=BindingTableSubscriber})
+end
+
+function BindingTableSubscriber:has_changed ()
+   return self.control.version ~= self.version
+end
+
+-- Map the PSID map of GENERATION, unless it is already mapped.
+-- Returns false if it has been unlinked in the meantime.
+function BindingTableSubscriber:open_generation (generation)
+   if self.generation == generation then return true end
+   local psid_ranges = open_segment(
+      generation_path(generation).."psid-map", psid_ranges_t,
+      ffi.sizeof(psid_range_t), ffi.sizeof(psid_ranges_t, 0))
+   if not psid_ranges then return false end
+   local builder = rangemap.RangeMapBuilder.new(psid_map_value_t)
+   for i = 0, psid_ranges.count - 1 do
+      local range = psid_ranges.ranges[i]
+      builder:add_range(range.lo, range.hi, range.value)
+   end
+   shm.unmap(psid_ranges)
+   for _, slot in pairs(self.slots) do shm.unmap(slot) end
+   self.generation, self.slots = generation, {}
+   self.psid_map = build_psid_map(builder)
+   return true
+end
+
+-- Map SLOT of the current generation, unless it is already mapped.
+-- Returns nil if it has been unlinked in the meantime.
+function BindingTableSubscriber:open_slot (slot)
+   if not self.slots[slot] then
+      self.slots[slot] = open_segment(slot_path(self.generation, slot),
+                                      "uint8_t[?]", 1)
+   end
+   return self.slots[slot]
+end
+
+-- Attach to the currently active slot and return it as a binding
+-- table.  Binding tables returned by earlier calls must not be used
+-- anymore.
+function BindingTableSubscriber:attach ()
+   local control = self:detach()
+   for _ = 1, shared_attach_attempts do
+      local version = control.version
+      local generation, slot = control.generation, control.active
+      atomic_add(control.readers + slot, 1)
+      -- Check that the publisher did not activate another slot before
+      -- it could see our reference.
+      if control.version == version and self:open_generation(generation)
+         and self:open_slot(slot) then
+         self.version, self.slot = version, slot
+         local softwires = ctable.load_view(self.slots[slot], softwires_params)
+         return BindingTable.new(self.psid_map, softwires)
+      end
+      atomic_add(control.readers + slot, -1)
+   end
+   error("could not attach to the shared binding table")
+end
+
+function BindingTableSubscriber:detach ()
+   local control = self.control
+   if self.slot then
+      atomic_add(control.readers + self.slot, -1)
+      self.slot = nil
+   end
+   return control
+end
+
 function selftest()
    print('selftest: binding_table')
-   local function load_str(str)
+   local function parse_str(str)
       local mem = require("lib.stream.mem")
       local yang = require('lib.yang.yang')
       local data = require('lib.yang.data')
@@ -309,9 +759,9 @@ function selftest()
       local subgrammar = assert(grammar.members['softwire-config'])
       local subgrammar = assert(subgrammar.members['binding-table'])
       local parse = data.data_parser_from_grammar(subgrammar)
-      return load(parse(mem.open_input_string(str)))
+      return parse(mem.open_input_string(str))
    end
-   local map = load_str([[
+   local conf = parse_str([[
       softwire { ipv4 178.79.150.233; psid 80; b4-ipv6 127:2:3:4:5:6:7:128; br-address 8:9:a:b:c:d:e:f; port-set { psid-length 16; }}
       softwire { ipv4 178.79.150.233; psid 2300; b4-ipv6 127:11:12:13:14:15:16:128; br-address 8:9:a:b:c:d:e:f; port-set { psid-length 16; }}
       softwire { ipv4 178.79.150.233; psid 2700; b4-ipv6 127:11:12:13:14:15:16:128; br-address 8:9:a:b:c:d:e:f; port-set { psid-length 16; }}
@@ -324,6 +774,7 @@ function selftest()
       softwire { ipv4 178.79.150.2; psid 7850; b4-ipv6 127:24:35:46:57:68:79:128; br-address 1E:1:1:1:1:1:1:af; port-set { psid-length 16; }}
       softwire { ipv4 178.79.150.3; psid 4; b4-ipv6 127:14:25:36:47:58:69:128; br-address 1E:2:2:2:2:2:2:af; port-set { psid-length 6; }}
    ]])
+   local map = load(conf)
 
    local ipv4_pton = require('lib.yang.util').ipv4_pton
    local ipv6_protocol = require("lib.protocol.ipv6")
@@ -369,5 +820,152 @@ function selftest()
       assert(i == #psid_map_iter + 1)
    end
 
+   do
+      -- Dense and clustered address pools get a compiled PSID map.
+      local b4 = ipv6_protocol:pton('127:2:3:4:5:6:7:128')
+      local br = ipv6_protocol:pton('8:9:a:b:c:d:e:f')
+      local function load_pool(addresses)
+         local softwire = {}
+         for _, addr in ipairs(addresses) do
+            table.insert(softwire, { ipv4 = addr, psid = 1, b4_ipv6 = b4,
+                                     br_address = br,
+                                     port_set = { psid_length = 6 } })
+         end
+         return load({ softwire = softwire })
+      end
+      local function check_pool(addresses, kind)
+         local bt = load_pool(addresses)
+         assert(getmetatable(bt.psid_map).__index == kind)
+         for _, addr in ipairs(addresses) do
+            assert(bt:is_managed_ipv4_address(addr))
+            assert(bt:lookup(addr, 1024 + 5))
+            assert(not bt:lookup(addr, 2048))
+            assert(not bt:is_managed_ipv4_address(addr + 1)
+                      or bt:lookup(addr + 1, 1024))
+         end
+         assert(not bt:is_managed_ipv4_address(0))
+         assert(not bt:is_managed_ipv4_address(0xffffffff))
+         local count = 0
+         for lo, hi, value in bt:iterate_psid_map() do
+            assert(value.psid_length == 6 and value.shift == 10)
+            count = count + hi - lo + 1
+         end
+         assert(count == #addresses)
+      end
+      local dense, clustered, scattered = {}, {}, {}
+      for i = 0, 1023 do
+         table.insert(dense, ipv4_pton('10.0.0.0') + i)
+         table.insert(clustered, ipv4_pton('10.0.0.0')
+                         + math.floor(i / 256) * 2^22 + i % 256)
+         table.insert(scattered, ipv4_pton('10.0.0.0') + i * 2^16)
+      end
+      check_pool(dense, rangemap.DirectMap)
+      check_pool(clustered, rangemap.BlockMap)
+      check_pool(scattered, rangemap.RangeMap)
+   end
+
+   do
+      local pkt = ffi.cast("struct packet *", 0)
+      local lq, mq = BTLookupQueue.new(map), BTManagedQueue.new(map)
+      local addresses = { '178.79.150.233', '178.79.150.4', '178.79.150.3' }
+      for i = 1, BTLookupQueue_size do
+         local ipv4 = ipv4_pton(addresses[i % #addresses + 1])
+         lq:enqueue_lookup(pkt, ipv4, 4096)
+         mq:enqueue_lookup(pkt, ipv4, i % #addresses)
+      end
+      assert(lq:is_full() and mq:is_full())
+      lq:process_queue()
+      mq:process_queue()
+      for n = 0, BTLookupQueue_size - 1 do
+         local _, b4_ipv6 = lq:get_lookup(n)
+         local _, managed, tag = mq:get_lookup(n)
+         assert(tag == (n + 1) % #addresses)
+         assert(managed == (tag ~= 1))
+         assert((b4_ipv6 ~= nil) == (tag == 2))
+      end
+      lq:reset_queue()
+      mq:reset_queue()
+      assert(lq:process_queue() == 0 and mq:process_queue() == 0)
+   end
+
+   do
+      -- Publish the table to shared memory and follow updates.
+      local publisher = BindingTablePublisher.new()
+      publisher:sync(conf)
+      local subscriber = BindingTableSubscriber.new()
+      local bt = subscriber:attach()
+      assert(not subscriber:has_changed())
+      local function check_softwire(bt, ipv4, port, b4)
+         local val = bt:lookup(ipv4_pton(ipv4), port)
+         if not b4 then return assert(val == nil) end
+         assert(val, ipv4..':'..port)
+         assert(ffi.C.memcmp(ipv6_protocol:pton(b4), val.b4_ipv6, 16) == 0)
+      end
+      check_softwire(bt, '178.79.150.233', 80, '127:2:3:4:5:6:7:128')
+      check_softwire(bt, '178.79.150.15', 4095, '127:22:33:44:55:66:77:128')
+      check_softwire(bt, '178.79.150.15', 8192, nil)
+      check_softwire(bt, '178.79.150.4', 80, nil)
+      local function softwire(ipv4, psid, b4)
+         return { ipv4 = ipv4_pton(ipv4), psid = psid,
+                  b4_ipv6 = ipv6_protocol:pton(b4),
+                  br_address = ipv6_protocol:pton('8:9:a:b:c:d:e:f'),
+                  port_set = { psid_length = 4,
+                               reserved_ports_bit_count = 0 },
+                  padding = 0 }
+      end
+      -- Updates to existing addresses are made in place, in slots that
+      -- no subscriber reads.  A subscriber that lags behind keeps its
+      -- slot, and does not hold up the publisher.
+      local lagging = BindingTableSubscriber.new()
+      local lagging_bt = lagging:attach()
+      local generation = publisher.generation
+      for i = 2, 5 do
+         publisher:begin_update()
+         publisher:stage_add({softwire('178.79.150.15', i, '127::'..i)})
+         publisher:stage_remove(softwire_key_t({ipv4_pton('178.79.150.15'),
+                                                i - 1}))
+         publisher:sync(conf)
+         assert(publisher.generation == generation)
+         assert(subscriber:has_changed())
+         bt = subscriber:attach()
+         check_softwire(bt, '178.79.150.15', i * 4096, '127::'..i)
+         check_softwire(bt, '178.79.150.15', (i - 1) * 4096, nil)
+         if i > 2 then
+            -- Reused slots catch up on the updates they missed.
+            check_softwire(bt, '178.79.150.15', (i - 2) * 4096, nil)
+         end
+         check_softwire(lagging_bt, '178.79.150.15', 4096,
+                        '127:22:33:44:55:66:77:128')
+      end
+      assert(lagging.slot == 0 and subscriber.slot ~= 0)
+      -- If all slots are in use, the update needs a new generation.
+      local control = publisher.control
+      for slot = 0, shared_max_slots - 1 do
+         control.readers[slot] = control.readers[slot] + 1
+      end
+      assert(not publisher:update({}))
+      for slot = 0, shared_max_slots - 1 do
+         control.readers[slot] = control.readers[slot] - 1
+      end
+      -- New addresses need a new generation.
+      local added = softwire('178.79.150.4', 3, '127::4')
+      publisher:begin_update()
+      publisher:stage_add({added})
+      require('lib.yang.list').object(conf.softwire):add_entry(added)
+      publisher:sync(conf)
+      assert(publisher.generation == generation + 1)
+      bt = subscriber:attach()
+      check_softwire(bt, '178.79.150.4', 3 * 4096, '127::4')
+      check_softwire(bt, '178.79.150.233', 80, '127:2:3:4:5:6:7:128')
+      lagging_bt = lagging:attach()
+      check_softwire(lagging_bt, '178.79.150.4', 3 * 4096, '127::4')
+      subscriber:detach()
+      lagging:detach()
+      for slot = 0, shared_max_slots - 1 do
+         assert(control.readers[slot] == 0)
+      end
+      shm.unlink(shared_path)
+   end
+
    print('ok')
 end
@@ -36,6 +36,13 @@ local S = require("syscall")
 local PKT_FROM_INET = 1
 local PKT_HAIRPINNED = 2
 
+-- Outgoing IPv4 packets are queued up so that the binding table checks
+-- deciding whether to hairpin them can be done in batches.  Note
+-- whether a queued packet was decapsulated from a B4, or is an ICMPv4
+-- error generated by the lwAFTR itself.
+local EGRESS_DECAPSULATED = 1
+local EGRESS_ICMP_ERROR = 2
+
 local debug = lib.getenv("LWAFTR_DEBUG")
 
 local ethernet_header_t = ffi.typeof([[
@@ -407,9 +414,13 @@ function LwAftr:new(conf)
    local o = setmetatable({}, {__index=LwAftr})
    conf = lwutil.merge_instance(conf).softwire_config
    o.conf = conf
-   o.binding_table = bt.load(conf.binding_table)
-   o.inet_lookup_queue = bt.BTLookupQueue.new(o.binding_table)
-   o.hairpin_lookup_queue = bt.BTLookupQueue.new(o.binding_table)
+   o.external_ipv4 = convert_ipv4(conf.external_interface.ip)
+   if conf.binding_table.shared then
+      o.shared_binding_table = bt.BindingTableSubscriber.new()
+      o:set_binding_table(o.shared_binding_table:attach())
+   else
+      o:set_binding_table(bt.load(conf.binding_table))
+   end
 
    o.icmpv4_error_count = 0
    o.icmpv4_error_rate_limit_start = 0
@@ -447,40 +458,43 @@ function LwAftr:new(conf)
    return o
 end
 
+-- The lookup queues refer to the binding table, so they are replaced
+-- along with it.  They must be empty at this point.
+function LwAftr:set_binding_table(binding_table)
+   self.binding_table = binding_table
+   self.inet_lookup_queue = bt.BTLookupQueue.new(binding_table)
+   self.hairpin_lookup_queue = bt.BTLookupQueue.new(binding_table)
+   self.egress_queue = bt.BTManagedQueue.new(binding_table)
+end
+
 -- The following two methods are called by lib.ptree.worker in reaction
 -- to binding table changes, via
--- lib/ptree/support/snabb-softwire-v3.lua.
+-- lib/ptree/support/snabb-softwire-v3.lua.  A shared binding table is
+-- instead updated by the manager, see apps.lwaftr.binding_table.
 function LwAftr:add_softwire_entry(entry_blob)
+   assert(not self.shared_binding_table, "binding table is shared")
    self.binding_table:add_softwire_entry(entry_blob)
 end
 function LwAftr:remove_softwire_entry(entry_key_blob)
+   assert(not self.shared_binding_table, "binding table is shared")
    self.binding_table:remove_softwire_entry(entry_key_blob)
 end
 
 local function decrement_ttl(pkt)
    local ipv4_header = get_ethernet_payload(pkt)
-   local chksum = bnot(ntohs(rd16(ipv4_header + o_ipv4_checksum)))
    local old_ttl = ipv4_header[o_ipv4_ttl]
    if old_ttl == 0 then return 0 end
    local new_ttl = band(old_ttl - 1, 0xff)
    ipv4_header[o_ipv4_ttl] = new_ttl
    -- Now fix up the checksum.  o_ipv4_ttl is the first byte in the
-   -- 16-bit big-endian word, so the difference to the overall sum is
-   -- multiplied by 0xff.
-   chksum = chksum + lshift(new_ttl - old_ttl, 8)
-   -- Now do the one's complement 16-bit addition of the 16-bit words of
-   -- the checksum, which necessarily is a 32-bit value.  Two carry
-   -- iterations will suffice.
-   chksum = band(chksum, 0xffff) + rshift(chksum, 16)
-   chksum = band(chksum, 0xffff) + rshift(chksum, 16)
-   wr16(ipv4_header + o_ipv4_checksum, htons(bnot(chksum)))
+   -- 16-bit big-endian word, so it contributes to the sum shifted left
+   -- by 8 bits.
+   local chksum = ntohs(rd16(ipv4_header + o_ipv4_checksum))
+   chksum = checksum.update16(chksum, lshift(old_ttl, 8), lshift(new_ttl, 8))
+   wr16(ipv4_header + o_ipv4_checksum, htons(chksum))
    return new_ttl
 end
 
-function LwAftr:ipv4_in_binding_table (ip)
-   return self.binding_table:is_managed_ipv4_address(ip)
-end
-
 function LwAftr:transmit_icmpv6_reply (pkt)
    local now = tonumber(engine.now())
    -- Reset if elapsed time reached.
@@ -546,15 +560,8 @@ function LwAftr:transmit_icmpv4_reply(pkt, orig_pkt, orig_pkt_link)
       -- ... and the tunneling should happen via the 'hairpinning' queue, to make
       -- sure counters are handled appropriately, despite this not being hairpinning.
       -- This avoids having phantom incoming IPv4 packets.
-      local ipv4_header = get_ethernet_payload(pkt)
-      local dst_ip = get_ipv4_dst_address(ipv4_header)
-      if self:ipv4_in_binding_table(dst_ip) then
-         return transmit(self.input.hairpin_in, pkt)
-      else
-         counter.add(self.shm["out-ipv4-bytes"], pkt.length)
-         counter.add(self.shm["out-ipv4-packets"])
-         return transmit(self.o4, pkt)
-      end
+      -- The binding table check is batched; see flush_egress.
+      return self:enqueue_egress(pkt, EGRESS_ICMP_ERROR)
    else
       return drop(pkt)
    end
@@ -578,21 +585,41 @@ end
 -- I *think* this approach bypasses using the physical NIC but am not
 -- absolutely certain.
 function LwAftr:transmit_ipv4(pkt)
-   local ipv4_header = get_ethernet_payload(pkt)
-   local dst_ip = get_ipv4_dst_address(ipv4_header)
-   if (self.conf.internal_interface.hairpinning and
-       self:ipv4_in_binding_table(dst_ip)) then
-      -- The destination address is managed by the lwAFTR, so we need to
-      -- hairpin this packet.  Enqueue on the IPv4 interface, as if it
-      -- came from the internet.
-      counter.add(self.shm["hairpin-ipv4-bytes"], pkt.length)
-      counter.add(self.shm["hairpin-ipv4-packets"])
-      return transmit(self.input.hairpin_in, pkt)
-   else
-      counter.add(self.shm["out-ipv4-bytes"], pkt.length)
-      counter.add(self.shm["out-ipv4-packets"])
-      return transmit(self.o4, pkt)
+   return self:enqueue_egress(pkt, EGRESS_DECAPSULATED)
+end
+
+-- Outgoing IPv4 packets are checked against the binding table in
+-- batches, in the order in which they were enqueued.
+function LwAftr:enqueue_egress(pkt, kind)
+   local eq = self.egress_queue
+   if eq:is_full() then self:flush_egress() end
+   local dst_ip = get_ipv4_dst_address(get_ethernet_payload(pkt))
+   eq:enqueue_lookup(pkt, dst_ip, kind)
+end
+
+function LwAftr:flush_egress()
+   local eq = self.egress_queue
+   local hairpinning = self.conf.internal_interface.hairpinning
+   eq:process_queue()
+   for n = 0, eq.length - 1 do
+      local pkt, managed, kind = eq:get_lookup(n)
+      if managed and (hairpinning or kind == EGRESS_ICMP_ERROR) then
+         -- The destination address is managed by the lwAFTR, so we need
+         -- to hairpin this packet.  Enqueue on the IPv4 interface, as if
+         -- it came from the internet.  Locally generated errors are
+         -- tunneled this way too, but are not counted as hairpinned.
+         if kind == EGRESS_DECAPSULATED then
+            counter.add(self.shm["hairpin-ipv4-bytes"], pkt.length)
+            counter.add(self.shm["hairpin-ipv4-packets"])
+         end
+         transmit(self.input.hairpin_in, pkt)
+      else
+         counter.add(self.shm["out-ipv4-bytes"], pkt.length)
+         counter.add(self.shm["out-ipv4-packets"])
+         transmit(self.o4, pkt)
+      end
    end
+   eq:reset_queue()
 end
 
 -- ICMPv4 type 3 code 1, as per RFC 7596.
@@ -623,7 +650,7 @@ function LwAftr:drop_ipv4_packet_to_unreachable_host(pkt, pkt_src_link)
       code = constants.icmpv4_host_unreachable,
    }
    local icmp_dis = new_icmpv4_packet(
-      convert_ipv4(self.conf.external_interface.ip),
+      self.external_ipv4,
       to_ip, pkt, icmp_config)
 
    return self:transmit_icmpv4_reply(icmp_dis, pkt, pkt_src_link)
@@ -680,7 +707,7 @@ function LwAftr:cannot_fragment_df_packet_error(pkt)
       next_hop_mtu = mtu - constants.ipv6_fixed_header_size,
    }
    return new_icmpv4_packet(
-      convert_ipv4(self.conf.external_interface.ip),
+      self.external_ipv4,
       dst_ip, pkt, icmp_config)
 end
 
@@ -701,7 +728,7 @@ function LwAftr:encapsulate_and_transmit(pkt, ipv6_dst, ipv6_src, pkt_src_link)
                            code = constants.icmpv4_ttl_exceeded_in_transit,
                            }
       local reply = new_icmpv4_packet(
-         convert_ipv4(self.conf.external_interface.ip),
+         self.external_ipv4,
          dst_ip, pkt, icmp_config)
 
       return self:transmit_icmpv4_reply(reply, pkt, pkt_src_link)
@@ -780,9 +807,11 @@ end
 
 function LwAftr:enqueue_encapsulation(pkt, ipv4, port, pkt_src_link)
    if pkt_src_link == PKT_FROM_INET then
+      if self.inet_lookup_queue:is_full() then self:flush_encapsulation() end
       self.inet_lookup_queue:enqueue_lookup(pkt, ipv4, port)
    else
       assert(pkt_src_link == PKT_HAIRPINNED)
+      if self.hairpin_lookup_queue:is_full() then self:flush_hairpin() end
       self.hairpin_lookup_queue:enqueue_lookup(pkt, ipv4, port)
    end
 end
@@ -888,7 +917,7 @@ function LwAftr:tunnel_unreachable(pkt, code, next_hop_mtu)
                         }
    local dst_ip = get_ipv4_src_address_ptr(embedded_ipv4_header)
    local icmp_reply = new_icmpv4_packet(
-      convert_ipv4(self.conf.external_interface.ip),
+      self.external_ipv4,
       dst_ip, pkt, icmp_config)
    return icmp_reply
 end
@@ -971,6 +1000,7 @@ function LwAftr:flush_decapsulation()
 end
 
 function LwAftr:enqueue_decapsulation(pkt, ipv4, port)
+   if self.inet_lookup_queue:is_full() then self:flush_decapsulation() end
    self.inet_lookup_queue:enqueue_lookup(pkt, ipv4, port)
 end
 
@@ -1052,6 +1082,11 @@ function LwAftr:push ()
    self.bad_ipv4_softwire_matches_alarm:check()
    self.bad_ipv6_softwire_matches_alarm:check()
 
+   local shared_binding_table = self.shared_binding_table
+   if shared_binding_table and shared_binding_table:has_changed() then
+      self:set_binding_table(shared_binding_table:attach())
+   end
+
    for _ = 1, link.nreadable(i6) do
       -- Decapsulate incoming IPv6 packets from the B4 interface and
       -- push them out the V4 link, unless they need hairpinning, in
@@ -1071,6 +1106,7 @@ function LwAftr:push ()
       end
    end
    self:flush_decapsulation()
+   self:flush_egress()
 
    for _ = 1, link.nreadable(i4) do
       -- Encapsulate incoming IPv4 packets, excluding hairpinned
@@ -1090,6 +1126,7 @@ function LwAftr:push ()
       end
    end
    self:flush_encapsulation()
+   self:flush_egress()
 
    for _ = 1, link.nreadable(ih) do
       -- Encapsulate hairpinned packet.
@@ -1099,4 +1136,9 @@ function LwAftr:push ()
       self:from_inet(pkt, PKT_HAIRPINNED)
    end
    self:flush_hairpin()
+   self:flush_egress()
+end
+
+function LwAftr:stop ()
+   if self.shared_binding_table then self.shared_binding_table:detach() end
 end
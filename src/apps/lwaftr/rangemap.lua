@@ -7,17 +7,33 @@
 -- being fairly small and will always be found in cache.  For this
 -- reason, a lookup in the range map can use an optimized branchless
 -- binary search.
+--
+-- When the keys are dense, for example a pool of IPv4 addresses that
+-- covers most of a /16, the map can instead be compiled to a flat array
+-- indexed directly by key (a DirectMap), or to a two-level table whose
+-- second level is made of blocks of 256 keys (a BlockMap), so that a
+-- lookup is a bounds check and one or two memory accesses.  All three
+-- kinds of map have the same lookup and iterate interface; note that
+-- for the compiled maps only the "value" member of the entry returned
+-- by lookup is meaningful.
 
 module(..., package.seeall)
 
 local ffi = require("ffi")
+local bit = require("bit")
 local C = ffi.C
 local binary_search = require('lib.binary_search')
 
+local band, lshift, rshift = bit.band, bit.lshift, bit.rshift
+
 local UINT32_MAX = 0xFFFFFFFF
+local BLOCK_BITS = 8
+local BLOCK_SIZE = lshift(1, BLOCK_BITS)
 
 RangeMapBuilder = {}
 RangeMap = {}
+DirectMap = {}
+BlockMap = {}
 
 local function make_entry_type(value_type)
    return ffi.typeof([[struct {
@@ -91,9 +107,15 @@ function RangeMapBuilder:add(key, value)
    self:add_range(key, key, value)
 end
 
-function RangeMapBuilder:build(default_value)
-   assert(default_value)
-   table.sort(self.entries, function(a,b) return a.max.key < b.max.key end)
+-- Partition [0, UINT32_MAX] into maximal ranges of keys with equal
+-- values, and return them as an array of entries sorted by key, each
+-- holding the highest key of its range, and the number of ranges.
+local function build_ranges(self, default_value)
+   -- Work on a copy of the entries, so that the builder can be used
+   -- again to build other kinds of map.
+   local entries = {}
+   for i, entry in ipairs(self.entries) do entries[i] = entry end
+   table.sort(entries, function(a,b) return a.max.key < b.max.key end)
 
    -- The optimized binary search routines in binary_search.dasl want to
    -- search for the entry whose key is *greater* than or equal to the K
@@ -101,16 +123,16 @@ function RangeMapBuilder:build(default_value)
    -- contiguous entries with the highest K having a value V, starting
    -- with UINT32_MAX and working our way down.
    local ranges = {}
-   if #self.entries == 0 or self.entries[#self.entries].max.key < UINT32_MAX then
-      table.insert(self.entries,
+   if #entries == 0 or entries[#entries].max.key < UINT32_MAX then
+      table.insert(entries,
                    { min=self.entry_type(UINT32_MAX, default_value),
                      max=self.entry_type(UINT32_MAX, default_value) })
    end
 
-   table.insert(ranges, self.entries[#self.entries].max)
-   local range_end = self.entries[#self.entries].min
-   for i=#self.entries-1,1,-1 do
-      local entry = self.entries[i]
+   table.insert(ranges, entries[#entries].max)
+   local range_end = entries[#entries].min
+   for i=#entries-1,1,-1 do
+      local entry = entries[i]
       if entry.max.key >= range_end.key then
          error("Multiple range map entries for key: "..entry.max.key)
       elseif entry.max.key + 1 ~= range_end.key then
@@ -131,7 +153,12 @@ function RangeMapBuilder:build(default_value)
    for i,entry in ipairs(ranges) do
       packed_entries[range_count-i] = entry
    end
+   return packed_entries, range_count
+end
 
+function RangeMapBuilder:build(default_value)
+   assert(default_value)
+   local packed_entries, range_count = build_ranges(self, default_value)
    local map = {
       value_type = self.value_type,
       entry_type = self.entry_type,
@@ -148,19 +175,165 @@ function RangeMap:lookup(k)
    return self.binary_search(self.entries, k)
 end
 
-function RangeMap:iterate()
+-- Return the number of keys with a non-default value, the lowest and
+-- highest such keys, and the number of BLOCK_SIZE blocks that they
+-- touch.  Useful to decide which kind of map to build.
+function RangeMapBuilder:stats()
+   local count, lo, hi = 0, UINT32_MAX, 0
+   local blocks = {}
+   for _, entry in ipairs(self.entries) do
+      local min, max = entry.min.key, entry.max.key
+      count = count + (max - min + 1)
+      lo, hi = math.min(lo, min), math.max(hi, max)
+      for block = rshift(min, BLOCK_BITS), rshift(max, BLOCK_BITS) do
+         blocks[block] = true
+      end
+   end
+   local nblocks = 0
+   for _ in pairs(blocks) do nblocks = nblocks + 1 end
+   if count == 0 then lo, hi = 0, 0 end
+   return count, lo, hi, nblocks
+end
+
+-- Compiled maps also keep the ranges of the map, to iterate over them.
+-- Building the ranges checks that the builder's entries do not overlap.
+local function compiled_map(builder, kind, default_value)
+   local count, lo, hi = builder:stats()
+   local ranges, nranges = build_ranges(builder, default_value)
+   local map = {
+      ranges = ranges,
+      nranges = nranges,
+      value_type = builder.value_type,
+      entry_type = builder.entry_type,
+      type = builder.type,
+      base = lo,
+      span = hi - lo + 1,
+      default = builder.entry_type(UINT32_MAX, default_value)
+   }
+   return setmetatable(map, { __index = kind })
+end
+
+-- Build a DirectMap: an array with one entry per key between the lowest
+-- and the highest key that was added.  Memory use is proportional to
+-- that span, so only use it for dense key sets.
+function RangeMapBuilder:build_direct(default_value)
+   assert(default_value)
+   local map = compiled_map(self, DirectMap, default_value)
+   map.entries = self.type(map.span)
+   for i = 0, map.span - 1 do
+      map.entries[i].key = map.base + i
+      map.entries[i].value = default_value
+   end
+   for _, entry in ipairs(self.entries) do
+      for key = entry.min.key, entry.max.key do
+         map.entries[key - map.base].value = entry.max.value
+      end
+   end
+   return map
+end
+
+function DirectMap:lookup(k)
+   local i = k - self.base
+   if i >= 0 and i < self.span then return self.entries + i end
+   return self.default
+end
+
+-- Build a BlockMap: a first-level array indexed by the high bits of the
+-- key relative to the lowest key, pointing into an array of blocks that
+-- is indexed by the low BLOCK_BITS.  Only blocks that contain keys are
+-- allocated; all other first-level slots point to block 0, which holds
+-- the default value.
+function RangeMapBuilder:build_blocks(default_value)
+   assert(default_value)
+   local map = compiled_map(self, BlockMap, default_value)
+   -- Align the base so that blocks line up with BLOCK_SIZE boundaries.
+   map.base = lshift(rshift(map.base, BLOCK_BITS), BLOCK_BITS) % 2^32
+   local _, _, hi, nblocks = self:stats()
+   map.span = hi - map.base + 1
+   map.top = ffi.new("uint32_t[?]", rshift(map.span - 1, BLOCK_BITS) + 1)
+   map.entries = self.type((nblocks + 1) * BLOCK_SIZE)
+   for i = 0, BLOCK_SIZE - 1 do map.entries[i].value = default_value end
+   local next_block = 1
+   local function block_index(key)
+      local slot = rshift(key - map.base, BLOCK_BITS)
+      if map.top[slot] == 0 then
+         map.top[slot] = next_block
+         local start = next_block * BLOCK_SIZE
+         local key_base = map.base + slot * BLOCK_SIZE
+         for i = 0, BLOCK_SIZE - 1 do
+            map.entries[start + i].key = key_base + i
+            map.entries[start + i].value = default_value
+         end
+         next_block = next_block + 1
+      end
+      return map.top[slot]
+   end
+   for _, entry in ipairs(self.entries) do
+      for key = entry.min.key, entry.max.key do
+         local i = block_index(key) * BLOCK_SIZE + band(key, BLOCK_SIZE - 1)
+         map.entries[i].value = entry.max.value
+      end
+   end
+   assert(next_block == nblocks + 1)
+   return map
+end
+
+function BlockMap:lookup(k)
+   local i = k - self.base
+   if i >= 0 and i < self.span then
+      local block = self.top[rshift(i, BLOCK_BITS)]
+      return self.entries + (lshift(block, BLOCK_BITS) + band(i, BLOCK_SIZE - 1))
+   end
+   return self.default
+end
+
+-- Look up the N keys in the uint32_t array KEYS, and store pointers to
+-- their entries in the array ENTRIES (see lookup_batch_type).  All
+-- addresses are computed before the caller reads any of the entries,
+-- so that for a batch of keys the loads of the entries can overlap
+-- instead of each waiting for the lookup of the previous key.
+local function lookup_batch(map, keys, n, entries)
+   for i = 0, n - 1 do entries[i] = map:lookup(keys[i]) end
+end
+
+RangeMap.lookup_batch = lookup_batch
+DirectMap.lookup_batch = lookup_batch
+BlockMap.lookup_batch = lookup_batch
+
+-- Return the type of the ENTRIES argument of lookup_batch for maps
+-- with values of VALUE_TYPE.
+function lookup_batch_type(value_type)
+   return ffi.typeof('$*[?]', get_entry_type(value_type))
+end
+
+-- Iterate over the sorted ranges in ENTRIES, returning the lowest and
+-- highest key and the value of each.
+local function iterate_ranges(entries, size)
    local entry = -1
    local function next_entry()
       entry = entry + 1
-      if entry >= self.size then return end
-      local hi, val = self.entries[entry].key, self.entries[entry].value
+      if entry >= size then return end
+      local hi, val = entries[entry].key, entries[entry].value
       local lo = 0
-      if entry > 0 then lo = self.entries[entry - 1].key + 1 end
+      if entry > 0 then lo = entries[entry - 1].key + 1 end
       return lo, hi, val
    end
    return next_entry
 end
 
+function RangeMap:iterate()
+   return iterate_ranges(self.entries, self.size)
+end
+
+-- Compiled maps iterate over the ranges they were compiled from, with
+-- the same semantics as RangeMap:iterate.
+local function iterate_compiled(map)
+   return iterate_ranges(map.ranges, map.nranges)
+end
+
+DirectMap.iterate = iterate_compiled
+BlockMap.iterate = iterate_compiled
+
 function selftest()
    local builder = RangeMapBuilder.new(ffi.typeof('uint8_t'))
    builder:add(0, 1)
@@ -256,6 +429,66 @@ function selftest()
    assert(map:lookup(UINT32_MAX-1).value == 99)
    assert(map:lookup(UINT32_MAX).value == 100)
 
+   -- Compiled maps must agree with the range map, for lookup as well as
+   -- for iteration.
+   local function check_compiled(base, keys)
+      local builder = RangeMapBuilder.new(ffi.typeof('uint8_t'))
+      for i, key in ipairs(keys) do
+         builder:add(base + key, i % 3 + 1)
+      end
+      builder:add_range(base + 1000, base + 1100, 7)
+      local ranges = builder:build(0)
+      local direct = builder:build_direct(0)
+      local blocks = builder:build_blocks(0)
+      -- Building leaves the builder's entries as they were.
+      for i, key in ipairs(keys) do
+         assert(builder.entries[i].min.key == base + key)
+      end
+      for key = -300, 1500 do
+         local k = (base + key) % 2^32
+         local expected = ranges:lookup(k).value
+         assert(direct:lookup(k).value == expected)
+         assert(blocks:lookup(k).value == expected)
+      end
+      -- The range map may split the default value at UINT32_MAX, so
+      -- only compare the ranges with a non-default value.
+      local function non_default(map)
+         local f = map:iterate()
+         return function ()
+            local lo, hi, value
+            repeat lo, hi, value = f() until lo == nil or value ~= 0
+            return lo, hi, value
+         end
+      end
+      for _, compiled in ipairs({direct, blocks}) do
+         local next_range = non_default(ranges)
+         for lo, hi, value in non_default(compiled) do
+            local expected_lo, expected_hi, expected_value = next_range()
+            assert(lo == expected_lo and hi == expected_hi)
+            assert(value == expected_value)
+         end
+         assert(next_range() == nil)
+      end
+      -- Batched lookups agree with single lookups.
+      local n = 1801
+      local batch = ffi.new('uint32_t[?]', n)
+      local entries = lookup_batch_type(builder.value_type)(n)
+      for i = 0, n - 1 do batch[i] = (base + i - 300) % 2^32 end
+      for _, map in ipairs({ranges, direct, blocks}) do
+         map:lookup_batch(batch, n, entries)
+         for i = 0, n - 1 do
+            assert(entries[i].value == ranges:lookup(batch[i]).value)
+         end
+      end
+      local count, lo, hi, nblocks = builder:stats()
+      assert(count == #keys + 101)
+      assert(lo == base + keys[1] and hi == base + 1100)
+      return nblocks
+   end
+   assert(check_compiled(5000, {3, 4, 5, 100, 300, 301, 302, 999}) == 3)
+   assert(check_compiled(0, {0, 1, 2, 600}) == 4)
+   check_compiled(UINT32_MAX - 1100, {0, 7, 8, 9, 255, 256})
+
    local pmu = require('lib.pmu')
    local has_pmu_counters, err = pmu.is_available()
    if not has_pmu_counters then
@@ -307,4 +540,21 @@ function selftest()
    end
 
    check_perf(test_lookup, 1e8, 35, 10, 'lookup')
+
+   local builder = RangeMapBuilder.new(ffi.typeof('uint8_t'))
+   for i = 0, 2^16 - 1, 2 do builder:add(0x0a000000 + i, i % 251) end
+   local dense = { ranges = builder:build(0),
+                   direct = builder:build_direct(0),
+                   blocks = builder:build_blocks(0) }
+   for _, kind in ipairs({'direct', 'blocks', 'ranges'}) do
+      local map = dense[kind]
+      local function test_dense_lookup(iterations)
+         local result = 0
+         for i=1,iterations do
+            result = map:lookup(0x0a000000 + band(i * 7919, 0xffff)).value
+         end
+         return result
+      end
+      check_perf(test_dense_lookup, 1e7, 60, 30, 'dense lookup ('..kind..')')
+   end
 end
@@ -38,6 +38,7 @@ local register = require("lib.hardware.register")
 local index_set = require("lib.index_set")
 local macaddress = require("lib.macaddress")
 local mib = require("lib.ipc.shmem.mib")
+local toeplitz = require("lib.hash.toeplitz")
 local timer = require("core.timer")
 local shm = require("core.shm")
 local counter = require("core.counter")
@@ -219,7 +220,8 @@ ConnectX.config = {
    fc_tx_enable = { default  = false },
    queues       = { required = true },
    macvlan      = { default  = false },
-   sync_stats_interval = {default = 1}
+   sync_stats_interval = {default = 1},
+   rss_key      = { default  = false }
 }
 local queue_config = {
    id   = { required = true },
@@ -409,6 +411,8 @@ function ConnectX:new (conf)
       error("NYI: promisc vlan")
    end
 
+   local rss_key = conf.rss_key and toeplitz.parse_key(conf.rss_key)
+
    local function setup_rss_rxtable (rqlist, tdomain, level)
       -- Set up RSS accross all queues. Hashing is only performed for
       -- IPv4/IPv6 with or without TCP/UDP. All non-IP packets are
@@ -431,7 +435,7 @@ function ConnectX:new (conf)
       for _, l3_proto in ipairs(l3_protos) do
          for _, l4_proto in ipairs(l4_protos) do
             local tir = hca:create_tir_indirect(rqt, tdomain,
-                                                l3_proto, l4_proto)
+                                                l3_proto, l4_proto, rss_key)
             -- NOTE: flow table entries will only match if the packet
             -- contains the complete L4 header. Keep this in mind when
             -- processing truncated packets (e.g. from a port-mirror).
@@ -447,7 +451,8 @@ function ConnectX:new (conf)
          rxtable, NIC_RX, index, index + #l3_protos - 1, "l3-only"
       )
       for _, l3_proto in ipairs(l3_protos) do
-         local tir = hca:create_tir_indirect(rqt, tdomain, l3_proto, nil)
+         local tir = hca:create_tir_indirect(rqt, tdomain, l3_proto, nil,
+                                             rss_key)
          hca:set_flow_table_entry_ip(rxtable, NIC_RX, flow_group_ip_l3,
                                      index, TIR, tir, l3_proto, nil)
          index = index + 1
@@ -1220,7 +1225,9 @@ end
 
 -- Create a TIR with indirect dispatching (hashing) based on IPv4/IPv6
 -- addresses and optionally TCP/UDP ports.
-function HCA:create_tir_indirect (rqt, transport_domain, l3_proto, l4_proto)
+-- Key is the Toeplitz hash key as a string of bytes, or false for a
+-- random key.
+function HCA:create_tir_indirect (rqt, transport_domain, l3_proto, l4_proto, key)
    local l3_protos = {
       v4 = 0,
       v6 = 1
@@ -1250,7 +1257,12 @@ function HCA:create_tir_indirect (rqt, transport_domain, l3_proto, l4_proto)
    end
    -- XXX Is random hash key a good solution?
    for i = 0x28, 0x4C, 4 do
-      self:input("toeplitz_key["..((i-0x28)/4).."]", 0x20 + i, 31,  0, math.random(2^32))
+      local word = math.random(2^32)
+      if key then
+         local b0, b1, b2, b3 = key:byte(i-0x28+1, i-0x28+4)
+         word = ((b0 * 256 + b1) * 256 + b2) * 256 + b3
+      end
+      self:input("toeplitz_key["..((i-0x28)/4).."]", 0x20 + i, 31,  0, word)
    end
    self:execute()
    return self:output(0x08, 23, 0)
@@ -4,8 +4,10 @@
 --
 -- This module exposes the following API:
 --
---  define(tablename)
---    define a named connection tracking table.
+--  define(tablename, conf)
+--    define a named connection tracking table and return it.
+--    `conf` is an optional table of the parameters listed in
+--    `params` below; it only applies when the table is created.
 --
 --  clear()
 --    clears all tracking tables.
@@ -16,20 +18,55 @@
 --
 --  spec:track(trackname)
 --    tracks the connection in the named tracking table.
---    internally handles any ageing and table rotation.
 --
 --  spec:check(trackname)
---    checks if an equivalent (or revese) spec is registered
---    in the named tracking table.
+--    checks if an equivalent (or reverse) spec is registered
+--    in the named tracking table, and refreshes it if so.
 --
 --  NOTE: the spec() function doesn't allocate new spec objects,
 --  the returned objects are to be used and for tracking and
 --  checking but not stored, because they might be overwritten
 --  by the next call to spec().
-
+--
+-- Tracking tables are ctables keyed by the binary 5-tuple of a
+-- connection, in a canonical order so that both directions map to the
+-- same entry.  Each entry records when the connection was last seen
+-- and its state; TCP connections move through the states below as
+-- SYNs, FINs and RSTs go by, and each state has its own timeout.
+-- Expired entries are reclaimed incrementally by table:expire(), which
+-- visits a bounded number of slots per call.
+--
+-- Besides the spec API, a table can look up packets in batches:
+--
+--  table:prepare(i, buffer)
+--    computes the key of the packet in `buffer` as the i'th key of the
+--    next batch, for 0 <= i < table.batch_size.
+--
+--  table:prepare_packets(packets, n)
+--    prepares the first `n` packets of the array `packets` as the
+--    keys of the next batch.
+--
+--  table:lookup()
+--    looks up the keys of the batch in one go.  check() and track()
+--    may be mixed freely afterwards.
+--
+--  table:check(i, now)
+--    returns true if the i'th packet belongs to a live connection,
+--    and refreshes the connection.
+--
+--  table:track(i, now)
+--    starts tracking the connection of the i'th packet.  Returns nil
+--    if the packet is not IP, and false if the table is full.
 
 local ffi = require 'ffi'
+local bit = require 'bit'
 local lib = require 'core.lib'
+local ctable = require 'lib.ctable'
+
+local C = ffi.C
+local band, bor, bnot, lshift, rshift =
+   bit.band, bit.bor, bit.bnot, bit.lshift, bit.rshift
+local min, max = math.min, math.max
 
 local const = ffi.new([[struct {
    static const int ETHERTYPE_IPV4 = 0x0008;
@@ -40,226 +77,458 @@ local const = ffi.new([[struct {
 
    static const int ETHERTYPE_OFFSET = 12;
 
+   static const int IPV4_VERSION_IHL_OFFSET = 14;
    static const int IPV4_SOURCE_OFFSET = 26;
    static const int IPV4_PROTOCOL_OFFSET = 23;
-   static const int IPV4_SOURCE_PORT_OFFSET = 34;
 
    static const int IPV6_SOURCE_OFFSET = 22;
    static const int IPV6_NEXT_HEADER_OFFSET = 20; // protocol
    static const int IPV6_SOURCE_PORT_OFFSET = 54;
+
+   static const int TCP_FLAGS_OFFSET = 13;
+   static const int TCP_FIN = 0x01;
+   static const int TCP_RST = 0x04;
 }]])
 
 ---
---- connection spec structures
+--- connection keys and state
 ---
 
-ffi.cdef [[
-   typedef struct {
-      uint32_t src_ip, dst_ip;
-      uint16_t src_port, dst_port;
+-- Both endpoints of a connection, in canonical order: endpoint `a' is
+-- the one with the lower address (compared as two native uint64_t
+-- words), or the lower port if the addresses are equal.  IPv4
+-- addresses are stored as IPv4-mapped IPv6 addresses.
+local key_t = ffi.typeof[[
+   struct {
+      uint32_t a[4], b[4];
+      uint16_t a_port, b_port;
       uint8_t protocol;
-   } __attribute__((packed)) conn_spec_ipv4;
-
-   typedef struct {
-      uint64_t a, b;
-   } __attribute__((packed)) ipv6_addr;
-
-   typedef struct {
-      ipv6_addr src_ip, dst_ip;
-      uint16_t src_port, dst_port;
-      uint8_t protocol;
-   } __attribute__((packed)) conn_spec_ipv6;
+      uint8_t pad[3];
+   } __attribute__((packed))
 ]]
 
-----
+local value_t = ffi.typeof[[
+   struct {
+      double last_seen;     // engine.now() of the last packet
+      uint8_t state;        // see below
+      uint8_t origin;       // direction of the first packet
+      uint8_t fin;          // bit per direction that has sent a FIN
+      uint8_t pad[5];
+   }
+]]
 
----
---- connection tracking
----
---- these are the only functions that have access
---- to the connection tracking tables.
---- each named table is a 4-tuple of the form:
---- ( current set, old set, time of last rotation, number of entries)
----
-local define, clear     -- part of the exported API
-local track, check      -- internal functions, used by spec objects
-do
-   local MAX_AGE = 7200             -- two hours
-   local MAX_CONNECTIONS = 1000     -- overflow threshold
-   local conntracks = {}            -- named tracking tables
-   local time = engine.now
-   local function init(old)   return {}, old, time(), 0 end
-   local function put(t, key) t[1][key] = true end
-   local function get(t, key) return t[1][key] or t[2][key] end
-   local function swap(t)     t[1], t[2], t[3], t[4] = init(t[1]) end
-
-   function define (name)
-      if not name then return end
-      conntracks[name] = conntracks[name] or { init({}) }
-   end
+local key_ptr_t = ffi.typeof('$*', key_t)
+
+-- Hash value of empty ctable slots.
+local HASH_MAX = 0xFFFFFFFF
+
+local NEW, ESTABLISHED, CLOSING, CLOSED = 1, 2, 3, 4
+
+local params = {
+   -- Maximum number of connections to track.
+   capacity = {default=1e6},
+   -- Allocate room for CAPACITY connections up front, so that the table
+   -- never grows on the data plane.  Otherwise the table starts small
+   -- and doubles in size as needed, which keeps small tables cache
+   -- friendly.
+   preallocate = {default=false},
+   -- Seconds of inactivity after which connections expire, by state:
+   -- only one direction seen, both directions seen, one TCP FIN seen,
+   -- and both FINs or a RST seen.
+   new_timeout = {default=60},
+   established_timeout = {default=7200},
+   closing_timeout = {default=120},
+   closed_timeout = {default=10},
+   -- Number of packets per batched lookup.
+   batch_size = {default=32},
+   -- Number of table slots visited per call to expire().
+   expire_budget = {default=1024}
+}
 
-   function clear()
-      for name, t in pairs(conntracks) do
-         t[1], t[2], t[3], t[4] = init ({})
-      end
-      conntracks = {}
-   end
+local uint16_ptr_t = ffi.typeof('uint16_t*')
+local uint32_ptr_t = ffi.typeof('uint32_t*')
+local uint64_ptr_t = ffi.typeof('uint64_t*')
+local mapped_prefix = lib.htonl(0xffff)
+
+-- Masks indexed by protocol: ports are only tracked for TCP and UDP,
+-- and flags only for TCP.
+local port_mask = ffi.new('uint8_t[256]')
+local flag_mask = ffi.new('uint8_t[256]')
+port_mask[const.IP_TCP], port_mask[const.IP_UDP] = 1, 1
+flag_mask[const.IP_TCP] = 0xff
+
+-- Key construction is branch-free: branches on packet contents turn
+-- into unpredictable side exits.  gt() and gt64() return 1 if X > Y,
+-- and 0 otherwise, for numbers below 2^32 and for uint64_t values.
+local function gt (x, y) return min(max(x - y, 0), 1) end
+local function gt64 (x, y)
+   return rshift(bor(band(bnot(y), x), band(bor(bnot(y), x), y - x)), 63)
+end
 
-   function track (name, key, revkey)
-      local t = conntracks[name]
-      if time() > t[3]+MAX_AGE or t[4] > MAX_CONNECTIONS then
-         swap(t)
-      end
-      t[4] = t[4] + 1
-      put(t, key)
-      put(t, revkey)
+-- Fill KEY with the connection of the packet in B.  Returns the
+-- direction of the packet (0 for a->b, 1 for b->a) and its TCP flags,
+-- or nil if the packet is not IPv4 or IPv6.  The packet is assumed to
+-- have no IPv6 extension headers, like in the pflang filters.
+local function fill_key (key, b)
+   local ethertype = ffi.cast(uint16_ptr_t, b+const.ETHERTYPE_OFFSET)[0]
+   local swap, protocol, ports
+   if ethertype == const.ETHERTYPE_IPV4 then
+      local ips = ffi.cast(uint32_ptr_t, b+const.IPV4_SOURCE_OFFSET)
+      protocol = b[const.IPV4_PROTOCOL_OFFSET]
+      ports = b + const.IPV4_VERSION_IHL_OFFSET
+         + band(b[const.IPV4_VERSION_IHL_OFFSET], 0x0f) * 4
+      local m = port_mask[protocol]
+      local sp = ffi.cast(uint16_ptr_t, ports)[0] * m
+      local dp = ffi.cast(uint16_ptr_t, ports)[1] * m
+      local s, d = ips[0], ips[1]
+      local g, l = gt(s, d), gt(d, s)
+      swap = g + (1 - g - l) * gt(sp, dp)
+      local k = ffi.cast(uint32_ptr_t, key)
+      k[0], k[1], k[2], k[3] = 0, 0, mapped_prefix, s + swap * (d - s)
+      k[4], k[5], k[6], k[7] = 0, 0, mapped_prefix, d + swap * (s - d)
+      key.a_port, key.b_port = sp + swap * (dp - sp), dp + swap * (sp - dp)
+   elseif ethertype == const.ETHERTYPE_IPV6 then
+      local w = ffi.cast(uint64_ptr_t, b+const.IPV6_SOURCE_OFFSET)
+      protocol = b[const.IPV6_NEXT_HEADER_OFFSET]
+      ports = b + const.IPV6_SOURCE_PORT_OFFSET
+      local m = port_mask[protocol]
+      local sp = ffi.cast(uint16_ptr_t, ports)[0] * m
+      local dp = ffi.cast(uint16_ptr_t, ports)[1] * m
+      local g0, l0 = gt64(w[0], w[2]), gt64(w[2], w[0])
+      local g1, l1 = gt64(w[1], w[3]), gt64(w[3], w[1])
+      swap = tonumber(g0 + (1 - g0 - l0) * (g1 + (1 - g1 - l1) * gt(sp, dp)))
+      local k, o = ffi.cast(uint64_ptr_t, key), swap * 2
+      k[0], k[1], k[2], k[3] = w[o], w[o+1], w[2-o], w[3-o]
+      key.a_port, key.b_port = sp + swap * (dp - sp), dp + swap * (sp - dp)
+   else
+      return nil
    end
+   key.protocol = protocol
+   return swap, band(ports[const.TCP_FLAGS_OFFSET], flag_mask[protocol])
+end
 
-   function check (name, key)
-      return get(conntracks[name], key)
+-- Advance the state of a connection for a packet going in direction
+-- DIR with TCP FLAGS.
+local function update_state (value, dir, flags)
+   local state = value.state
+   if state == NEW and dir ~= value.origin then state = ESTABLISHED end
+   if band(flags, const.TCP_RST) ~= 0 then
+      state = CLOSED
+   elseif band(flags, const.TCP_FIN) ~= 0 and state ~= CLOSED then
+      local fin = bor(value.fin, lshift(1, dir))
+      value.fin = fin
+      state = fin == 3 and CLOSED or CLOSING
    end
+   value.state = state
 end
 
------------------
---- generic connection spec functions, work for either IPv4 or IPv6
-local genspec = {}
-
---- reverses a spec
---- o: (optional) if given, a spec to be filled with
---- the reverse of the original
---- if omitted, the spec is reversed in place.
-function genspec:reverse(o)
-   if o then
-      o.protocol = self.protocol
-   else
-      o = self
+---
+--- connection tracking tables
+---
+
+local ConnTrack = {}
+ConnTrack.__index = ConnTrack
+
+local function new_table (conf)
+   conf = lib.parse(conf or {}, params)
+   local max_occupancy_rate = 0.9
+   local initial_size = 1024
+   if conf.preallocate then
+      initial_size = math.ceil(conf.capacity / max_occupancy_rate) + 1
    end
-   o.src_ip, o.dst_ip = self.dst_ip, self.src_ip
-   o.src_port, o.dst_port = self.dst_port, self.src_port
+   local o = setmetatable({
+      capacity = conf.capacity,
+      timeouts = ffi.new('double[5]', 0, conf.new_timeout,
+                         conf.established_timeout, conf.closing_timeout,
+                         conf.closed_timeout),
+      batch_size = conf.batch_size,
+      expire_budget = conf.expire_budget,
+      ctab = ctable.new{
+         key_type = key_t,
+         value_type = value_t,
+         initial_size = initial_size,
+         max_occupancy_rate = max_occupancy_rate
+      },
+      cursor = 0,
+      dirs = ffi.new('int8_t[?]', conf.batch_size),
+      flags = ffi.new('uint8_t[?]', conf.batch_size),
+      value = value_t()
+   }, ConnTrack)
+   o:make_streamer()
    return o
 end
 
---- returns a binary string, usable as a table key
-function genspec:__tostring()
-   return ffi.string(self, ffi.sizeof(self))
+-- Lookup streamers depend on the table's size and maximum
+-- displacement, so make a new one whenever they change.
+function ConnTrack:make_streamer ()
+   self.streamer = self.ctab:make_lookup_streamer(self.batch_size)
+   self.entry_size = ffi.sizeof(self.ctab.entry_type)
+   self.max_displacement = self.ctab.max_displacement
+   self.size = self.ctab.size
 end
 
---- checks if the spec is present in the named tracking table
-function genspec:check(trackname)
-   return check(trackname, self:__tostring())
+function ConnTrack:prepare (i, b)
+   local key = ffi.cast(key_ptr_t, self.streamer.keys + i * self.entry_size)
+   local dir, flags = fill_key(key, b)
+   self.dirs[i] = dir or -1
+   self.flags[i] = flags or 0
 end
 
+function ConnTrack:prepare_packets (packets, n)
+   local keys, entry_size = self.streamer.keys, self.entry_size
+   local dirs, flags = self.dirs, self.flags
+   for i = 0, n - 1 do
+      local dir, f = fill_key(ffi.cast(key_ptr_t, keys + i * entry_size),
+                              packets[i].data)
+      dirs[i], flags[i] = dir or -1, f or 0
+   end
+end
 
-----
---- IPv4 spec
-
-local spec_v4 = ffi.typeof('conn_spec_ipv4')
-local ipv4 = {
-   __tostring  = genspec.__tostring,
-   reverse = genspec.reverse,
-   check = genspec.check
-}
-ipv4.__index = ipv4
+function ConnTrack:lookup ()
+   local ctab, old = self.ctab, self.streamer
+   if ctab.max_displacement ~= self.max_displacement
+      or ctab.size ~= self.size then
+      self:make_streamer()
+      ffi.copy(self.streamer.entries, old.entries,
+               self.entry_size * self.batch_size)
+   end
+   self.streamer:stream()
+   self.modified = false
+end
 
+local function live (self, value, now)
+   return now - value.last_seen <= self.timeouts[value.state]
+end
 
---- fills `self` with the specifications of
---- the packet in `b` (a byte buffer)
-function ipv4:fill(b)
-   do
-      local hdr_ips = ffi.cast('uint32_t*', b+const.IPV4_SOURCE_OFFSET)
-      self.src_ip = hdr_ips[0]
-      self.dst_ip = hdr_ips[1]
-   end
-   self.protocol = b[const.IPV4_PROTOCOL_OFFSET]
-   if self.protocol == const.IP_TCP or self.protocol == const.IP_UDP then
-      local hdr_ports = ffi.cast('uint16_t*', b+const.IPV4_SOURCE_PORT_OFFSET)
-      self.src_port = hdr_ports[0]
-      self.dst_port = hdr_ports[1]
+function ConnTrack:check (i, now)
+   local dir = self.dirs[i]
+   if dir < 0 then return false end
+   local streamer, entry = self.streamer
+   if self.modified then
+      -- Connections added or removed since lookup() may have moved
+      -- entries around; look the key up again.
+      entry = self.ctab:lookup_ptr(streamer.entries[i].key)
+      if not entry then return false end
+   elseif streamer.entries[i].hash ~= HASH_MAX then
+      entry = streamer:entry_ptr(i)
    else
-      self.src_port, self.dst_port = 0, 0
+      return false
    end
-   return self
+   local value = entry.value
+   if not live(self, value, now) then return false end
+   value.last_seen = now
+   update_state(value, dir, self.flags[i])
+   return true
 end
 
---- inserts `self` in the named tracking table.
---- it's iserted twice: directly and reversed
-do
-   local rev = nil      -- to hold the reversed spec
-   function ipv4:track(trackname)
-      rev = rev or spec_v4()
-      return track(trackname, self:__tostring(), self:reverse(rev):__tostring())
+-- Add KEY in direction DIR unless the table is full.
+function ConnTrack:add (key, dir, flags, now)
+   local ctab = self.ctab
+   if ctab.occupancy >= self.capacity then
+      self:expire(now, self.expire_budget * 4)
+      if ctab.occupancy >= self.capacity then return false end
    end
+   local value = self.value
+   value.last_seen = now
+   value.state = NEW
+   value.origin = dir
+   value.fin = 0
+   update_state(value, dir, flags)
+   ctab:add(key, value, true)
+   self.modified = true
+   return true
 end
 
-spec_v4 = ffi.metatype(spec_v4, ipv4)
+function ConnTrack:track (i, now)
+   local dir = self.dirs[i]
+   if dir < 0 then return nil end
+   return self:add(self.streamer.entries[i].key, dir, self.flags[i], now)
+end
 
+-- Visit up to BUDGET slots of the table, removing expired entries.
+function ConnTrack:expire (now, budget)
+   local ctab = self.ctab
+   local entries = ctab.entries
+   local slots = ctab.size + ctab.max_displacement
+   local i = self.cursor
+   for _ = 1, budget or self.expire_budget do
+      if i >= slots then i = 0 end
+      local entry = entries + i
+      if entry.hash ~= HASH_MAX and not live(self, entry.value, now) then
+         -- Removal shifts the following entries back into slot i, so
+         -- look at it again.
+         ctab:remove_ptr(entry)
+         self.modified = true
+      else
+         i = i + 1
+      end
+   end
+   self.cursor = i
+end
 
--------
---- IPv6 spec
+function ConnTrack:occupancy ()
+   return self.ctab.occupancy
+end
 
-local spec_v6 = ffi.typeof('conn_spec_ipv6')
-local ipv6 = {
-   __tostring  = genspec.__tostring,
-   reverse = genspec.reverse,
-   check = genspec.check
-}
-ipv6.__index = ipv6
+----
 
+local conntracks = {}            -- named tracking tables
 
---- fills `self` with the specifications of
---- the packet in `b` (a byte buffer)
-function ipv6:fill(b)
-   do
-      local hdr_ips = ffi.cast('ipv6_addr*', b+const.IPV6_SOURCE_OFFSET)
-      self.src_ip = hdr_ips[0]
-      self.dst_ip = hdr_ips[1]
-   end
-   self.protocol = b[const.IPV6_NEXT_HEADER_OFFSET]
-   if self.protocol == const.IP_TCP or self.protocol == const.IP_UDP then
-      local hdr_ports = ffi.cast('uint16_t*', b+const.IPV6_SOURCE_PORT_OFFSET)
-      self.src_port = hdr_ports[0]
-      self.dst_port = hdr_ports[1]
-   else
-      self.src_port, self.dst_port = 0, 0
-   end
-   return self
+local function define (name, conf)
+   if not name then return end
+   conntracks[name] = conntracks[name] or new_table(conf)
+   return conntracks[name]
 end
 
+local function clear ()
+   conntracks = {}
+end
+
+-----------------
+--- spec objects, for looking up one packet at a time
+
+local spec = {
+   key = key_t(),
+   dir = 0,
+   flags = 0
+}
+
+--- returns a binary string, usable as a table key
+function spec:__tostring()
+   return ffi.string(self.key, ffi.sizeof(self.key))
+end
+
+--- checks if the spec is present in the named tracking table
+function spec:check(trackname)
+   local t = conntracks[trackname]
+   local entry = t.ctab:lookup_ptr(self.key)
+   local now = engine.now()
+   if not entry or not live(t, entry.value, now) then return false end
+   entry.value.last_seen = now
+   update_state(entry.value, self.dir, self.flags)
+   return true
+end
 
 --- inserts `self` in the named tracking table.
---- it's iserted twice: directly and reversed
-do
-   local rev = nil
-   function ipv6:track(trackname)
-      rev = rev or spec_v6()
-      return track(trackname, self:__tostring(), self:reverse(rev):__tostring())
-   end
+function spec:track(trackname)
+   local t = conntracks[trackname]
+   return t:add(self.key, self.dir, self.flags, engine.now())
 end
 
+setmetatable(spec, {__index = spec, __tostring = spec.__tostring})
 
-spec_v6 = ffi.metatype(spec_v6, ipv6)
+local function new_spec (b)
+   if not b then return nil end
+   local dir, flags = fill_key(spec.key, b)
+   if not dir then return nil end
+   spec.dir, spec.flags = dir, flags
+   return spec
+end
 
 ------
 
-local new_spec=nil
-do
-   local specv4 = spec_v4()
-   local specv6 = spec_v6()
-   new_spec = function (b)
-      if not b then return nil end
-      local ethertype = ffi.cast('uint16_t*', b+const.ETHERTYPE_OFFSET)[0]
-      if ethertype == const.ETHERTYPE_IPV4 then
-         return specv4:fill(b)
+local function selftest ()
+   print("selftest: conntrack")
+   local packet = require("core.packet")
+   local datagram = require("lib.protocol.datagram")
+   local ethernet = require("lib.protocol.ethernet")
+   local ipv4 = require("lib.protocol.ipv4")
+   local ipv6 = require("lib.protocol.ipv6")
+   local tcp = require("lib.protocol.tcp")
+   local udp = require("lib.protocol.udp")
+
+   local function make (family, src, dst, sport, dport, proto, flags)
+      local dg = datagram:new()
+      local l4
+      if proto == "tcp" then
+         flags = flags or {}
+         flags.src_port, flags.dst_port = sport, dport
+         l4 = tcp:new(flags)
+      else
+         l4 = udp:new({src_port=sport, dst_port=dport})
       end
-      if ethertype == const.ETHERTYPE_IPV6 then
-         return specv6:fill(b)
+      dg:push(l4)
+      if family == 4 then
+         dg:push(ipv4:new({src=ipv4:pton(src), dst=ipv4:pton(dst),
+                           protocol=proto == "tcp" and 6 or 17}))
+         dg:push(ethernet:new({type=0x0800}))
+      else
+         dg:push(ipv6:new({src=ipv6:pton(src), dst=ipv6:pton(dst),
+                           next_header=proto == "tcp" and 6 or 17}))
+         dg:push(ethernet:new({type=0x86dd}))
       end
+      return dg:packet()
    end
+
+   local now = 1000
+   local t = new_table({capacity=4, batch_size=4})
+   local function check_and_track (p, track)
+      t:prepare(0, p.data)
+      t:lookup()
+      if t:check(0, now) then return "hit" end
+      if track and t:track(0, now) then return "tracked" end
+      return "miss"
+   end
+
+   -- Both directions map to the same entry, for IPv4 and IPv6.
+   local out4 = make(4, "10.0.0.1", "10.0.0.2", 1234, 80, "tcp", {syn=1})
+   local in4 = make(4, "10.0.0.2", "10.0.0.1", 80, 1234, "tcp", {syn=1, ack=1})
+   assert(check_and_track(in4) == "miss")
+   assert(check_and_track(out4, true) == "tracked")
+   assert(check_and_track(in4) == "hit")
+   assert(check_and_track(out4) == "hit")
+   local out6 = make(6, "fe80::1", "fe80::2", 5353, 53, "udp")
+   local in6 = make(6, "fe80::2", "fe80::1", 53, 5353, "udp")
+   assert(check_and_track(out6, true) == "tracked")
+   assert(check_and_track(in6) == "hit")
+   assert(t:occupancy() == 2)
+
+   -- Unanswered connections expire sooner than established ones.
+   local lone = make(4, "10.0.0.3", "10.0.0.4", 1, 2, "udp")
+   assert(check_and_track(lone, true) == "tracked")
+   now = now + 61
+   assert(check_and_track(lone) == "miss")
+   assert(check_and_track(out4) == "hit")
+   t:expire(now, 1e6)
+   assert(t:occupancy() == 2)
+
+   -- FINs in both directions close TCP connections.
+   local fin_out = make(4, "10.0.0.1", "10.0.0.2", 1234, 80, "tcp",
+                           {fin=1, ack=1})
+   local fin_in = make(4, "10.0.0.2", "10.0.0.1", 80, 1234, "tcp",
+                          {fin=1, ack=1})
+   assert(check_and_track(fin_out) == "hit")
+   assert(check_and_track(fin_in) == "hit")
+   now = now + 11
+   assert(check_and_track(out4) == "miss")
+   assert(check_and_track(in6) == "hit")
+
+   -- The table does not grow beyond its capacity.
+   for i = 1, 8 do
+      local p = make(4, "10.0.1.1", "10.0.1.2", i, 9, "udp")
+      local result = check_and_track(p, true)
+      packet.free(p)
+      assert(result == (i <= 3 and "tracked" or "miss"))
+   end
+   assert(t:occupancy() == 4)
+   now = now + 61
+   local p = make(4, "10.0.2.1", "10.0.2.2", 1, 9, "udp")
+   assert(check_and_track(p, true) == "tracked")
+
+   -- The spec API works on named tables.
+   define("selftest")
+   local s = new_spec(out4.data)
+   assert(not s:check("selftest"))
+   assert(s:track("selftest"))
+   assert(new_spec(in4.data):check("selftest"))
+   clear()
+
+   print("selftest: ok")
 end
 
 return {
    define = define,
    spec = new_spec,
    clear = clear,
+   selftest = selftest
 }
-
@@ -0,0 +1,155 @@
+-- Use of this source code is governed by the Apache 2.0 license; see COPYING.
+
+module(...,package.seeall)
+
+local ffi = require("ffi")
+local counter = require("core.counter")
+local lib = require("core.lib")
+local link = require("core.link")
+local packet = require("core.packet")
+local multi_filter = require("lib.pcap.multi_filter")
+
+PcapClassifier = {}
+
+-- PcapClassifier is an app that forwards each packet to the output
+-- named after the first of several classes whose filter expression
+-- matches the packet.  All filters are evaluated by a single compiled
+-- program (see lib.pcap.multi_filter), so the cost per packet grows
+-- much slower than the number of classes.
+--
+-- conf:
+--   classes = array of { name = <output>, filter = <pcap-filter(7)> }
+--   default = optional output for packets that match no class; such
+--             packets are dropped otherwise
+local classifier_config_params = {
+   classes = {required=true},
+   default = {default=false}
+}
+
+function PcapClassifier:new (conf)
+   conf = lib.parse(conf, classifier_config_params)
+   local names, filters = {}, {}
+   for i, class in ipairs(conf.classes) do
+      assert(class.name and class.filter,
+             "PcapClassifier class needs a name and a filter")
+      names[i], filters[i] = class.name, class.filter
+   end
+   local o = {
+      names = names,
+      default = conf.default,
+      match = multi_filter.first_match(filters),
+      outputs = {},
+      shm = { rxerrors = {counter} }
+   }
+   return setmetatable(o, { __index = PcapClassifier })
+end
+
+function PcapClassifier:link ()
+   -- Index the outputs by class number, with the default output (or
+   -- nothing) in slot 0 and in the slot of any unlinked class.
+   local default = self.default and self.output[self.default] or false
+   self.outputs[0] = default
+   for i, name in ipairs(self.names) do
+      self.outputs[i] = self.output[name] or default
+   end
+end
+
+function PcapClassifier:push ()
+   local input = assert(self.input.input, "input port not found")
+   local match, outputs = self.match, self.outputs
+   local dropped = 0
+   for _ = 1, link.nreadable(input) do
+      local p = link.receive(input)
+      local output = outputs[match(p.data, p.length) or 0]
+      if output then
+         link.transmit(output, p)
+      else
+         packet.free(p)
+         dropped = dropped + 1
+      end
+   end
+   if dropped > 0 then counter.add(self.shm.rxerrors, dropped) end
+end
+
+function selftest ()
+   print("selftest: pcap_classifier")
+   local config = require("core.config")
+   local pcap = require("apps.pcap.pcap")
+   local basic_apps = require("apps.basic.basic_apps")
+   local pf = require("pf")
+   local pcap_lib = require("lib.pcap.pcap")
+
+   local classes = {
+      { name = "dns", filter = "udp port 53" },
+      { name = "tcp6", filter = "ip6 and tcp" },
+      { name = "tcp", filter = "tcp" },
+      { name = "unlinked", filter = "udp" },
+      { name = "v4", filter = "ip" }
+   }
+   local input = "apps/packet_filter/samples/v4.pcap"
+   local input6 = "apps/packet_filter/samples/v6.pcap"
+
+   -- Count what a cascade of PcapFilter-style filters would do.
+   local expected, total = {}, 0
+   for _, class in ipairs(classes) do
+      class.match = pf.compile_filter(class.filter)
+   end
+   for _, file in ipairs{input, input6} do
+      for record in pcap_lib.records(file) do
+         local data = ffi.cast("uint8_t *", record)
+         local class = "default"
+         for _, c in ipairs(classes) do
+            if c.match(data, #record) then
+               class = c.name
+               break
+            end
+         end
+         if class == "unlinked" then class = "default" end
+         expected[class] = (expected[class] or 0) + 1
+         total = total + 1
+      end
+   end
+
+   local c = config.new()
+   config.app(c, "source4", pcap.PcapReader, input)
+   config.app(c, "source6", pcap.PcapReader, input6)
+   config.app(c, "join", basic_apps.Join)
+   config.app(c, "classifier", PcapClassifier,
+              {classes=classes, default="default"})
+   config.link(c, "source4.output -> join.in4")
+   config.link(c, "source6.output -> join.in6")
+   config.link(c, "join.output -> classifier.input")
+   for _, name in ipairs{"dns", "tcp6", "tcp", "v4", "default"} do
+      config.app(c, name, basic_apps.Sink)
+      config.link(c, "classifier."..name.." -> "..name..".input")
+   end
+   local function run ()
+      engine.configure(config.new())
+      engine.configure(c)
+      local classifier = engine.app_table.classifier
+      engine.main{done=function ()
+                     return engine.app_table.source4.done
+                        and engine.app_table.source6.done
+                        and link.empty(classifier.input.input)
+                  end,
+                  no_report=true}
+      return classifier
+   end
+
+   run()
+   local received = 0
+   for _, name in ipairs{"dns", "tcp6", "tcp", "v4", "default"} do
+      local n = link.stats(engine.app_table[name].input.input).txpackets
+      assert(n == (expected[name] or 0), name)
+      received = received + n
+   end
+   assert(received == total)
+   assert(expected.dns and expected.tcp6 and expected.tcp and expected.default)
+
+   -- Without a default output, unmatched packets are dropped.
+   config.app(c, "classifier", PcapClassifier, {classes=classes})
+   local classifier = run()
+   assert(counter.read(classifier.shm.rxerrors) == expected.default)
+   engine.configure(config.new())
+   print("selftest: ok")
+end
@@ -10,7 +10,8 @@ local counter = require("core.counter")
 local lib = require("core.lib")
 local link = require("core.link")
 local packet = require("core.packet")
-local C = require("ffi").C
+local ffi = require("ffi")
+local C = ffi.C
 local S = require("syscall")
 
 local pf = require("pf")        -- pflua
@@ -30,6 +31,7 @@ PcapFilter = {}
 --   filter      = string expression specifying which packets to accept
 --                 syntax: http://www.tcpdump.org/manpages/pcap-filter.7.html
 --   state_table = optional string name to use for stateful-tracking table
+--   state_table_capacity = optional maximum number of tracked connections
 --   native      = optional boolean argument that enables dynasm compilation
 function PcapFilter:new (conf)
    assert(conf.filter, "PcapFilter conf.filter parameter missing")
@@ -38,9 +40,14 @@ function PcapFilter:new (conf)
       -- XXX Investigate the latency impact of filter compilation.
       accept_fn = pf.compile_filter(conf.filter, { native = conf.native or false }),
       state_table = conf.state_table or false,
-      shm = { rxerrors = {counter}, sessions_established = {counter} }
+      shm = { rxerrors = {counter}, sessions_established = {counter},
+              sessions_untracked = {counter} }
    }
-   if conf.state_table then conntrack.define(conf.state_table) end
+   if conf.state_table then
+      o.conntrack = conntrack.define(conf.state_table,
+                                     {capacity=conf.state_table_capacity})
+      o.batch = ffi.new("struct packet *[?]", o.conntrack.batch_size)
+   end
 
    alarms.add_to_inventory(
       {alarm_type_id='filtered-packets', alarm_type_qualifier=conf.alarm_type_qualifier},
@@ -62,17 +69,11 @@ function PcapFilter:push ()
 
    self.filtered_packets_alarm:check()
 
+   if self.conntrack then return self:push_stateful(i, o) end
+
    while not link.empty(i) do
       local p = link.receive(i)
-      local spec = self.state_table and conntrack.spec(p.data)
-
-      if spec and spec:check(self.state_table) then
-         link.transmit(o, p)
-      elseif self.accept_fn(p.data, p.length) then
-         if spec then
-            spec:track(self.state_table)
-            counter.add(self.shm.sessions_established)
-         end
+      if self.accept_fn(p.data, p.length) then
          link.transmit(o, p)
       else
          packet.free(p)
@@ -81,6 +82,41 @@ function PcapFilter:push ()
    end
 end
 
+-- Look up packets in the state table in batches, and only run the
+-- filter on packets that do not belong to a tracked connection.
+function PcapFilter:push_stateful (i, o)
+   local ct, accept_fn, batch = self.conntrack, self.accept_fn, self.batch
+   local now = engine.now()
+   while not link.empty(i) do
+      local n = math.min(link.nreadable(i), ct.batch_size)
+      for j = 0, n - 1 do batch[j] = link.receive(i) end
+      ct:prepare_packets(batch, n)
+      ct:lookup()
+      for j = 0, n - 1 do
+         local p = batch[j]
+         if ct:check(j, now) then
+            link.transmit(o, p)
+         elseif accept_fn(p.data, p.length) then
+            local tracked = ct:track(j, now)
+            if tracked then
+               counter.add(self.shm.sessions_established)
+            elseif tracked == false then
+               counter.add(self.shm.sessions_untracked)
+            end
+            link.transmit(o, p)
+         else
+            packet.free(p)
+            counter.add(self.shm.rxerrors)
+         end
+      end
+   end
+end
+
+-- Reclaim expired connections a little at a time.
+function PcapFilter:tick ()
+   if self.conntrack then self.conntrack:expire(engine.now()) end
+end
+
 -- Testing
 
 local pcap = require("apps.pcap.pcap")
@@ -0,0 +1,539 @@
+-- Use of this source code is governed by the Apache 2.0 license; see COPYING.
+
+module(...,package.seeall)
+
+-- Always-on packet capture into a ring of preallocated pcap segments.
+--
+-- The Capture app copies packets into memory-mapped segment files and
+-- moves on to the next segment when the current one is full, so that
+-- the ring always holds the most recent traffic.  The data plane never
+-- makes a system call: segments are allocated and mapped up front, and
+-- flushing them to disk is left to a separate rotator process.
+--
+-- Capturing can be frozen, either by setting the "freeze" field of the
+-- ring control file (see freeze() and thaw() below) or through the
+-- app's configuration.  A frozen ring is left untouched by the data
+-- plane, and the rotator exports its contents, oldest packet first, to
+-- a snapshot file in the capture directory.  Once the app has
+-- acknowledged a freeze, it does not resume capturing until the
+-- snapshot has been exported, even if the ring is thawed earlier.
+
+local ffi = require("ffi")
+local S = require("syscall")
+local lib = require("core.lib")
+local link = require("core.link")
+local packet = require("core.packet")
+local counter = require("core.counter")
+local worker = require("core.worker")
+local pcap = require("lib.pcap.pcap")
+local pf = require("pf")
+
+local C = ffi.C
+local floor, min = math.floor, math.min
+
+local file_header_t = pcap.file_header_t
+local record_header_ptr_t = ffi.typeof("$*", pcap.record_header_t)
+local file_header_size = ffi.sizeof(pcap.file_header_t)
+local record_header_size = ffi.sizeof(pcap.record_header_t)
+
+-- Ring control file shared by the capture app, the rotator, and tools
+-- that freeze the capture.
+local ring_t = ffi.typeof[[
+struct {
+   uint32_t nsegments;  /* number of segment files */
+   uint32_t current;    /* index of the segment being written */
+   uint64_t freeze;     /* set to a non-zero value to stop capturing */
+   uint64_t frozen;     /* value of freeze acknowledged by the app,
+                           until thawed and exported */
+   uint64_t exported;   /* value of frozen last exported by the rotator */
+   struct {
+      uint64_t sequence; /* order in which segments were started, 0 if unused */
+      uint64_t length;   /* bytes of valid data, including the file header */
+   } segment[?];
+}
+]]
+local ring_ptr_t = ffi.typeof("$&", ring_t)
+
+local function ring_filename (directory)
+   return directory.."/ring"
+end
+
+local function segment_filename (directory, i)
+   return ("%s/segment-%d.pcap"):format(directory, i)
+end
+
+local function snapshot_filename (directory, n)
+   return ("%s/snapshot-%d.pcap"):format(directory, n)
+end
+
+-- Map FILENAME into memory.  When SIZE is given the file is created,
+-- its blocks are reserved, and its pages are faulted in, so that
+-- writing to the mapping later on does not have to wait for the file
+-- system.
+local function map_file (filename, size)
+   local create = size ~= nil
+   local fd, err
+   if create then
+      fd, err = S.open(filename, "creat, rdwr", "rusr, wusr, rgrp, roth")
+   else
+      fd, err = S.open(filename, "rdwr")
+   end
+   if not fd then error(filename..": "..tostring(err)) end
+   if create then
+      assert(fd:ftruncate(size), "ftruncate failed: "..filename)
+      -- Not every file system supports fallocate(); tmpfs and ext4 do.
+      S.fallocate(fd, 0, 0, size)
+   else
+      size = fd:fstat().size
+   end
+   local flags = create and "shared, populate" or "shared"
+   local mem, err = S.mmap(nil, size, "read, write", flags, fd, 0)
+   fd:close()
+   if not mem then error("mmap failed: "..filename..": "..tostring(err)) end
+   return ffi.cast("uint8_t *", mem), size
+end
+
+local function map_ring (directory, nsegments)
+   local size = nsegments and ffi.sizeof(ring_t, nsegments)
+   local mem, size = map_file(ring_filename(directory), size)
+   return ffi.cast(ring_ptr_t, mem), mem, size
+end
+
+-- Stop capturing into the ring in DIRECTORY.  Returns the freeze
+-- number, which names the snapshot written by the rotator.
+function freeze (directory)
+   local ring, mem, size = map_ring(directory)
+   if ring.freeze == 0 then
+      local last = ring.exported > ring.frozen and ring.exported or ring.frozen
+      ring.freeze = last + 1
+   end
+   local n = tonumber(ring.freeze)
+   S.munmap(mem, size)
+   return n, snapshot_filename(directory, n)
+end
+
+-- Resume capturing into the ring in DIRECTORY once the current
+-- snapshot, if any, has been exported.
+function thaw (directory)
+   local ring, mem, size = map_ring(directory)
+   ring.freeze = 0
+   S.munmap(mem, size)
+end
+
+Capture = {
+   shm = {
+      captured = {counter},         -- packets written to the ring
+      captured_bytes = {counter},   -- bytes written, after truncation
+      filtered = {counter},         -- packets rejected by the filter
+      uncaptured = {counter},       -- packets seen while frozen
+      segments = {counter}          -- segments started
+   }
+}
+
+local capture_config_params = {
+   -- Directory holding the ring control file and the segments.
+   directory = {required=true},
+   -- Number of segment files in the ring.
+   segments = {default=8},
+   -- Size of each segment file in bytes.
+   segment_size = {default=64*1024*1024},
+   -- Move on to the next segment after this many seconds, so that the
+   -- ring holds at most SEGMENTS * SEGMENT_DURATION seconds of traffic.
+   segment_duration = {},
+   -- Capture at most this many bytes of each packet.
+   snaplen = {default=65535},
+   -- Only packets that match this pflang filter are captured.
+   filter = {},
+   -- Do not capture; set this to freeze the ring via reconfiguration.
+   freeze = {default=false},
+   -- Lock the segments in memory so that writes never page fault.
+   lock = {default=true},
+   -- Run a rotator process that flushes segments and exports
+   -- snapshots, and the interval at which it does so in seconds.
+   rotator = {default=true},
+   flush_interval = {default=0.1}
+}
+
+function Capture:new (conf)
+   conf = lib.parse(conf, capture_config_params)
+   assert(conf.segments >= 2, "need at least two segments")
+   assert(conf.snaplen + record_header_size + file_header_size
+             <= conf.segment_size, "snaplen exceeds segment_size")
+   S.mkdir(conf.directory, "rwxu, rgrp, xgrp, roth, xoth")
+   local o = {
+      conf = conf,
+      directory = conf.directory,
+      nsegments = conf.segments,
+      segment_size = conf.segment_size,
+      duration = conf.segment_duration,
+      snaplen = conf.snaplen,
+      filter = conf.filter and pf.compile_filter(conf.filter),
+      segments = {},
+      sequence = 1
+   }
+   setmetatable(o, {__index = Capture})
+   o.ring, o.ring_mem, o.ring_size = map_ring(conf.directory, conf.segments)
+   local header = ffi.new(file_header_t)
+   header.magic_number = 0xa1b2c3d4
+   header.version_major = 2
+   header.version_minor = 4
+   header.snaplen = conf.snaplen
+   header.network = 1
+   for i = 0, conf.segments - 1 do
+      local mem = map_file(segment_filename(conf.directory, i),
+                           conf.segment_size)
+      if conf.lock and not S.mlock(mem, conf.segment_size) then
+         print("warning: apps.pcap.capture: could not lock segments in memory")
+         conf.lock = false
+      end
+      ffi.copy(mem, header, file_header_size)
+      o.segments[i] = mem
+   end
+   -- Keep numbering snapshots where a previous capture left off.
+   local ring = o.ring
+   local last = ring.exported > ring.frozen and ring.exported or ring.frozen
+   ffi.fill(o.ring_mem, o.ring_size)
+   ring.nsegments = conf.segments
+   ring.current = 0
+   ring.segment[0].sequence = o.sequence
+   ring.segment[0].length = file_header_size
+   ring.exported = last
+   o:set_freeze(conf.freeze)
+   o.base, o.pos = o.segments[0], file_header_size
+   o.segment_start = C.get_unix_time()
+   if conf.rotator then
+      o.rotator = "pcap capture rotator for "..conf.directory
+      worker.start(o.rotator,
+                   ("require('apps.pcap.capture').rotate(%q, %s)")
+                      :format(conf.directory, conf.flush_interval))
+   end
+   return o
+end
+
+-- Only the freeze key can change without reallocating the ring.
+function Capture:reconfig (conf)
+   conf = lib.parse(conf, capture_config_params)
+   local old = lib.deepcopy(self.conf)
+   old.freeze, old.lock = conf.freeze, conf.lock
+   if lib.equal(old, conf) then
+      self:set_freeze(conf.freeze)
+      self.conf.freeze = conf.freeze
+   else
+      self:stop()
+      for k, v in pairs(Capture:new(conf)) do self[k] = v end
+   end
+end
+
+function Capture:set_freeze (freeze)
+   local ring = self.ring
+   if freeze and ring.freeze == 0 then
+      local last = ring.exported > ring.frozen and ring.exported or ring.frozen
+      ring.freeze = last + 1
+   elseif not freeze then
+      ring.freeze = 0
+   end
+end
+
+-- Start writing to the next segment, overwriting the oldest one.
+function Capture:advance (now)
+   local ring = self.ring
+   ring.segment[ring.current].length = self.pos
+   local next = (ring.current + 1) % self.nsegments
+   self.sequence = self.sequence + 1
+   ring.segment[next].sequence = self.sequence
+   ring.segment[next].length = file_header_size
+   ring.current = next
+   self.base, self.pos = self.segments[next], file_header_size
+   self.segment_start = now
+   counter.add(self.shm.segments)
+end
+
+function Capture:push ()
+   local input, output = self.input.input, self.output.output
+   local ring = self.ring
+   if ring.freeze ~= 0 or ring.frozen ~= 0 then
+      local n = link.nreadable(input)
+      for _ = 1, n do
+         local p = link.receive(input)
+         if output then link.transmit(output, p) else packet.free(p) end
+      end
+      counter.add(self.shm.uncaptured, n)
+      return
+   end
+   local now = C.get_unix_time()
+   if self.duration and now - self.segment_start >= self.duration then
+      self:advance(now)
+   end
+   local sec = floor(now)
+   local usec = floor((now - sec) * 1e6)
+   local filter, snaplen, size = self.filter, self.snaplen, self.segment_size
+   local base, pos = self.base, self.pos
+   local captured, bytes, filtered = 0, 0, 0
+   for _ = 1, link.nreadable(input) do
+      local p = link.receive(input)
+      if filter and not filter(p.data, p.length) then
+         filtered = filtered + 1
+      else
+         local len = min(p.length, snaplen)
+         if pos + record_header_size + len > size then
+            self.pos = pos
+            self:advance(now)
+            base, pos = self.base, self.pos
+         end
+         local record = ffi.cast(record_header_ptr_t, base + pos)
+         record.ts_sec, record.ts_usec = sec, usec
+         record.incl_len, record.orig_len = len, p.length
+         ffi.copy(base + pos + record_header_size, p.data, len)
+         pos = pos + record_header_size + len
+         captured, bytes = captured + 1, bytes + len
+      end
+      if output then link.transmit(output, p) else packet.free(p) end
+   end
+   self.pos = pos
+   ring.segment[ring.current].length = pos
+   counter.add(self.shm.captured, captured)
+   counter.add(self.shm.captured_bytes, bytes)
+   counter.add(self.shm.filtered, filtered)
+end
+
+-- Acknowledge freeze requests.  Segment lengths are up to date after
+-- every push, so the ring is consistent once frozen is set.  After a
+-- thaw, frozen is cleared only when the rotator has exported the
+-- snapshot, since it may still be reading the segments.
+function Capture:tick ()
+   local ring = self.ring
+   local freeze, frozen = ring.freeze, ring.frozen
+   if freeze ~= 0 then
+      if frozen ~= freeze then ring.frozen = freeze end
+   elseif frozen ~= 0 and frozen == ring.exported then
+      ring.frozen = 0
+   end
+end
+
+function Capture:stop ()
+   if self.rotator then worker.stop(self.rotator) end
+   for i = 0, self.nsegments - 1 do
+      S.munmap(self.segments[i], self.segment_size)
+   end
+   S.munmap(self.ring_mem, self.ring_size)
+end
+
+-- The rotator runs in its own process and does the slow work on
+-- behalf of a Capture app: writing completed segments back to disk and
+-- exporting snapshots of frozen rings.
+Rotator = {}
+
+function Rotator.new (directory)
+   local ring, mem, size = map_ring(directory)
+   local o = {
+      directory = directory,
+      ring = ring, ring_mem = mem, ring_size = size,
+      nsegments = ring.nsegments,
+      segments = {},
+      flushed = {}
+   }
+   for i = 0, o.nsegments - 1 do
+      o.segments[i], o.segment_size =
+         map_file(segment_filename(directory, i))
+      o.flushed[i] = 0
+   end
+   return setmetatable(o, {__index = Rotator})
+end
+
+function Rotator:step ()
+   local ring = self.ring
+   local current = ring.segment[ring.current].sequence
+   for i = 0, self.nsegments - 1 do
+      local sequence = ring.segment[i].sequence
+      if sequence > self.flushed[i] and sequence < current then
+         S.msync(self.segments[i], self.segment_size, "sync")
+         self.flushed[i] = sequence
+      end
+   end
+   -- Export acknowledged freezes even if the ring has been thawed
+   -- since: the app waits for the export before it resumes capturing.
+   local frozen = ring.frozen
+   if frozen ~= 0 and frozen ~= ring.exported then
+      self:export(snapshot_filename(self.directory, tonumber(frozen)))
+      ring.exported = frozen
+   end
+end
+
+-- Write the packets in the ring to FILENAME, oldest first.
+function Rotator:export (filename)
+   local ring, order = self.ring, {}
+   for i = 0, self.nsegments - 1 do
+      if ring.segment[i].sequence ~= 0 then table.insert(order, i) end
+   end
+   table.sort(order, function (a, b)
+      return ring.segment[a].sequence < ring.segment[b].sequence
+   end)
+   local tmp = filename..".tmp"
+   local fd = assert(S.open(tmp, "creat, wronly, trunc",
+                            "rusr, wusr, rgrp, roth"))
+   local function write (ptr, len)
+      while len > 0 do
+         local written = assert(fd:write(ptr, len))
+         ptr, len = ptr + written, len - written
+      end
+   end
+   write(self.segments[order[1]], file_header_size)
+   for _, i in ipairs(order) do
+      write(self.segments[i] + file_header_size,
+            ring.segment[i].length - file_header_size)
+   end
+   fd:close()
+   assert(S.rename(tmp, filename))
+end
+
+function rotate (directory, interval)
+   local rotator = Rotator.new(directory)
+   while true do
+      rotator:step()
+      C.usleep(interval * 1e6)
+   end
+end
+
+function selftest ()
+   print("selftest: apps.pcap.capture")
+   local config = require("core.config")
+   local basic_apps = require("apps.basic.basic_apps")
+   local PcapReader = require("apps.pcap.pcap").PcapReader
+   local input = "apps/packet_filter/samples/v6.pcap"
+
+   local directory = os.tmpname()
+   os.remove(directory)
+
+   local prefixes = {}
+   for data in pcap.records(input) do
+      prefixes[data], prefixes[data:sub(1, 128)] = true, true
+   end
+
+   local function snapshot_records (filename)
+      local file = pcap.MappedReader.new(filename)
+      local n = 0
+      while true do
+         local ptr, len = file:next()
+         if not ptr then break end
+         assert(prefixes[ffi.string(ptr, len)])
+         n = n + 1
+      end
+      file:close()
+      return n
+   end
+
+   local function run (conf, loop, duration)
+      local c = config.new()
+      config.app(c, "source", PcapReader, {filename=input, loop=loop})
+      config.app(c, "capture", Capture, conf)
+      config.app(c, "sink", basic_apps.Sink)
+      config.link(c, "source.output -> capture.input")
+      config.link(c, "capture.output -> sink.input")
+      engine.configure(c)
+      if loop then
+         engine.main{duration=duration, no_report=true}
+      else
+         engine.main{done=function () return engine.app_table.source.done end,
+                     no_report=true}
+         engine.main{duration=0.01, no_report=true}
+      end
+      return engine.app_table.capture
+   end
+
+   -- Filtered capture of the whole sample file.
+   do
+      local capture = run({directory=directory, segments=2,
+                           segment_size=256*1024, filter="icmp6",
+                           rotator=false})
+      assert(counter.read(capture.shm.captured) == 49)
+      assert(counter.read(capture.shm.filtered) == 161 - 49)
+      local n, filename = freeze(directory)
+      engine.main{duration=0.01, no_report=true}
+      local rotator = Rotator.new(directory)
+      rotator:step()
+      assert(snapshot_records(filename) == 49)
+      engine.configure(config.new())
+   end
+
+   -- Looping capture wraps around the ring and keeps the latest
+   -- segments.  Nothing is written while frozen.
+   do
+      local conf = {directory=directory, segments=4, segment_size=64*1024,
+                    snaplen=128, rotator=false}
+      local capture = run(conf, true, 0.05)
+      local ring = capture.ring
+      assert(counter.read(capture.shm.segments) > 4)
+      local n, filename = freeze(directory)
+      engine.main{duration=0.01, no_report=true}
+      assert(ring.frozen == n)
+      local current, length = ring.current, ring.segment[ring.current].length
+      local captured = counter.read(capture.shm.captured)
+      engine.main{duration=0.01, no_report=true}
+      assert(ring.current == current)
+      assert(ring.segment[current].length == length)
+      assert(counter.read(capture.shm.captured) == captured)
+      assert(counter.read(capture.shm.uncaptured) > 0)
+      local rotator = Rotator.new(directory)
+      rotator:step()
+      assert(ring.exported == n)
+      local records = snapshot_records(filename)
+      assert(records > 0 and records < tonumber(captured))
+      -- Thawing resumes capture.
+      thaw(directory)
+      engine.main{duration=0.01, no_report=true}
+      assert(ring.frozen == 0)
+      assert(counter.read(capture.shm.captured) > captured)
+      -- Thawing right after freezing leaves the ring frozen until the
+      -- snapshot has been exported.
+      n, filename = freeze(directory)
+      engine.main{duration=0.01, no_report=true}
+      assert(ring.frozen == n)
+      thaw(directory)
+      current, length = ring.current, ring.segment[ring.current].length
+      captured = counter.read(capture.shm.captured)
+      engine.main{duration=0.01, no_report=true}
+      assert(ring.frozen == n)
+      assert(ring.current == current)
+      assert(ring.segment[current].length == length)
+      assert(counter.read(capture.shm.captured) == captured)
+      rotator:step()
+      assert(ring.exported == n)
+      assert(snapshot_records(filename) > 0)
+      engine.main{duration=0.01, no_report=true}
+      assert(ring.frozen == 0)
+      assert(counter.read(capture.shm.captured) > captured)
+      -- Freezing through reconfiguration keeps the app running.
+      conf = lib.deepcopy(conf)
+      conf.freeze = true
+      local c = config.new()
+      config.app(c, "source", PcapReader, {filename=input, loop=true})
+      config.app(c, "capture", Capture, conf)
+      config.app(c, "sink", basic_apps.Sink)
+      config.link(c, "source.output -> capture.input")
+      config.link(c, "capture.output -> sink.input")
+      engine.configure(c)
+      assert(engine.app_table.capture == capture)
+      engine.main{duration=0.01, no_report=true}
+      assert(ring.frozen ~= 0 and ring.frozen == ring.freeze)
+      engine.configure(config.new())
+   end
+
+   -- The rotator process exports snapshots on its own.
+   do
+      run({directory=directory, segments=2, segment_size=1024*1024,
+           flush_interval=0.01})
+      local n, filename = freeze(directory)
+      local deadline = engine.now() + 5
+      engine.main{done=function ()
+                     return S.stat(filename) or engine.now() > deadline
+                  end, no_report=true}
+      assert(snapshot_records(filename) == 161)
+      engine.configure(config.new())
+   end
+
+   for _, file in ipairs(S.util.dirtable(directory)) do
+      if file ~= "." and file ~= ".." then os.remove(directory.."/"..file) end
+   end
+   S.rmdir(directory)
+   print("selftest: ok")
+end
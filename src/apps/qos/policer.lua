@@ -0,0 +1,747 @@
+-- Use of this source code is governed by the Apache 2.0 license; see COPYING.
+
+-- Hierarchical token-bucket policing and shaping.
+--
+-- Packets are sorted into classes (by VLAN, DSCP and/or pcap filter)
+-- and optionally attributed to a subscriber (by IP address).  A packet
+-- conforms if the bucket of its subscriber, the buckets of its class
+-- and of the class's ancestors, and the aggregate bucket all hold
+-- enough tokens for it.  The Policer drops packets that do not
+-- conform.  The Shaper charges them to the buckets anyway and holds
+-- them on a calendar queue (a timing wheel of fixed-length slots) until
+-- the buckets will have refilled.
+--
+-- Time is read from the TSC once per breath, and the class and
+-- aggregate buckets are refilled once per breath.  Subscriber buckets
+-- live in a ctable and are refilled when they are looked up.  A few
+-- slots of the ctable are scanned each breath for idle subscribers,
+-- whose buckets have refilled completely: these are removed, since a
+-- full bucket is no different from a new one.
+
+module(..., package.seeall)
+
+local ffi     = require("ffi")
+local bit     = require("bit")
+local lib     = require("core.lib")
+local link    = require("core.link")
+local packet  = require("core.packet")
+local counter = require("core.counter")
+local ctable  = require("lib.ctable")
+local tsc     = require("lib.tsc")
+local pf      = require("pf")
+
+local band, rshift, lshift = bit.band, bit.rshift, bit.lshift
+local min, max, floor = math.min, math.max, math.floor
+local receive, transmit = link.receive, link.transmit
+local ntohs = lib.ntohs
+
+local ether_header_len = 14
+local dot1q_header_len = 4
+local ethertype_ipv4 = 0x0800
+local ethertype_ipv6 = 0x86dd
+local ethertype_dot1q = 0x8100
+
+local uint16_ptr_t = ffi.typeof("uint16_t *")
+
+-- A token bucket.  Tokens are bytes; the stamp is in TSC ticks since
+-- the app was started.
+local bucket_t = ffi.typeof[[
+   struct { double tokens, stamp; }
+]]
+
+-- Subscriber keys: the address to take from the IP header.
+local subscriber_keys = {
+   ["ipv4-src"] = { ethertype = ethertype_ipv4, offset = 12, size = 4 },
+   ["ipv4-dst"] = { ethertype = ethertype_ipv4, offset = 16, size = 4 },
+   ["ipv6-src"] = { ethertype = ethertype_ipv6, offset = 8, size = 16 },
+   ["ipv6-dst"] = { ethertype = ethertype_ipv6, offset = 24, size = 16 }
+}
+
+local config = {
+   -- Aggregate rate (bytes per second) and burst (bytes.)
+   rate = {default=1/0},
+   burst = {},
+   classes = {default={}},
+   subscriber_key = {default=false},
+   subscriber_rate = {},
+   subscriber_burst = {},
+   max_subscribers = {default=1e6},
+   initial_subscribers = {default=1024},
+   -- Number of subscriber table slots scanned for idle subscribers per
+   -- breath.
+   subscriber_scan = {default=256}
+}
+
+local class_config = {
+   name = {required=true},
+   vlan = {},
+   dscp = {},
+   filter = {},
+   rate = {default=1/0},
+   burst = {},
+   parent = {}
+}
+
+local shaper_config = {
+   -- Granularity and number of slots of the calendar queue, and the
+   -- number of packets each slot holds.
+   slot_time = {default=10e-6},
+   slots = {default=1024},
+   slot_packets = {default=128}
+}
+
+Policer = {
+   config = config,
+   shm = {
+      ["conform-packets"] = {counter},
+      ["conform-bytes"] = {counter},
+      ["exceed-packets"] = {counter},
+      ["exceed-bytes"] = {counter},
+      ["subscribers"] = {counter},
+      ["subscriber-overflow"] = {counter}
+   }
+}
+
+Shaper = { config = {}, shm = {} }
+for k, v in pairs(config) do Shaper.config[k] = v end
+for k, v in pairs(shaper_config) do Shaper.config[k] = v end
+for k, v in pairs(Policer.shm) do Shaper.shm[k] = v end
+Shaper.shm["delayed-packets"] = {counter}
+
+-- Default burst: 10 ms worth of rate, but at least a jumbo frame.
+local function default_burst (rate)
+   return max(rate/100, 10240)
+end
+
+-- Return a function that maps a frame to a class number (1-based), or
+-- to 0 if no class matches.  The function is generated so that the
+-- class tests are straight-line code instead of a loop over closures.
+local function make_classifier (classes)
+   local env, code = {}, {"local env = ...\n", "return function (p, vid, ds)\n"}
+   for i, class in ipairs(classes) do
+      local tests = {}
+      if class.vlan then
+         table.insert(tests, ("vid == %d"):format(class.vlan))
+      end
+      if class.dscp then
+         local dscp = {}
+         local values = type(class.dscp) == 'table' and class.dscp
+            or {class.dscp}
+         for _, v in ipairs(values) do
+            assert(v >= 0 and v < 64, "bad DSCP value: "..v)
+            dscp[v] = true
+         end
+         env["dscp"..i] = dscp
+         table.insert(tests, ("ds and env.dscp%d[ds]"):format(i))
+      end
+      if class.filter then
+         env["filter"..i] = pf.compile_filter(class.filter)
+         table.insert(tests, ("env.filter%d(p.data, p.length)"):format(i))
+      end
+      if #tests == 0 then tests = {"true"} end
+      table.insert(code, ("   if %s then return %d end\n")
+                      :format(table.concat(tests, " and "), i))
+   end
+   table.insert(code, "   return 0\nend\n")
+   return assert(loadstring(table.concat(code)))(env)
+end
+
+-- Parse the Ethernet header (with an optional 802.1Q tag) of p, and
+-- return its ethertype, the offset of the L3 header, its VLAN ID (or
+-- false), and its DSCP (or false if not IP.)
+local function parse (p)
+   local data = p.data
+   if p.length < ether_header_len then return 0, 0, false, false end
+   local ethertype = ntohs(ffi.cast(uint16_ptr_t, data + 12)[0])
+   local l3, vid = ether_header_len, false
+   if ethertype == ethertype_dot1q
+      and p.length >= ether_header_len + dot1q_header_len then
+      vid = band(ntohs(ffi.cast(uint16_ptr_t, data + 14)[0]), 0xfff)
+      ethertype = ntohs(ffi.cast(uint16_ptr_t, data + 16)[0])
+      l3 = l3 + dot1q_header_len
+   end
+   local dscp = false
+   if ethertype == ethertype_ipv4 and p.length >= l3 + 20 then
+      dscp = rshift(data[l3 + 1], 2)
+   elseif ethertype == ethertype_ipv6 and p.length >= l3 + 40 then
+      dscp = rshift(band(lshift(data[l3], 8) + data[l3 + 1], 0x0fc0), 6)
+   end
+   return ethertype, l3, vid, dscp
+end
+
+local function refill (b, rate, burst, now)
+   b.tokens = min(burst, b.tokens + (now - b.stamp) * rate)
+   b.stamp = now
+end
+
+local function new (class, conf)
+   local o = setmetatable({}, {__index=class})
+   o.tsc = tsc.new()
+   o.time_fn = o.tsc:time_fn()
+   o.start = o.time_fn()
+   local tps = tonumber(o.tsc:tps())
+
+   -- Bucket 0 is the aggregate, buckets 1..n belong to the classes.
+   local classes = {}
+   for i, c in ipairs(conf.classes) do classes[i] = lib.parse(c, class_config) end
+   local nbuckets = #classes + 1
+   o.buckets = ffi.new(ffi.typeof("$[?]", bucket_t), nbuckets)
+   o.rates, o.bursts = {}, {}
+   local function init_bucket (i, rate, burst)
+      -- Rates are kept in bytes per tick.
+      o.rates[i] = rate / tps
+      o.bursts[i] = burst or default_burst(rate)
+      o.buckets[i].tokens = o.bursts[i]
+   end
+   init_bucket(0, conf.rate, conf.burst)
+   local index = {}
+   for i, c in ipairs(classes) do
+      assert(not index[c.name], "duplicate class: "..c.name)
+      index[c.name] = i
+      init_bucket(i, c.rate, c.burst)
+   end
+   o.nbuckets = nbuckets
+
+   -- The chain of buckets that a packet of each class is charged to:
+   -- the class, its ancestors, and the aggregate.  Packets that match
+   -- no class (class 0) are only charged to the aggregate.  Buckets
+   -- without a rate limit are left out.
+   local function limited (i) return o.rates[i] < 1/0 end
+   o.chains = {[0] = limited(0) and {0} or {}}
+   for i, c in ipairs(classes) do
+      local chain, seen, j = {}, {}, i
+      while j do
+         assert(not seen[j], "class hierarchy has a cycle at: "..c.name)
+         seen[j] = true
+         if limited(j) then table.insert(chain, j) end
+         local parent = classes[j].parent
+         j = parent and assert(index[parent], "no such class: "..parent)
+      end
+      if limited(0) then table.insert(chain, 0) end
+      o.chains[i] = chain
+   end
+   o.classify = make_classifier(classes)
+
+   -- Per-class counters, in addition to those of the app class.
+   o.shm = {}
+   for k, v in pairs(class.shm) do o.shm[k] = v end
+   -- They are accumulated per breath in npackets and nexceed.
+   o.class_packets, o.class_exceed = {}, {}
+   o.npackets, o.nexceed = {[0]=0}, {[0]=0}
+   for i, c in ipairs(classes) do
+      o.class_packets[i] = "class-"..c.name.."-packets"
+      o.class_exceed[i] = "class-"..c.name.."-exceed"
+      o.shm[o.class_packets[i]] = {counter}
+      o.shm[o.class_exceed[i]] = {counter}
+      o.npackets[i], o.nexceed[i] = 0, 0
+   end
+
+   if conf.subscriber_key then
+      local key = assert(subscriber_keys[conf.subscriber_key],
+                         "bad subscriber_key: "..conf.subscriber_key)
+      assert(conf.subscriber_rate, "subscriber_rate required")
+      o.subscriber = key
+      o.subscriber_rate = conf.subscriber_rate / tps
+      o.subscriber_burst = conf.subscriber_burst
+         or default_burst(conf.subscriber_rate)
+      o.max_subscribers = conf.max_subscribers
+      o.subscriber_scan = conf.subscriber_scan
+      o.expiry_cursor = 0
+      -- Subscribers that do not fit the table share this bucket.
+      o.overflow = bucket_t(o.subscriber_burst, 0)
+      local key_t = ffi.typeof("struct { uint8_t addr[$]; }", key.size)
+      o.subscriber_key = key_t()
+      o.subscriber_value = bucket_t()
+      o.subscribers = ctable.new{
+         key_type = key_t,
+         value_type = bucket_t,
+         initial_size = conf.initial_subscribers,
+         max_displacement_limit = 30
+      }
+   end
+   return o
+end
+
+function Policer:new (conf)
+   return new(Policer, conf)
+end
+
+function Shaper:new (conf)
+   local o = new(Shaper, conf)
+   local tps = tonumber(o.tsc:tps())
+   assert(conf.slot_packets <= link.max, "slot_packets exceeds link size")
+   o.slot_ticks = conf.slot_time * tps
+   o.nslots = conf.slots
+   o.slot_packets = conf.slot_packets
+   o.horizon = (conf.slots - 1) * o.slot_ticks
+   o.calendar = ffi.new("struct packet *[?]", conf.slots * conf.slot_packets)
+   o.fill = ffi.new("uint16_t[?]", conf.slots)
+   o.cursor = false
+   return o
+end
+
+-- Refill the class and aggregate buckets, and return the current time.
+local function refill_all (self)
+   local now = tonumber(self.time_fn() - self.start)
+   local buckets, rates, bursts = self.buckets, self.rates, self.bursts
+   for i = 0, self.nbuckets - 1 do
+      if rates[i] < 1/0 then refill(buckets[i], rates[i], bursts[i], now) end
+   end
+   return now
+end
+
+-- Remove the subscribers whose buckets would be full by now from the
+-- next subscriber_scan slots of the subscriber table.
+local function expire_subscribers (self, now)
+   local subscribers = self.subscribers
+   if not subscribers then return end
+   local rate, burst = self.subscriber_rate, self.subscriber_burst
+   local cursor = self.expiry_cursor
+   for _ = 1, self.subscriber_scan do
+      local entry
+      cursor, entry = subscribers:next_entry(cursor, cursor + 1)
+      if entry then
+         local b = entry.value
+         if b.tokens + (now - b.stamp) * rate >= burst then
+            -- The next entry may move into this slot.
+            subscribers:remove_ptr(entry)
+         else
+            cursor = cursor + 1
+         end
+      end
+   end
+   self.expiry_cursor = cursor
+   counter.set(self.shm.subscribers, subscribers.occupancy)
+end
+
+-- Return the bucket of the subscriber of p (refilled), or nil.
+local function subscriber_bucket (self, p, ethertype, l3, now)
+   local sub = self.subscriber
+   if not sub or ethertype ~= sub.ethertype
+      or p.length < l3 + sub.offset + sub.size then
+      return nil
+   end
+   local key = self.subscriber_key
+   ffi.copy(key.addr, p.data + l3 + sub.offset, sub.size)
+   local entry = self.subscribers:lookup_ptr(key)
+   if not entry then
+      if self.subscribers.occupancy >= self.max_subscribers then
+         counter.add(self.shm["subscriber-overflow"])
+         local b = self.overflow
+         refill(b, self.subscriber_rate, self.subscriber_burst, now)
+         return b
+      end
+      local value = self.subscriber_value
+      value.tokens, value.stamp = self.subscriber_burst, now
+      entry = self.subscribers:add(key, value)
+      counter.set(self.shm.subscribers, self.subscribers.occupancy)
+   end
+   local b = entry.value
+   refill(b, self.subscriber_rate, self.subscriber_burst, now)
+   return b
+end
+
+local function add_class_counters (self)
+   local npackets, nexceed = self.npackets, self.nexceed
+   for i = 1, #self.class_packets do
+      if npackets[i] > 0 then
+         counter.add(self.shm[self.class_packets[i]], npackets[i])
+         counter.add(self.shm[self.class_exceed[i]], nexceed[i])
+         npackets[i], nexceed[i] = 0, 0
+      end
+   end
+end
+
+local function charge (buckets, chain, sb, len)
+   for i = 1, #chain do
+      local b = buckets[chain[i]]
+      b.tokens = b.tokens - len
+   end
+   if sb then sb.tokens = sb.tokens - len end
+end
+
+function Policer:push ()
+   local input, output = self.input.input, self.output.output
+   local now = refill_all(self)
+   expire_subscribers(self, now)
+   local buckets, chains = self.buckets, self.chains
+   local npackets, nexceed = self.npackets, self.nexceed
+   local conform, conform_bytes, exceed, exceed_bytes = 0, 0, 0, 0
+   for _ = 1, link.nreadable(input) do
+      local p = receive(input)
+      local len = p.length
+      local ethertype, l3, vid, dscp = parse(p)
+      local class = self.classify(p, vid, dscp)
+      local chain = chains[class]
+      local sb = subscriber_bucket(self, p, ethertype, l3, now)
+      local ok = not sb or sb.tokens >= len
+      for i = 1, #chain do
+         ok = ok and buckets[chain[i]].tokens >= len
+      end
+      npackets[class] = npackets[class] + 1
+      if ok then
+         charge(buckets, chain, sb, len)
+         transmit(output, p)
+         conform, conform_bytes = conform + 1, conform_bytes + len
+      else
+         nexceed[class] = nexceed[class] + 1
+         packet.free(p)
+         exceed, exceed_bytes = exceed + 1, exceed_bytes + len
+      end
+   end
+   counter.add(self.shm["conform-packets"], conform)
+   counter.add(self.shm["conform-bytes"], conform_bytes)
+   counter.add(self.shm["exceed-packets"], exceed)
+   counter.add(self.shm["exceed-bytes"], exceed_bytes)
+   add_class_counters(self)
+end
+
+-- Hold p in the calendar slot due at time t.  Returns false if the slot
+-- is full, or if t is beyond the last slot of the current turn of the
+-- wheel (the cursor may lag behind the current time, e.g. if pull()
+-- could not release a slot), which would wrap around onto a slot that
+-- is due earlier.
+local function schedule (self, p, t)
+   local cursor = self.cursor
+   local slot = max(floor(t / self.slot_ticks), cursor)
+   if slot - cursor >= self.nslots then return false end
+   local i = slot % self.nslots
+   local n = self.fill[i]
+   if n == self.slot_packets then return false end
+   self.calendar[i * self.slot_packets + n] = p
+   self.fill[i] = n + 1
+   return true
+end
+
+function Shaper:push ()
+   local input, output = self.input.input, self.output.output
+   local now = refill_all(self)
+   expire_subscribers(self, now)
+   if not self.cursor then self.cursor = floor(now / self.slot_ticks) end
+   local buckets, chains, rates = self.buckets, self.chains, self.rates
+   local npackets, nexceed = self.npackets, self.nexceed
+   local conform, conform_bytes, exceed, exceed_bytes = 0, 0, 0, 0
+   local delayed = 0
+   for _ = 1, link.nreadable(input) do
+      local p = receive(input)
+      local len = p.length
+      local ethertype, l3, vid, dscp = parse(p)
+      local class = self.classify(p, vid, dscp)
+      local chain = chains[class]
+      local sb = subscriber_bucket(self, p, ethertype, l3, now)
+      -- Time until every bucket holds enough tokens for p.
+      local wait = 0
+      if sb and sb.tokens < len then
+         wait = (len - sb.tokens) / self.subscriber_rate
+      end
+      for i = 1, #chain do
+         local b = chain[i]
+         local deficit = len - buckets[b].tokens
+         if deficit > 0 then wait = max(wait, deficit / rates[b]) end
+      end
+      npackets[class] = npackets[class] + 1
+      if wait == 0 then
+         charge(buckets, chain, sb, len)
+         transmit(output, p)
+         conform, conform_bytes = conform + 1, conform_bytes + len
+      elseif wait <= self.horizon and schedule(self, p, now + wait) then
+         charge(buckets, chain, sb, len)
+         delayed = delayed + 1
+         conform, conform_bytes = conform + 1, conform_bytes + len
+      else
+         nexceed[class] = nexceed[class] + 1
+         packet.free(p)
+         exceed, exceed_bytes = exceed + 1, exceed_bytes + len
+      end
+   end
+   counter.add(self.shm["conform-packets"], conform)
+   counter.add(self.shm["conform-bytes"], conform_bytes)
+   counter.add(self.shm["exceed-packets"], exceed)
+   counter.add(self.shm["exceed-bytes"], exceed_bytes)
+   add_class_counters(self)
+   counter.add(self.shm["delayed-packets"], delayed)
+end
+
+-- Release the packets of all slots that are due.
+function Shaper:pull ()
+   if not self.cursor then return end
+   local output = self.output.output
+   local now = tonumber(self.time_fn() - self.start)
+   local current = floor(now / self.slot_ticks)
+   local calendar, fill, slot_packets = self.calendar, self.fill, self.slot_packets
+   -- After a full turn of the wheel every slot is due.
+   local turns = min(current - self.cursor + 1, self.nslots)
+   for _ = 1, turns do
+      local i = self.cursor % self.nslots
+      local n = fill[i]
+      -- Leave the slot for the next breath if it does not fit.
+      if n > link.nwritable(output) then return end
+      for j = i * slot_packets, i * slot_packets + n - 1 do
+         transmit(output, calendar[j])
+      end
+      fill[i] = 0
+      self.cursor = self.cursor + 1
+   end
+   self.cursor = max(self.cursor, current + 1)
+end
+
+function Shaper:stop ()
+   for i = 0, self.nslots - 1 do
+      for j = i * self.slot_packets, i * self.slot_packets + self.fill[i] - 1 do
+         packet.free(self.calendar[j])
+      end
+      self.fill[i] = 0
+   end
+end
+
+function selftest ()
+   print("selftest: apps.qos.policer")
+   local shm = require("core.shm")
+   local ethernet = require("lib.protocol.ethernet")
+   local ipv4 = require("lib.protocol.ipv4")
+   local ipv6 = require("lib.protocol.ipv6")
+   local datagram = require("lib.protocol.datagram")
+
+   local function make_packet (size, ip, vlan)
+      local dgram = datagram:new(packet.resize(packet.allocate(), size))
+      local header
+      if ip.version == 6 then
+         header = ipv6:new({src=ipv6:pton(ip.src), dst=ipv6:pton(ip.dst),
+                            traffic_class=lshift(ip.dscp or 0, 2),
+                            next_header=17, hop_limit=64})
+         header:payload_length(size)
+      else
+         header = ipv4:new({src=ipv4:pton(ip.src), dst=ipv4:pton(ip.dst),
+                            dscp=ip.dscp or 0, protocol=17, ttl=64})
+         header:total_length(header:sizeof() + size)
+      end
+      dgram:push(header)
+      dgram:push(ethernet:new({type=ip.version == 6 and ethertype_ipv6
+                                  or ethertype_ipv4}))
+      local p = dgram:packet()
+      if vlan then
+         p = packet.shiftright(p, dot1q_header_len)
+         ffi.copy(p.data, p.data + dot1q_header_len, 12)
+         ffi.cast(uint16_ptr_t, p.data + 12)[0] = lib.htons(ethertype_dot1q)
+         ffi.cast(uint16_ptr_t, p.data + 14)[0] = lib.htons(vlan)
+      end
+      return p
+   end
+
+   -- Run APP with a fake clock, pushing the packets returned by
+   -- generate(t) at each of ticks breaths of dt seconds.  Returns the
+   -- number of bytes transmitted.
+   local function run (class, conf, generate, ticks, dt)
+      local app = class:new(lib.parse(conf, class.config))
+      app.shm = shm.create_frame("apps/qos", app.shm)
+      app.input = {input=link.new("qos input")}
+      app.output = {output=link.new("qos output")}
+      local tps = tonumber(app.tsc:tps())
+      local now = 0
+      app.time_fn = function () return app.start + now end
+      local bytes, packets = 0, 0
+      for tick = 1, ticks do
+         now = floor(tick * dt * tps)
+         for _, p in ipairs(generate(tick)) do
+            link.transmit(app.input.input, p)
+         end
+         app:push()
+         if app.pull then app:pull() end
+         while not link.empty(app.output.output) do
+            local p = link.receive(app.output.output)
+            bytes, packets = bytes + p.length, packets + 1
+            packet.free(p)
+         end
+      end
+      if app.stop then app:stop() end
+      link.free(app.input.input, "qos input")
+      link.free(app.output.output, "qos output")
+      local counters = {}
+      for name, c in pairs(app.shm) do
+         if type(c) == 'cdata' then counters[name] = tonumber(counter.read(c)) end
+      end
+      shm.delete_frame(app.shm)
+      return bytes, packets, app, counters
+   end
+
+   local function near (value, expected, tolerance)
+      return math.abs(value - expected) <= expected * tolerance
+   end
+
+   -- Classification.
+   do
+      local classify = make_classifier(
+         {{name="voice", dscp={46, 34}},
+          {name="mgmt", vlan=100},
+          {name="dns", filter="udp port 53"},
+          {name="rest"}})
+      local function class_of (p)
+         local _, _, vid, dscp = parse(p)
+         local class = classify(p, vid, dscp)
+         packet.free(p)
+         return class
+      end
+      local ip = {src="10.0.0.1", dst="10.0.0.2"}
+      assert(class_of(make_packet(100, ip)) == 4)
+      assert(class_of(make_packet(100, ip, 100)) == 2)
+      assert(class_of(make_packet(100, ip, 200)) == 4)
+      assert(class_of(make_packet(100, {src="10.0.0.1", dst="10.0.0.2",
+                                         dscp=46})) == 1)
+      assert(class_of(make_packet(100, {version=6, src="::1", dst="::2",
+                                         dscp=34})) == 1)
+      assert(class_of(make_packet(100, {version=6, src="::1", dst="::2",
+                                         dscp=35})) == 4)
+   end
+
+   -- The policer passes the configured rate plus the burst, per class.
+   do
+      local rate, burst, seconds, dt = 1e6, 1e4, 2, 1e-3
+      local bytes, _, _, counters = run(Policer, {
+         classes = {{name="ef", dscp=46, rate=rate, burst=burst},
+                    {name="be", rate=rate/2, burst=burst}}
+      }, function (tick)
+         -- 4 MB/s of each class, in 1000-byte packets.
+         local ps = {}
+         for i = 1, 4 do
+            table.insert(ps, make_packet(1000, {src="10.0.0.1",
+                                                dst="10.0.0.2", dscp=46}))
+            table.insert(ps, make_packet(1000, {src="10.0.0.1",
+                                                dst="10.0.0.2"}))
+         end
+         return ps
+      end, seconds/dt, dt)
+      local expected = 1.5 * rate * seconds + 2 * burst
+      assert(near(bytes, expected, 0.02), bytes)
+      assert(counters["class-ef-packets"] == 4 * seconds/dt)
+      assert(counters["class-be-packets"] == 4 * seconds/dt)
+      assert(counters["conform-bytes"] == bytes)
+      assert(counters["class-ef-exceed"] + counters["class-be-exceed"]
+                == counters["exceed-packets"])
+   end
+
+   -- Hierarchy: two children of a parent share the parent's rate.
+   do
+      local rate, seconds, dt = 1e6, 2, 1e-3
+      local bytes = run(Policer, {
+         classes = {{name="a", dscp=10, rate=rate, parent="p"},
+                    {name="b", rate=rate, parent="p"},
+                    {name="p", dscp=63, rate=rate}}
+      }, function (tick)
+         local ps = {}
+         for i = 1, 2 do
+            table.insert(ps, make_packet(500, {src="10.0.0.1",
+                                               dst="10.0.0.2", dscp=10}))
+            table.insert(ps, make_packet(500, {src="10.0.0.1",
+                                               dst="10.0.0.2"}))
+         end
+         return ps
+      end, seconds/dt, dt)
+      assert(near(bytes, rate * seconds, 0.05), bytes)
+   end
+
+   -- Per-subscriber buckets.
+   do
+      local rate, burst, seconds, dt = 2e4, 2000, 2, 1e-3
+      local nsubscribers = 100
+      local bytes, _, app = run(Policer, {
+         subscriber_key = "ipv6-dst",
+         subscriber_rate = rate,
+         subscriber_burst = burst,
+         max_subscribers = nsubscribers - 10
+      }, function (tick)
+         local ps = {}
+         for i = 1, 10 do
+            local sub = (tick * 10 + i) % nsubscribers
+            table.insert(ps, make_packet(
+                            500, {version=6, src="::1", dst="::"..sub}))
+         end
+         return ps
+      end, seconds/dt, dt)
+      assert(app.subscribers.occupancy == nsubscribers - 10)
+      -- Each subscriber offers 55.4 kB/s: 90 are held to their rate
+      -- plus burst, and the 10 that do not fit the table share the
+      -- overflow bucket.
+      local expected = (nsubscribers - 10 + 1) * (rate * seconds + burst)
+      assert(near(bytes, expected, 0.05), bytes)
+   end
+
+   -- Idle subscribers are removed to make room for new ones.
+   do
+      local rate, burst, seconds, dt = 2e4, 2000, 2, 1e-3
+      local nsubscribers = 90
+      local bytes, _, app, counters = run(Policer, {
+         subscriber_key = "ipv4-src",
+         subscriber_rate = rate,
+         subscriber_burst = burst,
+         max_subscribers = nsubscribers
+      }, function (tick)
+         -- A different set of subscribers in each second.
+         local base = tick <= 1000 and 0 or 100
+         local ps = {}
+         for i = 1, 10 do
+            local sub = base + (tick * 10 + i) % nsubscribers
+            table.insert(ps, make_packet(
+                            500, {src="10.0.0."..sub, dst="10.0.0.255"}))
+         end
+         return ps
+      end, seconds/dt, dt)
+      assert(app.subscribers.occupancy <= nsubscribers)
+      -- The new subscribers overflow until the old ones are idle, i.e.
+      -- for burst/rate = 100 ms.
+      local expected = 2 * nsubscribers * (rate * seconds/2 + burst)
+      assert(bytes <= expected * 1.02 and bytes >= expected * 0.9, bytes)
+      assert(counters["subscriber-overflow"] < 0.15 * 10/dt,
+             counters["subscriber-overflow"])
+   end
+
+   -- The shaper delays rather than drops: bursts above the rate are
+   -- smoothed out as long as they fit the calendar horizon.
+   do
+      local rate, seconds, dt = 1.1e6, 1, 1e-4
+      local conf = {rate = rate, burst = 1000,
+                    slot_time = 1e-4, slots = 1024, slot_packets = 64}
+      local _, packets, _, counters = run(Shaper, conf, function (tick)
+         -- A burst of 50 packets every 50 ms: about 1 MB/s on average.
+         local ps = {}
+         if tick % 500 == 1 and tick < seconds/dt then
+            for i = 1, 50 do
+               table.insert(ps, make_packet(1000, {src="10.0.0.1",
+                                                   dst="10.0.0.2"}))
+            end
+         end
+         return ps
+      end, (seconds + 0.1)/dt, dt)
+      assert(counters["exceed-packets"] == 0)
+      assert(counters["delayed-packets"] == 20 * 50)
+      assert(packets == 20 * 50, packets)
+      -- Beyond the horizon (0.1 s) packets are dropped.
+      local _, packets, _, counters = run(Shaper, conf, function (tick)
+         local ps = {}
+         if tick == 1 then
+            for i = 1, 200 do
+               table.insert(ps, make_packet(1000, {src="10.0.0.1",
+                                                   dst="10.0.0.2"}))
+            end
+         end
+         return ps
+      end, 2000, dt)
+      local expected = floor((1023 * 1e-4 * rate + 1000) / 1034)
+      assert(near(packets, expected, 0.02), packets)
+      assert(counters["exceed-packets"] == 200 - packets)
+   end
+
+   -- Packets are not scheduled beyond the current turn of the wheel
+   -- when the cursor lags behind.
+   do
+      local app = Shaper:new(lib.parse({rate=1e6, slots=16}, Shaper.config))
+      local p = packet.allocate()
+      app.cursor = 100
+      assert(schedule(app, p, 115.5 * app.slot_ticks))
+      assert(not schedule(app, p, 116.5 * app.slot_ticks))
+      assert(schedule(app, p, 10 * app.slot_ticks))
+      assert(app.fill[100 % 16] == 1 and app.fill[115 % 16] == 1)
+      packet.free(p)
+   end
+
+   print("selftest: ok")
+end
@@ -0,0 +1,278 @@
+-- Use of this source code is governed by the Apache 2.0 license; see COPYING.
+
+-- Deficit round robin (DRR) scheduler.
+--
+-- The input links are the queues: each breath the scheduler moves as
+-- many packets as the output link has room for, taking them from the
+-- strict priority inputs first (in order), and then from the other
+-- inputs by DRR, which shares the output between them in proportion
+-- to their weights in bytes (M. Shreedhar and G. Varghese, "Efficient
+-- Fair Queuing using Deficit Round Robin", 1995).  Packets that do not
+-- fit into an input link are tail-dropped by link.transmit() upstream,
+-- and show up in the per-class drop counters.
+
+module(..., package.seeall)
+
+local lib     = require("core.lib")
+local link    = require("core.link")
+local counter = require("core.counter")
+
+local receive, transmit, front = link.receive, link.transmit, link.front
+local nreadable, nwritable = link.nreadable, link.nwritable
+local max = math.max
+
+local class_config = {
+   name = {required=true},
+   weight = {default=1},
+   priority = {default=false}
+}
+
+Scheduler = {
+   config = {
+      -- Array of { name = <input>, weight = <n>, priority = <bool> }
+      classes = {required=true},
+      -- Bytes per unit of weight that a class may send per round.
+      quantum = {default=1514}
+   }
+}
+
+function Scheduler:new (conf)
+   local o = setmetatable({}, {__index=Scheduler})
+   o.classes, o.priority, o.drr, o.by_name = {}, {}, {}, {}
+   o.shm = {}
+   for i, c in ipairs(conf.classes) do
+      c = lib.parse(c, class_config)
+      assert(not o.by_name[c.name], "duplicate class: "..c.name)
+      assert(c.weight > 0, "weight must be positive: "..c.name)
+      local class = {
+         name = c.name,
+         quantum = c.weight * conf.quantum,
+         deficit = 0,
+         input = false,
+         -- Accumulated between ticks.
+         npackets = 0,
+         nbytes = 0,
+         depth_max = 0,
+         counters = {
+            packets = c.name.."-packets",
+            bytes = c.name.."-bytes",
+            drops = c.name.."-drops",
+            depth = c.name.."-queue-depth",
+            depth_max = c.name.."-queue-depth-max"
+         }
+      }
+      for _, name in pairs(class.counters) do o.shm[name] = {counter} end
+      table.insert(o.classes, class)
+      table.insert(c.priority and o.priority or o.drr, class)
+      o.by_name[c.name] = class
+   end
+   -- Index into o.drr of the class whose turn it is, and whether it
+   -- was interrupted in the middle of its turn (and has thus already
+   -- been given its quantum.)
+   o.turn, o.resume = 1, false
+   return o
+end
+
+function Scheduler:link ()
+   for name, input in pairs(self.input) do
+      if type(name) == 'string' then
+         local class = assert(self.by_name[name], "no class for input: "..name)
+         class.input = input
+      end
+   end
+   for _, class in ipairs(self.classes) do
+      if not self.input[class.name] then class.input = false end
+   end
+end
+
+-- Transmit packets from class until its deficit or the room on the
+-- output is exhausted, or its input is empty.  Returns the remaining
+-- room.
+local function serve (class, output, room)
+   local input, deficit = class.input, class.deficit
+   local packets, bytes = 0, 0
+   while room > 0 do
+      local p = front(input)
+      if not p then
+         -- An idle class does not save up its deficit.
+         deficit = 0
+         break
+      end
+      local len = p.length
+      if len > deficit then break end
+      transmit(output, receive(input))
+      deficit = deficit - len
+      packets, bytes, room = packets + 1, bytes + len, room - 1
+   end
+   class.deficit = deficit
+   class.npackets = class.npackets + packets
+   class.nbytes = class.nbytes + bytes
+   return room
+end
+
+function Scheduler:push ()
+   local output = self.output.output
+   local room = nwritable(output)
+
+   for _, class in ipairs(self.classes) do
+      if class.input then
+         class.depth_max = max(class.depth_max, nreadable(class.input))
+      end
+   end
+
+   -- Strict priority classes, in order.
+   for _, class in ipairs(self.priority) do
+      local input = class.input
+      while room > 0 and input and not link.empty(input) do
+         local p = receive(input)
+         class.npackets = class.npackets + 1
+         class.nbytes = class.nbytes + p.length
+         transmit(output, p)
+         room = room - 1
+      end
+   end
+
+   -- DRR over the other classes, until the output is full or a whole
+   -- round finds every input empty.
+   local drr, n = self.drr, #self.drr
+   local turn, resume = self.turn, self.resume
+   local idle = 0
+   while room > 0 and idle < n do
+      local class = drr[turn]
+      if class.input and not link.empty(class.input) then
+         idle = 0
+         if not resume then class.deficit = class.deficit + class.quantum end
+         room = serve(class, output, room)
+         -- Keep the turn if the class still has packets it could send.
+         resume = room == 0 and class.deficit > 0
+            and not link.empty(class.input)
+            and front(class.input).length <= class.deficit
+         if resume then break end
+      else
+         class.deficit = 0
+         idle = idle + 1
+      end
+      turn = turn % n + 1
+      resume = false
+   end
+   self.turn, self.resume = turn, resume
+end
+
+function Scheduler:tick ()
+   for _, class in ipairs(self.classes) do
+      local c, shm = class.counters, self.shm
+      counter.add(shm[c.packets], class.npackets)
+      counter.add(shm[c.bytes], class.nbytes)
+      class.npackets, class.nbytes = 0, 0
+      if class.input then
+         counter.set(shm[c.drops], counter.read(class.input.stats.txdrop))
+         counter.set(shm[c.depth], nreadable(class.input))
+      end
+      counter.set(shm[c.depth_max],
+                  max(class.depth_max, tonumber(counter.read(shm[c.depth_max]))))
+      class.depth_max = 0
+   end
+end
+
+function selftest ()
+   print("selftest: apps.qos.scheduler")
+   local shm = require("core.shm")
+   local packet = require("core.packet")
+
+   -- Run a Scheduler over inputs that are kept full of packets of the
+   -- given sizes, with room for at most room packets on the output per
+   -- breath.  Returns the bytes sent per input.
+   local function run (conf, sizes, breaths, room)
+      local app = Scheduler:new(lib.parse(conf, Scheduler.config))
+      app.shm = shm.create_frame("apps/scheduler", app.shm)
+      app.input, app.output = {}, {output=link.new("scheduler output")}
+      for name in pairs(sizes) do
+         app.input[name] = link.new("scheduler "..name)
+      end
+      app:link()
+      local sent = {}
+      for name in pairs(sizes) do sent[name] = 0 end
+      local tags = {}
+      for _ = 1, breaths do
+         for name, size in pairs(sizes) do
+            local input = app.input[name]
+            while not link.full(input) do
+               local p = packet.allocate()
+               p.length = size
+               -- Tag the packet with the index of its input.
+               p.data[0] = #name
+               tags[#name] = name
+               transmit(input, p)
+            end
+         end
+         -- Leave only room free slots on the output.
+         local output = app.output.output
+         for _ = 1, nwritable(output) - room do
+            transmit(output, packet.allocate())
+         end
+         app:push()
+         -- Drain the padding and count what was scheduled.
+         while not link.empty(output) do
+            local p = receive(output)
+            local name = tags[p.data[0]]
+            if p.length > 0 and name then
+               sent[name] = sent[name] + p.length
+            end
+            packet.free(p)
+         end
+      end
+      app:tick()
+      local counters = {}
+      for name, c in pairs(app.shm) do
+         if type(c) == 'cdata' then
+            counters[name] = tonumber(counter.read(c))
+         end
+      end
+      for name, input in pairs(app.input) do
+         if type(name) == 'string' then
+            link.free(input, "scheduler "..name)
+         end
+      end
+      link.free(app.output.output, "scheduler output")
+      shm.delete_frame(app.shm)
+      return sent, counters
+   end
+
+   local function near (value, expected, tolerance)
+      return math.abs(value - expected) <= expected * tolerance
+   end
+
+   -- Byte-fair sharing by weight, regardless of packet size.  (Input
+   -- names have distinct lengths, which the test uses as packet tags.)
+   local sent, counters = run({classes={{name="a", weight=1},
+                                        {name="bb", weight=2},
+                                        {name="ccc", weight=1}}},
+                              {a=64, bb=1500, ccc=600}, 2000, 16)
+   local total = sent.a + sent.bb + sent.ccc
+   assert(near(sent.a, total/4, 0.05), sent.a)
+   assert(near(sent.bb, total/2, 0.05), sent.bb)
+   assert(near(sent.ccc, total/4, 0.05), sent.ccc)
+   assert(counters["bb-bytes"] == sent.bb)
+   assert(counters["a-queue-depth"] > 0)
+   assert(counters["a-queue-depth-max"] == link.max)
+
+   -- A strict priority class is served first, and starves the others
+   -- if it can fill the output on its own.
+   local sent = run({classes={{name="a", priority=true},
+                              {name="bb"}}},
+                    {a=64, bb=64}, 100, 16)
+   assert(sent.a == 100 * 16 * 64 and sent.bb == 0)
+
+   -- With an idle class, the others share its bandwidth.
+   local sent = run({classes={{name="a", weight=3}, {name="bb", weight=1},
+                              {name="ccc", weight=4}}},
+                    {a=1000, bb=1000}, 1000, 8)
+   assert(near(sent.a, 3 * sent.bb, 0.05), sent.a/sent.bb)
+
+   -- Without contention everything is passed on.
+   local sent = run({classes={{name="a"}, {name="bb"}}},
+                    {a=100, bb=100}, 10, link.max)
+   assert(sent.a + sent.bb == 10 * link.max * 100)
+
+   print("selftest: ok")
+end
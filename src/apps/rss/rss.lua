@@ -6,13 +6,14 @@ local packet   = require("core.packet")
 local lib      = require("core.lib")
 local counter  = require("core.counter")
 local siphash  = require("lib.hash.siphash")
+local toeplitz = require("lib.hash.toeplitz")
 local metadata = require("apps.rss.metadata")
 local pf       = require("pf")
 local ffi      = require("ffi")
 
 local events = timeline.load_events(engine.timeline(), "apps.rss.rss")
 
-local rshift = bit.rshift
+local rshift, band = bit.rshift, bit.band
 local receive, transmit = link.receive, link.transmit
 local nreadable = link.nreadable
 local free, clone = packet.free, packet.clone
@@ -33,11 +34,22 @@ rss = {
    config = {
       default_class = { default = true },
       classes = { default = {} },
-      remove_extension_headers = { default = true }
+      remove_extension_headers = { default = true },
+      hash = { default = "siphash" },
+      toeplitz_key = { default = "symmetric" },
+      rebalance = { default = false },
+      buckets = { default = 512 },
+      rebalance_interval = { default = 0.1 },
+      rebalance_grace = { default = 0.05 },
+      rebalance_backlog = { default = 256 },
+      rebalance_moves = { default = 32 }
    },
    shm = {
       rxpackets = { counter, 0},
-      rxdrops_filter = { counter, 0}
+      rxdrops_filter = { counter, 0},
+      rebalance_overloads = { counter, 0},
+      rebalance_moves = { counter, 0},
+      rebalance_stuck = { counter, 0}
    },
    push_link = {}
 }
@@ -56,6 +68,8 @@ local function mk_addr_copy_fn (size)
    return loadstring(str)()
 end
 
+-- The layout of the hash keys per ethertype. Each instance has its own
+-- keys and hash functions (see rss:new.)
 local hash_info = {
    -- IPv4
    [0x0800] = {
@@ -70,6 +84,55 @@ local hash_info = {
       addr_size = 4
    },
 }
+for _, info in pairs(hash_info) do
+   info.key_t = ffi.typeof([[
+         struct {
+            uint64_t addrs[$];
+            uint32_t ports;
+            uint8_t proto;
+         } __attribute__((packed))
+      ]], info.addr_size)
+   info.copy_addr_fn = mk_addr_copy_fn(info.addr_size)
+end
+
+local function siphash_hash (self, md)
+   local info = self.hash_info[md.ethertype]
+   local hash = 0
+   if info then
+      info.copy_addr_fn(info.key.addrs, ffi.cast("uint64_t*", md.l3 + info.addr_offset))
+      if transport_proto_p[md.proto] then
+         info.key.ports = ffi.cast("uint32_t *", md.l4)[0]
+      else
+         info.key.ports = 0
+      end
+      info.key.proto = md.proto
+      -- Our SipHash implementation produces only even numbers to satisfy some
+      -- ctable internals.
+      hash = rshift(info.hash_fn(info.key), 1)
+   end
+   md.hash = hash
+end
+
+-- Like a NIC, hash TCP and UDP packets (other than non-initial
+-- fragments) by their addresses and ports, and all other IP packets by
+-- their addresses only. The hash is truncated to its 16 least
+-- significant bits, which are also the ones NICs use to index their
+-- indirection tables.
+local function toeplitz_hash (self, md)
+   local info = self.hash_info[md.ethertype]
+   local hash = 0
+   if info then
+      info.copy_addr_fn(info.key.addrs, ffi.cast("uint64_t*", md.l3 + info.addr_offset))
+      local proto = md.proto
+      if (proto == 6 or proto == 17) and md.frag_offset == 0 then
+         info.key.ports = ffi.cast("uint32_t *", md.l4)[0]
+         hash = info.hash_fn(info.key_ptr)
+      else
+         hash = info.hash_l3_fn(info.key_ptr)
+      end
+   end
+   md.hash = hash
+end
 
 local etht_demux = {}
 
@@ -119,19 +182,45 @@ function rss:new (config)
                rm_ext_headers = config.remove_extension_headers
              }
 
-   for _, info in pairs(hash_info) do
-      info.key_t = ffi.typeof([[
-            struct {
-               uint64_t addrs[$];
-               uint32_t ports;
-               uint8_t proto;
-            } __attribute__((packed))
-         ]], info.addr_size)
-      info.key = info.key_t()
-      info.hash_fn =
-         siphash.make_hash({ size = ffi.sizeof(info.key),
-                             key = siphash.random_sip_hash_key() })
-      info.copy_addr_fn = mk_addr_copy_fn(info.addr_size)
+   assert(config.hash == "siphash" or config.hash == "toeplitz",
+          "Unknown hash function: "..tostring(config.hash))
+
+   if config.rebalance then
+      local buckets = config.buckets
+      assert(buckets >= 1 and buckets <= 2^16 and band(buckets, buckets-1) == 0,
+             "Number of buckets must be a power of 2 not larger than 2^16")
+      o.rebalance = {
+         buckets = buckets,
+         bits = math.log(buckets)/math.log(2),
+         timer = lib.throttle(config.rebalance_interval),
+         grace = config.rebalance_grace,
+         backlog = config.rebalance_backlog,
+         moves = config.rebalance_moves
+      }
+   end
+
+   o.hash_info = {}
+   for ethertype, layout in pairs(hash_info) do
+      local info = { addr_offset = layout.addr_offset,
+                     copy_addr_fn = layout.copy_addr_fn,
+                     key = layout.key_t() }
+      if config.hash == "toeplitz" then
+         info.key_ptr = ffi.cast("uint8_t *", info.key)
+         -- The addresses, followed by the ports for TCP and UDP, are laid
+         -- out in the key in the order NICs hash them in.
+         local addr_bytes = ffi.sizeof("uint64_t") * layout.addr_size
+         info.hash_fn =
+            toeplitz.make_hash({ size = addr_bytes + 4,
+                                 key = config.toeplitz_key })
+         info.hash_l3_fn =
+            toeplitz.make_hash({ size = addr_bytes,
+                                 key = config.toeplitz_key })
+      else
+         info.hash_fn =
+            siphash.make_hash({ size = ffi.sizeof(info.key),
+                                key = siphash.random_sip_hash_key() })
+      end
+      o.hash_info[ethertype] = info
    end
 
    local function add_class (name, match_fn, continue)
@@ -230,6 +319,7 @@ function rss:new (config)
    })
 
    o.nqueues = #o.demux_queues
+   o.hash = config.hash == "toeplitz" and toeplitz_hash or siphash_hash
 
    return setmetatable(o, { __index = self })
 end
@@ -243,6 +333,138 @@ local function insert_unique(t, new_elt)
    table.insert(t, new_elt)
 end
 
+-- Dynamic load balancing
+--
+-- With rebalancing enabled, each class maps the flow hash to one of a
+-- fixed number of buckets, and an indirection table maps each bucket
+-- to an output link.  Initially, the buckets are assigned to the
+-- links in proportion to their weights.  Once per interval, the
+-- output links are checked for packets dropped due to a full link and
+-- for a backlog of unread packets.  Buckets that are mapped to an
+-- overloaded link are then moved to the links with the lowest load
+-- relative to their weights, where the load of a link is the number
+-- of packets sent to it during the last interval.
+--
+-- A bucket is only moved when it is "cold": no packet has hashed to
+-- it for at least the grace period, and all packets sent for it have
+-- been read from the output link.  Because the last packet of a bucket
+-- is only known to within one interval, the packet count of the link
+-- at the end of that interval is used as the position of the last
+-- packet.  The grace period must cover the time it takes the receiver
+-- on the other side of the output link (e.g. an interlink) to process
+-- a packet, so that moving a bucket never reorders the packets of a
+-- flow.  Hot buckets stay on their link, which eventually ends up
+-- serving only the flows it can not shed.
+
+local function init_indirection (conf, class)
+   local links, index = {}, {}
+   for _, link in ipairs(class.output) do
+      if not index[link] then
+         table.insert(links, { link = link, index = #links + 1, weight = 0,
+                               txdrop = tonumber(counter.read(link.stats.txdrop)) })
+         index[link] = #links
+      end
+      local out = links[index[link]]
+      out.weight = out.weight + 1
+   end
+   local n = conf.buckets
+   class.outputs = links
+   class.table = {}
+   class.table_index = ffi.new("uint16_t[?]", n)
+   class.bucket_packets = ffi.new("double[?]", n)
+   class.bucket_prev = ffi.new("double[?]", n)
+   class.bucket_active = ffi.new("double[?]", n)
+   class.bucket_mark = ffi.new("double[?]", n)
+   class.bucket_mask = n - 1
+   class.cursor = 0
+   for b = 0, n-1 do
+      local link = class.output[rshift(b * class.output.n, conf.bits) + 1]
+      class.table[b+1] = link
+      class.table_index[b] = index[link]
+   end
+end
+
+local function rebalance (self, class, now)
+   local conf = self.rebalance
+   local outputs = class.outputs
+   if #outputs < 2 then return end
+   local counts, prev = class.bucket_packets, class.bucket_prev
+   local active, mark, index = class.bucket_active, class.bucket_mark,
+      class.table_index
+   for _, out in ipairs(outputs) do
+      out.load = 0
+      out.sent = tonumber(counter.read(out.link.stats.txpackets))
+      out.read = tonumber(counter.read(out.link.stats.rxpackets))
+   end
+   local total = 0
+   for b = 0, conf.buckets-1 do
+      local delta = counts[b] - prev[b]
+      if delta > 0 then
+         local out = outputs[index[b]]
+         prev[b] = counts[b]
+         active[b] = now
+         mark[b] = out.sent
+         out.load = out.load + delta
+         total = total + delta
+      end
+   end
+   local overloaded, targets = {}, {}
+   for i, out in ipairs(outputs) do
+      local txdrop = tonumber(counter.read(out.link.stats.txdrop))
+      out.drops = txdrop - out.txdrop
+      out.txdrop = txdrop
+      out.backlog = out.sent - out.read
+      if out.drops > 0 or out.backlog > conf.backlog then
+         table.insert(overloaded, i)
+      else
+         table.insert(targets, out)
+      end
+   end
+   if #overloaded == 0 then return end
+   counter.add(self.shm.rebalance_overloads)
+   if #targets == 0 then
+      counter.add(self.shm.rebalance_stuck)
+      events.rebalance_stuck(class.seq, #overloaded)
+      return
+   end
+   -- Each moved bucket is expected to add the average load of a bucket
+   -- to its new link.
+   local cost = math.max(1, total / conf.buckets)
+   local function least_loaded ()
+      local best
+      for _, out in ipairs(targets) do
+         if not best or out.load/out.weight < best.load/best.weight then
+            best = out
+         end
+      end
+      return best
+   end
+   local is_overloaded = {}
+   for _, i in ipairs(overloaded) do is_overloaded[i] = true end
+   -- Scan the buckets starting where the last scan stopped, so that
+   -- buckets are moved evenly.
+   local moves, b = 0, class.cursor
+   for _ = 1, conf.buckets do
+      if moves == conf.moves then break end
+      local from = index[b]
+      if is_overloaded[from] and now - active[b] >= conf.grace
+         and outputs[from].read >= mark[b] then
+         local out = least_loaded()
+         class.table[b+1] = out.link
+         index[b] = out.index
+         -- The bucket is empty on its new link.
+         mark[b] = 0
+         out.load = out.load + cost
+         moves = moves + 1
+         events.bucket_moved(class.seq, b, from, out.index)
+      end
+      b = band(b + 1, class.bucket_mask)
+   end
+   class.cursor = b
+   counter.add(self.shm.rebalance_moves, moves)
+   events.rebalanced(class.seq, #overloaded, moves)
+end
+
 function rss:link (direction, name)
    if direction == 'input' then
       local vlan = name:match("^vlan(%d+)$")
@@ -265,6 +487,9 @@ function rss:link (direction, name)
             end
             -- Avoid calls to lj_tab_len() in distribute()
             class.output.n = #class.output
+            if self.rebalance then
+               init_indirection(self.rebalance, class)
+            end
 
             insert_unique(self.classes_active, class)
          end
@@ -286,33 +511,22 @@ function rss:unlink (direction, name)
    end
 end
 
-local function hash (md)
-   local info = hash_info[md.ethertype]
-   local hash = 0
-   if info then
-      info.copy_addr_fn(info.key.addrs, ffi.cast("uint64_t*", md.l3 + info.addr_offset))
-      if transport_proto_p[md.proto] then
-         info.key.ports = ffi.cast("uint32_t *", md.l4)[0]
-      else
-         info.key.ports = 0
-      end
-      info.key.proto = md.proto
-      -- Our SipHash implementation produces only even numbers to satisfy some
-      -- ctable internals.
-      hash = rshift(info.hash_fn(info.key), 1)
-   end
-   md.hash = hash
-end
-
 local function distribute (p, links, hash)
    -- This relies on the hash being a 16-bit value
    local index = rshift(hash * links.n, 16) + 1
    transmit(links[index], p)
 end
 
+local function distribute_indirect (p, class, hash)
+   local bucket = band(hash, class.bucket_mask)
+   local counts = class.bucket_packets
+   counts[bucket] = counts[bucket] + 1
+   transmit(class.table[bucket + 1], p)
+end
+
 local function md_wrapper(self, demux_queue, queue, vlan)
    local p = receive(demux_queue)
-   hash(mdadd(p, self.rm_ext_headers, vlan))
+   self:hash(mdadd(p, self.rm_ext_headers, vlan))
    transmit(queue, p)
 end
 
@@ -437,14 +651,27 @@ function rss:push_with_vlan(link, vlan)
 
    for _, class in ipairs(self.classes_active) do
       local npackets = nreadable(class.input)
-      for _ = 1, npackets do
-         local p = receive(class.input)
-         local md  = mdget(p)
-         if md.ref > 1 then
-            md.ref = md.ref - 1
-            distribute(mdcopy(p), class.output, md.hash)
-         else
-            distribute(p, class.output, md.hash)
+      if self.rebalance then
+         for _ = 1, npackets do
+            local p = receive(class.input)
+            local md  = mdget(p)
+            if md.ref > 1 then
+               md.ref = md.ref - 1
+               distribute_indirect(mdcopy(p), class, md.hash)
+            else
+               distribute_indirect(p, class, md.hash)
+            end
+         end
+      else
+         for _ = 1, npackets do
+            local p = receive(class.input)
+            local md  = mdget(p)
+            if md.ref > 1 then
+               md.ref = md.ref - 1
+               distribute(mdcopy(p), class.output, md.hash)
+            else
+               distribute(p, class.output, md.hash)
+            end
          end
       end
       events.distributed(class.seq, npackets)
@@ -456,6 +683,12 @@ function rss:tick()
       counter.set(self.shm.rxpackets, self.rxpackets)
       counter.set(self.shm.rxdrops_filter, self.rxdrops_filter)
    end
+   if self.rebalance and self.rebalance.timer() then
+      local now = engine.now()
+      for _, class in ipairs(self.classes_active) do
+         rebalance(self, class, now)
+      end
+   end
 end
 
 function selftest ()
@@ -635,4 +868,135 @@ function selftest ()
          end
       end
    end
+
+   -- Toeplitz hashing.  With the key of the RSS specification, the
+   -- hash matches that of a NIC (the first test vector of
+   -- lib.hash.toeplitz).  With the symmetric key, both directions of
+   -- a flow hash alike.
+   local ipv4 = require("lib.protocol.ipv4")
+   local function udp_packet (src, sport, dst, dport)
+      local dgram = require("lib.protocol.datagram"):new()
+      dgram:push(require("lib.protocol.udp"):new({ src_port = sport,
+                                                   dst_port = dport }))
+      local ip = ipv4:new({ protocol = 17, ttl = 64,
+                            src = ipv4:pton(src), dst = ipv4:pton(dst) })
+      ip:total_length(28)
+      dgram:push(ip)
+      dgram:push(require("lib.protocol.ethernet"):new({ type = 0x0800 }))
+      return dgram:packet()
+   end
+   local function toeplitz_hash (key, ...)
+      local app = rss:new(lib.parse({ hash = "toeplitz", toeplitz_key = key },
+                                    rss.config))
+      local p = udp_packet(...)
+      local md = mdadd(p, true, nil)
+      app:hash(md)
+      packet.free(p)
+      return md.hash
+   end
+   assert(toeplitz_hash("microsoft", "66.9.149.187", 2794,
+                        "161.142.100.80", 1766) == 0xc178)
+   for _ = 1, 100 do
+      local a, b = ipv4:ntop(random_ip(addr_ip)), ipv4:ntop(random_ip(addr_ip))
+      local sport, dport = math.random(2^16-1), math.random(2^16-1)
+      assert(toeplitz_hash("symmetric", a, sport, b, dport) ==
+                toeplitz_hash("symmetric", b, dport, a, sport))
+   end
+
+   -- Instances keep their own hash functions: creating a SipHash
+   -- instance does not change the hashes of a Toeplitz one.
+   do
+      local toeplitz_app = rss:new(lib.parse({ hash = "toeplitz",
+                                               toeplitz_key = "microsoft" },
+                                             rss.config))
+      local siphash_app = rss:new(lib.parse({ hash = "siphash" }, rss.config))
+      local p = udp_packet("66.9.149.187", 2794, "161.142.100.80", 1766)
+      local md = mdadd(p, true, nil)
+      toeplitz_app:hash(md)
+      assert(md.hash == 0xc178)
+      siphash_app:hash(md)
+      toeplitz_app:hash(md)
+      assert(md.hash == 0xc178)
+      packet.free(p)
+   end
+
+   -- Rebalancing.  Flows come and go, each flow is active for about
+   -- 50ms.  One of the receivers can only read 16 packets per breath,
+   -- which is less than its share.  Buckets must move away from it
+   -- without reordering the packets of any flow.
+   local Flows = {}
+
+   function Flows:new ()
+      local dgram = require("lib.protocol.datagram"):new(packet.allocate())
+      dgram:push(require("lib.protocol.udp"):new({}))
+      dgram:push(require("lib.protocol.ipv4"):new({ protocol = 17,
+                                                    ttl = 64 }))
+      dgram:push(require("lib.protocol.ethernet"):new({ type = 0x0800 }))
+      local template = dgram:packet()
+      template = packet.append(template, ffi.new("uint32_t[1]"), 4)
+      return setmetatable({ template = template, seq = {} },
+                          { __index = Flows })
+   end
+
+   function Flows:pull ()
+      local base = math.floor(engine.now() / 0.01) * 16
+      for _ = 1, engine.pull_npackets do
+         local flow = base + math.random(0, 79)
+         local seq = (self.seq[flow] or 0) + 1
+         self.seq[flow] = seq
+         local p = packet.clone(self.template)
+         ffi.cast("uint32_t *", p.data + 26)[0] = flow
+         ffi.cast("uint32_t *", p.data + 42)[0] = seq
+         transmit(self.output.output, p)
+      end
+   end
+
+   local last_seq = {}
+   local OrderedSink = {}
+
+   function OrderedSink:new (limit)
+      return setmetatable({ limit = limit }, { __index = OrderedSink })
+   end
+
+   function OrderedSink:push ()
+      local input = self.input.input
+      for _ = 1, math.min(self.limit, link.nreadable(input)) do
+         local p = receive(input)
+         local flow = ffi.cast("uint32_t *", p.data + 26)[0]
+         local seq = ffi.cast("uint32_t *", p.data + 42)[0]
+         assert(seq > (last_seq[flow] or 0), "flow reordered")
+         last_seq[flow] = seq
+         packet.free(p)
+      end
+   end
+
+   graph = config.new()
+   config.app(graph, "rss", rss, { rebalance = true,
+                                   rebalance_interval = 0.005,
+                                   rebalance_grace = 0.01 })
+   config.app(graph, "source", Flows)
+   config.link(graph, "source.output -> rss.input")
+   for i = 1, 4 do
+      config.app(graph, "sink"..i, OrderedSink, i == 1 and 16 or 1e9)
+      config.link(graph, "rss.default_"..i.." -> sink"..i..".input")
+   end
+   engine.configure(config.new())
+   engine.configure(graph)
+   engine.main({ duration = 1 })
+
+   local app = engine.app_table.rss
+   local moves = tonumber(counter.read(app.shm.rebalance_moves))
+   assert(moves > 0, "no buckets moved")
+   local class = app.classes_active[1]
+   local slow_index
+   for _, out in ipairs(class.outputs) do
+      if out.link == app.output.default_1 then slow_index = out.index end
+   end
+   local slow = 0
+   for b = 0, app.rebalance.buckets-1 do
+      if class.table_index[b] == slow_index then slow = slow + 1 end
+   end
+   print(("%d buckets moved, %d of %d buckets left on slow link")
+         :format(moves, slow, app.rebalance.buckets))
+   assert(slow < app.rebalance.buckets/8)
 end
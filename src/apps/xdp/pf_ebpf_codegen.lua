@@ -15,6 +15,7 @@ local ssa = require('pf.ssa')
 local sel = require("pf.selection")
 local ra = require("pf.regalloc")
 local bpf = require("apps.xdp.bpf")
+local multi_filter = require("lib.pcap.multi_filter")
 
 local c, f, m, a, s, j = bpf.c, bpf.f, bpf.m, bpf.a, bpf.s, bpf.j
 
@@ -348,8 +349,15 @@ function codegen (ir, alloc)
    return tr
 end
 
+-- FILTER is either a filter string, or an array of filter strings in
+-- which case the program matches packets that match any of them.
 function compile(filter, dump)
-   local expr = optimize(expand(parse(filter), "EN10MB"))
+   local expr
+   if type(filter) == "table" then
+      expr = multi_filter.union(filter)
+   else
+      expr = optimize(expand(parse(filter), "EN10MB"))
+   end
    local ssa = ssa.convert_ssa(anf.convert_anf(expr))
    local ir = sel.select(ssa)
    local alloc = ra.allocate(ir, ebpf_regs)
@@ -357,7 +365,7 @@ function compile(filter, dump)
    if dump then
       require("core.lib").print_object(alloc)
       require("core.lib").print_object(ir)
-      print(filter)
+      print(type(filter) == "table" and table.concat(filter, " | ") or filter)
       bpf.dis(bpf.asm(code))
    end
    return code
@@ -370,4 +378,6 @@ function selftest()
            "dump")
    compile("1 = 2",
            "dump")
+   compile({"ip proto esp", "ip proto 99", "arp"},
+           "dump")
 end
@@ -270,8 +270,9 @@ function compute_config_actions (old, new)
    local actions = {}
 
    -- First determine the links that are going away and remove them.
-   for linkspec in pairs(old.links) do
-      if not new.links[linkspec] then
+   -- Links with changed options are recreated.
+   for linkspec, options in pairs(old.links) do
+      if not lib.equal(options, new.links[linkspec]) then
          local fa, fl, ta, tl = config.parse_link(linkspec)
          table.insert(actions, {'unlink_output', {fa, fl}})
          table.insert(actions, {'unlink_input', {ta, tl}})
@@ -313,10 +314,13 @@ function compute_config_actions (old, new)
    end
 
    -- Now rebuild links.
-   for linkspec,_ in pairs(new.links) do
+   for linkspec, options in pairs(new.links) do
       local fa, fl, ta, tl = config.parse_link(linkspec)
-      local fresh_link = not old.links[linkspec]
-      if fresh_link then table.insert(actions, {'new_link', {linkspec}}) end
+      local fresh_link = not lib.equal(options, old.links[linkspec])
+      if fresh_link then
+         if options == true then options = nil end
+         table.insert(actions, {'new_link', {linkspec, options}})
+      end
       if not new.apps[fa] then error("no such app: " .. fa) end
       if not new.apps[ta] then error("no such app: " .. ta) end
       if fresh_link or fresh_apps[fa] then
@@ -375,9 +379,9 @@ function apply_config_actions (actions)
       link_table[linkspec] = nil
       configuration.links[linkspec] = nil
    end
-   function ops.new_link (linkspec)
-      link_table[linkspec] = link.new(linkspec)
-      configuration.links[linkspec] = true
+   function ops.new_link (linkspec, options)
+      link_table[linkspec] = link.new(linkspec, options)
+      configuration.links[linkspec] = options or true
    end
    function ops.link_output (appname, linkname, linkspec)
       local app = app_table[appname]
@@ -777,6 +781,7 @@ function report_links ()
       l = link_table[name]
       local txpackets = counter.read(l.stats.txpackets)
       local txdrop = counter.read(l.stats.txdrop)
+      if l.aqm ~= nil then txdrop = txdrop + counter.read(l.aqm.drops) end
       print(("%20s sent on %s (loss rate: %d%%)"):format(
             lib.comma_value(txpackets), name, loss_rate(txdrop, txpackets)))
    end
@@ -839,6 +844,25 @@ function selftest ()
    configure(config.new())
    assert(#breathe_pull_order == 0)
    assert(#breathe_push_order == 0)
+   -- Test link options: links with changed options are recreated.
+   local c5 = config.new()
+   config.app(c5, "app1", App)
+   config.app(c5, "app2", App)
+   config.link(c5, "app1.x -> app2.x", {aqm={algorithm="codel"}})
+   print("empty -> c5")
+   configure(c5)
+   local aqm_link = link_table['app1.x -> app2.x']
+   assert(aqm_link.aqm ~= nil)
+   configure(c5)
+   assert(tostring(aqm_link) == tostring(link_table['app1.x -> app2.x']))
+   print("c5 -> c1")
+   configure(c1)
+   assert(link_table['app1.x -> app2.x'].aqm == nil)
+   assert(app_table.app1.input.x == nil and app_table.app2.input.x ~= nil)
+   configure(config.new())
+   assert(not pcall(config.link, c5, "app1.x -> app2.x", {foo=true}))
+   assert(not pcall(config.link, c5, "app1.x -> app2.x",
+                    {aqm={algorithm="red"}}))
    -- Test app arg validation
    local AppC = {
       config = {
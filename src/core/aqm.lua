@@ -0,0 +1,356 @@
+-- Use of this source code is governed by the Apache 2.0 license; see COPYING.
+
+-- Active queue management (AQM) for links.
+--
+-- A link normally only drops packets when it is full (tail drop), so a
+-- slow app can keep a standing queue of up to link.max packets on its
+-- input without the senders ever noticing. A link can optionally run
+-- CoDel (RFC 8289) or PIE (RFC 8033) instead, which drop packets, or
+-- mark them with ECN Congestion Experienced (RFC 3168), when packets
+-- have been waiting on the link for too long.
+--
+-- Each packet is stamped with the time at which it was transmitted onto
+-- the link (in TSC ticks, see lib.tsc). The AQM decision is taken in
+-- link.transmit(), based on the sojourn time of the packet at the head
+-- of the queue, i.e. how long it has been waiting so far. Unlike the
+-- classic CoDel, which drops at the head of the queue on dequeue, this
+-- keeps link.receive() and link.front() untouched, and never drops a
+-- packet an app has already seen with link.front().
+
+module(...,package.seeall)
+
+local ffi = require("ffi")
+local C = ffi.C
+local lib = require("core.lib")
+local counter = require("core.counter")
+local checksum = require("lib.checksum")
+local tsc = require("lib.tsc")
+require("core.link_h")
+
+local band, bor, rshift = bit.band, bit.bor, bit.rshift
+local ntohs = lib.ntohs
+local sqrt, min, max, random = math.sqrt, math.min, math.max, math.random
+
+ffi.cdef[[
+struct aqm {
+  // Enqueue time of the packet in each slot of the link's ring.
+  double enqueued[LINK_RING_SIZE];
+  int algorithm;
+  uint8_t ecn;
+  // Target queue delay, and CoDel interval in ticks; ticks per second.
+  double target, interval, tps;
+  // CoDel state
+  double first_above, drop_next;
+  uint32_t count, lastcount;
+  uint8_t dropping;
+  // PIE state (probability and delays in seconds, times in ticks)
+  double p, qdelay_old, burst_allowance, next_update;
+  double tupdate, max_burst, alpha, beta;
+  struct counter *drops, *marks;
+};
+]]
+
+local CODEL, PIE = 1, 2
+local algorithms = { codel = CODEL, pie = PIE }
+
+local aqm_config = {
+   -- "codel" or "pie"
+   algorithm = {required=true},
+   -- Target queue delay in seconds. Defaults to 5 ms for CoDel and to
+   -- 15 ms for PIE.
+   target = {},
+   -- CoDel: the interval in seconds over which the queue delay must
+   -- stay above target before packets are dropped.
+   interval = {default=100e-3},
+   -- PIE: drop probability update interval in seconds, burst allowance
+   -- in seconds, and the weights of the controller.
+   tupdate = {default=15e-3},
+   max_burst = {default=150e-3},
+   alpha = {default=0.125},
+   beta = {default=1.25},
+   -- Mark ECN capable packets instead of dropping them.
+   ecn = {default=true}
+}
+
+-- Validate conf and fill in the defaults.
+function parse (conf)
+   conf = lib.parse(conf, aqm_config)
+   assert(algorithms[conf.algorithm],
+          "unknown AQM algorithm: "..tostring(conf.algorithm))
+   if not conf.target then
+      conf.target = conf.algorithm == 'codel' and 5e-3 or 15e-3
+   end
+   assert(conf.target > 0 and conf.interval > 0 and conf.tupdate > 0,
+          "AQM target and intervals must be positive")
+   return conf
+end
+
+-- Time source, set up by the first call to new().
+local clock
+local function now () return tonumber(clock()) end
+
+-- AQM state must not be garbage collected while its link uses it.
+local anchors = {}
+
+-- Return new AQM state for the link with shm path name (e.g.
+-- "links/a.output -> b.input").
+function new (name, conf)
+   conf = parse(conf)
+   local timer = tsc.new()
+   if not clock then clock = timer:time_fn() end
+   local q = ffi.new("struct aqm")
+   q.algorithm = algorithms[conf.algorithm]
+   q.ecn = conf.ecn and 1 or 0
+   q.tps = tonumber(timer:tps())
+   q.target = conf.target * q.tps
+   q.interval = conf.interval * q.tps
+   q.tupdate = conf.tupdate * q.tps
+   q.max_burst = conf.max_burst * q.tps
+   q.burst_allowance = q.max_burst
+   q.alpha, q.beta = conf.alpha, conf.beta
+   q.drops = counter.create(name.."/aqmdrop.counter")
+   q.marks = counter.create(name.."/aqmmark.counter")
+   anchors[name] = q
+   return q
+end
+
+function free (name)
+   counter.delete(name.."/aqmdrop.counter")
+   counter.delete(name.."/aqmmark.counter")
+   anchors[name] = nil
+end
+
+-- Set the ECN field of the IPv4 or IPv6 packet in the (possibly 802.1Q
+-- tagged) Ethernet frame p to Congestion Experienced. Returns false if
+-- p is not ECN capable.
+local ethertype_ipv4, ethertype_ipv6, ethertype_dot1q = 0x0800, 0x86dd, 0x8100
+local function mark (p)
+   local data, length = p.data, p.length
+   local l3, ethertype = 14, ntohs(ffi.cast("uint16_t *", data + 12)[0])
+   if ethertype == ethertype_dot1q then
+      l3, ethertype = 18, ntohs(ffi.cast("uint16_t *", data + 16)[0])
+   end
+   if ethertype == ethertype_ipv4 and length >= l3 + 20 then
+      local tos = data[l3 + 1]
+      if band(tos, 0x03) == 0 then return false end
+      if band(tos, 0x03) ~= 0x03 then
+         -- Update the version/IHL and TOS word, and the header checksum.
+         checksum.update_field16(data + l3 + 10, data + l3,
+                                 data[l3] * 256 + bor(tos, 0x03))
+      end
+      return true
+   elseif ethertype == ethertype_ipv6 and length >= l3 + 40 then
+      -- The ECN field is in bits 4-5 of the second byte.
+      local tc = data[l3 + 1]
+      if band(tc, 0x30) == 0 then return false end
+      data[l3 + 1] = bor(tc, 0x30)
+      return true
+   end
+   return false
+end
+
+-- Signal congestion with packet p: mark it if possible, or drop it.
+-- Returns true if p is to be enqueued.
+local function signal (q, p)
+   if q.ecn ~= 0 and mark(p) then
+      counter.add(q.marks)
+      return true
+   else
+      counter.add(q.drops)
+      return false
+   end
+end
+
+-- CoDel (RFC 8289) control law: the time of the next drop.
+local function control_law (q, t)
+   return t + q.interval / sqrt(q.count)
+end
+
+local function codel (q, p, t, sojourn, empty)
+   local ok_to_drop = false
+   if empty or sojourn < q.target then
+      q.first_above = 0
+   elseif q.first_above == 0 then
+      q.first_above = t + q.interval
+   elseif t >= q.first_above then
+      ok_to_drop = true
+   end
+   if q.dropping ~= 0 then
+      if not ok_to_drop then
+         q.dropping = 0
+      elseif t >= q.drop_next then
+         q.count = q.count + 1
+         q.drop_next = control_law(q, q.drop_next)
+         return signal(q, p)
+      end
+   elseif ok_to_drop then
+      q.dropping = 1
+      -- Resume at the previous drop rate if we were dropping recently.
+      local delta = q.count - q.lastcount
+      if delta > 1 and t - q.drop_next < 16 * q.interval then
+         q.count = delta
+      else
+         q.count = 1
+      end
+      q.lastcount = q.count
+      q.drop_next = control_law(q, t)
+      return signal(q, p)
+   end
+   return true
+end
+
+-- PIE (RFC 8033): update the drop probability from the queue delay.
+local function pie_update (q, qdelay)
+   local target = q.target / q.tps
+   local qdelay_old = q.qdelay_old
+   local p = q.p
+   -- Scale the weights down while the probability is small, so that it
+   -- starts out gently.
+   local scale = 1
+   if     p < 0.000001 then scale = 1/2048
+   elseif p < 0.00001  then scale = 1/512
+   elseif p < 0.0001   then scale = 1/128
+   elseif p < 0.001    then scale = 1/32
+   elseif p < 0.01     then scale = 1/8
+   elseif p < 0.1      then scale = 1/2 end
+   local delta = scale * (q.alpha * (qdelay - target)
+                             + q.beta * (qdelay - qdelay_old))
+   if p >= 0.1 and delta > 0.02 then delta = 0.02 end
+   p = p + delta
+   if qdelay > 0.25 then p = p + 0.02 end
+   if qdelay == 0 and qdelay_old == 0 then p = p * 0.98 end
+   p = min(max(p, 0), 1)
+   q.p = p
+   q.burst_allowance = max(0, q.burst_allowance - q.tupdate)
+   if p == 0 and qdelay < target/2 and qdelay_old < target/2 then
+      q.burst_allowance = q.max_burst
+   end
+   q.qdelay_old = qdelay
+end
+
+local function pie (q, p, t, sojourn, nqueued)
+   if t >= q.next_update then
+      pie_update(q, sojourn / q.tps)
+      q.next_update = t + q.tupdate
+   end
+   if q.burst_allowance > 0 then return true end
+   if q.qdelay_old < q.target / q.tps / 2 and q.p < 0.2 then return true end
+   if nqueued < 2 then return true end
+   if random() >= q.p then return true end
+   -- Drop rather than mark when the probability gets high, to protect
+   -- against senders that ignore ECN.
+   if q.p > 0.1 then
+      counter.add(q.drops)
+      return false
+   end
+   return signal(q, p)
+end
+
+-- Stamp packet p, which is about to be transmitted onto the link r with
+-- AQM state q, and decide whether to enqueue it. Returns false if p is
+-- to be dropped.
+function enqueue (q, r, p)
+   local t = now()
+   local read, write = r.read, r.write
+   local empty = read == write
+   local sojourn = empty and 0 or max(0, t - q.enqueued[read])
+   local ok
+   if q.algorithm == CODEL then
+      ok = codel(q, p, t, sojourn, empty)
+   else
+      local nqueued = band(write - read, C.LINK_RING_SIZE - 1)
+      ok = pie(q, p, t, sojourn, nqueued)
+   end
+   if ok then q.enqueued[write] = t end
+   return ok
+end
+
+function selftest ()
+   print("selftest: core.aqm")
+   local link = require("core.link")
+   local packet = require("core.packet")
+
+   local function ipv4 (tos)
+      local p = packet.from_string(lib.hexundump([[
+         02:00:00:00:00:01 02:00:00:00:00:02 08 00
+         45 00 00 1c 00 00 00 00 40 11 00 00 0a 00 00 01 0a 00 00 02
+         00 01 00 02 00 08 00 00
+      ]], 42))
+      p.data[15] = tos
+      ffi.cast("uint16_t *", p.data + 24)[0] =
+         lib.htons(checksum.ipsum(p.data + 14, 20, 0))
+      return p
+   end
+   local function ipv6 (tc)
+      local p = packet.from_string(lib.hexundump([[
+         02:00:00:00:00:01 02:00:00:00:00:02 86 dd
+         60 00 00 00 00 00 3b 40
+         00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 01
+         00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 02
+      ]], 54))
+      p.data[15] = bor(p.data[15], tc * 16)
+      return p
+   end
+
+   -- ECN marking.
+   local p = ipv4(0x02)
+   assert(mark(p) and band(p.data[15], 0x03) == 0x03)
+   assert(checksum.ipsum(p.data + 14, 20, 0) == 0)
+   packet.free(p)
+   local p = ipv4(0x00)
+   assert(not mark(p))
+   packet.free(p)
+   local p = ipv6(0x1)
+   assert(mark(p) and band(rshift(p.data[15], 4), 0x03) == 0x03)
+   packet.free(p)
+   local p = ipv6(0x0)
+   assert(not mark(p))
+   packet.free(p)
+
+   -- Run traffic over a link with AQM, where the receiver lags behind the
+   -- transmitter by a fixed delay. Returns the number of packets sent,
+   -- marked and dropped.
+   local function run (conf, tos, delay, duration)
+      local name = "aqm selftest"
+      local r = link.new(name, {aqm=conf})
+      local q = r.aqm
+      -- Fake the clock.
+      local t, saved = 0, clock
+      clock = function () return t end
+      local sent = 0
+      while t < duration * q.tps do
+         link.transmit(r, ipv4(tos))
+         sent = sent + 1
+         t = t + q.tps / 10000
+         while not link.empty(r) and t - q.enqueued[r.read] > delay * q.tps do
+            packet.free(link.receive(r))
+         end
+      end
+      clock = saved
+      local marks = tonumber(counter.read(q.marks))
+      local drops = tonumber(counter.read(q.drops))
+      link.free(r, name)
+      return sent, marks, drops
+   end
+
+   -- No standing queue: nothing is dropped.
+   for _, algorithm in ipairs{"codel", "pie"} do
+      local sent, marks, drops = run({algorithm=algorithm}, 0, 1e-3, 2)
+      assert(marks == 0 and drops == 0)
+   end
+   -- A standing queue of 20 ms: packets are dropped, or marked if they
+   -- are ECN capable. (PIE still drops once its drop probability exceeds
+   -- 10%, which it does here since the queue delay is fixed.)
+   for _, algorithm in ipairs{"codel", "pie"} do
+      local sent, marks, drops = run({algorithm=algorithm}, 0, 20e-3, 2)
+      assert(marks == 0 and drops > 0, algorithm)
+      local sent, marks, drops = run({algorithm=algorithm}, 0x02, 20e-3, 2)
+      assert(marks > 0, algorithm)
+      assert(drops == 0 or algorithm == 'pie', algorithm)
+      local sent, marks, drops =
+         run({algorithm=algorithm, ecn=false}, 0x02, 20e-3, 2)
+      assert(marks == 0 and drops > 0, algorithm)
+   end
+
+   print("selftest: ok")
+end
@@ -5,6 +5,7 @@
 module(..., package.seeall)
 
 local lib = require("core.lib")
+local aqm = require("core.aqm")
 
 -- API: Create a new configuration.
 -- Initially there are no apps or links.
@@ -35,11 +36,21 @@ function app (config, name, class, arg)
    config.apps[name] = { class = class, arg = arg}
 end
 
+local link_options = {
+   -- Active queue management settings (see core.aqm).
+   aqm = {default=false}
+}
+
 -- API: Add a link to the configuration.
 --
 -- Example: config.link(c, "nic.tx -> vm.rx")
-function link (config, spec)
-   config.links[canonical_link(spec)] = true
+--          config.link(c, "nic.tx -> vm.rx", {aqm={algorithm="codel"}})
+function link (config, spec, options)
+   if options then
+      options = lib.parse(options, link_options)
+      if options.aqm then options.aqm = aqm.parse(options.aqm) end
+   end
+   config.links[canonical_link(spec)] = options or true
 end
 
 -- Given "a.out -> b.in" return "a", "out", "b", "in".
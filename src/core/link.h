@@ -1,5 +1,7 @@
 /* Use of this source code is governed by the Apache 2.0 license; see COPYING. */
 
+struct aqm;
+
 enum { LINK_RING_SIZE    = 1024,
        LINK_MAX_PACKETS  = LINK_RING_SIZE - 1
 };
@@ -15,5 +17,7 @@ struct link {
   //   read:  the next element to be read
   //   write: the next element to be written
   int read, write;
+  // Optional active queue management state (see core/aqm.lua), or NULL.
+  struct aqm *aqm;
 };
 
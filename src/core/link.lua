@@ -15,6 +15,7 @@ local counter = require("core.counter")
 require("core.counter_h")
 
 require("core.link_h")
+local aqm = require("core.aqm")
 local link_t = ffi.typeof("struct link")
 
 local band = require("bit").band
@@ -26,12 +27,17 @@ local provided_counters = {
    "dtime", "rxpackets", "rxbytes", "txpackets", "txbytes", "txdrop"
 }
 
-function new (name)
+-- Options is an optional table of link options (see config.link):
+--   aqm: active queue management settings (see core.aqm), or false
+function new (name, options)
    local r = ffi.new(link_t)
    for _, c in ipairs(provided_counters) do
       r.stats[c] = counter.create("links/"..name.."/"..c..".counter")
    end
    counter.set(r.stats.dtime, C.get_unix_time())
+   if options and options.aqm then
+      r.aqm = aqm.new("links/"..name, options.aqm)
+   end
    return r
 end
 
@@ -42,6 +48,7 @@ function free (r, name)
    for _, c in ipairs(provided_counters) do
       counter.delete("links/"..name.."/"..c..".counter")
    end
+   if r.aqm ~= nil then aqm.free("links/"..name) end
    shm.unlink("links/"..name)
 end
 
@@ -64,6 +71,8 @@ function transmit (r, p)
    if full(r) then
       counter.add(r.stats.txdrop)
       packet.free(p)
+   elseif r.aqm ~= nil and not aqm.enqueue(r.aqm, r, p) then
+      packet.free(p)
    else
       r.packets[r.write] = p
       r.write = band(r.write + 1, size - 1)
@@ -100,6 +109,10 @@ function stats (r)
    for _, c in ipairs(provided_counters) do
       stats[c] = tonumber(counter.read(r.stats[c]))
    end
+   if r.aqm ~= nil then
+      stats.aqmdrop = tonumber(counter.read(r.aqm.drops))
+      stats.aqmmark = tonumber(counter.read(r.aqm.marks))
+   end
    return stats
 end
 
@@ -78,6 +78,10 @@ $(cat $mdroot/apps/rss/README.md)
 
 $(cat $mdroot/apps/interlink/README.md)
 
+$(cat $mdroot/apps/gro/README.md)
+
+$(cat $mdroot/apps/qos/README.md)
+
 # Libraries
 
 $(cat $mdroot/lib/README.checksum.md)
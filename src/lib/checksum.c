@@ -13,6 +13,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <sys/time.h>
+#include <immintrin.h>
 
 uint16_t cksum_generic(unsigned char *p, size_t len, uint16_t initial)
 {
@@ -43,6 +44,127 @@ uint16_t cksum_generic(unsigned char *p, size_t len, uint16_t initial)
 }
 
 // SIMD versions
+//
+// The vector kernels below are compiled for their target ISA with
+// function attributes, so that the rest of this file stays portable.
+// Callers must check for CPU support before calling them (see
+// lib/checksum.lua).
+//
+// Both kernels sum the even and odd bytes of the input separately into
+// 64-bit lanes with PSADBW, which cannot overflow for any packet size.
+// The little-endian 16-bit word sum is then even + (odd << 8), which is
+// folded exactly like the generic version.
+
+static inline uint16_t cksum_finish(uint64_t sum, uint16_t initial)
+{
+  sum += htons(initial);
+  sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+  sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+  while (sum >> 16)
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  return ntohs((uint16_t)~sum);
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t hsum_avx2(__m256i v)
+{
+  __m128i s = _mm_add_epi64(_mm256_castsi256_si128(v),
+                            _mm256_extracti128_si256(v, 1));
+  return _mm_cvtsi128_si64(s) + _mm_extract_epi64(s, 1);
+}
+
+__attribute__((target("avx2")))
+uint16_t cksum_avx2(unsigned char *p, size_t len, uint16_t initial)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i mask = _mm256_set1_epi16(0x00FF);
+  __m256i even0 = zero, odd0 = zero, even1 = zero, odd1 = zero;
+  uint64_t sum, even, odd;
+
+  while (len >= 64) {
+    __m256i v0 = _mm256_loadu_si256((const __m256i *)p);
+    __m256i v1 = _mm256_loadu_si256((const __m256i *)(p + 32));
+    even0 = _mm256_add_epi64(even0, _mm256_sad_epu8(_mm256_and_si256(v0, mask), zero));
+    odd0  = _mm256_add_epi64(odd0,  _mm256_sad_epu8(_mm256_srli_epi16(v0, 8), zero));
+    even1 = _mm256_add_epi64(even1, _mm256_sad_epu8(_mm256_and_si256(v1, mask), zero));
+    odd1  = _mm256_add_epi64(odd1,  _mm256_sad_epu8(_mm256_srli_epi16(v1, 8), zero));
+    p += 64;
+    len -= 64;
+  }
+  if (len >= 32) {
+    __m256i v0 = _mm256_loadu_si256((const __m256i *)p);
+    even0 = _mm256_add_epi64(even0, _mm256_sad_epu8(_mm256_and_si256(v0, mask), zero));
+    odd0  = _mm256_add_epi64(odd0,  _mm256_sad_epu8(_mm256_srli_epi16(v0, 8), zero));
+    p += 32;
+    len -= 32;
+  }
+  even = hsum_avx2(_mm256_add_epi64(even0, even1));
+  odd = hsum_avx2(_mm256_add_epi64(odd0, odd1));
+
+  // Fewer than 32 bytes remain.
+  while (len >= 2) {
+    even += p[0];
+    odd += p[1];
+    p += 2;
+    len -= 2;
+  }
+  if (len == 1)
+    even += p[0];
+
+  sum = even + (odd << 8);
+  return cksum_finish(sum, initial);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+uint16_t cksum_avx512(unsigned char *p, size_t len, uint16_t initial)
+{
+  const __m512i zero = _mm512_setzero_si512();
+  const __m512i mask = _mm512_set1_epi16(0x00FF);
+  __m512i even0 = zero, odd0 = zero, even1 = zero, odd1 = zero;
+  uint64_t sum;
+
+  while (len >= 128) {
+    __m512i v0 = _mm512_loadu_si512((const void *)p);
+    __m512i v1 = _mm512_loadu_si512((const void *)(p + 64));
+    even0 = _mm512_add_epi64(even0, _mm512_sad_epu8(_mm512_and_si512(v0, mask), zero));
+    odd0  = _mm512_add_epi64(odd0,  _mm512_sad_epu8(_mm512_srli_epi16(v0, 8), zero));
+    even1 = _mm512_add_epi64(even1, _mm512_sad_epu8(_mm512_and_si512(v1, mask), zero));
+    odd1  = _mm512_add_epi64(odd1,  _mm512_sad_epu8(_mm512_srli_epi16(v1, 8), zero));
+    p += 128;
+    len -= 128;
+  }
+  // Fewer than 128 bytes remain: finish with (masked) 64-byte loads.
+  // Chunks start at even offsets, so an odd trailing byte lands in an
+  // even lane, just as in the generic version.
+  while (len > 0) {
+    __mmask64 m = len >= 64 ? ~(__mmask64)0 : (((__mmask64)1 << len) - 1);
+    __m512i v0 = _mm512_maskz_loadu_epi8(m, (const void *)p);
+    even0 = _mm512_add_epi64(even0, _mm512_sad_epu8(_mm512_and_si512(v0, mask), zero));
+    odd0  = _mm512_add_epi64(odd0,  _mm512_sad_epu8(_mm512_srli_epi16(v0, 8), zero));
+    if (len <= 64) break;
+    p += 64;
+    len -= 64;
+  }
+  sum = _mm512_reduce_add_epi64(_mm512_add_epi64(even0, even1))
+    + (_mm512_reduce_add_epi64(_mm512_add_epi64(odd0, odd1)) << 8);
+  return cksum_finish(sum, initial);
+}
+
+// Batched versions: checksum n buffers in one call. initial may be
+// NULL, in which case zero is used for every buffer.
+
+#define CKSUM_BATCH(name, kernel)                                       \
+  void name(unsigned char **p, const uint16_t *len,                     \
+            const uint16_t *initial, uint16_t *out, size_t n)           \
+  {                                                                     \
+    size_t i;                                                           \
+    for (i = 0; i < n; i++)                                             \
+      out[i] = kernel(p[i], len[i], initial ? initial[i] : 0);          \
+  }
+
+CKSUM_BATCH(cksum_batch_generic, cksum_generic)
+CKSUM_BATCH(cksum_batch_avx2, cksum_avx2)
+CKSUM_BATCH(cksum_batch_avx512, cksum_avx512)
 
 //
 // A unaligned version of the cksum,
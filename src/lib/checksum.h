@@ -8,10 +8,23 @@ uint16_t cksum_sse2(unsigned char *p, size_t n, uint16_t initial);
 // (This will crash if you call it on a CPU that does not support AVX2.)
 uint16_t cksum_avx2(unsigned char *p, size_t n, uint16_t initial);
 
+// Calculate IP checksum using AVX-512 (AVX512F and AVX512BW) instructions.
+// (This will crash if you call it on a CPU that does not support AVX-512.)
+uint16_t cksum_avx512(unsigned char *p, size_t n, uint16_t initial);
+
 // Calculate IP checksum using portable C code.
 // This works on all hardware.
 uint16_t cksum_generic(unsigned char *p, size_t n, uint16_t initial);
 
+// Calculate the IP checksums of n buffers p[i] of length len[i] into
+// out[i], using initial[i] as initial value (or 0 if initial is NULL).
+void cksum_batch_generic(unsigned char **p, const uint16_t *len,
+                         const uint16_t *initial, uint16_t *out, size_t n);
+void cksum_batch_avx2(unsigned char **p, const uint16_t *len,
+                      const uint16_t *initial, uint16_t *out, size_t n);
+void cksum_batch_avx512(unsigned char **p, const uint16_t *len,
+                        const uint16_t *initial, uint16_t *out, size_t n);
+
 // Incrementally update checksum when modifying a 16-bit value.
 void checksum_update_incremental_16(uint16_t* checksum_cell,
                                     uint16_t* value_cell,
@@ -8,9 +8,112 @@ require("lib.checksum_h")
 local lib = require("core.lib")
 local ffi = require("ffi")
 local C = ffi.C
-local band, lshift = bit.band, bit.lshift
+local band, bnot, lshift, rshift = bit.band, bit.bnot, bit.lshift, bit.rshift
 
-ipsum = require("arch.checksum").checksum
+-- Checksum kernels, fastest last. Each provides ipsum (pointer, length,
+-- initial) and, optionally, batch (pointers, lengths, initials,
+-- results, n). The vector kernels only pay off for buffers of at least
+-- min_length bytes; shorter ones are handed to the asm kernel.
+local asm = require("arch.checksum").checksum
+kernels = {
+   generic = { ipsum = C.cksum_generic, batch = C.cksum_batch_generic },
+   asm = { ipsum = asm },
+   avx2 = { ipsum = C.cksum_avx2, batch = C.cksum_batch_avx2,
+            min_length = 512 },
+   avx512 = { ipsum = C.cksum_avx512, batch = C.cksum_batch_avx512,
+              min_length = 256 }
+}
+
+local cpuinfo = lib.readfile("/proc/cpuinfo", "*a") or ""
+local function cpu_has (flag)
+   return cpuinfo:match("[ \t]"..flag.."[ \n]") ~= nil
+end
+
+-- Return the names of the kernels supported by this CPU.
+function supported_kernels ()
+   local supported = {"generic", "asm"}
+   if cpu_has("avx2") then table.insert(supported, "avx2") end
+   if cpu_has("avx512f") and cpu_has("avx512bw") then
+      table.insert(supported, "avx512")
+   end
+   return supported
+end
+
+-- Select the kernel to use: SNABB_CHECKSUM can name one explicitly
+-- (e.g. to avoid AVX-512 frequency licenses), otherwise the best one
+-- supported by the CPU is used.
+local function select_kernel ()
+   local supported = supported_kernels()
+   local name = lib.getenv("SNABB_CHECKSUM")
+   if name then
+      for _, s in ipairs(supported) do
+         if s == name then return name end
+      end
+      error("checksum kernel not supported by this CPU: "..name)
+   end
+   return supported[#supported]
+end
+
+kernel = select_kernel()
+
+if kernels[kernel].min_length then
+   local vector, min_length = kernels[kernel].ipsum, kernels[kernel].min_length
+   function ipsum (ptr, len, initial)
+      if len < min_length then return asm(ptr, len, initial)
+      else return vector(ptr, len, initial) end
+   end
+else
+   ipsum = kernels[kernel].ipsum
+end
+
+local function batch_loop (ptrs, lengths, initials, results, n)
+   for i = 0, n-1 do
+      results[i] = ipsum(ptrs[i], lengths[i], initials and initials[i] or 0)
+   end
+end
+
+-- Compute the checksums of n buffers in one call. See README.checksum.md.
+ipsum_batch = kernels[kernel].batch or batch_loop
+
+-- Incremental checksum update (RFC 1624, eqn. 3): HC' = ~(~HC + ~m + m').
+-- All values are in host byte order.
+
+local function fold (sum)
+   sum = band(sum, 0xffff) + rshift(sum, 16)
+   return band(sum, 0xffff) + rshift(sum, 16)
+end
+
+function update16 (csum, old, new)
+   return band(bnot(fold(band(bnot(csum), 0xffff) +
+                         band(bnot(old), 0xffff) + new)), 0xffff)
+end
+
+function update32 (csum, old, new)
+   local sum = band(bnot(csum), 0xffff)
+      + band(bnot(rshift(old, 16)), 0xffff) + band(bnot(old), 0xffff)
+      + rshift(new, 16) + band(new, 0xffff)
+   return band(bnot(fold(sum)), 0xffff)
+end
+
+local uint16_ptr_t = ffi.typeof("uint16_t *")
+local uint32_ptr_t = ffi.typeof("uint32_t *")
+
+-- Store new in the 16-bit (32-bit) network byte order field at ptr and
+-- update the network byte order checksum at csum_ptr accordingly.
+
+function update_field16 (csum_ptr, ptr, new)
+   local c, f = ffi.cast(uint16_ptr_t, csum_ptr), ffi.cast(uint16_ptr_t, ptr)
+   local csum = update16(lib.ntohs(c[0]), lib.ntohs(f[0]), new)
+   f[0] = lib.htons(new)
+   c[0] = lib.htons(csum)
+end
+
+function update_field32 (csum_ptr, ptr, new)
+   local c, f = ffi.cast(uint16_ptr_t, csum_ptr), ffi.cast(uint32_ptr_t, ptr)
+   local csum = update32(lib.ntohs(c[0]), lib.ntohl(f[0]), new)
+   f[0] = lib.htonl(new)
+   c[0] = lib.htons(csum)
+end
 
 function finish_packet (buf, len, offset)
    ffi.cast('uint16_t *', buf+offset)[0] = lib.htons(ipsum(buf, len, 0))
@@ -101,10 +204,96 @@ function selftest ()
       local ref = C.cksum_generic(array+i*2, i*10+i, initial)
       assert(ipsum(array+i*2, i*10+i, initial) == ref, "API function check")
    end
+   selftest_kernels()
+   selftest_batch()
+   selftest_incremental()
    selftest_ipv4_tcp()
    print("selftest: ok")
 end
 
+function selftest_kernels ()
+   print("selftest: kernels ("..table.concat(supported_kernels(), " ")..
+            "; using "..kernel..")")
+   local n = 10000
+   local random, ones = ffi.new("uint8_t[?]", n), ffi.new("uint8_t[?]", n)
+   for i = 0, n-1 do random[i], ones[i] = math.random(0, 255), 0xff end
+   for _, name in ipairs(supported_kernels()) do
+      local f = kernels[name].ipsum
+      for _, array in ipairs({random, ones}) do
+         -- Every length and alignment around the vector widths.
+         for len = 0, 300 do
+            for offset = 0, 3 do
+               local initial = math.random(0, 0xFFFF)
+               local ref = C.cksum_generic(array+offset, len, initial)
+               assert(f(array+offset, len, initial) == ref, name)
+            end
+         end
+         -- Long buffers that carry many times.
+         for len = n-130, n-1 do
+            local ref = C.cksum_generic(array, len, 0xFFFF)
+            assert(f(array, len, 0xFFFF) == ref, name)
+         end
+      end
+   end
+end
+
+function selftest_batch ()
+   print("selftest: batch")
+   local n, size = 64, 2048
+   local data = ffi.new("uint8_t[?]", n*size)
+   for i = 0, n*size-1 do data[i] = math.random(0, 255) end
+   local ptrs = ffi.new("uint8_t *[?]", n)
+   local lengths = ffi.new("uint16_t[?]", n)
+   local initials = ffi.new("uint16_t[?]", n)
+   local results = ffi.new("uint16_t[?]", n)
+   for i = 0, n-1 do
+      ptrs[i] = data + i*size + math.random(0, 1)
+      lengths[i] = math.random(0, size-2)
+      initials[i] = math.random(0, 0xFFFF)
+   end
+   for _, name in ipairs(supported_kernels()) do
+      local batch = kernels[name].batch or batch_loop
+      ffi.fill(results, ffi.sizeof(results))
+      batch(ptrs, lengths, initials, results, n)
+      for i = 0, n-1 do
+         local ref = C.cksum_generic(ptrs[i], lengths[i], initials[i])
+         assert(results[i] == ref, name)
+      end
+      batch(ptrs, lengths, nil, results, n)
+      for i = 0, n-1 do
+         assert(results[i] == C.cksum_generic(ptrs[i], lengths[i], 0), name)
+      end
+   end
+end
+
+function selftest_incremental ()
+   print("selftest: incremental update")
+   local header = ffi.new("uint8_t[20]")
+   local function verify ()
+      assert(ipsum(header, 20, 0) == 0, "incremental update")
+   end
+   for i = 1, 10000 do
+      for j = 0, 19 do header[j] = math.random(0, 255) end
+      if i % 10 == 0 then ffi.fill(header, 20, 0xff) end
+      header[10], header[11] = 0, 0
+      ffi.cast(uint16_ptr_t, header+10)[0] = lib.htons(ipsum(header, 20, 0))
+      verify()
+      update_field16(header+10, header+math.random(0, 4)*2,
+                     math.random(0, 0xFFFF))
+      verify()
+      update_field32(header+10, header+12+math.random(0, 1)*4,
+                     math.random(0, 0xFFFFFFFF))
+      verify()
+      -- Update the high byte of a 16-bit word, e.g. to decrement the TTL.
+      local ttl, proto = header[8], header[9]
+      local csum = lib.ntohs(ffi.cast(uint16_ptr_t, header+10)[0])
+      header[8] = band(ttl - 1, 0xff)
+      csum = update16(csum, lshift(ttl, 8), lshift(header[8], 8))
+      ffi.cast(uint16_ptr_t, header+10)[0] = lib.htons(csum)
+      verify()
+   end
+end
+
 function selftest_ipv4_tcp ()
    print("selftest: tcp/ipv4")
    local s = "45 00 05 DC 00 26 40 00 40 06 20 F4 0A 00 00 01 0A 00 00 02 8A DE 13 89 6C 27 3B 04 1C E9 F9 C6 80 10 00 E5 5E 47 00 00 01 01 08 0A 01 0F 3A CA 01 0B 32 A9 00 00 00 00 00 00 00 01 00 00 13 89 00 00 00 00 00 00 00 00 FF FF E8 90 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37 38 39 30 31 32 33 34 35 36 37"
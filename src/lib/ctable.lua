@@ -185,6 +185,9 @@ local function calloc(t, count)
       end
    end
    if not mem then
+      -- Unmap exactly what was mapped: the rounded size would also
+      -- unmap whatever follows this mapping.
+      alloc_byte_size = byte_size
       mem, err = S.mmap(nil, byte_size, 'read, write',
                         'private, anonymous')
       if not mem then error("mmap failed: " .. tostring(err)) end
@@ -221,6 +224,10 @@ function CTable:reseed_hash_function(seed)
    -- multi_hash functions.
 end
 
+local function compute_alloc_size(size, max_displacement_limit)
+   return math.min(size*2, size + 2 * max_displacement_limit)
+end
+
 function CTable:resize(size)
    assert(size >= (self.occupancy / self.max_occupancy_rate))
    assert(size == floor(size))
@@ -236,8 +243,9 @@ function CTable:resize(size)
    -- this value that "should be enough for everyone".  This is not
    -- entirely safe, since an overrun can occur before the check for
    -- the cap in maybe_increase_max_displacement(). The factor 2 here
-   -- reduces that risk but does not eliminate it.
-   local alloc_size = math.min(size*2, size + 2 * self.max_displacement_limit)
+   -- reduces that risk but does not eliminate it.  See
+   -- compute_alloc_size().
+   local alloc_size = compute_alloc_size(size, self.max_displacement_limit)
    self.entries, self.byte_size = calloc(self.entry_type, alloc_size)
    self.size = size
    self.scale = self.size / HASH_MAX
@@ -306,6 +314,65 @@ function CTable:save(stream)
                       self.size + self.max_displacement)
 end
 
+-- A table can also live in a block of memory provided by the caller,
+-- for example a shared memory segment that is mapped by several
+-- processes.  The layout is a header followed by all allocated
+-- entries, including the spare entries past the end of the table.
+local header_ptr_t = ffi.typeof('$*', header_t)
+
+function CTable:get_view_size()
+   return ffi.sizeof(header_t) + self.byte_size
+end
+
+function CTable:save_view(ptr)
+   local header = ffi.cast(header_ptr_t, ptr)
+   header[0] = header_t(self.size, self.occupancy, self.max_displacement,
+                        self.hash_seed, self.max_occupancy_rate,
+                        self.min_occupancy_rate)
+   ffi.copy(header + 1, self.entries, self.byte_size)
+end
+
+-- Return a table whose entries are the memory at PTR, as laid out by
+-- save_view().  PARAMS are as for new(), but the size and hash seed
+-- are taken from the header.  Changes made through the view are made
+-- in place; call sync_view() afterwards to update the header.  A view
+-- can not be resized: an add() that would need to grow the table
+-- signals an error instead.  The view keeps a reference to PTR, so
+-- that cdata memory stays alive for as long as the view is used.
+function load_view(ptr, params)
+   local header = ffi.cast(header_ptr_t, ptr)
+   local params_copy = {}
+   for k,v in pairs(params) do params_copy[k] = v end
+   params_copy.initial_size = 0
+   params_copy.min_occupancy_rate = header.min_occupancy_rate
+   params_copy.max_occupancy_rate = header.max_occupancy_rate
+   params_copy.hash_seed = ffi.new('uint8_t[16]')
+   ffi.copy(params_copy.hash_seed, header.hash_seed, 16)
+   local ctab = new(params_copy)
+   local alloc_size = compute_alloc_size(header.size,
+                                         ctab.max_displacement_limit)
+   ctab.view_mem = ptr
+   ctab.view_header = header
+   ctab.entries = ffi.cast(ffi.typeof('$*', ctab.entry_type), header + 1)
+   ctab.byte_size = ffi.sizeof(ctab.entry_type) * alloc_size
+   ctab.size = header.size
+   ctab.scale = ctab.size / HASH_MAX
+   ctab.occupancy = header.occupancy
+   ctab.occupancy_hi = ceil(ctab.size * ctab.max_occupancy_rate)
+   ctab.occupancy_lo = floor(ctab.size * ctab.min_occupancy_rate)
+   ctab:maybe_increase_max_displacement(header.max_displacement)
+   function ctab:resize(size)
+      error("can not resize a ctable view")
+   end
+   return ctab
+end
+
+function CTable:sync_view()
+   local header = assert(self.view_header, "not a ctable view")
+   header.occupancy = self.occupancy
+   header.max_displacement = self.max_displacement
+end
+
 function CTable:make_lookup_helper()
    local entries_per_lookup = self.max_displacement + 1
    local search = self.lookup_helpers[entries_per_lookup]
@@ -470,6 +537,8 @@ function CTable:make_lookup_streamer(width)
    assert(width > 0 and width <= 262144, "Width value out of range: "..width)
    local res = {
       all_entries = self.entries,
+      -- Keep the memory of a view alive; see load_view().
+      view_mem = self.view_mem,
       width = width,
       equal_fn = self.equal_fn,
       entries_per_lookup = self.max_displacement + 1,
@@ -477,6 +546,9 @@ function CTable:make_lookup_streamer(width)
       pointers = ffi.new('void*['..width..']'),
       entries = self.type(width),
       hashes = ffi.new('uint32_t[?]', width),
+      -- Position of each hit relative to pointers[i]; see entry_ptr().
+      offsets = ffi.new('int32_t[?]', width),
+      entry_ptr_t = ffi.typeof('$*', self.entry_type),
       -- Binary search over N elements can return N if no entry was
       -- found that was greater than or equal to the key.  We would
       -- have to check the result of binary search to ensure that we
@@ -536,6 +608,7 @@ function LookupStreamer:stream()
          -- Direct hit?
          if equal_fn(found.key, entries[i].key) then
             entries[i].value = found.value
+            self.offsets[i] = found - (stream_entries + index)
          else
             -- Mark this result as not found unless we prove
             -- otherwise.
@@ -548,6 +621,7 @@ function LookupStreamer:stream()
                   -- Yay!  Re-mark this result as found.
                   entries[i].hash = hash
                   entries[i].value = found.value
+                  self.offsets[i] = found - (stream_entries + index)
                   break
                end
                found = found + 1
@@ -569,6 +643,13 @@ function LookupStreamer:is_found(i)
    return not self:is_empty(i)
 end
 
+-- Return a pointer to the table entry found for key I, so that its
+-- value can be updated in place.  Only valid until the table is
+-- modified.
+function LookupStreamer:entry_ptr(i)
+   return ffi.cast(self.entry_ptr_t, self.pointers[i]) + self.offsets[i]
+end
+
 function CTable:selfcheck()
    local occupancy = 0
    local max_displacement = 0
@@ -742,11 +823,72 @@ function selftest()
             assert(streamer:is_found(j))
             local value = streamer.entries[j].value[0]
             assert(value == bnot(i + j))
+            local ptr = ctab:lookup_ptr(streamer.entries[j].key)
+            assert(streamer:entry_ptr(j) == ptr)
          end
       end
       width = width * 2
    until width > 256
 
+   -- Views over external memory see the same entries, and can be
+   -- modified in place as long as they need not grow.
+   do
+      local mem = ffi.new('uint8_t[?]', ctab:get_view_size())
+      ctab:save_view(mem)
+      local view = load_view(mem, params)
+      view:selfcheck()
+      for i = 1, occupancy, 31 do
+         k[0] = i
+         assert(view:lookup_ptr(k).value[0] == bnot(i))
+      end
+      k[0] = 1
+      view:remove(k)
+      view:sync_view()
+      view = load_view(mem, params)
+      assert(view.occupancy == occupancy - 1)
+      assert(view:lookup_ptr(k) == nil)
+      view:add(k, v)
+      assert(view:lookup_ptr(k))
+      view:selfcheck()
+      local ok = pcall(function ()
+         for i = occupancy + 1, view.occupancy_hi + 1 do
+            k[0] = i
+            view:add(k, v)
+         end
+      end)
+      assert(not ok)
+   end
+
+   -- A view keeps its memory alive after the caller drops it, and so
+   -- does a lookup streamer after its view is dropped.
+   do
+      local view, streamer
+      do
+         local mem = ffi.new('uint8_t[?]', ctab:get_view_size())
+         ctab:save_view(mem)
+         view = load_view(mem, params)
+         mem = ffi.new('uint8_t[?]', ctab:get_view_size())
+         ctab:save_view(mem)
+         streamer = load_view(mem, params):make_lookup_streamer(32)
+      end
+      for _ = 1, 3 do
+         collectgarbage()
+         -- Allocate garbage that would likely reuse freed memory.
+         for _ = 1, 10 do ffi.fill(ffi.new('uint8_t[?]', 1e6), 1e6, 0xff) end
+         for i = 2, occupancy, 31 do
+            k[0] = i
+            assert(view:lookup_ptr(k).value[0] == bnot(i))
+         end
+         for i = 0, 31 do streamer.entries[i].key[0] = i + 2 end
+         streamer:stream()
+         for i = 0, 31 do
+            assert(streamer:is_found(i))
+            assert(streamer:entry_ptr(i).value[0] == bnot(i + 2))
+         end
+      end
+      view:selfcheck()
+   end
+
    -- A check that our equality functions work as intended.
    local numbers_equal = make_equal_fn(ffi.typeof('int'))
    assert(numbers_equal(1,1))
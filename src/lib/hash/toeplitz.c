@@ -0,0 +1,93 @@
+/* Use of this source code is governed by the Apache 2.0 license; see COPYING. */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <immintrin.h>
+#include "toeplitz.h"
+
+// The Toeplitz hash of an input is the XOR of the 32-bit windows of the
+// key that start at the (big-endian) bit positions of the input that are
+// set.
+
+uint32_t toeplitz_generic(const struct toeplitz_key *key,
+                          const uint8_t *data, size_t len)
+{
+  const uint8_t *k = key->bytes;
+  uint32_t hash = 0;
+  uint32_t v = (uint32_t)k[0] << 24 | k[1] << 16 | k[2] << 8 | k[3];
+  size_t i;
+  int b;
+
+  for (i = 0; i < len; i++) {
+    for (b = 7; b >= 0; b--) {
+      if (data[i] & (1 << b)) hash ^= v;
+      v = v << 1 | ((k[i + 4] >> b) & 1);
+    }
+  }
+  return hash;
+}
+
+// Load up to 16 bytes at p, zero-padded. The input has typically just
+// been written with 8 or 4-byte stores, so read it in 8 and 4-byte loads,
+// which the CPU can forward from those stores (unlike a 16-byte load.)
+static inline __m128i load_block(const uint8_t *p, size_t n)
+{
+  uint64_t lo = 0, hi = 0;
+  uint32_t w;
+
+  switch (n >= 16 ? 16 : n) {
+  case 16: memcpy(&hi, p + 8, 8); memcpy(&lo, p, 8); break;
+  case 12: memcpy(&w, p + 8, 4); hi = w; memcpy(&lo, p, 8); break;
+  case 8:  memcpy(&lo, p, 8); break;
+  case 4:  memcpy(&w, p, 4); lo = w; break;
+  default: {
+      uint8_t b[16] = { 0 };
+      memcpy(b, p, n);
+      memcpy(&lo, b, 8);
+      memcpy(&hi, b + 8, 8);
+    }
+  }
+  return _mm_set_epi64x(hi, lo);
+}
+
+// For a 32-bit word w of input at bit position 32m, the windows are the
+// top 32 bits of window[m] << j for each bit j of w that is set (counting
+// from the most significant bit.) Their XOR is the middle 32 bits of the
+// carry-less product of window[m] and w with its bits reversed, which is
+// what the bytes of w read as a little-endian word are after reversing
+// the bits of each byte.
+__attribute__((target("pclmul,ssse3")))
+uint32_t toeplitz_clmul(const struct toeplitz_key *key,
+                        const uint8_t *data, size_t len)
+{
+  const __m128i nibbles = _mm_set1_epi8(0x0f);
+  // Bit reversal of each nibble value.
+  const __m128i rev_lo = _mm_setr_epi8(0x00, 0x80, 0x40, 0xc0, 0x20, 0xa0,
+                                       0x60, 0xe0, 0x10, 0x90, 0x50, 0xd0,
+                                       0x30, 0xb0, 0x70, 0xf0);
+  const __m128i rev_hi = _mm_setr_epi8(0x00, 0x08, 0x04, 0x0c, 0x02, 0x0a,
+                                       0x06, 0x0e, 0x01, 0x09, 0x05, 0x0d,
+                                       0x03, 0x0b, 0x07, 0x0f);
+  const __m128i zero = _mm_setzero_si128();
+  __m128i acc = zero;
+  size_t i;
+
+  for (i = 0; i < len; i += 16) {
+    __m128i x = load_block(data + i, len - i), lo, hi, r, k;
+    lo = _mm_shuffle_epi8(rev_lo, _mm_and_si128(x, nibbles));
+    hi = _mm_shuffle_epi8(rev_hi, _mm_and_si128(_mm_srli_epi16(x, 4), nibbles));
+    r = _mm_or_si128(lo, hi);
+    // Words 0 and 1, and 2 and 3 of r, zero-extended to 64 bits, times
+    // their windows.
+    k = _mm_loadu_si128((const __m128i *)&key->window[i / 4]);
+    lo = _mm_unpacklo_epi32(r, zero);
+    acc = _mm_xor_si128(acc, _mm_clmulepi64_si128(lo, k, 0x00));
+    acc = _mm_xor_si128(acc, _mm_clmulepi64_si128(lo, k, 0x11));
+    k = _mm_loadu_si128((const __m128i *)&key->window[i / 4 + 2]);
+    hi = _mm_unpackhi_epi32(r, zero);
+    acc = _mm_xor_si128(acc, _mm_clmulepi64_si128(hi, k, 0x00));
+    acc = _mm_xor_si128(acc, _mm_clmulepi64_si128(hi, k, 0x11));
+  }
+  return (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(acc, 4));
+}
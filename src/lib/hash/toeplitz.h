@@ -0,0 +1,26 @@
+/* Use of this source code is governed by the Apache 2.0 license; see COPYING. */
+
+enum { TOEPLITZ_KEY_SIZE  = 40,
+       // The longest input a key covers: two IPv6 addresses and two ports.
+       TOEPLITZ_MAX_INPUT = 36,
+       // Windows of the key (see below), rounded up to whole 16-byte
+       // blocks of input.
+       TOEPLITZ_WINDOWS   = 12
+};
+
+// A Toeplitz key, and the 64 key bits starting at each 32-bit offset
+// (big-endian, zero-padded; used by the CLMUL kernel.)
+struct toeplitz_key {
+  uint8_t bytes[TOEPLITZ_KEY_SIZE];
+  uint64_t window[TOEPLITZ_WINDOWS];
+};
+
+// Compute the Toeplitz hash of the len bytes at data, where
+// len <= TOEPLITZ_MAX_INPUT, using portable C code.
+uint32_t toeplitz_generic(const struct toeplitz_key *key,
+                          const uint8_t *data, size_t len);
+
+// Same, using PCLMULQDQ and SSSE3 instructions. (This will crash if you call it on a CPU that does not support
+// PCLMULQDQ.)
+uint32_t toeplitz_clmul(const struct toeplitz_key *key,
+                        const uint8_t *data, size_t len);
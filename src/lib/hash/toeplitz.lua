@@ -0,0 +1,214 @@
+-- Use of this source code is governed by the Apache 2.0 license; see COPYING.
+
+-- The Toeplitz hash, as computed by NICs for receive side scaling (RSS)
+-- (see Microsoft's "RSS hashing types" and "Verifying the RSS hash
+-- calculation".)  The input is a flow's source and destination
+-- addresses, optionally followed by its source and destination ports,
+-- in network byte order.  With the same key, make_hash() computes the
+-- same hash as a NIC, so that software RSS (e.g. apps.rss) can agree
+-- with hardware RSS.
+--
+-- The symmetric key repeats a 16-bit pattern, so that swapping the
+-- addresses and ports of a flow does not change its hash, i.e. both
+-- directions of a connection hash alike (S. Woo and K. Park, "Scalable
+-- TCP Session Monitoring with Symmetric Receive-side Scaling", 2012.)
+
+module(..., package.seeall)
+
+require("lib.hash.toeplitz_h")
+local lib = require("core.lib")
+local ffi = require("ffi")
+local C = ffi.C
+
+key_size = C.TOEPLITZ_KEY_SIZE
+max_input = C.TOEPLITZ_MAX_INPUT
+
+keys = {
+   symmetric = ("\x6d\x5a"):rep(key_size / 2),
+   -- The key of the RSS specification, the default of many drivers.
+   microsoft = lib.hexundump([[
+      6d 5a 56 da 25 5b 0e c2 41 67 25 3d 43 a3 8f b0
+      d0 ca 2b cb ae 7b 30 b4 77 cb 2d a3 80 30 f2 0c
+      6a 42 b7 3b be ac 01 fa
+   ]], key_size)
+}
+
+kernels = {
+   generic = C.toeplitz_generic,
+   clmul = C.toeplitz_clmul
+}
+
+local cpuinfo = lib.readfile("/proc/cpuinfo", "*a") or ""
+local function cpu_has (flag)
+   return cpuinfo:match("[ \t]"..flag.."[ \n]") ~= nil
+end
+
+-- Return the names of the kernels supported by this CPU.
+function supported_kernels ()
+   local supported = {"generic"}
+   if cpu_has("pclmulqdq") and cpu_has("ssse3") then
+      table.insert(supported, "clmul")
+   end
+   return supported
+end
+
+-- Select the kernel to use: SNABB_TOEPLITZ can name one explicitly,
+-- otherwise the best one supported by the CPU is used.
+local function select_kernel ()
+   local supported = supported_kernels()
+   local name = lib.getenv("SNABB_TOEPLITZ")
+   if name then
+      for _, s in ipairs(supported) do
+         if s == name then return name end
+      end
+      error("toeplitz kernel not supported by this CPU: "..name)
+   end
+   return supported[#supported]
+end
+
+kernel = select_kernel()
+
+-- Return the key bytes of key, which is either the name of one of the
+-- keys above, or a string of key_size bytes in hexadecimal (whitespace
+-- is ignored.)
+function parse_key (key)
+   if keys[key] then return keys[key] end
+   assert(type(key) == 'string' and #key:gsub("%s", "") == key_size * 2
+             and not key:gsub("%s", ""):match("%X"),
+          "Toeplitz key must be one of the named keys or "
+             ..key_size.." bytes in hex: "..tostring(key))
+   return lib.hexundump(key, key_size)
+end
+
+-- Return a struct toeplitz_key for key (see parse_key.)
+function new_key (key)
+   local bytes = parse_key(key)
+   local k = ffi.new("struct toeplitz_key")
+   ffi.copy(k.bytes, bytes, key_size)
+   for m = 0, C.TOEPLITZ_WINDOWS - 1 do
+      local w = 0ULL
+      for i = 0, 7 do
+         local byte = 4*m + i < key_size and k.bytes[4*m + i] or 0
+         w = bit.bor(bit.lshift(w, 8), byte)
+      end
+      k.window[m] = w
+   end
+   return k
+end
+
+local hash_config = {
+   -- Size of the input in bytes.
+   size = {required=true},
+   -- Key name or bytes, see parse_key.
+   key = {default="symmetric"},
+   -- Kernel to use, see kernels.
+   kernel = {}
+}
+
+-- Return a function that returns the Toeplitz hash (a 32-bit unsigned
+-- number) of the opts.size bytes at a pointer.
+function make_hash (opts)
+   opts = lib.parse(opts, hash_config)
+   local size = opts.size
+   assert(size > 0 and size <= max_input,
+          "Toeplitz input size must be between 1 and "..max_input)
+   local key = new_key(opts.key)
+   local name = opts.kernel or kernel
+   local fn = assert(kernels[name], "no such toeplitz kernel: "..name)
+   return function (ptr)
+      return fn(key, ptr, size)
+   end
+end
+
+function selftest ()
+   print("selftest: lib.hash.toeplitz")
+   local ipv4, ipv6 = require("lib.protocol.ipv4"), require("lib.protocol.ipv6")
+   local function pton4 (a) return ipv4:pton(a) end
+   local function pton6 (a) return ipv6:pton(a) end
+
+   -- The test vectors of "Verifying the RSS hash calculation": source
+   -- address and port, destination address and port, the hash of the
+   -- addresses, and the hash of the addresses and ports.
+   local vectors4 = {
+      {"66.9.149.187", 2794, "161.142.100.80", 1766, 0x323e8fc2, 0x51ccc178},
+      {"199.92.111.2", 14230, "65.69.140.83", 4739, 0xd718262a, 0xc626b0ea},
+      {"24.19.198.95", 12898, "12.22.207.184", 38024, 0xd2d0a5de, 0x5c2b394a},
+      {"38.27.205.30", 48228, "209.142.163.6", 2217, 0x82989176, 0xafc7327f},
+      {"153.39.163.191", 44251, "202.188.127.2", 1303, 0x5d1809c5, 0x10e828a2}
+   }
+   local vectors6 = {
+      {"3ffe:2501:200:1fff::7", 2794, "3ffe:2501:200:3::1", 1766,
+       0x2cc18cd5, 0x40207d3d},
+      {"3ffe:501:8::260:97ff:fe40:efab", 14230, "ff02::1", 4739,
+       0x0f0c461c, 0xdde51bbf},
+      {"3ffe:1900:4545:3:200:f8ff:fe21:67cf", 44251, "fe80::200:f8ff:fe21:67cf",
+       38024, 0x4b61e985, 0x02d1feef}
+   }
+   local input = ffi.new("uint8_t[?]", max_input)
+   local function tuple (pton, src, sport, dst, dport)
+      local a, b = pton(src), pton(dst)
+      local n = ffi.sizeof(a)
+      ffi.copy(input, a, n)
+      ffi.copy(input + n, b, n)
+      ffi.cast("uint16_t *", input + 2*n)[0] = lib.htons(sport)
+      ffi.cast("uint16_t *", input + 2*n)[1] = lib.htons(dport)
+      return 2*n
+   end
+   for _, name in ipairs(supported_kernels()) do
+      for _, v in ipairs(vectors4) do
+         local n = tuple(pton4, unpack(v))
+         assert(make_hash{size=n, key="microsoft", kernel=name}(input) == v[5])
+         assert(make_hash{size=n+4, key="microsoft", kernel=name}(input) == v[6])
+      end
+      for _, v in ipairs(vectors6) do
+         local n = tuple(pton6, unpack(v))
+         assert(make_hash{size=n, key="microsoft", kernel=name}(input) == v[5])
+         assert(make_hash{size=n+4, key="microsoft", kernel=name}(input) == v[6])
+      end
+   end
+
+   -- The kernels agree on random keys and inputs.
+   local function random_key ()
+      return lib.hexdump(ffi.string(lib.random_bytes(key_size), key_size))
+   end
+   local data = ffi.new("uint8_t[?]", max_input)
+   for _ = 1, 1000 do
+      local key = random_key()
+      local size = math.random(max_input)
+      local generic = make_hash{size=size, key=key, kernel="generic"}
+      local hashes = {}
+      for _, name in ipairs(supported_kernels()) do
+         hashes[name] = make_hash{size=size, key=key, kernel=name}
+      end
+      for _ = 1, 10 do
+         for i = 0, size - 1 do data[i] = math.random(0, 255) end
+         for name, hash in pairs(hashes) do
+            assert(hash(data) == generic(data), name)
+         end
+      end
+   end
+
+   -- The symmetric key hashes both directions of a flow alike.
+   local function swap (n)
+      local a = ffi.new("uint8_t[?]", n)
+      ffi.copy(a, input, n)
+      ffi.copy(input, input + n, n)
+      ffi.copy(input + n, a, n)
+      local ports = ffi.cast("uint16_t *", input + 2*n)
+      ports[0], ports[1] = ports[1], ports[0]
+   end
+   for _, n in ipairs{4, 16} do
+      local hash = make_hash{size=2*n+4}
+      for _ = 1, 1000 do
+         for i = 0, 2*n+3 do input[i] = math.random(0, 255) end
+         local h = hash(input)
+         swap(n)
+         assert(hash(input) == h)
+      end
+   end
+
+   assert(not pcall(parse_key, "foo"))
+   assert(parse_key(lib.hexdump(keys.microsoft)) == keys.microsoft)
+
+   print("selftest: ok")
+end
@@ -56,6 +56,66 @@ module(...,package.seeall)
 --    push(r) / pull(r)
 --       Makes subsequent calls to full / empty reflect updates to the queue
 --       caused by insert / extract.
+--
+-- Batch API
+-- ----------
+--
+-- The packet array of an interlink is aligned to cache lines, and can be
+-- operated on in groups of batch_size packets (one cache line worth of
+-- packet pointers.) Filling and draining the queue a whole cache line at a
+-- time means that the transmitter and receiver rarely touch the same line of
+-- the packet array at the same time.
+--
+--    room(r, n) -> count
+--       Return the number of packets, up to n, that can be inserted into
+--       interlink r as one batch: never more than the free slots left in
+--       the current cache line of the queue.
+--
+--    insert_batch(r, packets, n)
+--       Insert n packets from the array packets (indexed from 0) into
+--       interlink r. Must not be called with n greater than room(r, n).
+--
+--    avail(r, n) -> count
+--       Return the number of packets, up to n, that can be extracted from
+--       interlink r as one batch: never more than the filled slots left in
+--       the current cache line of the queue.
+--
+--    Packets of a batch can be inserted / extracted one by one with insert /
+--    extract, or all at once with the functions below.
+--
+--    extract_batch(r, packets, n) -> count
+--       Extract up to n packets from interlink r into the array packets, and
+--       return the number of packets extracted. Never extracts past the end
+--       of the current cache line of the queue, or when the queue is empty.
+--
+--    push_early(r) / pull_early(r)
+--       Adaptive variants of push / pull that are meant to be called after
+--       each batch. They publish completed cache lines only if the other end
+--       is waiting for them: push_early when the receiver has drained the
+--       queue, and pull_early when the queue was full. A lightly loaded
+--       queue thus gets low latency, while a busy queue only writes to the
+--       shared indexes once per breath (on push / pull.)
+--
+-- Residency measurement
+-- ---------------------
+--
+-- Optionally, the transmitter can stamp each cache line of packets with the
+-- time (in TSC ticks, see lib.tsc) at which it started filling it, and the
+-- receiver can compute how long a cache line spent in the queue. This costs
+-- one store per batch for the transmitter, and one load per batch for the
+-- receiver.
+--
+--    enable_stamps(r, enable)
+--       Called by the transmitter to announce whether it stamps batches.
+--
+--    stamp(r, tsc)
+--       Record tsc as the enqueue time of the next batch if it starts a
+--       cache line. Must be called before inserting the batch.
+--
+--    residency(r, tsc) -> ticks | nil
+--       Return the number of ticks the next batch spent in the queue as of
+--       tsc if it starts a cache line and was stamped, or nil otherwise.
+--       Must be called before extracting the batch.
 
 local shm = require("core.shm")
 local ffi = require("ffi")
@@ -66,13 +126,21 @@ local sync = require("core.sync")
 local CACHELINE = 64 -- XXX - make dynamic
 local INT = ffi.sizeof("uint32_t")
 
+batch_size = CACHELINE / ffi.sizeof("struct packet *")
+
+local LINE = batch_size - 1
+
 -- Based on MCRingBuffer, see
 --   http://www.cse.cuhk.edu.hk/%7Epclee/www/pubs/ipdps10.pdf
 
+-- The packets array is followed by one TSC stamp per cache line of packets
+-- (see stamp and residency.) The stamped field is set while the transmitter
+-- is stamping batches.
+
 ffi.cdef([[
    struct interlink {
-      uint32_t read, write, size, state[1];
-      char pad1[]]..CACHELINE-4*INT..[[];
+      uint32_t read, write, size, state[1], stamped;
+      char pad1[]]..CACHELINE-5*INT..[[];
       uint32_t lwrite, nread, rmask;
       char pad2[]]..CACHELINE-3*INT..[[];
       uint32_t lread, nwrite, wmask;
@@ -81,6 +149,11 @@ ffi.cdef([[
    } __attribute__((packed, aligned(]]..CACHELINE..[[)))
 ]])
 
+-- Number of elements of the packets array, including stamps.
+local function nslots (size)
+   return size + size / batch_size
+end
+
 -- The life cycle of an interlink is managed using a state machine. This is
 -- necessary because we allow receiving and transmitting processes to attach
 -- and detach in any order, and even for multiple processes to attempt to
@@ -139,12 +212,13 @@ local DOWN = 6 -- Both ends have detached; must be re-allocated.
 
 local function attach (name, size, transitions)
    assert(band(size, size-1) == 0, "size is not a power of two")
+   assert(size >= batch_size, "size is smaller than a batch")
    local r
    local first_try = true
    waitfor(
       function ()
          -- Create/open the queue.
-         r = shm.create(name, "struct interlink", size)
+         r = shm.create(name, "struct interlink", nslots(size))
          -- Initialize queue and configure its size
          -- (only one process can set size).
          if sync.cas(r.state, INIT, CONF) then
@@ -268,6 +342,98 @@ function pull (r)
    r.read = r.nread
 end
 
+-- Batch operations follow below.
+
+function room (r, n)
+   local nwrite, mask = r.nwrite, r.wmask
+   -- Limit to the current cache line of the packet array.
+   n = math.min(n, batch_size - band(nwrite, LINE))
+   -- Limit to the free slots, refresh cached read index if needed.
+   local avail = band(r.lread - nwrite - 1, mask)
+   if avail < n then
+      r.lread = r.read
+      avail = band(r.lread - nwrite - 1, mask)
+      if avail < n then n = avail end
+   end
+   return n
+end
+
+function insert_batch (r, packets, n)
+   local nwrite = r.nwrite
+   for i = 0, n - 1 do
+      r.packets[nwrite + i] = packets[i]
+   end
+   r.nwrite = band(nwrite + n, r.wmask)
+end
+
+function avail (r, n)
+   local nread, mask = r.nread, r.rmask
+   -- Limit to the current cache line of the packet array.
+   n = math.min(n, batch_size - band(nread, LINE))
+   -- Limit to the filled slots, refresh cached write index if needed.
+   local filled = band(r.lwrite - nread, mask)
+   if filled < n then
+      r.lwrite = r.write
+      filled = band(r.lwrite - nread, mask)
+      if filled < n then n = filled end
+   end
+   return n
+end
+
+function extract_batch (r, packets, n)
+   local nread = r.nread
+   n = avail(r, n)
+   for i = 0, n - 1 do
+      packets[i] = r.packets[nread + i]
+   end
+   r.nread = band(nread + n, r.rmask)
+   return n
+end
+
+function push_early (r)
+   local nwrite = r.nwrite
+   -- Publish if we completed a cache line and the receiver is idle.
+   if band(nwrite, LINE) == 0 and r.read == r.write then
+      r.write = nwrite
+   end
+end
+
+function pull_early (r)
+   local nread = r.nread
+   -- Publish if we completed a cache line and the transmitter is blocked.
+   if band(nread, LINE) == 0 and band(r.write + 1, r.rmask) == r.read then
+      r.read = nread
+   end
+end
+
+-- Residency measurement follows below.
+
+local uint64_ptr_t = ffi.typeof("uint64_t *")
+
+local function stamps (r)
+   return ffi.cast(uint64_ptr_t, r.packets + r.size)
+end
+
+function enable_stamps (r, enable)
+   r.stamped = enable and 1 or 0
+end
+
+function stamp (r, tsc)
+   local nwrite = r.nwrite
+   if band(nwrite, LINE) == 0 then
+      stamps(r)[nwrite / batch_size] = tsc
+   end
+end
+
+function residency (r, tsc)
+   local nread = r.nread
+   if r.stamped ~= 0 and band(nread, LINE) == 0 then
+      local enqueued = stamps(r)[nread / batch_size]
+      -- Ignore stale stamps (written before the transmitter attached.)
+      if enqueued > 0 and enqueued <= tsc then return tsc - enqueued end
+   end
+end
+
 -- The code below registers an abstract SHM object type with core.shm, and
 -- implements the minimum API necessary for programs like snabb top to inspect
 -- interlink queues (including a tostring meta-method to describe queue
@@ -279,7 +445,7 @@ function open (name, readonly)
    local r = shm.open(name, "struct interlink", 'read-only', 1)
    local size = r.size
    shm.unmap(r)
-   return shm.open(name, "struct interlink", readonly, size)
+   return shm.open(name, "struct interlink", readonly, nslots(size))
 end
 
 local function describe (r)
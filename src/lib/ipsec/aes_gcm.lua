@@ -70,6 +70,29 @@ end
 
 local function u8_ptr (ptr) return ffi.cast("uint8_t *", ptr) end
 
+-- Maximum number of messages that can be queued for batch processing.
+max_batch = 32
+
+-- Per-message IV, AAD and tag of a batch.
+local batch_block_t = ffi.typeof[[
+   struct {
+      uint32_t iv[4];  // salt, IV, block counter
+      uint32_t aad[4]; // SPI, Sequence Number (high, low), padding
+      uint8_t tag[16];
+   } __attribute__((aligned(16)))
+]]
+
+-- The batch state is shared by all instances (which makes having many
+-- SAs cheap): messages must be queued and processed by one instance at
+-- a time.
+local jobs = ffi.new("gcm_job[?]", max_batch)
+local blocks = ffi.new(ffi.typeof("$[?]", batch_block_t), max_batch)
+for i = 0, max_batch - 1 do
+   local job, block = jobs[i], blocks[i]
+   block.iv[3] = htonl(0x1)
+   job.iv, job.aad = u8_ptr(block.iv), u8_ptr(block.aad)
+end
+
 local aes_gcm = {}
 
 function aes_gcm:new (spi, key, keylen, salt)
@@ -84,7 +107,7 @@ function aes_gcm:new (spi, key, keylen, salt)
    o.iv = iv:new(lib.hexundump(salt, 4, "Need 4 bytes of salt."))
    -- “Implementations MUST support a full-length 16-octet ICV”
    o.AUTH_SIZE = 16
-   o.auth_buf = ffi.new("uint8_t[?]", o.AUTH_SIZE)
+   o.auth_buf = ffi.new("uint8_t[?] __attribute__((aligned(16)))", o.AUTH_SIZE)
    o.AAD_SIZE = 12
    o.aad = aad:new(spi)
    -- Compute subkey (H)
@@ -102,6 +125,16 @@ function aes_gcm:new (spi, key, keylen, salt)
       o.gcm_dec = ASM.aesni_gcm_dec_256_avx_gen4
    end
    ASM.aesni_gcm_precomp_avx_gen4(o.gcm_data, hash_subkey)
+   if keylen == 128 then
+      o.gcm_enc_x4 = ASM.aesni_gcm_enc_128_avx_gen4_x4
+      o.gcm_dec_x4 = ASM.aesni_gcm_dec_128_avx_gen4_x4
+   elseif keylen == 256 then
+      o.gcm_enc_x4 = ASM.aesni_gcm_enc_256_avx_gen4_x4
+      o.gcm_dec_x4 = ASM.aesni_gcm_dec_256_avx_gen4_x4
+   end
+   -- Salt and SPI as stored in the IV and AAD blocks of a batch.
+   o.salt = ffi.cast("uint32_t *", o.iv:header().salt)[0]
+   o.spi = o.aad:header().spi
    return setmetatable(o, {__index=aes_gcm})
 end
 
@@ -128,6 +161,93 @@ function aes_gcm:decrypt (out_ptr, seq_low, seq_high, iv, ciphertext, length)
    return ASM.auth16_equal(self.auth_buf, ciphertext + length) == 0
 end
 
+-- The Sequence Number enters the tag only via the AAD block, which GHASH
+-- multiplies by H^m, m being the number of blocks hashed from the AAD
+-- block on (AAD, ciphertext and lengths blocks).  Hence, once a message
+-- has been decrypted under SEQ_HIGH (its tag left in auth_buf), the tag
+-- under a different NEW_SEQ_HIGH is that tag XOR (AAD XOR AAD') * H^m,
+-- and aes_gcm:reauthenticate checks whether it matches without touching
+-- the message again. (The plaintext does not depend on the Sequence
+-- Number, so the message need not be decrypted again either.)
+local auth_delta = ffi.new("uint32_t[4] __attribute__((aligned(16)))")
+
+function aes_gcm:reauthenticate (seq_high, new_seq_high, ciphertext, length)
+   auth_delta[1] = bit.bxor(htonl(seq_high), htonl(new_seq_high))
+   ASM.aesni_gcm_hpow_mul_avx_gen4(self.gcm_data, u8_ptr(auth_delta),
+                                   math.ceil(length / 16) + 2)
+   local tag = ffi.cast("uint32_t *", self.auth_buf)
+   for i = 0, 3 do
+      tag[i] = bit.bxor(tag[i], auth_delta[i])
+      auth_delta[i] = 0
+   end
+   return ASM.auth16_equal(self.auth_buf, ciphertext + length) == 0
+end
+
+-- Batch interface: up to max_batch messages are queued with
+-- aes_gcm:queue, and then encrypted or decrypted with a single call to
+-- aes_gcm:encrypt_batch or aes_gcm:decrypt_batch, which processes short
+-- messages four at a time with the multi-buffer kernel.  Messages queued
+-- for decryption (without AUTH_DEST) have their tag computed into the
+-- batch state, and aes_gcm:verify then tells whether it matches the tag
+-- found at the end of the ciphertext.
+
+function aes_gcm:queue (i, out_ptr, iv, seq_low, seq_high, input, length, auth_dest)
+   local job, block = jobs[i], blocks[i]
+   block.iv[0] = self.salt
+   ffi.copy(block.iv + 1, iv, 8) -- IV_SIZE
+   block.aad[0] = self.spi
+   block.aad[1] = htonl(seq_high)
+   block.aad[2] = htonl(seq_low)
+   job.dst, job.src, job.len, job.aadlen = out_ptr, input, length, self.AAD_SIZE
+   job.tag = auth_dest or block.tag
+end
+
+-- The single message kernel processes eight blocks at a time with
+-- aggregated GHASH reduction, so it beats the multi-buffer kernel once
+-- messages are that long: we only use the latter for groups of four
+-- messages that are all shorter than x4_max_length.
+local x4_max_length = 16*8
+
+local function x4_eligible (jobs, i)
+   return jobs[i].len < x4_max_length and jobs[i+1].len < x4_max_length
+      and jobs[i+2].len < x4_max_length and jobs[i+3].len < x4_max_length
+end
+
+function aes_gcm:encrypt_batch (n)
+   local gcm_data = self.gcm_data
+   for i = 0, n - 1, 4 do
+      if i + 4 <= n and x4_eligible(jobs, i) then
+         self.gcm_enc_x4(gcm_data, jobs + i)
+      else
+         for i = i, math.min(i + 3, n - 1) do
+            local job = jobs[i]
+            self.gcm_enc(gcm_data, job.dst, job.src, job.len, job.iv,
+                         job.aad, self.AAD_SIZE, job.tag, self.AUTH_SIZE)
+         end
+      end
+   end
+end
+
+function aes_gcm:decrypt_batch (n)
+   local gcm_data = self.gcm_data
+   for i = 0, n - 1, 4 do
+      if i + 4 <= n and x4_eligible(jobs, i) then
+         self.gcm_dec_x4(gcm_data, jobs + i)
+      else
+         for i = i, math.min(i + 3, n - 1) do
+            local job = jobs[i]
+            self.gcm_dec(gcm_data, job.dst, job.src, job.len, job.iv,
+                         job.aad, self.AAD_SIZE, job.tag, self.AUTH_SIZE)
+         end
+      end
+   end
+end
+
+function aes_gcm:verify (i)
+   local job = jobs[i]
+   return ASM.auth16_equal(job.tag, u8_ptr(job.src) + job.len) == 0
+end
+
 aes_128_gcm = {}
 function aes_128_gcm:new (spi, key, salt)
    return aes_gcm:new(spi, key, 128, salt)
@@ -393,6 +513,78 @@ function selftest ()
       assert(ffi.string(buf, ffi.sizeof(buf)) == lib.hexundump(t.plaintext, #t.plaintext/2))
       assert(ffi.string(tag, 16) == lib.hexundump(t.tag, #t.tag/2))
    end
+   -- Test the batch interface against single message encryption, for
+   -- batches of messages of random lengths (in particular with
+   -- differing numbers of full blocks and partial last blocks).
+   for _, keylen in ipairs{128, 256} do
+      local k = ("0123456789abcdef"):rep(keylen/64)
+      local gcm = aes_gcm:new(0x12345678, k, keylen, "0a0b0c0d")
+      local max_length = 300
+      local size = max_length + gcm.AUTH_SIZE
+      local plain = ffi.new("uint8_t[?]", max_batch * size)
+      local single = ffi.new("uint8_t[?]", max_batch * size)
+      local batch = ffi.new("uint8_t[?]", max_batch * size)
+      local ivs = ffi.new("uint8_t[?]", max_batch * gcm.IV_SIZE)
+      for round = 1, 200 do
+         local n = math.random(max_batch)
+         local lengths = {}
+         for i = 0, n - 1 do
+            lengths[i] = math.random(0, round < 100 and 64 or max_length)
+            ffi.copy(plain + i*size, lib.random_bytes(max_length), max_length)
+            ffi.copy(ivs + i*gcm.IV_SIZE, lib.random_bytes(gcm.IV_SIZE),
+                     gcm.IV_SIZE)
+         end
+         for i = 0, n - 1 do
+            local p, o = plain + i*size, single + i*size
+            local iv = ivs + i*gcm.IV_SIZE
+            gcm:encrypt(o, iv, i, round, p, lengths[i], o + lengths[i])
+            o = batch + i*size
+            gcm:queue(i, o, iv, i, round, p, lengths[i], o + lengths[i])
+         end
+         gcm:encrypt_batch(n)
+         for i = 0, n - 1 do
+            assert(C.memcmp(single + i*size, batch + i*size,
+                            lengths[i] + gcm.AUTH_SIZE) == 0,
+                   "batch encryption mismatch")
+         end
+         -- Corrupt one message, then decrypt the batch in place.
+         local bad = math.random(0, n - 1)
+         local pos = bad*size + math.random(0, lengths[bad])
+         batch[pos] = bit.bxor(batch[pos], 1)
+         for i = 0, n - 1 do
+            local c = batch + i*size
+            gcm:queue(i, c, ivs + i*gcm.IV_SIZE, i, round, c, lengths[i])
+         end
+         gcm:decrypt_batch(n)
+         for i = 0, n - 1 do
+            if i == bad then
+               assert(not gcm:verify(i), "corrupt message verified")
+            else
+               assert(gcm:verify(i), "batch authentication failed")
+               assert(C.memcmp(plain + i*size, batch + i*size,
+                               lengths[i]) == 0,
+                      "batch decryption mismatch")
+            end
+         end
+      end
+   end
+   -- Test reauthentication under a different Sequence Number.
+   for _, keylen in ipairs{128, 256} do
+      local k = ("fedcba9876543210"):rep(keylen/64)
+      local gcm = aes_gcm:new(0x12345678, k, keylen, "0a0b0c0d")
+      local iv = lib.random_bytes(gcm.IV_SIZE)
+      local buf = ffi.new("uint8_t[?]", 300 + gcm.AUTH_SIZE)
+      for length = 0, 300 do
+         local plain = lib.random_bytes(length)
+         local seq_high = math.random(0, 2^32-1)
+         gcm:encrypt(buf, iv, 42, seq_high, plain, length, buf + length)
+         assert(not gcm:decrypt(buf, 42, seq_high - 1, iv, buf, length))
+         assert(ffi.string(buf, length) == ffi.string(plain, length))
+         assert(not gcm:reauthenticate(seq_high - 1, seq_high + 1, buf, length))
+         assert(gcm:reauthenticate(seq_high + 1, seq_high, buf, length),
+                "reauthentication failed")
+      end
+   end
    -- Microbenchmarks.
    local pmu = require("lib.pmu")
    local has_pmu_counters, err = pmu.is_available()
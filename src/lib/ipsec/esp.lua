@@ -34,7 +34,20 @@ local logger = require("lib.logger").new({ rate = 32, module = 'esp' })
 local htons, htonl, ntohl = lib.htons, lib.htonl, lib.ntohl
 
 require("lib.ipsec.track_seq_no_h")
-local window_t = ffi.typeof("uint8_t[?]")
+local window_t = ffi.typeof("uint64_t[?]")
+
+-- Maximum number of packets processed by the batch routines at once.
+max_batch = aes_gcm.max_batch
+
+-- State of batched decapsulation (per packet).
+local batch_state_t = ffi.typeof([[
+   struct {
+      uint32_t seq_low[$];
+      int64_t seq_high[$];
+      int32_t job[$];
+      bool authentic[$];
+   }
+]], max_batch, max_batch, max_batch, max_batch)
 
 PROTOCOL = 50 -- https://tools.ietf.org/html/rfc4303#section-2
 
@@ -101,11 +114,15 @@ function encrypt:encode_esp_trailer (ptr, next_header, pad_length)
 end
 
 function encrypt:encrypt_payload (ptr, length)
-   self:next_seq_no()
    local seq, low, high = self.seq, self.seq:low(), self.seq:high()
    self.cipher:encrypt(ptr, seq, low, high, ptr, length, ptr + length)
 end
 
+function encrypt:queue_payload (i, ptr, length)
+   local seq, low, high = self.seq, self.seq:low(), self.seq:high()
+   self.cipher:queue(i, ptr, seq, low, high, ptr, length, ptr + length)
+end
+
 function encrypt:encode_esp_header (ptr)
    local esp_header = ffi.cast(esp_header_ptr_t, ptr)
    esp_header.spi = htonl(self.spi)
@@ -116,10 +133,12 @@ end
 -- Encapsulation in transport mode is performed as follows:
 --   1. Grow p to fit ESP overhead
 --   2. Append ESP trailer to p
---   3. Encrypt payload+trailer in place
---   4. Move resulting ciphertext to make room for ESP header
---   5. Write ESP header
-function encrypt:encapsulate_transport6 (p)
+--   3. Move payload+trailer to make room for ESP header
+--   4. Write ESP header
+--   5. Encrypt payload+trailer in place
+-- Steps 1-4 are performed by prepare_transport6, which returns the
+-- packet and the location and length of the plaintext to encrypt.
+function encrypt:prepare_transport6 (p)
    if p.length < TRANSPORT6_PAYLOAD_OFFSET then return nil end
 
    local ip = ffi.cast(ipv6_ptr_t, p.data + ETHERNET_SIZE)
@@ -134,16 +153,21 @@ function encrypt:encapsulate_transport6 (p)
    self:encode_esp_trailer(tail, ip.next_header, pad_length)
 
    local ctext_length = payload_length + pad_length + ESP_TAIL_SIZE
-   self:encrypt_payload(payload, ctext_length)
-
    local ctext = payload + ESP_SIZE + self.cipher.IV_SIZE
-   C.memmove(ctext, payload, ctext_length + self.cipher.AUTH_SIZE)
+   C.memmove(ctext, payload, ctext_length)
 
+   self:next_seq_no()
    self:encode_esp_header(payload)
 
    ip.next_header = PROTOCOL
    ip.payload_length = htons(payload_length + overhead)
 
+   return p, ctext, ctext_length
+end
+
+function encrypt:encapsulate_transport6 (p)
+   local p, ctext, ctext_length = self:prepare_transport6(p)
+   if p then self:encrypt_payload(ctext, ctext_length) end
    return p
 end
 
@@ -152,11 +176,12 @@ end
 -- its Ethernet header.)
 --   1. Grow and shift p to fit ESP overhead
 --   2. Append ESP trailer to p
---   3. Encrypt payload+trailer in place
---   4. Write ESP header
+--   3. Write ESP header
+--   4. Encrypt payload+trailer in place
 -- (The resulting packet contains the raw ESP frame, without IP or Ethernet
 -- headers.)
-function encrypt:encapsulate_tunnel (p, next_header)
+-- Steps 1-3 are performed by prepare_tunnel.
+function encrypt:prepare_tunnel (p, next_header)
    local pad_length = self:padding(p.length)
    local trailer_overhead = pad_length + ESP_TAIL_SIZE + self.cipher.AUTH_SIZE
    local orig_length = p.length
@@ -166,16 +191,47 @@ function encrypt:encapsulate_tunnel (p, next_header)
    self:encode_esp_trailer(tail, next_header, pad_length)
 
    local ctext_length = orig_length + pad_length + ESP_TAIL_SIZE
-   self:encrypt_payload(p.data, ctext_length)
-
-   local len = p.length
    p = packet.shiftright(p, ESP_SIZE + self.cipher.IV_SIZE)
 
+   self:next_seq_no()
    self:encode_esp_header(p.data)
 
+   return p, p.data + ESP_SIZE + self.cipher.IV_SIZE, ctext_length
+end
+
+function encrypt:encapsulate_tunnel (p, next_header)
+   local p, ctext, ctext_length = self:prepare_tunnel(p, next_header)
+   self:encrypt_payload(ctext, ctext_length)
    return p
 end
 
+-- Batched encapsulation: the N packets in INPUT (at most max_batch) are
+-- encapsulated, and their payloads encrypted with a single call to the
+-- multi-buffer cipher.  OUTPUT[i] is set to the encapsulated packet, or
+-- to nil if INPUT[i] could not be encapsulated (in which case it is left
+-- to the caller to dispose of it).
+function encrypt:encapsulate_transport6_batch (input, output, n)
+   local nqueued = 0
+   for i = 0, n - 1 do
+      local p, ctext, ctext_length = self:prepare_transport6(input[i])
+      output[i] = p
+      if p then
+         self:queue_payload(nqueued, ctext, ctext_length)
+         nqueued = nqueued + 1
+      end
+   end
+   self.cipher:encrypt_batch(nqueued)
+end
+
+function encrypt:encapsulate_tunnel_batch (input, output, n, next_header)
+   for i = 0, n - 1 do
+      local p, ctext, ctext_length = self:prepare_tunnel(input[i], next_header)
+      output[i] = p
+      self:queue_payload(i, ctext, ctext_length)
+   end
+   self.cipher:encrypt_batch(n)
+end
+
 
 decrypt = {}
 
@@ -186,9 +242,12 @@ function decrypt:new (conf)
    o.CTEXT_OFFSET = ESP_SIZE + o.cipher.IV_SIZE
    o.PLAIN_OVERHEAD = ESP_SIZE + o.cipher.IV_SIZE + o.cipher.AUTH_SIZE
 
+   -- The window is a bitmap of 64 bit words, and its size a power of two
+   -- (which lets us index it cheaply.)
    local window_size = conf.window_size or 128
-   o.window_size = window_size + padding(8, window_size)
-   o.window = ffi.new(window_t, o.window_size / 8)
+   o.window_size = 64
+   while o.window_size < window_size do o.window_size = o.window_size * 2 end
+   o.window = ffi.new(window_t, o.window_size / 64)
 
    o.resync_threshold = conf.resync_threshold or 1024
    o.resync_attempts = conf.resync_attempts or 8
@@ -197,11 +256,17 @@ function decrypt:new (conf)
 
    o.auditing = conf.auditing
 
-   o.copy = packet.allocate()
+   o.batch_state = ffi.new(batch_state_t)
 
    return setmetatable(o, {__index=decrypt})
 end
 
+function decrypt:check_seq_no (seq_low)
+   return tonumber(
+      C.check_seq_no(seq_low, self.seq.no, self.window, self.window_size)
+   )
+end
+
 function decrypt:decrypt_payload (ptr, length, ip)
    -- NB: bounds check is performed by caller
    local esp_header = ffi.cast(esp_header_ptr_t, ptr)
@@ -210,9 +275,7 @@ function decrypt:decrypt_payload (ptr, length, ip)
    local ctext_length = length - self.PLAIN_OVERHEAD
 
    local seq_low = ntohl(esp_header.seq_no)
-   local seq_high = tonumber(
-      C.check_seq_no(seq_low, self.seq.no, self.window, self.window_size)
-   )
+   local seq_high = self:check_seq_no(seq_low)
 
    local error = nil
    if seq_high < 0 or not self.cipher:decrypt(
@@ -233,10 +296,18 @@ function decrypt:decrypt_payload (ptr, length, ip)
       return nil
    end
 
-   self.decap_fail = 0
+   self:track_seq_no(seq_low, seq_high)
+   return self:accept_payload(ctext_start, ctext_length)
+end
+
+function decrypt:track_seq_no (seq_low, seq_high)
    self.seq.no = C.track_seq_no(
       seq_high, seq_low, self.seq.no, self.window, self.window_size
    )
+end
+
+function decrypt:accept_payload (ctext_start, ctext_length)
+   self.decap_fail = 0
 
    local esp_trailer_start = ctext_start + ctext_length - ESP_TAIL_SIZE
    local esp_trailer = ffi.cast(esp_trailer_ptr_t, esp_trailer_start)
@@ -245,12 +316,109 @@ function decrypt:decrypt_payload (ptr, length, ip)
    return ctext_start, ptext_length, esp_trailer.next_header
 end
 
+-- Batched decryption of the payloads (at OFFSET) of the N packets in
+-- INPUT is performed in three passes:
+--   1. Check the Sequence Numbers of all payloads against the window at
+--      once, and queue those that are not replayed for decryption
+--   2. Decrypt all queued payloads with a single call to the
+--      multi-buffer cipher, and verify their tags
+--   3. Track the Sequence Numbers of the authentic payloads at once,
+--      which also rejects those replayed within the batch
+-- OUTPUT[i] is set to INPUT[i], or to nil if it is too short, and
+-- finish_payload then accepts or rejects each payload in order.
+--
+-- Batches in which resynchronization could be triggered (i.e., those
+-- that would exceed resync_threshold if all their payloads failed) skip
+-- pass 3 instead: their failed payloads have their ciphertext restored
+-- and go through decrypt_payload, so that they are handled exactly as if
+-- the packets had been decapsulated one by one.
+function decrypt:decrypt_payload_batch (input, output, n, offset)
+   local state = self.batch_state
+   local seq_low, seq_high = state.seq_low, state.seq_high
+   for i = 0, n - 1 do
+      local p = input[i]
+      if p.length - offset < self.MIN_SIZE then
+         output[i] = nil
+         seq_low[i] = 0
+      else
+         output[i] = p
+         local esp_header = ffi.cast(esp_header_ptr_t, p.data + offset)
+         seq_low[i] = ntohl(esp_header.seq_no)
+      end
+   end
+   C.check_seq_no_batch(
+      seq_low, seq_high, n, self.seq.no, self.window, self.window_size
+   )
+   local nqueued = 0
+   for i = 0, n - 1 do
+      local p = output[i]
+      if p ~= nil and seq_high[i] >= 0 then
+         local ptr = p.data + offset
+         local ctext_start = ptr + self.CTEXT_OFFSET
+         self.cipher:queue(nqueued, ctext_start, ptr + ESP_SIZE, seq_low[i],
+                           tonumber(seq_high[i]), ctext_start,
+                           p.length - offset - self.PLAIN_OVERHEAD)
+         state.job[i] = nqueued
+         nqueued = nqueued + 1
+      else
+         state.job[i] = -1
+      end
+   end
+   self.cipher:decrypt_batch(nqueued)
+   for i = 0, n - 1 do
+      local job = state.job[i]
+      state.authentic[i] = job >= 0 and self.cipher:verify(job)
+   end
+   self.batch_sequential = self.decap_fail + n > self.resync_threshold
+   if not self.batch_sequential then
+      for i = 0, n - 1 do
+         if not state.authentic[i] then seq_high[i] = -1 end
+      end
+      self.seq.no = C.track_seq_no_batch(
+         seq_low, seq_high, n, self.seq.no, self.window, self.window_size
+      )
+   end
+end
+
+-- Accept or reject payload I of the batch.
+function decrypt:finish_payload (i, ptr, length, ip)
+   local state = self.batch_state
+   local ctext_start = ptr + self.CTEXT_OFFSET
+   local ctext_length = length - self.PLAIN_OVERHEAD
+   local seq_low, seq_high = state.seq_low[i], tonumber(state.seq_high[i])
+   if self.batch_sequential then
+      if state.authentic[i] and self:check_seq_no(seq_low) == seq_high then
+         self:track_seq_no(seq_low, seq_high)
+         return self:accept_payload(ctext_start, ctext_length)
+      elseif state.job[i] >= 0 then
+         -- Undo the decryption to recover the original ciphertext.
+         self.cipher:encrypt(ctext_start, ptr + ESP_SIZE, seq_low, seq_high,
+                             ctext_start, ctext_length)
+      end
+      return self:decrypt_payload(ptr, length, ip)
+   elseif seq_high >= 0 then
+      return self:accept_payload(ctext_start, ctext_length)
+   else
+      self.decap_fail = self.decap_fail + 1
+      if self.auditing then
+         local esp_header = ffi.cast(esp_header_ptr_t, ptr)
+         local reason = "replayed"
+         if state.job[i] >= 0 and not state.authentic[i] then
+            reason = "integrity error"
+         end
+         self:audit(reason, ntohl(esp_header.spi), seq_low, ip)
+      end
+      return nil
+   end
+end
+
 -- Decapsulation in transport mode is performed as follows:
 --   1. Parse IP and ESP headers and check Sequence Number
 --   2. Decrypt ciphertext in place
 --   3. Parse ESP trailer and update IP header
 --   4. Move cleartext up to IP payload
 --   5. Shrink p by ESP overhead
+-- Steps 4-5 are performed by strip_transport6.
 function decrypt:decapsulate_transport6 (p)
    if p.length - TRANSPORT6_PAYLOAD_OFFSET < self.MIN_SIZE then return nil end
 
@@ -259,15 +427,18 @@ function decrypt:decapsulate_transport6 (p)
    local payload = p.data + TRANSPORT6_PAYLOAD_OFFSET
    local payload_length = p.length - TRANSPORT6_PAYLOAD_OFFSET
 
-   local ptext_start, ptext_length, next_header =
-      self:decrypt_payload(payload, payload_length, ip)
+   return self:strip_transport6(
+      p, ip, self:decrypt_payload(payload, payload_length, ip)
+   )
+end
 
+function decrypt:strip_transport6 (p, ip, ptext_start, ptext_length, next_header)
    if not ptext_start then return nil end
 
    ip.next_header = next_header
    ip.payload_length = htons(ptext_length)
 
-   C.memmove(payload, ptext_start, ptext_length)
+   C.memmove(p.data + TRANSPORT6_PAYLOAD_OFFSET, ptext_start, ptext_length)
    p = packet.resize(p, TRANSPORT6_PAYLOAD_OFFSET + ptext_length)
 
    return p
@@ -284,9 +455,10 @@ end
 function decrypt:decapsulate_tunnel (p)
    if p.length < self.MIN_SIZE then return nil end
 
-   local ptext_start, ptext_length, next_header =
-      self:decrypt_payload(p.data, p.length)
+   return self:strip_tunnel(p, self:decrypt_payload(p.data, p.length))
+end
 
+function decrypt:strip_tunnel (p, ptext_start, ptext_length, next_header)
    if not ptext_start then return nil end
 
    p = packet.shiftleft(p, self.CTEXT_OFFSET)
@@ -295,6 +467,41 @@ function decrypt:decapsulate_tunnel (p)
    return p, next_header
 end
 
+-- Batched decapsulation: the N packets in INPUT (at most max_batch) are
+-- decapsulated, and their payloads decrypted with a single call to the
+-- multi-buffer cipher.  OUTPUT[i] is set to the decapsulated packet, or
+-- to nil if INPUT[i] was rejected (in which case it is left to the
+-- caller to dispose of it).
+function decrypt:decapsulate_transport6_batch (input, output, n)
+   self:decrypt_payload_batch(input, output, n, TRANSPORT6_PAYLOAD_OFFSET)
+   for i = 0, n - 1 do
+      local p = output[i]
+      if p ~= nil then
+         local ip = ffi.cast(ipv6_ptr_t, p.data + ETHERNET_SIZE)
+         output[i] = self:strip_transport6(
+            p, ip, self:finish_payload(
+               i, p.data + TRANSPORT6_PAYLOAD_OFFSET,
+               p.length - TRANSPORT6_PAYLOAD_OFFSET, ip
+            )
+         )
+      end
+   end
+end
+
+-- NEXT_HEADER[i] is set to the Next Header of each decapsulated packet.
+function decrypt:decapsulate_tunnel_batch (input, output, next_header, n)
+   self:decrypt_payload_batch(input, output, n, 0)
+   for i = 0, n - 1 do
+      local p = output[i]
+      if p ~= nil then
+         local p, nh = self:strip_tunnel(
+            p, self:finish_payload(i, p.data, p.length)
+         )
+         output[i], next_header[i] = p, nh or 0
+      end
+   end
+end
+
 function decrypt:audit (reason, spi, seq, ip)
    if not self.auditing then return end
    -- The information RFC4303 says we SHOULD log:
@@ -308,6 +515,11 @@ function decrypt:audit (reason, spi, seq, ip)
                  reason))
 end
 
+-- Try the next resync_attempts candidates for the high-order bits of
+-- the Sequence Number. The payload is decrypted (in place) only once:
+-- since the plaintext does not depend on the Sequence Number, the tag for
+-- each further candidate is derived from the previous one by
+-- aes_gcm:reauthenticate.
 function decrypt:resync (ptr, length, seq_low, seq_high)
    local iv_start = ptr + ESP_SIZE
    local ctext_start = ptr + self.CTEXT_OFFSET
@@ -315,26 +527,22 @@ function decrypt:resync (ptr, length, seq_low, seq_high)
 
    if seq_high < 0 then
       -- The sequence number looked replayed, we use the last seq_high we have
-      -- seen
+      -- seen (and decrypt under it to obtain its tag, ignoring the result)
       seq_high = self.seq:high()
-   else
-      -- We failed to decrypt in-place, undo the damage to recover the original
-      -- ctext (ignore bogus auth data)
-      self.cipher:encrypt(
-         ctext_start, iv_start, seq_low, seq_high, ctext_start, ctext_length
+      self.cipher:decrypt(
+         ctext_start, seq_low, seq_high, iv_start, ctext_start, ctext_length
       )
    end
+   -- Otherwise, we failed to authenticate the payload decrypted in place
+   -- under seq_high already.
 
-   local p_orig = packet.append(packet.resize(self.copy, 0), ptr, length)
    for i = 1, self.resync_attempts do
-      seq_high = seq_high + 1
-      if self.cipher:decrypt(
-         ctext_start, seq_low, seq_high, iv_start, ctext_start, ctext_length
+      if self.cipher:reauthenticate(
+         seq_high, seq_high + 1, ctext_start, ctext_length
       ) then
-         return seq_high
-      else
-         ffi.copy(ptr, p_orig.data, length)
+         return seq_high + 1
       end
+      seq_high = seq_high + 1
    end
 end
 
@@ -503,4 +711,150 @@ ABCDEFGHIJKLMNOPQRSTUVWXYZ
       local px = op.encap(packet.clone(p))
       assert(not op.decap(px), "resynchronized with the past!")
    end
+   -- Batch routines: batch encapsulation must produce the same packets as
+   -- single packet encapsulation, and batch decapsulation must restore
+   -- them, rejecting invalid packets and replays within the batch, also
+   -- across Sequence Number epochs.
+   local function make_packet (size)
+      local d = datagram:new(packet.from_pointer(lib.random_bytes(size), size))
+      local ip = ipv6:new({})
+      ip:payload_length(size)
+      d:push(ip)
+      d:push(ethernet:new({type=0x86dd}))
+      return d:packet()
+   end
+   local input = ffi.new("struct packet *[?]", max_batch)
+   local output = ffi.new("struct packet *[?]", max_batch)
+   local next_header = ffi.new("uint8_t[?]", max_batch)
+   for _, tunnel in ipairs{false, true} do
+      for round = 1, 20 do
+         local single = encrypt:new(conf)
+         -- Every other round crosses into the next Sequence Number epoch.
+         local start = round % 2 == 0 and 2^32 - 8 or 0
+         enc.seq.no, single.seq.no, dec.seq.no = start, start, start
+         C.memset(dec.window, 0, dec.window_size / 8)
+         -- Every third round could trigger resynchronization (see below).
+         local sequential = round % 3 == 0
+         local n = math.random(2, sequential and max_batch - 1
+                                  or dec.resync_threshold - 1)
+         local originals = {}
+         for i = 0, n - 1 do
+            originals[i] = make_packet(math.random(0, 200))
+            input[i] = packet.clone(originals[i])
+         end
+         local invalid = not tunnel and math.random(0, n - 1)
+         if invalid then
+            packet.free(input[invalid])
+            input[invalid] = packet.from_string("invalid")
+         end
+         if tunnel then
+            enc:encapsulate_tunnel_batch(input, output, n, 42)
+         else
+            enc:encapsulate_transport6_batch(input, output, n)
+         end
+         for i = 0, n - 1 do
+            if i == invalid then
+               assert(output[i] == nil, "encapsulated invalid packet")
+               packet.free(input[i])
+            else
+               local p = packet.clone(originals[i])
+               if tunnel then p = single:encapsulate_tunnel(p, 42)
+               else           p = single:encapsulate_transport6(p) end
+               assert(p.length == output[i].length
+                         and C.memcmp(p.data, output[i].data, p.length) == 0,
+                      "batch encapsulation mismatch")
+               packet.free(p)
+            end
+         end
+         -- Decapsulate the valid packets, followed by a replay of one.
+         local m = 0
+         for i = 0, n - 1 do
+            if i ~= invalid then input[m], m = output[i], m + 1 end
+         end
+         input[m] = packet.clone(input[math.random(0, m - 1)])
+         -- The replay is rejected within the batch, unless the batch could
+         -- trigger resynchronization: then (only) it falls back to single
+         -- packet decryption.
+         dec.decap_fail = sequential and dec.resync_threshold or 0
+         local fallbacks = 0
+         dec.decrypt_payload = function (...)
+            fallbacks = fallbacks + 1
+            return decrypt.decrypt_payload(...)
+         end
+         if tunnel then
+            dec:decapsulate_tunnel_batch(input, output, next_header, m + 1)
+         else
+            dec:decapsulate_transport6_batch(input, output, m + 1)
+         end
+         dec.decrypt_payload = nil
+         assert(output[m] == nil, "accepted replayed packet in batch")
+         assert(fallbacks == (sequential and 1 or 0),
+                "batch decryption fell back")
+         packet.free(input[m])
+         local j = 0
+         for i = 0, n - 1 do
+            if i ~= invalid then
+               local p, o = output[j], originals[i]
+               assert(p ~= nil, "batch decapsulation failed")
+               assert(not tunnel or next_header[j] == 42)
+               assert(p.length == o.length
+                         and C.memcmp(p.data, o.data, o.length) == 0,
+                      "batch integrity check failed")
+               packet.free(p)
+               j = j + 1
+            end
+            packet.free(originals[i])
+         end
+      end
+   end
+   -- Anti-replay window: compare single and batch tracking against a
+   -- model, for reordered and duplicated Sequence Numbers, and window
+   -- sizes that are rounded up to the next power of two.
+   for _, window_size in ipairs{64, 1000, 4096} do
+      local single = decrypt:new{spi=0, aead="aes-gcm-16-icv", key=conf.key,
+                                 salt=conf.salt, window_size=window_size}
+      local batch = decrypt:new{spi=0, aead="aes-gcm-16-icv", key=conf.key,
+                                salt=conf.salt, window_size=window_size}
+      local W = single.window_size
+      assert(W >= window_size and bit.band(W, W - 1) == 0)
+      local seq_low = ffi.new("uint32_t[?]", max_batch)
+      local seq_high = ffi.new("int64_t[?]", max_batch)
+      local T, seen = 2^20, {}
+      single.seq.no, batch.seq.no = T, T
+      for round = 1, 2000 do
+         local n = math.random(max_batch)
+         for i = 0, n - 1 do
+            -- Mostly in order, some reordered, some replayed, some jumps.
+            local r = math.random()
+            if r < 0.6 then seq_low[i] = T + i + 1
+            elseif r < 0.9 then seq_low[i] = T - math.random(0, W + 64)
+            else seq_low[i] = T + math.random(W * 2) end
+         end
+         -- Single: check and track in order (each packet being authentic).
+         for i = 0, n - 1 do
+            local seq = seq_low[i]
+            local expected = 0
+            if seq <= T - W then expected = 1 -- next epoch
+            elseif seq <= T and seen[seq] then expected = -1 end
+            assert(single:check_seq_no(seq) == expected, "check_seq_no")
+            if expected == 0 then
+               single:track_seq_no(seq, 0)
+               T, seen[seq] = math.max(T, seq), true
+            end
+            assert(single.seq.no == T, "track_seq_no")
+         end
+         -- Batch: same result.
+         C.check_seq_no_batch(seq_low, seq_high, n, batch.seq.no,
+                              batch.window, batch.window_size)
+         for i = 0, n - 1 do
+            if seq_high[i] == 1 then seq_high[i] = -1 end -- not authentic
+         end
+         batch.seq.no = C.track_seq_no_batch(seq_low, seq_high, n,
+                                             batch.seq.no, batch.window,
+                                             batch.window_size)
+         assert(batch.seq.no == single.seq.no and
+                   C.memcmp(batch.window, single.window, W / 8) == 0,
+                "batch tracking mismatch")
+      end
+   end
 end
@@ -0,0 +1,219 @@
+-- Use of this source code is governed by the Apache 2.0 license; see COPYING.
+
+module(...,package.seeall)
+
+-- Security Association Database (see RFC 4301, section 4.4.2) for ESP in
+-- transport mode over IPv6. Holds any number of inbound SAs indexed by
+-- their SPI, and at most one outbound SA per peer, indexed by the peer’s
+-- IPv6 address. Each SA has its own ESP context (lib.ipsec.esp), and hence
+-- its own Sequence Number counter and anti-replay window.
+--
+-- The database is updated by passing it the complete list of SAs that
+-- should exist. SAs that did not change (same SPI, key, salt and peer) keep
+-- their context, and hence their state, which allows for make-before-break
+-- rekeying:
+--
+--   1. Add the new inbound SA (the old one still accepts packets)
+--   2. Replace the outbound SA of the peer with the new one
+--   3. Remove the old inbound SA once the peer has switched over
+
+local esp = require("lib.ipsec.esp")
+local ipv6 = require("lib.protocol.ipv6")
+local ctable = require("lib.ctable")
+local lib = require("core.lib")
+local ffi = require("ffi")
+
+local spi_t = ffi.typeof("uint32_t")
+local peer_t = ffi.typeof("uint8_t[16]")
+local index_t = ffi.typeof("uint32_t")
+
+local params = {
+   aead = {default="aes-gcm-16-icv"},
+   window_size = {},
+   resync_threshold = {},
+   resync_attempts = {},
+   auditing = {}
+}
+
+SADB = {}
+
+function new (conf)
+   conf = lib.parse(conf, params)
+   local o = {
+      conf = conf,
+      inbound = ctable.new{key_type=spi_t, value_type=index_t},
+      outbound = ctable.new{key_type=peer_t, value_type=index_t},
+      -- SAs by index, and free indices.
+      sas = {},
+      free = {},
+      peer = ffi.new(peer_t)
+   }
+   return setmetatable(o, {__index=SADB})
+end
+
+local function same_sa (a, b)
+   return a.direction == b.direction and a.spi == b.spi and a.key == b.key
+      and a.salt == b.salt and a.peer == b.peer
+end
+
+function SADB:allocate (sa)
+   local index = table.remove(self.free) or #self.sas + 1
+   self.sas[index] = sa
+   return index
+end
+
+function SADB:release (index)
+   self.sas[index] = nil
+   table.insert(self.free, index)
+end
+
+function SADB:context (sa)
+   local conf = self.conf
+   if sa.direction == "inbound" then
+      return esp.decrypt:new{
+         aead = conf.aead,
+         spi = sa.spi,
+         key = sa.key,
+         salt = sa.salt,
+         window_size = conf.window_size,
+         resync_threshold = conf.resync_threshold,
+         resync_attempts = conf.resync_attempts,
+         auditing = conf.auditing
+      }
+   else
+      return esp.encrypt:new{
+         aead = conf.aead,
+         spi = sa.spi,
+         key = sa.key,
+         salt = sa.salt
+      }
+   end
+end
+
+-- Update the database so that it contains exactly the SAs in the list SAS.
+-- Each SA is a table with the keys direction ("inbound" or "outbound"),
+-- spi, key, salt, and peer (IPv6 address as a string, outbound SAs only).
+function SADB:update (sas)
+   local wanted, peers = {}, {}
+   for _, sa in ipairs(sas) do
+      assert(sa.direction == "inbound" or sa.direction == "outbound",
+             "Invalid SA direction: "..tostring(sa.direction))
+      assert(sa.spi and sa.key and sa.salt, "Incomplete SA.")
+      if sa.direction == "inbound" then
+         assert(not wanted[sa.spi], "Duplicate inbound SPI: "..sa.spi)
+         wanted[sa.spi] = {direction=sa.direction, spi=sa.spi,
+                           key=sa.key, salt=sa.salt}
+      else
+         assert(sa.peer, "Outbound SA needs peer.")
+         local peer = ipv6:ntop(ipv6:pton(sa.peer))
+         assert(not peers[peer], "Duplicate outbound SA for "..peer)
+         peers[peer] = {direction=sa.direction, spi=sa.spi,
+                        key=sa.key, salt=sa.salt, peer=peer}
+      end
+   end
+   -- Remove SAs that went away or changed.
+   for index, sa in pairs(self.sas) do
+      if sa.direction == "inbound" then
+         if not (wanted[sa.spi] and same_sa(wanted[sa.spi], sa)) then
+            self.inbound:remove(sa.spi)
+            self:release(index)
+         else
+            wanted[sa.spi] = nil
+         end
+      else
+         if not (peers[sa.peer] and same_sa(peers[sa.peer], sa)) then
+            self.outbound:remove(ipv6:pton(sa.peer))
+            self:release(index)
+         else
+            peers[sa.peer] = nil
+         end
+      end
+   end
+   -- Add new SAs.
+   for spi, sa in pairs(wanted) do
+      sa.context = self:context(sa)
+      self.inbound:add(spi, self:allocate(sa))
+   end
+   for peer, sa in pairs(peers) do
+      sa.context = self:context(sa)
+      self.outbound:add(ipv6:pton(peer), self:allocate(sa))
+   end
+end
+
+-- Return the index of the inbound SA with SPI (a number in host byte
+-- order), or nil.
+function SADB:lookup_inbound (spi)
+   local entry = self.inbound:lookup_ptr(spi)
+   if entry then return entry.value end
+end
+
+-- Return the index of the outbound SA for the peer at PTR (pointer to an
+-- IPv6 address), or nil.
+function SADB:lookup_outbound (ptr)
+   ffi.copy(self.peer, ptr, 16)
+   local entry = self.outbound:lookup_ptr(self.peer)
+   if entry then return entry.value end
+end
+
+-- Return the ESP context (esp.decrypt or esp.encrypt) of the SA at INDEX.
+function SADB:get (index)
+   return self.sas[index].context
+end
+
+function selftest ()
+   print("selftest: lib.ipsec.sadb")
+   local key1 = "00112233445566778899AABBCCDDEEFF"
+   local key2 = "FFEEDDCCBBAA99887766554433221100"
+   local db = new{}
+   local sas = {
+      {direction="inbound", spi=1, key=key1, salt="00000001"},
+      {direction="outbound", spi=2, key=key1, salt="00000002",
+       peer="fc00::2"},
+      {direction="outbound", spi=3, key=key2, salt="00000003",
+       peer="fc00::3"}
+   }
+   db:update(sas)
+   assert(db:lookup_inbound(1))
+   assert(not db:lookup_inbound(2))
+   local peer2 = ipv6:pton("fc00::2")
+   local out2 = db:lookup_outbound(peer2)
+   assert(db:get(out2).spi == 2)
+   assert(db:get(db:lookup_outbound(ipv6:pton("fc00::3"))).spi == 3)
+   assert(not db:lookup_outbound(ipv6:pton("fc00::4")))
+   -- Sequence numbers survive updates of unrelated SAs.
+   local ctx = db:get(out2)
+   ctx:next_seq_no()
+   -- Make-before-break: new inbound SA next to the old one, then rekey
+   -- the outbound SA of fc00::3, then retire the old inbound SA.
+   table.insert(sas, {direction="inbound", spi=4, key=key2, salt="00000004"})
+   db:update(sas)
+   assert(db:lookup_inbound(1) and db:lookup_inbound(4))
+   assert(db:get(db:lookup_outbound(peer2)) == ctx)
+   sas[3] = {direction="outbound", spi=5, key=key1, salt="00000005",
+             peer="fc00:0::3"}
+   db:update(sas)
+   assert(db:get(db:lookup_outbound(ipv6:pton("fc00::3"))).spi == 5)
+   table.remove(sas, 1)
+   db:update(sas)
+   assert(not db:lookup_inbound(1) and db:lookup_inbound(4))
+   assert(db:get(db:lookup_outbound(peer2)) == ctx)
+   assert(ctx.seq.no == 1)
+   -- Changing the key of an SA creates a new context.
+   sas[1].key = key2
+   db:update(sas)
+   assert(db:get(db:lookup_outbound(peer2)) ~= ctx)
+   -- Many SAs.
+   local many = {}
+   for spi = 1, 2000 do
+      table.insert(many, {direction="inbound", spi=spi, key=key1,
+                          salt=("%08x"):format(spi)})
+   end
+   db:update(many)
+   for spi = 1, 2000 do
+      assert(db:get(db:lookup_inbound(spi)).spi == spi)
+   end
+   assert(not db:lookup_outbound(peer2))
+   db:update({})
+   assert(not next(db.sas))
+   print("OK")
+end
@@ -16,44 +16,47 @@
 #define MK64(L, H) ((uint64_t)(((uint32_t)(H)) * 4294967296ull + ((uint32_t)(L))))
 
 
-/* Set/clear the bit in our window that corresponds to sequence number `seq` */
-static inline void set_bit (bool on, uint64_t seq,
-                            uint8_t* window, uint32_t W) {
-  uint32_t bitno = seq % W;
-  uint32_t blockno = bitno / 8;
-  bitno %= 8;
-
-  /* First clear the bit, then maybe set it. This way we don't have to branch
-     on `on` */
-  window[blockno] &= ~(1u << bitno);
-  window[blockno] |= (uint8_t)on << bitno;
+/* The window is a bitmap of W bits stored in 64 bit words, where W is a
+   power of two no smaller than 64. Sequence number `seq` maps to bit
+   `seq % W`. */
+#define WORD(seq, W) (((seq) & ((W) - 1)) / 64)
+#define BIT(seq) (1ull << ((seq) % 64))
+
+/* Set the bit in our window that corresponds to sequence number `seq` */
+static inline void set_bit (uint64_t seq, uint64_t *window, uint32_t W) {
+  window[WORD(seq, W)] |= BIT(seq);
 }
 
 /* Get the bit in our window that corresponds to sequence number `seq` */
-static inline bool get_bit (uint64_t seq,
-                            uint8_t *window, uint32_t W) {
-  uint32_t bitno = seq % W;
-  uint32_t blockno = bitno / 8;
-  bitno = bitno % 8;
-
-  return window[blockno] & (1u << bitno);
+static inline bool get_bit (uint64_t seq, uint64_t *window, uint32_t W) {
+  return window[WORD(seq, W)] & BIT(seq);
 }
 
 /* Advance the window so that the "head" bit corresponds to sequence
  * number `seq`.  Clear all bits for the new sequence numbers that are
- * now considered in-window.
+ * now considered in-window, i.e. the range (T, seq], a word at a time.
  */
 static void advance_window (uint64_t seq,
-                            uint64_t T, uint8_t* window, uint32_t W) {
+                            uint64_t T, uint64_t *window, uint32_t W) {
   uint64_t diff = seq - T;
 
-  /* For advances greater than the window size, don't clear more bits than the
-     window has */
-  if (diff > W) diff = W;
+  /* For advances of the window size or more, clear the whole window */
+  if (diff >= W) {
+    for (uint32_t i = 0; i < W / 64; i++) window[i] = 0;
+    return;
+  }
 
-  /* Clear all bits corresponding to the sequence numbers that used to be ahead
-     of, but are now inside our window since we haven't seen them yet */
-  while (diff--) set_bit(0, seq--, window, W);
+  /* Clear the bits of T+1, ..., seq (which may wrap around the end of the
+     window) */
+  uint64_t from = T + 1;
+  while (diff) {
+    uint32_t bit = from % 64;
+    uint64_t n = 64 - bit < diff ? 64 - bit : diff;
+    uint64_t mask = n == 64 ? ~0ull : ((1ull << n) - 1) << bit;
+    window[WORD(from, W)] &= ~mask;
+    from += n;
+    diff -= n;
+  }
 }
 
 
@@ -70,8 +73,8 @@ static void advance_window (uint64_t seq,
  * If our answer is NOT "no", the caller will, provided the packet was
  * valid, use track_seq_no() for us to mark the sequence number as seen.
  */
-int64_t check_seq_no (uint32_t seq_lo,
-                      uint64_t T, uint8_t *window, uint32_t W) {
+static inline int64_t check (uint32_t seq_lo,
+                              uint64_t T, uint64_t *window, uint32_t W) {
   uint32_t Tl = LO32(T);
   uint32_t Th = HI32(T);
   uint32_t seq_hi;
@@ -93,14 +96,64 @@ int64_t check_seq_no (uint32_t seq_lo,
  * in fact valid -- we record that we have seen it so as to prevent
  * future replays of it.
  */
-uint64_t track_seq_no (uint32_t seq_hi, uint32_t seq_lo,
-                       uint64_t T, uint8_t *window, uint32_t W) {
+static inline uint64_t track (uint32_t seq_hi, uint32_t seq_lo,
+                              uint64_t T, uint64_t *window, uint32_t W) {
   uint64_t seq = MK64(seq_lo, seq_hi);
 
+  if (seq > T && seq - T < 64 - T % 64) {
+    /* Common case: T+1, ..., seq are in the same word as T, so we can
+       clear them and set the bit for seq at once */
+    uint64_t mask = ((2ull << (seq - T - 1)) - 1) << ((T + 1) % 64);
+    uint64_t *word = &window[WORD(seq, W)];
+    *word = (*word & ~mask) | BIT(seq);
+    return seq;
+  }
   if (seq > T) {
     advance_window(seq, T, window, W);
     T = seq;
   }
-  set_bit(1, seq, window, W);
+  set_bit(seq, window, W);
+  return T;
+}
+
+int64_t check_seq_no (uint32_t seq_lo,
+                      uint64_t T, uint64_t *window, uint32_t W) {
+  return check(seq_lo, T, window, W);
+}
+
+uint64_t track_seq_no (uint32_t seq_hi, uint32_t seq_lo,
+                       uint64_t T, uint64_t *window, uint32_t W) {
+  return track(seq_hi, seq_lo, T, window, W);
+}
+
+/* Batch variants of the above for a vector of `n` sequence numbers.
+ *
+ * check_seq_no_batch: checks each of `seq_lo` against the current window
+ * state, and stores the result of check_seq_no in `seq_hi`.
+ */
+void check_seq_no_batch (const uint32_t *seq_lo, int64_t *seq_hi, uint32_t n,
+                         uint64_t T, uint64_t *window, uint32_t W) {
+  for (uint32_t i = 0; i < n; i++)
+    seq_hi[i] = check(seq_lo[i], T, window, W);
+}
+
+/* track_seq_no_batch: in order, re-checks each sequence number with a
+ * non-negative `seq_hi` (i.e., one that passed check_seq_no_batch and was
+ * found valid) against the window state as updated by its predecessors,
+ * and tracks it if it still passes. Sequence numbers that no longer pass
+ * (e.g., duplicates within the batch) have their `seq_hi` set to -1.
+ * Returns the new T.
+ */
+uint64_t track_seq_no_batch (const uint32_t *seq_lo, int64_t *seq_hi,
+                             uint32_t n, uint64_t T,
+                             uint64_t *window, uint32_t W) {
+  for (uint32_t i = 0; i < n; i++) {
+    if (seq_hi[i] < 0) continue;
+    if (check(seq_lo[i], T, window, W) != seq_hi[i]) {
+      seq_hi[i] = -1;
+      continue;
+    }
+    T = track(seq_hi[i], seq_lo[i], T, window, W);
+  }
   return T;
 }
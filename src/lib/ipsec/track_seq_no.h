@@ -1,4 +1,8 @@
 /* Use of this source code is governed by the Apache 2.0 license; see COPYING. */
 
-uint64_t track_seq_no (uint32_t, uint32_t, uint64_t, uint8_t *, uint32_t);
-int64_t check_seq_no (uint32_t, uint64_t, uint8_t *, uint32_t);
+uint64_t track_seq_no (uint32_t, uint32_t, uint64_t, uint64_t *, uint32_t);
+int64_t check_seq_no (uint32_t, uint64_t, uint64_t *, uint32_t);
+void check_seq_no_batch (const uint32_t *, int64_t *, uint32_t,
+                         uint64_t, uint64_t *, uint32_t);
+uint64_t track_seq_no_batch (const uint32_t *, int64_t *, uint32_t,
+                             uint64_t, uint64_t *, uint32_t);
@@ -0,0 +1,384 @@
+-- Use of this source code is governed by the Apache 2.0 license; see COPYING.
+
+module(...,package.seeall)
+
+-- MPSC INTERLINK: multi-producer/single-consumer packet queue for fan-in
+--
+-- An “MPSC interlink” is the fan-in counterpart of lib.interlink: any number
+-- of transmitting processes (up to a fixed maximum chosen when the queue is
+-- created) can attach to the queue, and a single receiver drains packets
+-- from all of them.
+--
+-- Each transmitter claims a private “slot” of the queue: a single-producer/
+-- single-consumer ring buffer with the same cache-conscious layout as
+-- lib.interlink. Transmitters never write to a cache line shared with another
+-- transmitter, so adding producers does not add contention. Packets are
+-- batched per slot: a transmitter publishes all packets inserted since its
+-- last push with a single store, and the receiver releases all extracted
+-- slots of a producer with a single store on pull.
+--
+--    Receiver                        Transmitter
+--    ----------                      -------------
+--    attach_receiver(name, ...)      attach_transmitter(name, ...) -> r, s
+--    nslots(r)
+--    empty(r, s)                     full(r, s)
+--    extract(r, s)                   insert(r, s, p)
+--    pull(r, s)                      push(r, s)
+--    detach_receiver(r, name)        detach_transmitter(r, s, name)
+--
+-- API
+-- ----
+--
+--    attach_receiver(name, size, producers)
+--       Attaches to and returns the shared memory MPSC interlink object by
+--       name (a SHM path). The queue has room for producers slots of size
+--       packets each. If another receiver is attached this operation blocks
+--       until it detaches.
+--
+--    attach_transmitter(name, size, producers)
+--       Attaches to the shared memory MPSC interlink object by name, claims a
+--       free slot, and returns the queue and the slot index. If all slots are
+--       taken this operation blocks until one becomes available.
+--
+--    detach_receiver(r, name), detach_transmitter(r, s, name)
+--       Release the receiver end / slot s, and unmap r. If no other process
+--       is attached the queue is unlinked from its name, and any packets
+--       remaining are freed. Packets left in a slot by a detaching
+--       transmitter are still delivered to the receiver.
+--
+--    nslots(r)
+--       Returns the number of slots the receiver needs to poll (slots are
+--       numbered from 0 to nslots(r)-1.) Slots beyond this index have never
+--       been claimed.
+--
+--    full(r, s) / empty(r, s)
+--       Return true if slot s of r is full / empty.
+--
+--    insert(r, s, p) / extract(r, s)
+--       Insert a packet p into / extract a packet from slot s of r. Must not
+--       be called if the slot is full / empty.
+--
+--    push(r, s) / pull(r, s)
+--       Makes subsequent calls to full / empty reflect updates to slot s
+--       caused by insert / extract.
+
+local shm = require("core.shm")
+local ffi = require("ffi")
+local S = require("syscall")
+local band = require("bit").band
+local waitfor = require("core.lib").waitfor
+local sync = require("core.sync")
+
+local CACHELINE = 64 -- XXX - make dynamic
+local INT = ffi.sizeof("uint32_t")
+
+-- Upper bound on the number of producers of a queue (bounds the size of the
+-- slot table.)
+max_producers = 64
+
+-- Each slot is a MCRingBuffer (see lib.interlink.) The owner field holds the
+-- pid of the transmitter that claimed the slot, or zero if the slot is free.
+-- The base field is the offset of the slot’s ring in the packets array.
+
+ffi.cdef([[
+   struct mpsc_interlink_slot {
+      uint32_t read, write, owner[1], base;
+      char pad1[]]..CACHELINE-4*INT..[[];
+      uint32_t lwrite, nread;
+      char pad2[]]..CACHELINE-2*INT..[[];
+      uint32_t lread, nwrite;
+      char pad3[]]..CACHELINE-2*INT..[[];
+   } __attribute__((packed, aligned(]]..CACHELINE..[[)));
+
+   struct mpsc_interlink {
+      uint32_t size, mask, producers, state[1];
+      uint32_t users[1], receiver[1], nslots[1];
+      char pad1[]]..CACHELINE-7*INT..[[];
+      struct mpsc_interlink_slot slots[]]..max_producers..[[];
+      struct packet *packets[?];
+   } __attribute__((packed, aligned(]]..CACHELINE..[[)));
+]])
+
+-- The life cycle of an MPSC interlink is managed by a configuration state and
+-- a reference count of attached processes.
+--
+-- The configuration state mirrors lib.interlink: the first process to create
+-- the queue moves it from INIT to CONF, sets its dimensions, and marks it as
+-- FREE. Attaching processes increment users, and detaching processes
+-- decrement it. The last process to detach moves users from 1 to DOWN, frees
+-- any remaining packets, and unlinks the queue. Once in the DOWN state the
+-- reference count is never incremented again: processes that race to attach
+-- to a queue that is going down retry, and create a new queue.
+--
+-- Attaching as the receiver CASes receiver from 0 to the receiver’s pid, and
+-- claiming a slot CASes its owner from 0 to the transmitter’s pid. The owner
+-- pids allow the slots of a terminated process to be reclaimed (see
+-- apps.interlink.mpsc_transmitter.)
+
+local INIT = 0 -- Implicit initial state due to 0 value.
+local CONF = 1 -- Queue size is being configured.
+local FREE = 2 -- Queue is configured, ready to attach.
+
+local DOWN = 0x7fffffff -- Reference count of a queue being deallocated.
+
+local function acquire (r)
+   while true do
+      local users = r.users[0]
+      if users == DOWN then return false end
+      if sync.cas(r.users, users, users + 1) then return true end
+   end
+end
+
+-- Returns true if the caller was the last user of r.
+local function release (r)
+   while true do
+      local users = r.users[0]
+      assert(users ~= DOWN and users > 0, "mpsc_interlink: not attached")
+      if users == 1 then
+         if sync.cas(r.users, 1, DOWN) then return true end
+      elseif sync.cas(r.users, users, users - 1) then
+         return false
+      end
+   end
+end
+
+local function attach (name, size, producers, claim)
+   assert(band(size, size-1) == 0, "size is not a power of two")
+   assert(producers >= 1 and producers <= max_producers,
+          "producers must be in the range 1.."..max_producers)
+   local r, result
+   local first_try = true
+   waitfor(
+      function ()
+         -- Create/open the queue.
+         r = shm.create(name, "struct mpsc_interlink", size * producers)
+         -- Initialize queue and configure its size
+         -- (only one process can set size).
+         if sync.cas(r.state, INIT, CONF) then
+            r.size, r.mask, r.producers = size, size - 1, producers
+            for s = 0, producers - 1 do
+               r.slots[s].base = s * size
+            end
+            assert(sync.cas(r.state, CONF, FREE))
+         end
+         -- Return if we succeed to attach and claim our end.
+         if r.state[0] == FREE and acquire(r) then
+            result = claim(r)
+            if result then return true end
+            -- Could not claim; detach and try again.
+            if release(r) then shm.unlink(name) end
+         end
+         shm.unmap(r)
+         if first_try then
+            print("mpsc_interlink: waiting for "..name.." to become available...")
+            first_try = false
+         end
+      end
+   )
+   -- Make sure we agree on the queue dimensions.
+   assert(r.size == size, "mpsc_interlink: queue size mismatch on: "..name)
+   assert(r.producers == producers,
+          "mpsc_interlink: producers mismatch on: "..name)
+   return r, result
+end
+
+function attach_receiver (name, size, producers)
+   local pid = S.getpid()
+   return (attach(name, size, producers,
+                  function (r) return sync.cas(r.receiver, 0, pid) end))
+end
+
+function attach_transmitter (name, size, producers)
+   local pid = S.getpid()
+   local function claim (r)
+      for s = 0, r.producers - 1 do
+         if sync.cas(r.slots[s].owner, 0, pid) then
+            -- Raise the polling horizon of the receiver to include s.
+            while r.nslots[0] < s + 1 do
+               sync.cas(r.nslots, r.nslots[0], s + 1)
+            end
+            return s
+         end
+      end
+   end
+   return attach(name, size, producers, claim)
+end
+
+local function detach (r, name)
+   if release(r) then
+      -- If detach is called by the supervisor (due to an abnormal exit)
+      -- the packet module will not be loaded (and there will be no
+      -- freelist to put the packets into.)
+      for s = 0, r.nslots[0] - 1 do
+         while packet and not empty(r, s) do
+            packet.free(extract(r, s))
+         end
+      end
+      shm.unlink(name)
+   end
+   shm.unmap(r)
+end
+
+function detach_receiver (r, name)
+   assert(sync.cas(r.receiver, r.receiver[0], 0))
+   detach(r, name)
+end
+
+function detach_transmitter (r, s, name)
+   -- Publish anything inserted, and leave the slot for reuse.
+   push(r, s)
+   assert(sync.cas(r.slots[s].owner, r.slots[s].owner[0], 0))
+   detach(r, name)
+end
+
+-- Queue operations follow below.
+
+function nslots (r)
+   return r.nslots[0]
+end
+
+function full (r, s)
+   local slot = r.slots[s]
+   local after_nwrite = band(slot.nwrite + 1, r.mask)
+   if after_nwrite == slot.lread then
+      if after_nwrite == slot.read then
+         return true
+      end
+      slot.lread = slot.read
+   end
+end
+
+function insert (r, s, p)
+   local slot = r.slots[s]
+   r.packets[slot.base + slot.nwrite] = p
+   slot.nwrite = band(slot.nwrite + 1, r.mask)
+end
+
+function push (r, s)
+   -- NB: no need for memory barrier on x86 because of TSO.
+   local slot = r.slots[s]
+   slot.write = slot.nwrite
+end
+
+function empty (r, s)
+   local slot = r.slots[s]
+   if slot.nread == slot.lwrite then
+      if slot.nread == slot.write then
+         return true
+      end
+      slot.lwrite = slot.write
+   end
+end
+
+function extract (r, s)
+   local slot = r.slots[s]
+   local p = r.packets[slot.base + slot.nread]
+   slot.nread = band(slot.nread + 1, r.mask)
+   return p
+end
+
+function pull (r, s)
+   -- NB: no need for memory barrier on x86 (see push.)
+   local slot = r.slots[s]
+   slot.read = slot.nread
+end
+
+-- The code below registers an abstract SHM object type with core.shm, and
+-- implements the minimum API necessary for programs like snabb top to inspect
+-- MPSC interlink queues.
+
+shm.register('mpsc_interlink', getfenv())
+
+function open (name, readonly)
+   local r = shm.open(name, "struct mpsc_interlink", 'read-only', 1)
+   local n = r.size * r.producers
+   shm.unmap(r)
+   return shm.open(name, "struct mpsc_interlink", readonly, n)
+end
+
+local function describe (r)
+   local fill, producers = 0, 0
+   for s = 0, r.nslots[0] - 1 do
+      local read, write = r.slots[s].read, r.slots[s].write
+      fill = fill + (read > write and write + r.size - read or write - read)
+      if r.slots[s].owner[0] ~= 0 then producers = producers + 1 end
+   end
+   return ("%d/%d (%d/%d producers, %s)"):format(
+      fill, r.size * r.producers, producers, r.producers,
+      r.receiver[0] ~= 0 and "receiver attached" or "waiting for receiver")
+end
+
+ffi.metatype("struct mpsc_interlink", {__tostring=describe})
+
+function selftest ()
+   print("selftest: lib.mpsc_interlink")
+   local name = "mpsc_interlink_selftest"
+   local size, producers = 16, 4
+   -- Transmitters attach before the receiver, and claim distinct slots.
+   local tx = {}
+   for i = 1, 3 do
+      local r, s = attach_transmitter(name, size, producers)
+      assert(s == i - 1, "unexpected slot: "..s)
+      tx[i] = {r=r, s=s}
+   end
+   local rx = attach_receiver(name, size, producers)
+   assert(nslots(rx) == 3)
+   assert(rx.users[0] == 4)
+   -- Each slot holds size-1 packets; producers do not interfere.
+   for i, t in ipairs(tx) do
+      local n = 0
+      while not full(t.r, t.s) do
+         local p = packet.allocate()
+         p.length = i * 100 + n
+         insert(t.r, t.s, p)
+         n = n + 1
+      end
+      assert(n == size - 1)
+      -- Nothing is visible before push.
+      assert(empty(rx, t.s))
+      push(t.r, t.s)
+   end
+   -- Drain all slots in one pass, in per-producer order.
+   for s = 0, nslots(rx) - 1 do
+      local n = 0
+      while not empty(rx, s) do
+         local p = extract(rx, s)
+         assert(p.length == (s + 1) * 100 + n)
+         packet.free(p)
+         n = n + 1
+      end
+      pull(rx, s)
+      assert(n == size - 1)
+   end
+   for _, t in ipairs(tx) do assert(not full(t.r, t.s)) end
+   -- A detached slot is reused by the next transmitter, and packets left by
+   -- the former owner are still delivered.
+   local p = packet.allocate()
+   p.length = 42
+   insert(tx[2].r, tx[2].s, p)
+   detach_transmitter(tx[2].r, tx[2].s, name)
+   local r, s = attach_transmitter(name, size, producers)
+   assert(s == 1)
+   assert(not empty(rx, 1))
+   assert(extract(rx, 1).length == 42)
+   pull(rx, 1)
+   tx[2] = {r=r, s=s}
+   -- All slots taken: up to producers transmitters can attach.
+   local r4, s4 = attach_transmitter(name, size, producers)
+   assert(s4 == 3 and nslots(rx) == 4)
+   assert(tostring(rx):match("4/4 producers, receiver attached"))
+   -- Teardown: packets still queued are freed by the last process to detach.
+   insert(r4, s4, packet.allocate())
+   push(r4, s4)
+   detach_transmitter(r4, s4, name)
+   detach_receiver(rx, name)
+   assert(shm.exists(name))
+   for _, t in ipairs(tx) do detach_transmitter(t.r, t.s, name) end
+   assert(not shm.exists(name))
+   -- The queue can be recreated after teardown.
+   rx = attach_receiver(name, size, producers)
+   assert(rx.users[0] == 1 and nslots(rx) == 0)
+   detach_receiver(rx, name)
+   assert(not shm.exists(name))
+   print("selftest: ok")
+end
@@ -0,0 +1,275 @@
+-- Use of this source code is governed by the Apache 2.0 license; see COPYING.
+
+module(..., package.seeall)
+
+-- Compile a list of pcap-filter(7) expressions into a single decision
+-- program.  The filters are expanded into one pflang expression tree
+-- before optimization, so that header loads and tests which several
+-- filters have in common (e.g. "is this IPv4?") are emitted and
+-- evaluated once per packet instead of once per filter.
+--
+--   first_match(filters) => function (data, length)
+--      Returns the index of the first filter in FILTERS that matches
+--      the packet, or false if none do.
+--
+--   bitmask(filters) => function (data, length)
+--      Returns the sum of 2^(i-1) over all filters i that match the
+--      packet.
+--
+--   union(filters) => expr
+--      Returns the optimized pflang expression that is true if any of
+--      FILTERS matches, for use by other backends (see
+--      apps/xdp/pf_ebpf_codegen.lua).
+--
+-- FILTERS is an array of filter strings.  An empty string matches
+-- every packet, just like for pf.compile_filter().
+
+local parse = require("pf.parse").parse
+local expand = require("pf.expand").expand
+local optimize = require("pf.optimize").optimize
+local anf = require("pf.anf")
+local ssa = require("pf.ssa")
+local backend = require("pf.backend")
+local lib = require("core.lib")
+
+local compile_params = {
+   -- Link type of the packets.
+   dlt = {default="EN10MB"},
+   -- A bitmask program is split into independently evaluated parts
+   -- once the number of distinct outcomes (leaves) of a part would
+   -- exceed this limit.  The decision tree for N filters that can
+   -- match at the same time has up to 2^N leaves.
+   max_leaves = {default=64}
+}
+
+local function can_fail (expr)
+   if expr[1] == 'fail' then return true
+   elseif expr[1] == 'if' then
+      return can_fail(expr[2]) or can_fail(expr[3]) or can_fail(expr[4])
+   else
+      return false
+   end
+end
+
+local function make_if (test, t, e)
+   if test[1] == 'true' then return t
+   elseif test[1] == 'false' then return e
+   elseif t[1] == 'true' and e[1] == 'false' then return test
+   elseif t[1] == e[1] and (t[1] == 'true' or t[1] == 'false') then return t
+   else return { 'if', test, t, e } end
+end
+
+-- For a test EXPR, pure(EXPR) is EXPR with each 'fail' replaced by
+-- 'false', and ok(EXPR) is true if and only if evaluating EXPR does not
+-- fail.
+local pure
+local function ok (expr)
+   if expr[1] == 'fail' then return { 'false' }
+   elseif expr[1] == 'if' then
+      return make_if(ok(expr[2]),
+                     make_if(pure(expr[2]), ok(expr[3]), ok(expr[4])),
+                     { 'false' })
+   else
+      return { 'true' }
+   end
+end
+
+function pure (expr)
+   if expr[1] == 'fail' then return { 'false' }
+   elseif expr[1] == 'if' then
+      return make_if(pure(expr[2]), pure(expr[3]), pure(expr[4]))
+   else
+      return expr
+   end
+end
+
+-- Return EXPR with each 'fail' moved out of test positions:
+-- "if TEST T E" becomes "if ok(TEST) (if pure(TEST) T E) fail".  Unlike
+-- lifting the conditionals of TEST, this does not duplicate T and E.
+local function lift_fail (expr)
+   if expr[1] ~= 'if' then return expr end
+   local test, t, e = expr[2], lift_fail(expr[3]), lift_fail(expr[4])
+   if not can_fail(test) then return { 'if', test, t, e } end
+   return make_if(ok(test), make_if(pure(test), t, e), { 'fail' })
+end
+
+-- In pflang, out-of-bounds accesses abort the whole filter.  In a
+-- merged program they must only cause that one filter to not match,
+-- so each 'fail' in tail position of the filter becomes 'false' (and
+-- each 'match' becomes 'true').  A 'fail' within a test (e.g. under
+-- "not") must still make the whole filter false, hence it is first
+-- moved to tail position.
+local function replace_fail (expr)
+   if expr[1] == 'fail' then return { 'false' }
+   elseif expr[1] == 'match' then return { 'true' }
+   elseif expr[1] == 'if' then
+      return { 'if', expr[2], replace_fail(expr[3]), replace_fail(expr[4]) }
+   else
+      return expr
+   end
+end
+
+-- Each filter is optimized on its own first, so that the merged
+-- program decides like pf.compile_filter() would for that filter.
+local function test (filter, dlt)
+   return replace_fail(lift_fail(optimize(expand(parse(filter), dlt))))
+end
+
+-- Return a copy of EXPR with each { 'call', name } leaf replaced by
+-- f(name).
+local function map_leaves (expr, f)
+   if expr[1] == 'call' then return f(expr[2])
+   elseif expr[1] == 'if' then
+      return { 'if', expr[2], map_leaves(expr[3], f), map_leaves(expr[4], f) }
+   else
+      return expr
+   end
+end
+
+local function leaves (expr, acc)
+   acc = acc or {}
+   if expr[1] == 'call' then
+      if not acc[expr[2]] then
+         acc[expr[2]] = true
+         table.insert(acc, expr[2])
+      end
+   elseif expr[1] == 'if' then
+      leaves(expr[3], acc)
+      leaves(expr[4], acc)
+   end
+   return acc
+end
+
+-- Compile EXPR, an optimized expression whose leaves are calls, into
+-- a function of (data, length).  The call "rN" returns VALUES[N].
+local function load (expr, values, name)
+   local matcher = backend.emit_and_load_match(
+      ssa.convert_ssa(anf.convert_anf(expr)), name)
+   local handlers = {}
+   for _, leaf in ipairs(leaves(expr)) do
+      local value = values[tonumber(leaf:match("^r(%d+)$"))]
+      handlers[leaf] = function () return value end
+   end
+   return function (data, length)
+      return matcher(handlers, data, length)
+   end
+end
+
+local function name (filters)
+   return "multi_filter: "..table.concat(filters, " | ")
+end
+
+function first_match (filters, conf)
+   conf = lib.parse(conf or {}, compile_params)
+   local expr, values = { 'false' }, {}
+   for i = #filters, 1, -1 do
+      expr = { 'if', test(filters[i], conf.dlt), { 'call', 'r'..i }, expr }
+      values[i] = i
+   end
+   return load(optimize(expr), values, name(filters))
+end
+
+function bitmask (filters, conf)
+   conf = lib.parse(conf or {}, compile_params)
+   assert(#filters <= 52, "too many filters for a bitmask")
+   local parts, values = {}, {[0]=0}
+   local part, nleaves = nil, 0
+   local function finish ()
+      if part then table.insert(parts, load(part, values, name(filters))) end
+      part, nleaves = { 'call', 'r0' }, 1
+   end
+   finish()
+   for i, filter in ipairs(filters) do
+      local t, bit = test(filter, conf.dlt), 2^(i-1)
+      local function extend (part)
+         return optimize(map_leaves(part, function (leaf)
+            local mask = tonumber(leaf:match("^r(%d+)$"))
+            values[mask] = mask
+            values[mask+bit] = mask+bit
+            return { 'if', t, { 'call', 'r'..(mask+bit) }, { 'call', leaf } }
+         end))
+      end
+      local extended = extend(part)
+      if nleaves > 1 and #leaves(extended) > conf.max_leaves then
+         finish()
+         extended = extend(part)
+      end
+      part, nleaves = extended, #leaves(extended)
+   end
+   finish()
+   if #parts == 1 then return parts[1] end
+   return function (data, length)
+      local mask = 0
+      for i = 1, #parts do mask = mask + parts[i](data, length) end
+      return mask
+   end
+end
+
+function union (filters, conf)
+   conf = lib.parse(conf or {}, compile_params)
+   local expr = { 'false' }
+   for i = #filters, 1, -1 do
+      expr = { 'if', test(filters[i], conf.dlt), { 'true' }, expr }
+   end
+   return optimize(expr)
+end
+
+function selftest ()
+   print("selftest: lib.pcap.multi_filter")
+   local pf = require("pf")
+   local pcap = require("lib.pcap.pcap")
+   local ffi = require("ffi")
+
+   local filters = {
+      "ip and tcp dst port 80",
+      "ip and udp port 53",
+      "ip and tcp and (dst port 443 or dst port 8443)",
+      "ip6 and tcp",
+      "tcp",
+      "ip",
+      "udp",
+      "ip[100] = 1",
+      "ip6 and ip6[60:2] = 0",
+      -- Out-of-bounds accesses within tests, e.g. under "not".
+      "not ether[200] = 3",
+      "not (tcp and tcp[40] = 1) and not udp[20] = 0",
+      ""
+   }
+   local singles = {}
+   for i, filter in ipairs(filters) do
+      singles[i] = pf.compile_filter(filter)
+   end
+   local first = first_match(filters)
+   local mask = bitmask(filters)
+   local split = bitmask(filters, {max_leaves=4})
+   local any = backend.emit_and_load(
+      ssa.convert_ssa(anf.convert_anf(union(filters))), "union")
+
+   local npackets = 0
+   for _, sample in ipairs{"v4.pcap", "v6.pcap", "v4-tcp-udp.pcap",
+                              "v6-tcp-udp.pcap"} do
+      for record in pcap.records("apps/packet_filter/samples/"..sample) do
+         local data = ffi.cast("uint8_t *", record)
+         for _, length in ipairs{#record, 60, 34, 14, 0} do
+            length = math.min(length, #record)
+            local expected_first, expected_mask = false, 0
+            for i = #filters, 1, -1 do
+               if singles[i](data, length) then
+                  expected_first = i
+                  expected_mask = expected_mask + 2^(i-1)
+               end
+            end
+            assert(first(data, length) == expected_first)
+            assert(mask(data, length) == expected_mask)
+            assert(split(data, length) == expected_mask)
+            assert(any(data, length) == (expected_mask ~= 0))
+            npackets = npackets + 1
+         end
+      end
+   end
+   assert(npackets > 0)
+   assert(first_match({"tcp", "udp"})(ffi.new("uint8_t[1]"), 0) == false)
+   assert(first_match({"not ether[200] = 3"})(ffi.new("uint8_t[60]"), 60)
+             == false)
+   print("selftest: ok")
+end
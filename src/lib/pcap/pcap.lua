@@ -3,6 +3,10 @@
 module(...,package.seeall)
 
 local ffi = require("ffi")
+local bit = require("bit")
+local S = require("syscall")
+local lib = require("core.lib")
+local C = ffi.C
 
 -- PCAP file format: http://wiki.wireshark.org/Development/LibpcapFileFormat/
 local pcap_file_t = ffi.typeof[[
@@ -56,7 +60,8 @@ function read_file_header (file)
    local pcap_file = readc(file, pcap_file_t)
    if pcap_file.magic_number == 0xD4C3B2A1 then
       error("Endian mismatch in " .. filename)
-   elseif pcap_file.magic_number ~= 0xA1B2C3D4 then
+   elseif pcap_file.magic_number ~= 0xA1B2C3D4
+      and pcap_file.magic_number ~= 0xA1B23C4D then
       error("Bad PCAP magic number in " .. filename)
    end
    return pcap_file
@@ -88,3 +93,381 @@ function readc(file, type)
    ffi.copy(obj, string, ffi.sizeof(type))
    return obj
 end
+
+-- Memory-mapped savefiles.
+--
+-- MappedReader maps a savefile into memory and returns pointers to the
+-- packet data in the mapping, so that packets can be copied straight
+-- from the file.  It reads classic pcap files with microsecond or
+-- nanosecond timestamps as well as pcapng files.  Only files in host
+-- byte order are supported.
+--
+--   local file = MappedReader.new(filename)
+--   local ptr, len = file:next()       -- nil at end of file
+--   local sec, nsec = file:timestamp() -- of the last record
+--   file:rewind()
+
+local pcap_magic, pcap_magic_ns = 0xA1B2C3D4, 0xA1B23C4D
+local pcapng_shb, pcapng_idb, pcapng_spb, pcapng_epb =
+   0x0A0D0D0A, 0x00000001, 0x00000003, 0x00000006
+local pcapng_byte_order_magic = 0x1A2B3C4D
+local pcapng_if_tsresol = 9
+
+local pcap_file_ptr_t = ffi.typeof("$*", pcap_file_t)
+local pcap_record_ptr_t = ffi.typeof("$*", pcap_record_t)
+
+-- Exported for apps that lay out pcap files in memory themselves.
+file_header_t, record_header_t = pcap_file_t, pcap_record_t
+
+local pcapng_block_t = ffi.typeof[[
+struct {
+    uint32_t block_type;
+    uint32_t block_total_length;
+}
+]]
+local pcapng_shb_t = ffi.typeof[[
+struct {
+    uint32_t block_type;
+    uint32_t block_total_length;
+    uint32_t byte_order_magic;
+    uint16_t major_version;
+    uint16_t minor_version;
+    int64_t  section_length;
+} __attribute__((packed))
+]]
+local pcapng_idb_t = ffi.typeof[[
+struct {
+    uint32_t block_type;
+    uint32_t block_total_length;
+    uint16_t linktype;
+    uint16_t reserved;
+    uint32_t snaplen;
+}
+]]
+local pcapng_epb_t = ffi.typeof[[
+struct {
+    uint32_t block_type;
+    uint32_t block_total_length;
+    uint32_t interface_id;
+    uint32_t timestamp_high;
+    uint32_t timestamp_low;
+    uint32_t captured_len;
+    uint32_t original_len;
+}
+]]
+local pcapng_spb_t = ffi.typeof[[
+struct {
+    uint32_t block_type;
+    uint32_t block_total_length;
+    uint32_t original_len;
+}
+]]
+local pcapng_option_t = ffi.typeof[[
+struct {
+    uint16_t code;
+    uint16_t length;
+}
+]]
+local pcapng_block_ptr_t = ffi.typeof("$*", pcapng_block_t)
+local pcapng_shb_ptr_t = ffi.typeof("$*", pcapng_shb_t)
+local pcapng_idb_ptr_t = ffi.typeof("$*", pcapng_idb_t)
+local pcapng_epb_ptr_t = ffi.typeof("$*", pcapng_epb_t)
+local pcapng_spb_ptr_t = ffi.typeof("$*", pcapng_spb_t)
+local pcapng_option_ptr_t = ffi.typeof("$*", pcapng_option_t)
+
+local function pad4 (len) return bit.band(len + 3, bit.bnot(3)) end
+
+MappedReader = {}
+
+function MappedReader.new (filename)
+   local fd, err = S.open(filename, "rdonly")
+   if not fd then error("Unable to open file: "..filename..": "..tostring(err)) end
+   local size = assert(fd:fstat()).size
+   local o = {filename = filename, size = size, pos = 0}
+   if size > 0 then
+      local mem, err = S.mmap(nil, size, "read", "private", fd, 0)
+      if not mem then error("mmap failed: "..filename..": "..tostring(err)) end
+      S.madvise(mem, size, "sequential")
+      o.base = ffi.cast("uint8_t *", mem)
+   end
+   fd:close()
+   o = setmetatable(o, {__index = MappedReader})
+   if size < 4 then error("Truncated savefile: "..filename) end
+   local magic = ffi.cast("uint32_t *", o.base)[0]
+   if magic == pcap_magic or magic == pcap_magic_ns then
+      if size < ffi.sizeof(pcap_file_t) then
+         error("Truncated savefile: "..filename)
+      end
+      o.format = "pcap"
+      o.nanosecond = magic == pcap_magic_ns
+      o.start = ffi.sizeof(pcap_file_t)
+      o.next = MappedReader.next_pcap_record
+   elseif magic == pcapng_shb then
+      o.format = "pcapng"
+      o.interfaces = {}
+      o.start = 0
+      o.next = MappedReader.next_pcapng_record
+   elseif magic == 0xD4C3B2A1 or magic == 0x4D3CB2A1 then
+      error("Endian mismatch in "..filename)
+   else
+      error("Bad PCAP magic number in "..filename)
+   end
+   o:rewind()
+   return o
+end
+
+function MappedReader:rewind ()
+   self.pos = self.start
+   self.record = nil
+end
+
+function MappedReader:close ()
+   if self.base then S.munmap(self.base, self.size) end
+   self.base = nil
+end
+
+function MappedReader:next_pcap_record ()
+   local pos = self.pos
+   if pos + ffi.sizeof(pcap_record_t) > self.size then return nil end
+   local record = ffi.cast(pcap_record_ptr_t, self.base + pos)
+   local len = record.incl_len
+   pos = pos + ffi.sizeof(pcap_record_t)
+   if pos + len > self.size then return nil end
+   self.pos = pos + len
+   self.record = record
+   return self.base + pos, math.min(len, record.orig_len)
+end
+
+-- Units per second of the timestamps of a pcapng interface.
+local function pcapng_tsresol (base, idb)
+   local pos = ffi.sizeof(pcapng_idb_t)
+   local limit = idb.block_total_length - 4
+   while pos + ffi.sizeof(pcapng_option_t) <= limit do
+      local option = ffi.cast(pcapng_option_ptr_t, base + pos)
+      if option.code == 0 then break end
+      if option.code == pcapng_if_tsresol and option.length >= 1 then
+         local v = base[pos + ffi.sizeof(pcapng_option_t)]
+         if bit.band(v, 0x80) == 0 then return 10^v end
+         return 2^bit.band(v, 0x7f)
+      end
+      pos = pos + ffi.sizeof(pcapng_option_t) + pad4(option.length)
+   end
+   return 1e6
+end
+
+function MappedReader:next_pcapng_record ()
+   local base, size = self.base, self.size
+   while self.pos + ffi.sizeof(pcapng_block_t) <= size do
+      local pos = self.pos
+      local block = ffi.cast(pcapng_block_ptr_t, base + pos)
+      local block_len = block.block_total_length
+      if block_len < 12 or pos + block_len > size then return nil end
+      self.pos = pos + block_len
+      local block_type = block.block_type
+      if block_type == pcapng_epb then
+         local epb = ffi.cast(pcapng_epb_ptr_t, block)
+         self.record = epb
+         return base + pos + ffi.sizeof(pcapng_epb_t),
+            math.min(epb.captured_len, epb.original_len)
+      elseif block_type == pcapng_spb then
+         local spb = ffi.cast(pcapng_spb_ptr_t, block)
+         self.record = nil
+         return base + pos + ffi.sizeof(pcapng_spb_t),
+            math.min(spb.original_len, block_len - 16)
+      elseif block_type == pcapng_idb then
+         local idb = ffi.cast(pcapng_idb_ptr_t, block)
+         table.insert(self.interfaces, pcapng_tsresol(base + pos, idb))
+      elseif block_type == pcapng_shb then
+         local shb = ffi.cast(pcapng_shb_ptr_t, block)
+         if shb.byte_order_magic ~= pcapng_byte_order_magic then
+            error("Endian mismatch in "..self.filename)
+         end
+         self.interfaces = {}
+      end
+   end
+   return nil
+end
+
+-- Return the timestamp of the last record as seconds and nanoseconds.
+function MappedReader:timestamp ()
+   local record = self.record
+   if record == nil then return 0, 0 end
+   if self.format == "pcap" then
+      if self.nanosecond then return record.ts_sec, record.ts_usec end
+      return record.ts_sec, record.ts_usec * 1000
+   end
+   local resol = self.interfaces[record.interface_id + 1] or 1e6
+   local units = ffi.cast("uint64_t", record.timestamp_high) * 2^32
+      + record.timestamp_low
+   return tonumber(units / resol), tonumber(units % resol) * 1e9 / resol
+end
+
+-- Buffered savefile writer.
+--
+-- BufferedWriter collects records in a large page-aligned buffer that
+-- is written to the file with a single write() when it fills up, or
+-- when flush() is called.  It writes classic pcap files with
+-- microsecond or nanosecond timestamps, or pcapng files.
+--
+--   local file = BufferedWriter.new(filename, {format="pcapng"})
+--   file:write(ptr, len, timestamp) -- timestamp in seconds, optional
+--   file:flush()
+--   file:close()
+
+local writer_params = {
+   -- "pcap" or "pcapng".
+   format = {default="pcap"},
+   -- Record timestamps with nanosecond instead of microsecond resolution.
+   nanosecond = {default=false},
+   -- Add to the end of an existing file instead of truncating it.
+   append = {default=false},
+   -- Size of the write buffer in bytes.
+   buffer_size = {default=4*1024*1024},
+   -- Maximum number of bytes of each packet to write.
+   snaplen = {default=65535}
+}
+
+BufferedWriter = {}
+
+function BufferedWriter.new (filename, opts)
+   local o = lib.parse(opts or {}, writer_params)
+   assert(o.format == "pcap" or o.format == "pcapng",
+          "Unsupported savefile format: "..tostring(o.format))
+   local flags = o.append and "wronly, creat, append"
+                          or "wronly, creat, trunc"
+   local fd, err = S.open(filename, flags, "rusr, wusr, rgrp, roth")
+   if not fd then error("Unable to open file: "..filename..": "..tostring(err)) end
+   o.fd = fd
+   o.filename = filename
+   o.buffer_size = lib.align(o.buffer_size, 4096)
+   local mem, err = S.mmap(nil, o.buffer_size, "read, write",
+                           "private, anonymous")
+   if not mem then error("mmap failed: "..tostring(err)) end
+   o.buffer = ffi.cast("uint8_t *", mem)
+   o.length = 0
+   o.units = o.nanosecond and 1e9 or 1e6
+   o = setmetatable(o, {__index = BufferedWriter})
+   if o.format == "pcap" then
+      o.write = BufferedWriter.write_pcap_record
+   else
+      o.write = BufferedWriter.write_pcapng_record
+   end
+   if assert(fd:fstat()).size == 0 then o:write_file_header() end
+   return o
+end
+
+function BufferedWriter:write_file_header ()
+   if self.format == "pcap" then
+      local header = ffi.cast(pcap_file_ptr_t, self:reserve(ffi.sizeof(pcap_file_t)))
+      ffi.fill(header, ffi.sizeof(pcap_file_t))
+      header.magic_number = self.nanosecond and pcap_magic_ns or pcap_magic
+      header.version_major = 2
+      header.version_minor = 4
+      header.snaplen = self.snaplen
+      header.network = 1
+   else
+      local shb = ffi.cast(pcapng_shb_ptr_t, self:reserve(ffi.sizeof(pcapng_shb_t) + 4))
+      shb.block_type = pcapng_shb
+      shb.block_total_length = ffi.sizeof(pcapng_shb_t) + 4
+      shb.byte_order_magic = pcapng_byte_order_magic
+      shb.major_version = 1
+      shb.minor_version = 0
+      shb.section_length = -1
+      ffi.cast("uint32_t *", shb + 1)[0] = shb.block_total_length
+      -- One Ethernet interface, with an if_tsresol option for
+      -- nanosecond timestamps.
+      local idb_len = ffi.sizeof(pcapng_idb_t) + 4
+      if self.nanosecond then idb_len = idb_len + 12 end
+      local ptr = self:reserve(idb_len)
+      ffi.fill(ptr, idb_len)
+      local idb = ffi.cast(pcapng_idb_ptr_t, ptr)
+      idb.block_type = pcapng_idb
+      idb.block_total_length = idb_len
+      idb.linktype = 1
+      idb.snaplen = self.snaplen
+      if self.nanosecond then
+         local option = ffi.cast(pcapng_option_ptr_t, idb + 1)
+         option.code = pcapng_if_tsresol
+         option.length = 1
+         ffi.cast("uint8_t *", option + 1)[0] = 9
+         -- An opt_endofopt follows, zero-filled.
+      end
+      ffi.cast("uint32_t *", ptr + idb_len - 4)[0] = idb_len
+   end
+end
+
+-- Return a pointer to LEN bytes at the end of the buffer, flushing it
+-- first if necessary.
+function BufferedWriter:reserve (len)
+   if self.length + len > self.buffer_size then
+      self:flush()
+      assert(len <= self.buffer_size, "record larger than write buffer")
+   end
+   local ptr = self.buffer + self.length
+   self.length = self.length + len
+   return ptr
+end
+
+function BufferedWriter:write_pcap_record (ptr, len, timestamp)
+   local incl_len = math.min(len, self.snaplen)
+   local dst = self:reserve(ffi.sizeof(pcap_record_t) + incl_len)
+   local record = ffi.cast(pcap_record_ptr_t, dst)
+   if timestamp then
+      local sec = math.floor(timestamp)
+      record.ts_sec = sec
+      record.ts_usec = (timestamp - sec) * self.units
+   else
+      record.ts_sec, record.ts_usec = 0, 0
+   end
+   record.incl_len = incl_len
+   record.orig_len = len
+   ffi.copy(dst + ffi.sizeof(pcap_record_t), ptr, incl_len)
+end
+
+function BufferedWriter:write_pcapng_record (ptr, len, timestamp)
+   local incl_len = math.min(len, self.snaplen)
+   local block_len = ffi.sizeof(pcapng_epb_t) + pad4(incl_len) + 4
+   local dst = self:reserve(block_len)
+   local epb = ffi.cast(pcapng_epb_ptr_t, dst)
+   epb.block_type = pcapng_epb
+   epb.block_total_length = block_len
+   epb.interface_id = 0
+   if timestamp then
+      local sec = math.floor(timestamp)
+      local units = ffi.cast("uint64_t", sec) * self.units
+         + math.floor((timestamp - sec) * self.units)
+      epb.timestamp_high = tonumber(bit.rshift(units, 32))
+      epb.timestamp_low = tonumber(bit.band(units, 0xffffffff))
+   else
+      epb.timestamp_high, epb.timestamp_low = 0, 0
+   end
+   epb.captured_len = incl_len
+   epb.original_len = len
+   ffi.copy(dst + ffi.sizeof(pcapng_epb_t), ptr, incl_len)
+   -- Zero the padding and store the trailing block length.
+   if pad4(incl_len) ~= incl_len then
+      ffi.fill(dst + ffi.sizeof(pcapng_epb_t) + incl_len,
+               pad4(incl_len) - incl_len)
+   end
+   ffi.cast("uint32_t *", dst + block_len - 4)[0] = block_len
+end
+
+function BufferedWriter:flush ()
+   local written = 0
+   while written < self.length do
+      local n, err = self.fd:write(self.buffer + written, self.length - written)
+      if not n then
+         if err.AGAIN or err.INTR then n = 0
+         else error("write failed: "..self.filename..": "..tostring(err)) end
+      end
+      written = written + n
+   end
+   self.length = 0
+end
+
+function BufferedWriter:close ()
+   self:flush()
+   self.fd:close()
+   S.munmap(self.buffer, self.buffer_size)
+   self.buffer = nil
+end
@@ -32,9 +32,10 @@ function actions.free_link (codec, linkspec)
    local linkspec = codec:string(linkspec)
    return codec:finish(linkspec)
 end
-function actions.new_link (codec, linkspec)
+function actions.new_link (codec, linkspec, options)
    local linkspec = codec:string(linkspec)
-   return codec:finish(linkspec)
+   local options = codec:link_options(options)
+   return codec:finish(linkspec, options)
 end
 function actions.link_output (codec, appname, linkname, linkspec)
    local appname = codec:string(appname)
@@ -143,6 +144,9 @@ local function encoder()
       end
       self:string(file_name)
    end
+   function encoder:link_options(options)
+      self:config({}, options)
+   end
    function encoder:finish()
       local size = 0
       for _,src in ipairs(self.out) do size = size + ffi.sizeof(src) end
@@ -202,6 +206,9 @@ local function decoder(buf, len)
          return data
       end
    end
+   function decoder:link_options()
+      return self:config()
+   end
    function decoder:finish(...)
       return { ... }
    end
@@ -244,6 +251,7 @@ function selftest ()
    test_action({'unlink_input', {appname, linkname}})
    test_action({'free_link', {linkspec}})
    test_action({'new_link', {linkspec}})
+   test_action({'new_link', {linkspec, {aqm={algorithm='codel'}}}})
    test_action({'link_output', {appname, linkname, linkspec}})
    test_action({'link_input', {appname, linkname, linkspec}})
    test_action({'stop_app', {appname}})
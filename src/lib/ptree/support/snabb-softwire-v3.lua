@@ -92,23 +92,62 @@ local function add_softwire_entry_actions(app_graph, bt, entries)
    return ret
 end
 
+local function softwire_key_from_path(path)
+   path = path_mod.parse_path(path, get_softwire_grammar())
+   return binding_table.softwire_key_t(path[#path].key)
+end
+
 local function remove_softwire_entry_actions(app_graph, path)
    assert(app_graph.apps['lwaftr'])
-   path = path_mod.parse_path(path, get_softwire_grammar())
-   local key = binding_table.softwire_key_t(path[#path].key)
+   local key = softwire_key_from_path(path)
    local args = {'lwaftr', 'remove_softwire_entry', key}
    -- If it's the last softwire for the corresponding psid entry, remove it.
    -- TODO: check if last psid entry and then remove.
    return {{'call_app_method_with_blob', args}, {'commit', {}}}
 end
 
+-- A shared binding table is updated by the manager, once for all
+-- workers; see apps.lwaftr.binding_table.
+local function is_binding_table_shared(graph)
+   local lwaftr = graph.apps['lwaftr']
+   return lwaftr and lwaftr.arg.softwire_config.binding_table.shared
+end
+
+local function is_softwire_update(verb, path)
+   return (verb == 'add' and
+           path == '/softwire-config/binding-table/softwire') or
+      (verb == 'remove' and
+       path:match('^/softwire%-config/binding%-table/softwire'))
+end
+
+local function stage_shared_binding_table_update(configuration, verb, path, arg)
+   local publisher = binding_table.get_publisher()
+   publisher:begin_update()
+   if not configuration.softwire_config.binding_table.shared then
+      return false
+   elseif verb == 'add' and path == '/softwire-config/binding-table/softwire' then
+      publisher:stage_add(arg)
+      return true
+   elseif verb == 'remove' and
+      path:match('^/softwire%-config/binding%-table/softwire') then
+      publisher:stage_remove(softwire_key_from_path(path))
+      return true
+   elseif path:match('^/softwire%-config/binding%-table') or
+      path == '/' or path == '/softwire-config' then
+      publisher:stage_reload()
+   end
+   return false
+end
+
 local function compute_config_actions(get_binding_table_instance,
                                       old_graph, new_graph, to_restart,
                                       verb, path, arg)
-   if verb == 'add' and path == '/softwire-config/binding-table/softwire' then
+   if is_softwire_update(verb, path) and is_binding_table_shared(new_graph) then
+      return {}
+   elseif verb == 'add' and path == '/softwire-config/binding-table/softwire' then
       if to_restart == false then
          assert(new_graph.apps['lwaftr'])
-         local bt_conf = app_graph.apps.lwaftr.arg.softwire_config.binding_table
+         local bt_conf = new_graph.apps.lwaftr.arg.softwire_config.binding_table
          local bt = get_binding_table_instance(bt_conf)
          return add_softwire_entry_actions(new_graph, bt, arg)
       end
@@ -138,7 +177,9 @@ end
 local function compute_apps_to_restart_after_configuration_update(
       get_binding_table_instance,
       schema_name, configuration, verb, path, in_place_dependencies, arg)
-   if verb == 'add' and path == '/softwire-config/binding-table/softwire' then
+   if stage_shared_binding_table_update(configuration, verb, path, arg) then
+      return {}
+   elseif verb == 'add' and path == '/softwire-config/binding-table/softwire' then
       -- We need to check if the softwire defines a new port-set, if so we need to
       -- restart unfortunately. If not we can just add the softwire.
       local bt = get_binding_table_instance(configuration.softwire_config.binding_table)
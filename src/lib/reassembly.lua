@@ -0,0 +1,367 @@
+-- Use of this source code is governed by the Apache 2.0 license; see COPYING.
+
+module(..., package.seeall)
+
+-- Bounded-memory fragment reassembly, shared by the IPv4 and IPv6
+-- reassemblers (apps/ipv4/reassemble.lua, apps/ipv6/reassemble.lua).
+--
+-- At most MAX_REASSEMBLIES datagrams are reassembled at once.  Each
+-- one owns a packet (allocated from the packet freelist, i.e. hugepage
+-- memory) into which fragment payloads are copied directly at their
+-- final offset as they arrive, and an interval bitmap with one bit per
+-- 8-byte fragment unit that tells which parts of the datagram have
+-- been received.  Overlapping fragments are detected with the same
+-- bitmap, and cause the reassembly to be aborted (RFC 5722).  The
+-- assembled packet is handed to the caller as is, so no fragment is
+-- ever copied twice, sorted or scanned again: the work per fragment is
+-- constant (plus the copy of its payload).
+--
+-- Reassemblies expire TIMEOUT seconds after their first fragment was
+-- received.  Because all reassemblies have the same timeout, the
+-- timing wheel degenerates into a single queue in order of creation:
+-- expiry pops from its head, and when all slots are in use the oldest
+-- reassembly is evicted to make room for a new one.
+--
+-- To keep a single source from occupying all slots, the number of
+-- reassemblies per source is limited to MAX_PER_SOURCE.  Sources are
+-- hashed into buckets; sources that share a bucket share its quota.
+--
+--   new(conf) => reassembly
+--   reassembly:lookup(key, source, now) => slot, evicted
+--      Return the slot of the reassembly for KEY, starting a new one
+--      if needed.  SOURCE is a 32-bit value that identifies the sender
+--      of the fragment.  Returns nil if starting a new reassembly
+--      would exceed the quota of SOURCE.  EVICTED is true if the
+--      oldest reassembly was evicted to make room.
+--   reassembly:add(slot, header, header_len, payload, offset, size, last)
+--      => status, packet
+--      Add the fragment whose packet headers are HEADER_LEN bytes at
+--      HEADER and whose SIZE bytes of PAYLOAD belong at byte OFFSET of
+--      the datagram.  LAST is true for the final fragment.  STATUS is
+--      one of IN_PROGRESS, COMPLETE (the reassembly is done, and PACKET
+--      contains the headers of the first fragment followed by the
+--      reassembled payload) or INVALID (the reassembly was aborted).
+--      In both of the latter cases the slot is released.
+--   reassembly:expire(now) => n
+--      Abort reassemblies that have timed out.
+--   reassembly:memuse() => bytes
+--      Return the memory held: the tables, whose size is proportional
+--      to MAX_REASSEMBLIES, and the packets of reassemblies in
+--      progress.
+
+local ffi = require("ffi")
+local bit = require("bit")
+local lib = require("core.lib")
+local packet = require("core.packet")
+local ctable = require("lib.ctable")
+
+local band, bor, bxor = bit.band, bit.bor, bit.bxor
+local lshift, rshift = bit.lshift, bit.rshift
+local min = math.min
+
+IN_PROGRESS, COMPLETE, INVALID = 0, 1, 2
+
+-- One bit per 8-byte unit of the largest packet payload.
+local units_max = math.ceil(packet.max_payload / 8)
+local words = math.ceil(units_max / 64)
+
+local slot_t = ffi.typeof([[
+   struct {
+      uint64_t received[$];  // bitmap of 8-byte units received
+      double deadline;       // expiry time
+      uint32_t prev, next;   // creation order queue
+      uint32_t source;       // quota bucket
+      uint16_t base;         // length of headers before the payload
+      uint16_t nunits;       // 8-byte units received
+      uint16_t final_units;  // units in the datagram (once final)
+      uint16_t end_units;    // end of the last unit received
+      uint16_t length;       // payload length (once final)
+      uint16_t nfragments;
+      uint8_t final;         // final fragment received
+   }
+]], words)
+
+local params = {
+   -- FFI type of the keys that identify a datagram.
+   key_type = {required=true},
+   -- Maximum number of datagrams reassembled at once.
+   max_reassemblies = {default=20000},
+   -- Maximum number of fragments of a datagram.
+   max_fragments = {default=40},
+   -- Number of seconds after which incomplete reassemblies expire.
+   timeout = {default=60},
+   -- Maximum number of reassemblies per source (by default, a quarter
+   -- of all reassemblies).
+   max_per_source = {},
+   -- Maximum number of reassemblies to expire at once.
+   expire_budget = {default=1024}
+}
+
+local Reassembly = {}
+
+function new (conf)
+   conf = lib.parse(conf, params)
+   local n = conf.max_reassemblies
+   assert(n > 0 and n < 0xffffffff, "invalid max_reassemblies")
+   local nbuckets = 2^math.ceil(math.log(n * 4) / math.log(2))
+   local o = {
+      max_fragments = conf.max_fragments,
+      timeout = conf.timeout,
+      max_per_source = conf.max_per_source or math.ceil(n / 4),
+      expire_budget = conf.expire_budget,
+      -- Slot N is the head of the creation order queue.
+      slots = ffi.new(ffi.typeof('$[?]', slot_t), n + 1),
+      packets = ffi.new('struct packet *[?]', n),
+      free = ffi.new('uint32_t[?]', n),
+      nfree = n,
+      sentinel = n,
+      keys = ffi.new(ffi.typeof('$[?]', conf.key_type), n),
+      sources = ffi.new('uint32_t[?]', nbuckets),
+      source_mask = nbuckets - 1,
+      source_seed = math.random(0, 0x7fffffff),
+      ctab = ctable.new{
+         key_type = conf.key_type,
+         value_type = ffi.typeof('uint32_t'),
+         initial_size = math.ceil(n / 0.9) + 1,
+         max_occupancy_rate = 0.9
+      }
+   }
+   for i = 0, n - 1 do o.free[i] = n - 1 - i end
+   o.slots[n].prev, o.slots[n].next = n, n
+   return setmetatable(o, {__index = Reassembly})
+end
+
+-- Remove SLOT from the creation order queue and the table, and return
+-- its packet (if any) to the caller.
+function Reassembly:release (slot)
+   local slots = self.slots
+   local s = slots[slot]
+   slots[s.prev].next = s.next
+   slots[s.next].prev = s.prev
+   self.sources[s.source] = self.sources[s.source] - 1
+   self.ctab:remove(self.keys[slot])
+   self.free[self.nfree] = slot
+   self.nfree = self.nfree + 1
+   local p = self.packets[slot]
+   self.packets[slot] = nil
+   return p
+end
+
+function Reassembly:abort (slot)
+   local p = self:release(slot)
+   if p ~= nil then packet.free(p) end
+   return INVALID
+end
+
+function Reassembly:lookup (key, source, now)
+   local entry = self.ctab:lookup_ptr(key)
+   if entry then return entry.value, false end
+
+   source = band(bxor(source, rshift(source, 16), self.source_seed),
+                 self.source_mask)
+   if self.sources[source] >= self.max_per_source then return nil end
+
+   local evicted = false
+   if self.nfree == 0 then
+      self:abort(self.slots[self.sentinel].next)
+      evicted = true
+   end
+   self.nfree = self.nfree - 1
+   local slot = self.free[self.nfree]
+   local slots, sentinel = self.slots, self.sentinel
+   local s = slots[slot]
+   ffi.fill(s, ffi.sizeof(slot_t))
+   s.deadline = now + self.timeout
+   s.source = source
+   s.prev, s.next = slots[sentinel].prev, sentinel
+   slots[s.prev].next = slot
+   slots[sentinel].prev = slot
+   self.sources[source] = self.sources[source] + 1
+   ffi.copy(self.keys + slot, key, ffi.sizeof(key))
+   self.packets[slot] = packet.allocate()
+   self.ctab:add(self.keys[slot], slot)
+   return slot, evicted
+end
+
+-- Mark the 8-byte units [U0, U1) of the bitmap of S as received.
+-- Returns false if any of them was already received.
+local function mark (s, u0, u1)
+   local received = s.received
+   for w = rshift(u0, 6), rshift(u1 - 1, 6) do
+      local lo = math.max(u0 - w * 64, 0)
+      local hi = min(u1 - w * 64, 64)
+      -- Bits [lo, hi) of word W.
+      local mask = lshift(-1ULL, lo)
+      if hi < 64 then mask = band(mask, lshift(1ULL, hi) - 1) end
+      if band(received[w], mask) ~= 0ULL then return false end
+      received[w] = bor(received[w], mask)
+   end
+   return true
+end
+
+function Reassembly:add (slot, header, header_len, payload, offset, size, last)
+   local s = self.slots[slot]
+   local p = self.packets[slot]
+   if s.nfragments + 1 > self.max_fragments then
+      -- Too many fragments to reassemble this datagram.
+      return self:abort(slot)
+   end
+   s.nfragments = s.nfragments + 1
+   if s.nfragments == 1 then s.base = header_len end
+
+   local u0, u1 = rshift(offset, 3), rshift(offset + size + 7, 3)
+   if last then
+      if s.final ~= 0 or s.end_units > u1 then
+         -- There can be only one final fragment, and no data beyond it.
+         return self:abort(slot)
+      end
+      s.final, s.final_units, s.length = 1, u1, offset + size
+   elseif band(size, 7) ~= 0 or size == 0 then
+      -- The size of non-final fragments must be a non-zero multiple
+      -- of 8.
+      return self:abort(slot)
+   elseif s.final ~= 0 and u1 > s.final_units then
+      return self:abort(slot)
+   end
+   if offset == 0 and header_len ~= s.base then
+      -- The first fragment carries the headers of the datagram; if
+      -- they are not as long as those of the fragment that started the
+      -- reassembly (IPv4 options), move the payload received so far.
+      if header_len + s.end_units * 8 > packet.max_payload then
+         return self:abort(slot)
+      end
+      ffi.C.memmove(p.data + header_len, p.data + s.base, s.end_units * 8)
+      s.base = header_len
+   end
+   if s.base + offset + size > packet.max_payload then
+      -- Snabb packets have a maximum size of 10240 bytes.
+      return self:abort(slot)
+   end
+   if size > 0 and not mark(s, u0, u1) then
+      -- Overlapping fragment (RFC 5722).
+      return self:abort(slot)
+   end
+   s.nunits = s.nunits + (u1 - u0)
+   s.end_units = math.max(s.end_units, u1)
+
+   ffi.copy(p.data + s.base + offset, payload, size)
+   if offset == 0 or s.nfragments == 1 then
+      ffi.copy(p.data, header, header_len)
+   end
+
+   if s.final == 0 or s.nunits ~= s.final_units then
+      return IN_PROGRESS
+   end
+   p.length = s.base + s.length
+   return COMPLETE, self:release(slot)
+end
+
+function Reassembly:expire (now)
+   local slots, sentinel = self.slots, self.sentinel
+   local n = 0
+   while n < self.expire_budget do
+      local oldest = slots[sentinel].next
+      if oldest == sentinel or slots[oldest].deadline > now then break end
+      self:abort(oldest)
+      n = n + 1
+   end
+   return n
+end
+
+function Reassembly:memuse ()
+   local in_progress = self.sentinel - self.nfree
+   return self.ctab:get_backing_size()
+      + ffi.sizeof(self.slots) + ffi.sizeof(self.keys)
+      + ffi.sizeof(self.packets) + ffi.sizeof(self.free)
+      + ffi.sizeof(self.sources)
+      + in_progress * ffi.sizeof("struct packet")
+end
+
+function selftest ()
+   print("selftest: lib.reassembly")
+   local key_t = ffi.typeof("struct { uint32_t id; }")
+   local key = key_t()
+   local header = ffi.new("uint8_t[14]", 0xaa)
+   local data = ffi.new("uint8_t[?]", 8000)
+   for i = 0, 7999 do data[i] = i % 251 end
+
+   local function check (p, length)
+      assert(p.length == 14 + length)
+      for i = 0, 13 do assert(p.data[i] == 0xaa) end
+      for i = 0, length - 1 do assert(p.data[14 + i] == i % 251) end
+      packet.free(p)
+   end
+
+   local r = new{key_type=key_t, max_reassemblies=4, max_fragments=8,
+                 max_per_source=2, timeout=10}
+   local function add (slot, offset, size, last)
+      return r:add(slot, header, 14, data + offset, offset, size, last)
+   end
+
+   -- In order, reverse order, and interleaved.
+   for _, order in ipairs{{0, 1, 2, 3}, {3, 2, 1, 0}, {1, 3, 0, 2}} do
+      key.id = 1
+      local slot = r:lookup(key, 1, 0)
+      for i, frag in ipairs(order) do
+         local last = frag == 3
+         local status, p = add(slot, frag * 800, last and 100 or 800, last)
+         if i < #order then
+            assert(status == IN_PROGRESS)
+            assert(r:lookup(key, 1, 0) == slot)
+         else
+            assert(status == COMPLETE)
+            check(p, 3 * 800 + 100)
+         end
+      end
+      assert(r.nfree == 4)
+   end
+
+   -- Overlaps, duplicate final fragments, odd sizes, data beyond the
+   -- end and too many fragments abort the reassembly.
+   local function invalid (fragments)
+      key.id = 2
+      local slot = r:lookup(key, 1, 0)
+      local status
+      for _, f in ipairs(fragments) do
+         status = add(slot, unpack(f))
+         if status ~= IN_PROGRESS then break end
+      end
+      assert(status == INVALID)
+      assert(r.nfree == 4)
+   end
+   invalid{{0, 800, false}, {792, 800, false}}
+   invalid{{800, 800, false}, {0, 808, false}}
+   invalid{{800, 100, true}, {800, 100, true}}
+   invalid{{0, 804, false}}
+   invalid{{800, 100, true}, {1600, 800, false}}
+   invalid{{1600, 800, false}, {800, 100, true}}
+   invalid{{0, 8, false}, {8, 8, false}, {16, 8, false}, {24, 8, false},
+           {32, 8, false}, {40, 8, false}, {48, 8, false}, {56, 8, false},
+           {64, 8, true}}
+   invalid{{0, 8000, false}, {8000, 8000, true}}
+
+   -- Quotas and eviction.
+   local memuse = r:memuse()
+   for id = 1, 2 do key.id = id; assert(r:lookup(key, 7, id)) end
+   key.id = 3; assert(not r:lookup(key, 7, 3))
+   for id = 3, 4 do key.id = id; assert(r:lookup(key, id, id)) end
+   key.id = 5
+   local slot, evicted = r:lookup(key, 5, 5)
+   assert(slot and evicted)
+   -- Reassembly 1 was the oldest and is gone; its source can start
+   -- another one.
+   key.id = 1; assert(r:lookup(key, 7, 6))
+   assert(r.nfree == 0)
+   -- Only the packets of reassemblies in progress count as memory use.
+   assert(r:memuse() == memuse + 4 * ffi.sizeof("struct packet"))
+
+   -- Expiry.
+   assert(r:expire(10) == 0)
+   assert(r:expire(14.5) == 2)
+   assert(r.nfree == 2)
+   assert(r:expire(100) == 2)
+   assert(r.nfree == 4)
+   assert(r:memuse() == memuse)
+   assert(r.ctab.occupancy == 0)
+   print("selftest: ok")
+end
@@ -0,0 +1,454 @@
+-- Generated by ljdnpi's tools/update-protocol-ids script
+local T = {
+  [0] = "PROTOCOL_UNKNOWN",
+  [1] = "PROTOCOL_FTP_CONTROL",
+  [2] = "PROTOCOL_MAIL_POP",
+  [2] = "PROTOCOL_HISTORY_SIZE",
+  [3] = "PROTOCOL_MAIL_SMTP",
+  [4] = "PROTOCOL_MAIL_IMAP",
+  [5] = "PROTOCOL_DNS",
+  [6] = "PROTOCOL_IPP",
+  [7] = "PROTOCOL_HTTP",
+  [8] = "PROTOCOL_MDNS",
+  [9] = "PROTOCOL_NTP",
+  [10] = "PROTOCOL_NETBIOS",
+  [11] = "PROTOCOL_NFS",
+  [12] = "PROTOCOL_SSDP",
+  [13] = "PROTOCOL_BGP",
+  [14] = "PROTOCOL_SNMP",
+  [15] = "PROTOCOL_XDMCP",
+  [16] = "PROTOCOL_SMB",
+  [17] = "PROTOCOL_SYSLOG",
+  [18] = "PROTOCOL_DHCP",
+  [19] = "PROTOCOL_POSTGRES",
+  [20] = "PROTOCOL_MYSQL",
+  [21] = "PROTOCOL_TDS",
+  [22] = "PROTOCOL_DIRECT_DOWNLOAD_LINK",
+  [23] = "PROTOCOL_MAIL_POPS",
+  [24] = "PROTOCOL_APPLEJUICE",
+  [25] = "PROTOCOL_DIRECTCONNECT",
+  [26] = "PROTOCOL_SOCRATES",
+  [27] = "PROTOCOL_WINMX",
+  [28] = "PROTOCOL_VMWARE",
+  [29] = "PROTOCOL_MAIL_SMTPS",
+  [30] = "PROTOCOL_FILETOPIA",
+  [31] = "PROTOCOL_IMESH",
+  [32] = "PROTOCOL_KONTIKI",
+  [33] = "PROTOCOL_OPENFT",
+  [34] = "PROTOCOL_FASTTRACK",
+  [35] = "PROTOCOL_GNUTELLA",
+  [36] = "PROTOCOL_EDONKEY",
+  [37] = "PROTOCOL_BITTORRENT",
+  [38] = "PROTOCOL_EPP",
+  [39] = "CONTENT_AVI",
+  [40] = "CONTENT_FLASH",
+  [41] = "CONTENT_OGG",
+  [42] = "CONTENT_MPEG",
+  [43] = "CONTENT_QUICKTIME",
+  [44] = "CONTENT_REALMEDIA",
+  [45] = "CONTENT_WINDOWSMEDIA",
+  [46] = "CONTENT_MMS",
+  [47] = "PROTOCOL_XBOX",
+  [48] = "PROTOCOL_QQ",
+  [49] = "PROTOCOL_MOVE",
+  [50] = "PROTOCOL_RTSP",
+  [51] = "PROTOCOL_MAIL_IMAPS",
+  [52] = "PROTOCOL_ICECAST",
+  [53] = "PROTOCOL_PPLIVE",
+  [54] = "PROTOCOL_PPSTREAM",
+  [55] = "PROTOCOL_ZATTOO",
+  [56] = "PROTOCOL_SHOUTCAST",
+  [57] = "PROTOCOL_SOPCAST",
+  [58] = "PROTOCOL_TVANTS",
+  [59] = "PROTOCOL_TVUPLAYER",
+  [60] = "PROTOCOL_HTTP_APPLICATION_VEOHTV",
+  [61] = "PROTOCOL_QQLIVE",
+  [62] = "PROTOCOL_THUNDER",
+  [63] = "PROTOCOL_SOULSEEK",
+  [64] = "PROTOCOL_SSL_NO_CERT",
+  [65] = "PROTOCOL_IRC",
+  [66] = "PROTOCOL_AYIYA",
+  [67] = "PROTOCOL_UNENCRYPED_JABBER",
+  [68] = "PROTOCOL_MSN",
+  [69] = "PROTOCOL_OSCAR",
+  [70] = "PROTOCOL_YAHOO",
+  [71] = "PROTOCOL_BATTLEFIELD",
+  [72] = "PROTOCOL_QUAKE",
+  [73] = "PROTOCOL_IP_VRRP",
+  [74] = "PROTOCOL_STEAM",
+  [75] = "PROTOCOL_HALFLIFE2",
+  [76] = "PROTOCOL_WORLDOFWARCRAFT",
+  [77] = "PROTOCOL_TELNET",
+  [78] = "PROTOCOL_STUN",
+  [79] = "PROTOCOL_IP_IPSEC",
+  [80] = "PROTOCOL_IP_GRE",
+  [81] = "PROTOCOL_IP_ICMP",
+  [82] = "PROTOCOL_IP_IGMP",
+  [83] = "PROTOCOL_IP_EGP",
+  [84] = "PROTOCOL_IP_SCTP",
+  [85] = "PROTOCOL_IP_OSPF",
+  [86] = "PROTOCOL_IP_IP_IN_IP",
+  [87] = "PROTOCOL_RTP",
+  [88] = "PROTOCOL_RDP",
+  [89] = "PROTOCOL_VNC",
+  [90] = "PROTOCOL_PCANYWHERE",
+  [91] = "PROTOCOL_SSL",
+  [92] = "PROTOCOL_SSH",
+  [93] = "PROTOCOL_USENET",
+  [94] = "PROTOCOL_MGCP",
+  [95] = "PROTOCOL_IAX",
+  [96] = "PROTOCOL_TFTP",
+  [97] = "PROTOCOL_AFP",
+  [98] = "PROTOCOL_STEALTHNET",
+  [99] = "PROTOCOL_AIMINI",
+  [100] = "PROTOCOL_SIP",
+  [101] = "PROTOCOL_TRUPHONE",
+  [102] = "PROTOCOL_IP_ICMPV6",
+  [103] = "PROTOCOL_DHCPV6",
+  [104] = "PROTOCOL_ARMAGETRON",
+  [105] = "PROTOCOL_CROSSFIRE",
+  [106] = "PROTOCOL_DOFUS",
+  [107] = "PROTOCOL_FIESTA",
+  [108] = "PROTOCOL_FLORENSIA",
+  [109] = "PROTOCOL_GUILDWARS",
+  [110] = "PROTOCOL_HTTP_APPLICATION_ACTIVESYNC",
+  [111] = "PROTOCOL_KERBEROS",
+  [112] = "PROTOCOL_LDAP",
+  [113] = "PROTOCOL_MAPLESTORY",
+  [114] = "PROTOCOL_MSSQL",
+  [115] = "PROTOCOL_PPTP",
+  [116] = "PROTOCOL_WARCRAFT3",
+  [117] = "PROTOCOL_WORLD_OF_KUNG_FU",
+  [118] = "PROTOCOL_MEEBO",
+  [119] = "SERVICE_FACEBOOK",
+  [120] = "SERVICE_TWITTER",
+  [121] = "PROTOCOL_DROPBOX",
+  [122] = "SERVICE_GMAIL",
+  [123] = "SERVICE_GOOGLE_MAPS",
+  [124] = "SERVICE_YOUTUBE",
+  [125] = "PROTOCOL_SKYPE",
+  [126] = "SERVICE_GOOGLE",
+  [127] = "PROTOCOL_DCERPC",
+  [128] = "PROTOCOL_NETFLOW",
+  [129] = "PROTOCOL_SFLOW",
+  [130] = "PROTOCOL_HTTP_CONNECT",
+  [131] = "PROTOCOL_HTTP_PROXY",
+  [132] = "PROTOCOL_CITRIX",
+  [133] = "SERVICE_NETFLIX",
+  [134] = "SERVICE_LASTFM",
+  [135] = "SERVICE_WAZE",
+  [136] = "PROTOCOL_SKYFILE_PREPAID",
+  [137] = "PROTOCOL_SKYFILE_RUDICS",
+  [138] = "PROTOCOL_SKYFILE_POSTPAID",
+  [139] = "PROTOCOL_CITRIX_ONLINE",
+  [140] = "SERVICE_APPLE",
+  [141] = "PROTOCOL_WEBEX",
+  [142] = "SERVICE_WHATSAPP",
+  [143] = "SERVICE_APPLE_ICLOUD",
+  [144] = "PROTOCOL_VIBER",
+  [145] = "SERVICE_APPLE_ITUNES",
+  [146] = "PROTOCOL_RADIUS",
+  [147] = "SERVICE_WINDOWS_UPDATE",
+  [148] = "PROTOCOL_TEAMVIEWER",
+  [149] = "SERVICE_TUENTI",
+  [150] = "PROTOCOL_LOTUS_NOTES",
+  [151] = "PROTOCOL_SAP",
+  [152] = "PROTOCOL_GTP",
+  [153] = "PROTOCOL_UPNP",
+  [154] = "PROTOCOL_LLMNR",
+  [155] = "PROTOCOL_REMOTE_SCAN",
+  [156] = "PROTOCOL_SPOTIFY",
+  [157] = "CONTENT_WEBM",
+  [158] = "PROTOCOL_H323",
+  [159] = "PROTOCOL_OPENVPN",
+  [160] = "PROTOCOL_NOE",
+  [161] = "PROTOCOL_CISCOVPN",
+  [162] = "PROTOCOL_TEAMSPEAK",
+  [163] = "PROTOCOL_TOR",
+  [164] = "PROTOCOL_SKINNY",
+  [165] = "PROTOCOL_RTCP",
+  [166] = "PROTOCOL_RSYNC",
+  [167] = "PROTOCOL_ORACLE",
+  [168] = "PROTOCOL_CORBA",
+  [169] = "PROTOCOL_UBUNTUONE",
+  [170] = "PROTOCOL_WHOIS_DAS",
+  [171] = "PROTOCOL_COLLECTD",
+  [172] = "PROTOCOL_SOCKS5",
+  [173] = "PROTOCOL_SOCKS4",
+  [174] = "PROTOCOL_RTMP",
+  [175] = "PROTOCOL_FTP_DATA",
+  [176] = "SERVICE_WIKIPEDIA",
+  [177] = "PROTOCOL_ZMQ",
+  [178] = "SERVICE_AMAZON",
+  [179] = "SERVICE_EBAY",
+  [180] = "SERVICE_CNN",
+  [181] = "PROTOCOL_MEGACO",
+  [182] = "PROTOCOL_REDIS",
+  [183] = "PROTOCOL_PANDO",
+  [184] = "PROTOCOL_VHUA",
+  [185] = "PROTOCOL_TELEGRAM",
+  [186] = "SERVICE_VEVO",
+  [187] = "SERVICE_PANDORA",
+  [188] = "PROTOCOL_QUIC",
+  [189] = "PROTOCOL_WHATSAPP_VOICE",
+  [190] = "PROTOCOL_EAQ",
+  [191] = "SERVICE_TIMMEU",
+  [192] = "SERVICE_TORCEDOR",
+  [193] = "SERVICE_KAKAOTALK",
+  [194] = "SERVICE_KAKAOTALK_VOICE",
+  [195] = "SERVICE_TWITCH",
+  [196] = "SERVICE_QUICKPLAY",
+  [197] = "SERVICE_TIM",
+  [198] = "PROTOCOL_MPEGTS",
+  [199] = "SERVICE_SNAPCHAT",
+  [200] = "SERVICE_SIMET",
+  [201] = "SERVICE_OPENSIGNAL",
+  [202] = "SERVICE_99TAXI",
+  [203] = "SERVICE_EASYTAXI",
+  [204] = "SERVICE_GLOBOTV",
+  [205] = "SERVICE_TIMSOMDECHAMADA",
+  [206] = "SERVICE_TIMMENU",
+  [207] = "SERVICE_TIMPORTASABERTAS",
+  [208] = "SERVICE_TIMRECARGA",
+  [209] = "SERVICE_TIMBETA",
+  [210] = "SERVICE_DEEZER",
+  [211] = "SERVICE_INSTAGRAM",
+  [212] = "SERVICE_MICROSOFT",
+  [213] = "PROTOCOL_STARCRAFT",
+  [214] = "PROTOCOL_TEREDO",
+  [215] = "SERVICE_HOTSPOT_SHIELD",
+  [216] = "PROTOCOL_HEP",
+  [217] = "PROTOCOL_UBNTAC2",
+  [218] = "SERVICE_OCS",
+  [219] = "SERVICE_OFFICE_365",
+  [220] = "PROTOCOL_MS_LYNC",
+  PROTOCOL_UNKNOWN = 0,
+  PROTOCOL_FTP_CONTROL = 1,
+  PROTOCOL_MAIL_POP = 2,
+  PROTOCOL_HISTORY_SIZE = 2,
+  PROTOCOL_MAIL_SMTP = 3,
+  PROTOCOL_MAIL_IMAP = 4,
+  PROTOCOL_DNS = 5,
+  PROTOCOL_IPP = 6,
+  PROTOCOL_HTTP = 7,
+  PROTOCOL_MDNS = 8,
+  PROTOCOL_NTP = 9,
+  PROTOCOL_NETBIOS = 10,
+  PROTOCOL_NFS = 11,
+  PROTOCOL_SSDP = 12,
+  PROTOCOL_BGP = 13,
+  PROTOCOL_SNMP = 14,
+  PROTOCOL_XDMCP = 15,
+  PROTOCOL_SMB = 16,
+  PROTOCOL_SYSLOG = 17,
+  PROTOCOL_DHCP = 18,
+  PROTOCOL_POSTGRES = 19,
+  PROTOCOL_MYSQL = 20,
+  PROTOCOL_TDS = 21,
+  PROTOCOL_DIRECT_DOWNLOAD_LINK = 22,
+  PROTOCOL_MAIL_POPS = 23,
+  PROTOCOL_APPLEJUICE = 24,
+  PROTOCOL_DIRECTCONNECT = 25,
+  PROTOCOL_SOCRATES = 26,
+  PROTOCOL_WINMX = 27,
+  PROTOCOL_VMWARE = 28,
+  PROTOCOL_MAIL_SMTPS = 29,
+  PROTOCOL_FILETOPIA = 30,
+  PROTOCOL_IMESH = 31,
+  PROTOCOL_KONTIKI = 32,
+  PROTOCOL_OPENFT = 33,
+  PROTOCOL_FASTTRACK = 34,
+  PROTOCOL_GNUTELLA = 35,
+  PROTOCOL_EDONKEY = 36,
+  PROTOCOL_BITTORRENT = 37,
+  PROTOCOL_EPP = 38,
+  CONTENT_AVI = 39,
+  CONTENT_FLASH = 40,
+  CONTENT_OGG = 41,
+  CONTENT_MPEG = 42,
+  CONTENT_QUICKTIME = 43,
+  CONTENT_REALMEDIA = 44,
+  CONTENT_WINDOWSMEDIA = 45,
+  CONTENT_MMS = 46,
+  PROTOCOL_XBOX = 47,
+  PROTOCOL_QQ = 48,
+  PROTOCOL_MOVE = 49,
+  PROTOCOL_RTSP = 50,
+  PROTOCOL_MAIL_IMAPS = 51,
+  PROTOCOL_ICECAST = 52,
+  PROTOCOL_PPLIVE = 53,
+  PROTOCOL_PPSTREAM = 54,
+  PROTOCOL_ZATTOO = 55,
+  PROTOCOL_SHOUTCAST = 56,
+  PROTOCOL_SOPCAST = 57,
+  PROTOCOL_TVANTS = 58,
+  PROTOCOL_TVUPLAYER = 59,
+  PROTOCOL_HTTP_APPLICATION_VEOHTV = 60,
+  PROTOCOL_QQLIVE = 61,
+  PROTOCOL_THUNDER = 62,
+  PROTOCOL_SOULSEEK = 63,
+  PROTOCOL_SSL_NO_CERT = 64,
+  PROTOCOL_IRC = 65,
+  PROTOCOL_AYIYA = 66,
+  PROTOCOL_UNENCRYPED_JABBER = 67,
+  PROTOCOL_MSN = 68,
+  PROTOCOL_OSCAR = 69,
+  PROTOCOL_YAHOO = 70,
+  PROTOCOL_BATTLEFIELD = 71,
+  PROTOCOL_QUAKE = 72,
+  PROTOCOL_IP_VRRP = 73,
+  PROTOCOL_STEAM = 74,
+  PROTOCOL_HALFLIFE2 = 75,
+  PROTOCOL_WORLDOFWARCRAFT = 76,
+  PROTOCOL_TELNET = 77,
+  PROTOCOL_STUN = 78,
+  PROTOCOL_IP_IPSEC = 79,
+  PROTOCOL_IP_GRE = 80,
+  PROTOCOL_IP_ICMP = 81,
+  PROTOCOL_IP_IGMP = 82,
+  PROTOCOL_IP_EGP = 83,
+  PROTOCOL_IP_SCTP = 84,
+  PROTOCOL_IP_OSPF = 85,
+  PROTOCOL_IP_IP_IN_IP = 86,
+  PROTOCOL_RTP = 87,
+  PROTOCOL_RDP = 88,
+  PROTOCOL_VNC = 89,
+  PROTOCOL_PCANYWHERE = 90,
+  PROTOCOL_SSL = 91,
+  PROTOCOL_SSH = 92,
+  PROTOCOL_USENET = 93,
+  PROTOCOL_MGCP = 94,
+  PROTOCOL_IAX = 95,
+  PROTOCOL_TFTP = 96,
+  PROTOCOL_AFP = 97,
+  PROTOCOL_STEALTHNET = 98,
+  PROTOCOL_AIMINI = 99,
+  PROTOCOL_SIP = 100,
+  PROTOCOL_TRUPHONE = 101,
+  PROTOCOL_IP_ICMPV6 = 102,
+  PROTOCOL_DHCPV6 = 103,
+  PROTOCOL_ARMAGETRON = 104,
+  PROTOCOL_CROSSFIRE = 105,
+  PROTOCOL_DOFUS = 106,
+  PROTOCOL_FIESTA = 107,
+  PROTOCOL_FLORENSIA = 108,
+  PROTOCOL_GUILDWARS = 109,
+  PROTOCOL_HTTP_APPLICATION_ACTIVESYNC = 110,
+  PROTOCOL_KERBEROS = 111,
+  PROTOCOL_LDAP = 112,
+  PROTOCOL_MAPLESTORY = 113,
+  PROTOCOL_MSSQL = 114,
+  PROTOCOL_PPTP = 115,
+  PROTOCOL_WARCRAFT3 = 116,
+  PROTOCOL_WORLD_OF_KUNG_FU = 117,
+  PROTOCOL_MEEBO = 118,
+  SERVICE_FACEBOOK = 119,
+  SERVICE_TWITTER = 120,
+  PROTOCOL_DROPBOX = 121,
+  SERVICE_GMAIL = 122,
+  SERVICE_GOOGLE_MAPS = 123,
+  SERVICE_YOUTUBE = 124,
+  PROTOCOL_SKYPE = 125,
+  SERVICE_GOOGLE = 126,
+  PROTOCOL_DCERPC = 127,
+  PROTOCOL_NETFLOW = 128,
+  PROTOCOL_SFLOW = 129,
+  PROTOCOL_HTTP_CONNECT = 130,
+  PROTOCOL_HTTP_PROXY = 131,
+  PROTOCOL_CITRIX = 132,
+  SERVICE_NETFLIX = 133,
+  SERVICE_LASTFM = 134,
+  SERVICE_WAZE = 135,
+  PROTOCOL_SKYFILE_PREPAID = 136,
+  PROTOCOL_SKYFILE_RUDICS = 137,
+  PROTOCOL_SKYFILE_POSTPAID = 138,
+  PROTOCOL_CITRIX_ONLINE = 139,
+  SERVICE_APPLE = 140,
+  PROTOCOL_WEBEX = 141,
+  SERVICE_WHATSAPP = 142,
+  SERVICE_APPLE_ICLOUD = 143,
+  PROTOCOL_VIBER = 144,
+  SERVICE_APPLE_ITUNES = 145,
+  PROTOCOL_RADIUS = 146,
+  SERVICE_WINDOWS_UPDATE = 147,
+  PROTOCOL_TEAMVIEWER = 148,
+  SERVICE_TUENTI = 149,
+  PROTOCOL_LOTUS_NOTES = 150,
+  PROTOCOL_SAP = 151,
+  PROTOCOL_GTP = 152,
+  PROTOCOL_UPNP = 153,
+  PROTOCOL_LLMNR = 154,
+  PROTOCOL_REMOTE_SCAN = 155,
+  PROTOCOL_SPOTIFY = 156,
+  CONTENT_WEBM = 157,
+  PROTOCOL_H323 = 158,
+  PROTOCOL_OPENVPN = 159,
+  PROTOCOL_NOE = 160,
+  PROTOCOL_CISCOVPN = 161,
+  PROTOCOL_TEAMSPEAK = 162,
+  PROTOCOL_TOR = 163,
+  PROTOCOL_SKINNY = 164,
+  PROTOCOL_RTCP = 165,
+  PROTOCOL_RSYNC = 166,
+  PROTOCOL_ORACLE = 167,
+  PROTOCOL_CORBA = 168,
+  PROTOCOL_UBUNTUONE = 169,
+  PROTOCOL_WHOIS_DAS = 170,
+  PROTOCOL_COLLECTD = 171,
+  PROTOCOL_SOCKS5 = 172,
+  PROTOCOL_SOCKS4 = 173,
+  PROTOCOL_RTMP = 174,
+  PROTOCOL_FTP_DATA = 175,
+  SERVICE_WIKIPEDIA = 176,
+  PROTOCOL_ZMQ = 177,
+  SERVICE_AMAZON = 178,
+  SERVICE_EBAY = 179,
+  SERVICE_CNN = 180,
+  PROTOCOL_MEGACO = 181,
+  PROTOCOL_REDIS = 182,
+  PROTOCOL_PANDO = 183,
+  PROTOCOL_VHUA = 184,
+  PROTOCOL_TELEGRAM = 185,
+  SERVICE_VEVO = 186,
+  SERVICE_PANDORA = 187,
+  PROTOCOL_QUIC = 188,
+  PROTOCOL_WHATSAPP_VOICE = 189,
+  PROTOCOL_EAQ = 190,
+  SERVICE_TIMMEU = 191,
+  SERVICE_TORCEDOR = 192,
+  SERVICE_KAKAOTALK = 193,
+  SERVICE_KAKAOTALK_VOICE = 194,
+  SERVICE_TWITCH = 195,
+  SERVICE_QUICKPLAY = 196,
+  SERVICE_TIM = 197,
+  PROTOCOL_MPEGTS = 198,
+  SERVICE_SNAPCHAT = 199,
+  SERVICE_SIMET = 200,
+  SERVICE_OPENSIGNAL = 201,
+  SERVICE_99TAXI = 202,
+  SERVICE_EASYTAXI = 203,
+  SERVICE_GLOBOTV = 204,
+  SERVICE_TIMSOMDECHAMADA = 205,
+  SERVICE_TIMMENU = 206,
+  SERVICE_TIMPORTASABERTAS = 207,
+  SERVICE_TIMRECARGA = 208,
+  SERVICE_TIMBETA = 209,
+  SERVICE_DEEZER = 210,
+  SERVICE_INSTAGRAM = 211,
+  SERVICE_MICROSOFT = 212,
+  PROTOCOL_STARCRAFT = 213,
+  PROTOCOL_TEREDO = 214,
+  SERVICE_HOTSPOT_SHIELD = 215,
+  PROTOCOL_HEP = 216,
+  PROTOCOL_UBNTAC2 = 217,
+  SERVICE_OCS = 218,
+  SERVICE_OFFICE_365 = 219,
+  PROTOCOL_MS_LYNC = 220,
+}
+T.PROTOCOL_NO_MASTER_PROTO = T.PROTOCOL_UNKNOWN
+T.SERVICE_MSN = T.PROTOCOL_MSN
+T.SERVICE_DROPBOX = T.PROTOCOL_DROPBOX
+T.SERVICE_SKYPE = T.PROTOCOL_SKYPE
+T.SERVICE_VIBER = T.PROTOCOL_VIBER
+T.SERVICE_YAHOO = T.PROTOCOL_YAHOO
+return T
@@ -0,0 +1,465 @@
+-- Generated by ljdnpi's tools/update-protocol-ids script
+local T = {
+  [0] = "PROTOCOL_UNKNOWN",
+  [0] = "PROTOCOL_UNKNOWN",
+  [1] = "PROTOCOL_FTP_CONTROL",
+  [2] = "PROTOCOL_SIZE",
+  [2] = "PROTOCOL_MAIL_POP",
+  [3] = "PROTOCOL_MAIL_SMTP",
+  [4] = "PROTOCOL_MAIL_IMAP",
+  [5] = "PROTOCOL_DNS",
+  [6] = "PROTOCOL_IPP",
+  [7] = "PROTOCOL_HTTP",
+  [8] = "PROTOCOL_MDNS",
+  [9] = "PROTOCOL_NTP",
+  [10] = "PROTOCOL_NETBIOS",
+  [11] = "PROTOCOL_NFS",
+  [12] = "PROTOCOL_SSDP",
+  [13] = "PROTOCOL_BGP",
+  [14] = "PROTOCOL_SNMP",
+  [15] = "PROTOCOL_XDMCP",
+  [16] = "PROTOCOL_SMB",
+  [17] = "PROTOCOL_SYSLOG",
+  [18] = "PROTOCOL_DHCP",
+  [19] = "PROTOCOL_POSTGRES",
+  [20] = "PROTOCOL_MYSQL",
+  [21] = "PROTOCOL_HOTMAIL",
+  [22] = "PROTOCOL_DIRECT_DOWNLOAD_LINK",
+  [23] = "PROTOCOL_MAIL_POPS",
+  [24] = "PROTOCOL_APPLEJUICE",
+  [25] = "PROTOCOL_DIRECTCONNECT",
+  [26] = "PROTOCOL_SOCRATES",
+  [27] = "PROTOCOL_COAP",
+  [28] = "PROTOCOL_VMWARE",
+  [29] = "PROTOCOL_MAIL_SMTPS",
+  [30] = "PROTOCOL_FILETOPIA",
+  [31] = "PROTOCOL_UBNTAC2",
+  [32] = "PROTOCOL_KONTIKI",
+  [33] = "PROTOCOL_OPENFT",
+  [34] = "PROTOCOL_FASTTRACK",
+  [35] = "PROTOCOL_GNUTELLA",
+  [36] = "PROTOCOL_EDONKEY",
+  [37] = "PROTOCOL_BITTORRENT",
+  [38] = "PROTOCOL_EPP",
+  [39] = "CONTENT_AVI",
+  [40] = "CONTENT_FLASH",
+  [41] = "CONTENT_OGG",
+  [42] = "CONTENT_MPEG",
+  [43] = "CONTENT_QUICKTIME",
+  [44] = "CONTENT_REALMEDIA",
+  [45] = "CONTENT_WINDOWSMEDIA",
+  [46] = "CONTENT_MMS",
+  [47] = "PROTOCOL_XBOX",
+  [48] = "PROTOCOL_QQ",
+  [49] = "PROTOCOL_MOVE",
+  [50] = "PROTOCOL_RTSP",
+  [51] = "PROTOCOL_MAIL_IMAPS",
+  [52] = "PROTOCOL_ICECAST",
+  [53] = "PROTOCOL_PPLIVE",
+  [54] = "PROTOCOL_PPSTREAM",
+  [55] = "PROTOCOL_ZATTOO",
+  [56] = "PROTOCOL_SHOUTCAST",
+  [57] = "PROTOCOL_SOPCAST",
+  [58] = "PROTOCOL_TVANTS",
+  [59] = "PROTOCOL_TVUPLAYER",
+  [60] = "PROTOCOL_HTTP_DOWNLOAD",
+  [61] = "PROTOCOL_QQLIVE",
+  [62] = "PROTOCOL_THUNDER",
+  [63] = "PROTOCOL_SOULSEEK",
+  [64] = "PROTOCOL_SSL_NO_CERT",
+  [65] = "PROTOCOL_IRC",
+  [66] = "PROTOCOL_AYIYA",
+  [67] = "PROTOCOL_UNENCRYPTED_JABBER",
+  [68] = "PROTOCOL_MSN",
+  [69] = "PROTOCOL_OSCAR",
+  [70] = "PROTOCOL_YAHOO",
+  [71] = "PROTOCOL_BATTLEFIELD",
+  [72] = "PROTOCOL_QUAKE",
+  [73] = "PROTOCOL_IP_VRRP",
+  [74] = "PROTOCOL_STEAM",
+  [75] = "PROTOCOL_HALFLIFE2",
+  [76] = "PROTOCOL_WORLDOFWARCRAFT",
+  [77] = "PROTOCOL_TELNET",
+  [78] = "PROTOCOL_STUN",
+  [79] = "PROTOCOL_IP_IPSEC",
+  [80] = "PROTOCOL_IP_GRE",
+  [81] = "PROTOCOL_IP_ICMP",
+  [82] = "PROTOCOL_IP_IGMP",
+  [83] = "PROTOCOL_IP_EGP",
+  [84] = "PROTOCOL_IP_SCTP",
+  [85] = "PROTOCOL_IP_OSPF",
+  [86] = "PROTOCOL_IP_IP_IN_IP",
+  [87] = "PROTOCOL_RTP",
+  [88] = "PROTOCOL_RDP",
+  [89] = "PROTOCOL_VNC",
+  [90] = "PROTOCOL_PCANYWHERE",
+  [91] = "PROTOCOL_SSL",
+  [92] = "PROTOCOL_SSH",
+  [93] = "PROTOCOL_USENET",
+  [94] = "PROTOCOL_MGCP",
+  [95] = "PROTOCOL_IAX",
+  [96] = "PROTOCOL_TFTP",
+  [97] = "PROTOCOL_AFP",
+  [98] = "PROTOCOL_STEALTHNET",
+  [99] = "PROTOCOL_AIMINI",
+  [100] = "PROTOCOL_SIP",
+  [101] = "PROTOCOL_TRUPHONE",
+  [102] = "PROTOCOL_IP_ICMPV6",
+  [103] = "PROTOCOL_DHCPV6",
+  [104] = "PROTOCOL_ARMAGETRON",
+  [105] = "PROTOCOL_CROSSFIRE",
+  [106] = "PROTOCOL_DOFUS",
+  [107] = "PROTOCOL_FIESTA",
+  [108] = "PROTOCOL_FLORENSIA",
+  [109] = "PROTOCOL_GUILDWARS",
+  [110] = "PROTOCOL_HTTP_APPLICATION_ACTIVESYNC",
+  [111] = "PROTOCOL_KERBEROS",
+  [112] = "PROTOCOL_LDAP",
+  [113] = "PROTOCOL_MAPLESTORY",
+  [114] = "PROTOCOL_MSSQL_TDS",
+  [115] = "PROTOCOL_PPTP",
+  [116] = "PROTOCOL_WARCRAFT3",
+  [117] = "PROTOCOL_WORLD_OF_KUNG_FU",
+  [118] = "PROTOCOL_SLACK",
+  [119] = "PROTOCOL_FACEBOOK",
+  [120] = "PROTOCOL_TWITTER",
+  [121] = "PROTOCOL_DROPBOX",
+  [122] = "PROTOCOL_GMAIL",
+  [123] = "PROTOCOL_GOOGLE_MAPS",
+  [124] = "PROTOCOL_YOUTUBE",
+  [125] = "PROTOCOL_SKYPE",
+  [126] = "PROTOCOL_GOOGLE",
+  [127] = "PROTOCOL_DCERPC",
+  [128] = "PROTOCOL_NETFLOW",
+  [129] = "PROTOCOL_SFLOW",
+  [130] = "PROTOCOL_HTTP_CONNECT",
+  [131] = "PROTOCOL_HTTP_PROXY",
+  [132] = "PROTOCOL_CITRIX",
+  [133] = "PROTOCOL_NETFLIX",
+  [134] = "PROTOCOL_LASTFM",
+  [135] = "PROTOCOL_WAZE",
+  [136] = "PROTOCOL_SKYFILE_PREPAID",
+  [137] = "PROTOCOL_SKYFILE_RUDICS",
+  [138] = "PROTOCOL_SKYFILE_POSTPAID",
+  [139] = "PROTOCOL_CITRIX_ONLINE",
+  [140] = "PROTOCOL_APPLE",
+  [141] = "PROTOCOL_WEBEX",
+  [142] = "PROTOCOL_WHATSAPP",
+  [143] = "PROTOCOL_APPLE_ICLOUD",
+  [144] = "PROTOCOL_VIBER",
+  [145] = "PROTOCOL_APPLE_ITUNES",
+  [146] = "PROTOCOL_RADIUS",
+  [147] = "PROTOCOL_WINDOWS_UPDATE",
+  [148] = "PROTOCOL_TEAMVIEWER",
+  [149] = "PROTOCOL_TUENTI",
+  [150] = "PROTOCOL_LOTUS_NOTES",
+  [151] = "PROTOCOL_SAP",
+  [152] = "PROTOCOL_GTP",
+  [153] = "PROTOCOL_UPNP",
+  [154] = "PROTOCOL_LLMNR",
+  [155] = "PROTOCOL_REMOTE_SCAN",
+  [156] = "PROTOCOL_SPOTIFY",
+  [157] = "CONTENT_WEBM",
+  [158] = "PROTOCOL_H323",
+  [159] = "PROTOCOL_OPENVPN",
+  [160] = "PROTOCOL_NOE",
+  [161] = "PROTOCOL_CISCOVPN",
+  [162] = "PROTOCOL_TEAMSPEAK",
+  [163] = "PROTOCOL_TOR",
+  [164] = "PROTOCOL_SKINNY",
+  [165] = "PROTOCOL_RTCP",
+  [166] = "PROTOCOL_RSYNC",
+  [167] = "PROTOCOL_ORACLE",
+  [168] = "PROTOCOL_CORBA",
+  [169] = "PROTOCOL_UBUNTUONE",
+  [170] = "PROTOCOL_WHOIS_DAS",
+  [171] = "PROTOCOL_COLLECTD",
+  [172] = "PROTOCOL_SOCKS",
+  [173] = "PROTOCOL_MS_LYNC",
+  [174] = "PROTOCOL_RTMP",
+  [175] = "PROTOCOL_FTP_DATA",
+  [176] = "PROTOCOL_WIKIPEDIA",
+  [177] = "PROTOCOL_ZMQ",
+  [178] = "PROTOCOL_AMAZON",
+  [179] = "PROTOCOL_EBAY",
+  [180] = "PROTOCOL_CNN",
+  [181] = "PROTOCOL_MEGACO",
+  [182] = "PROTOCOL_REDIS",
+  [183] = "PROTOCOL_PANDO",
+  [184] = "PROTOCOL_VHUA",
+  [185] = "PROTOCOL_TELEGRAM",
+  [186] = "PROTOCOL_VEVO",
+  [187] = "PROTOCOL_PANDORA",
+  [188] = "PROTOCOL_QUIC",
+  [189] = "PROTOCOL_WHATSAPP_VOICE",
+  [190] = "PROTOCOL_EAQ",
+  [191] = "PROTOCOL_OOKLA",
+  [192] = "PROTOCOL_AMQP",
+  [193] = "PROTOCOL_KAKAOTALK",
+  [194] = "PROTOCOL_KAKAOTALK_VOICE",
+  [195] = "PROTOCOL_TWITCH",
+  [196] = "PROTOCOL_QUICKPLAY",
+  [197] = "PROTOCOL_WECHAT",
+  [198] = "PROTOCOL_MPEGTS",
+  [199] = "PROTOCOL_SNAPCHAT",
+  [200] = "PROTOCOL_SINA",
+  [201] = "PROTOCOL_HANGOUT",
+  [202] = "PROTOCOL_IFLIX",
+  [203] = "PROTOCOL_GITHUB",
+  [204] = "PROTOCOL_BJNP",
+  [205] = "PROTOCOL_1KXUN",
+  [206] = "PROTOCOL_IQIYI",
+  [207] = "PROTOCOL_SMPP",
+  [208] = "PROTOCOL_DNSCRYPT",
+  [209] = "PROTOCOL_FREE_209",
+  [210] = "PROTOCOL_DEEZER",
+  [211] = "PROTOCOL_INSTAGRAM",
+  [212] = "PROTOCOL_MICROSOFT",
+  [213] = "PROTOCOL_STARCRAFT",
+  [214] = "PROTOCOL_TEREDO",
+  [215] = "PROTOCOL_HOTSPOT_SHIELD",
+  [216] = "PROTOCOL_HEP",
+  [217] = "PROTOCOL_FREE_217",
+  [218] = "PROTOCOL_OCS",
+  [219] = "PROTOCOL_OFFICE_365",
+  [220] = "PROTOCOL_CLOUDFLARE",
+  [221] = "PROTOCOL_MS_ONE_DRIVE",
+  [222] = "PROTOCOL_MQTT",
+  [223] = "PROTOCOL_RX",
+  [224] = "PROTOCOL_FREE_224",
+  [225] = "PROTOCOL_OPENDNS",
+  [226] = "PROTOCOL_GIT",
+  [227] = "PROTOCOL_DRDA",
+  PROTOCOL_UNKNOWN = 0,
+  PROTOCOL_UNKNOWN = 0,
+  PROTOCOL_FTP_CONTROL = 1,
+  PROTOCOL_SIZE = 2,
+  PROTOCOL_MAIL_POP = 2,
+  PROTOCOL_MAIL_SMTP = 3,
+  PROTOCOL_MAIL_IMAP = 4,
+  PROTOCOL_DNS = 5,
+  PROTOCOL_IPP = 6,
+  PROTOCOL_HTTP = 7,
+  PROTOCOL_MDNS = 8,
+  PROTOCOL_NTP = 9,
+  PROTOCOL_NETBIOS = 10,
+  PROTOCOL_NFS = 11,
+  PROTOCOL_SSDP = 12,
+  PROTOCOL_BGP = 13,
+  PROTOCOL_SNMP = 14,
+  PROTOCOL_XDMCP = 15,
+  PROTOCOL_SMB = 16,
+  PROTOCOL_SYSLOG = 17,
+  PROTOCOL_DHCP = 18,
+  PROTOCOL_POSTGRES = 19,
+  PROTOCOL_MYSQL = 20,
+  PROTOCOL_HOTMAIL = 21,
+  PROTOCOL_DIRECT_DOWNLOAD_LINK = 22,
+  PROTOCOL_MAIL_POPS = 23,
+  PROTOCOL_APPLEJUICE = 24,
+  PROTOCOL_DIRECTCONNECT = 25,
+  PROTOCOL_SOCRATES = 26,
+  PROTOCOL_COAP = 27,
+  PROTOCOL_VMWARE = 28,
+  PROTOCOL_MAIL_SMTPS = 29,
+  PROTOCOL_FILETOPIA = 30,
+  PROTOCOL_UBNTAC2 = 31,
+  PROTOCOL_KONTIKI = 32,
+  PROTOCOL_OPENFT = 33,
+  PROTOCOL_FASTTRACK = 34,
+  PROTOCOL_GNUTELLA = 35,
+  PROTOCOL_EDONKEY = 36,
+  PROTOCOL_BITTORRENT = 37,
+  PROTOCOL_EPP = 38,
+  CONTENT_AVI = 39,
+  CONTENT_FLASH = 40,
+  CONTENT_OGG = 41,
+  CONTENT_MPEG = 42,
+  CONTENT_QUICKTIME = 43,
+  CONTENT_REALMEDIA = 44,
+  CONTENT_WINDOWSMEDIA = 45,
+  CONTENT_MMS = 46,
+  PROTOCOL_XBOX = 47,
+  PROTOCOL_QQ = 48,
+  PROTOCOL_MOVE = 49,
+  PROTOCOL_RTSP = 50,
+  PROTOCOL_MAIL_IMAPS = 51,
+  PROTOCOL_ICECAST = 52,
+  PROTOCOL_PPLIVE = 53,
+  PROTOCOL_PPSTREAM = 54,
+  PROTOCOL_ZATTOO = 55,
+  PROTOCOL_SHOUTCAST = 56,
+  PROTOCOL_SOPCAST = 57,
+  PROTOCOL_TVANTS = 58,
+  PROTOCOL_TVUPLAYER = 59,
+  PROTOCOL_HTTP_DOWNLOAD = 60,
+  PROTOCOL_QQLIVE = 61,
+  PROTOCOL_THUNDER = 62,
+  PROTOCOL_SOULSEEK = 63,
+  PROTOCOL_SSL_NO_CERT = 64,
+  PROTOCOL_IRC = 65,
+  PROTOCOL_AYIYA = 66,
+  PROTOCOL_UNENCRYPTED_JABBER = 67,
+  PROTOCOL_MSN = 68,
+  PROTOCOL_OSCAR = 69,
+  PROTOCOL_YAHOO = 70,
+  PROTOCOL_BATTLEFIELD = 71,
+  PROTOCOL_QUAKE = 72,
+  PROTOCOL_IP_VRRP = 73,
+  PROTOCOL_STEAM = 74,
+  PROTOCOL_HALFLIFE2 = 75,
+  PROTOCOL_WORLDOFWARCRAFT = 76,
+  PROTOCOL_TELNET = 77,
+  PROTOCOL_STUN = 78,
+  PROTOCOL_IP_IPSEC = 79,
+  PROTOCOL_IP_GRE = 80,
+  PROTOCOL_IP_ICMP = 81,
+  PROTOCOL_IP_IGMP = 82,
+  PROTOCOL_IP_EGP = 83,
+  PROTOCOL_IP_SCTP = 84,
+  PROTOCOL_IP_OSPF = 85,
+  PROTOCOL_IP_IP_IN_IP = 86,
+  PROTOCOL_RTP = 87,
+  PROTOCOL_RDP = 88,
+  PROTOCOL_VNC = 89,
+  PROTOCOL_PCANYWHERE = 90,
+  PROTOCOL_SSL = 91,
+  PROTOCOL_SSH = 92,
+  PROTOCOL_USENET = 93,
+  PROTOCOL_MGCP = 94,
+  PROTOCOL_IAX = 95,
+  PROTOCOL_TFTP = 96,
+  PROTOCOL_AFP = 97,
+  PROTOCOL_STEALTHNET = 98,
+  PROTOCOL_AIMINI = 99,
+  PROTOCOL_SIP = 100,
+  PROTOCOL_TRUPHONE = 101,
+  PROTOCOL_IP_ICMPV6 = 102,
+  PROTOCOL_DHCPV6 = 103,
+  PROTOCOL_ARMAGETRON = 104,
+  PROTOCOL_CROSSFIRE = 105,
+  PROTOCOL_DOFUS = 106,
+  PROTOCOL_FIESTA = 107,
+  PROTOCOL_FLORENSIA = 108,
+  PROTOCOL_GUILDWARS = 109,
+  PROTOCOL_HTTP_APPLICATION_ACTIVESYNC = 110,
+  PROTOCOL_KERBEROS = 111,
+  PROTOCOL_LDAP = 112,
+  PROTOCOL_MAPLESTORY = 113,
+  PROTOCOL_MSSQL_TDS = 114,
+  PROTOCOL_PPTP = 115,
+  PROTOCOL_WARCRAFT3 = 116,
+  PROTOCOL_WORLD_OF_KUNG_FU = 117,
+  PROTOCOL_SLACK = 118,
+  PROTOCOL_FACEBOOK = 119,
+  PROTOCOL_TWITTER = 120,
+  PROTOCOL_DROPBOX = 121,
+  PROTOCOL_GMAIL = 122,
+  PROTOCOL_GOOGLE_MAPS = 123,
+  PROTOCOL_YOUTUBE = 124,
+  PROTOCOL_SKYPE = 125,
+  PROTOCOL_GOOGLE = 126,
+  PROTOCOL_DCERPC = 127,
+  PROTOCOL_NETFLOW = 128,
+  PROTOCOL_SFLOW = 129,
+  PROTOCOL_HTTP_CONNECT = 130,
+  PROTOCOL_HTTP_PROXY = 131,
+  PROTOCOL_CITRIX = 132,
+  PROTOCOL_NETFLIX = 133,
+  PROTOCOL_LASTFM = 134,
+  PROTOCOL_WAZE = 135,
+  PROTOCOL_SKYFILE_PREPAID = 136,
+  PROTOCOL_SKYFILE_RUDICS = 137,
+  PROTOCOL_SKYFILE_POSTPAID = 138,
+  PROTOCOL_CITRIX_ONLINE = 139,
+  PROTOCOL_APPLE = 140,
+  PROTOCOL_WEBEX = 141,
+  PROTOCOL_WHATSAPP = 142,
+  PROTOCOL_APPLE_ICLOUD = 143,
+  PROTOCOL_VIBER = 144,
+  PROTOCOL_APPLE_ITUNES = 145,
+  PROTOCOL_RADIUS = 146,
+  PROTOCOL_WINDOWS_UPDATE = 147,
+  PROTOCOL_TEAMVIEWER = 148,
+  PROTOCOL_TUENTI = 149,
+  PROTOCOL_LOTUS_NOTES = 150,
+  PROTOCOL_SAP = 151,
+  PROTOCOL_GTP = 152,
+  PROTOCOL_UPNP = 153,
+  PROTOCOL_LLMNR = 154,
+  PROTOCOL_REMOTE_SCAN = 155,
+  PROTOCOL_SPOTIFY = 156,
+  CONTENT_WEBM = 157,
+  PROTOCOL_H323 = 158,
+  PROTOCOL_OPENVPN = 159,
+  PROTOCOL_NOE = 160,
+  PROTOCOL_CISCOVPN = 161,
+  PROTOCOL_TEAMSPEAK = 162,
+  PROTOCOL_TOR = 163,
+  PROTOCOL_SKINNY = 164,
+  PROTOCOL_RTCP = 165,
+  PROTOCOL_RSYNC = 166,
+  PROTOCOL_ORACLE = 167,
+  PROTOCOL_CORBA = 168,
+  PROTOCOL_UBUNTUONE = 169,
+  PROTOCOL_WHOIS_DAS = 170,
+  PROTOCOL_COLLECTD = 171,
+  PROTOCOL_SOCKS = 172,
+  PROTOCOL_MS_LYNC = 173,
+  PROTOCOL_RTMP = 174,
+  PROTOCOL_FTP_DATA = 175,
+  PROTOCOL_WIKIPEDIA = 176,
+  PROTOCOL_ZMQ = 177,
+  PROTOCOL_AMAZON = 178,
+  PROTOCOL_EBAY = 179,
+  PROTOCOL_CNN = 180,
+  PROTOCOL_MEGACO = 181,
+  PROTOCOL_REDIS = 182,
+  PROTOCOL_PANDO = 183,
+  PROTOCOL_VHUA = 184,
+  PROTOCOL_TELEGRAM = 185,
+  PROTOCOL_VEVO = 186,
+  PROTOCOL_PANDORA = 187,
+  PROTOCOL_QUIC = 188,
+  PROTOCOL_WHATSAPP_VOICE = 189,
+  PROTOCOL_EAQ = 190,
+  PROTOCOL_OOKLA = 191,
+  PROTOCOL_AMQP = 192,
+  PROTOCOL_KAKAOTALK = 193,
+  PROTOCOL_KAKAOTALK_VOICE = 194,
+  PROTOCOL_TWITCH = 195,
+  PROTOCOL_QUICKPLAY = 196,
+  PROTOCOL_WECHAT = 197,
+  PROTOCOL_MPEGTS = 198,
+  PROTOCOL_SNAPCHAT = 199,
+  PROTOCOL_SINA = 200,
+  PROTOCOL_HANGOUT = 201,
+  PROTOCOL_IFLIX = 202,
+  PROTOCOL_GITHUB = 203,
+  PROTOCOL_BJNP = 204,
+  PROTOCOL_1KXUN = 205,
+  PROTOCOL_IQIYI = 206,
+  PROTOCOL_SMPP = 207,
+  PROTOCOL_DNSCRYPT = 208,
+  PROTOCOL_FREE_209 = 209,
+  PROTOCOL_DEEZER = 210,
+  PROTOCOL_INSTAGRAM = 211,
+  PROTOCOL_MICROSOFT = 212,
+  PROTOCOL_STARCRAFT = 213,
+  PROTOCOL_TEREDO = 214,
+  PROTOCOL_HOTSPOT_SHIELD = 215,
+  PROTOCOL_HEP = 216,
+  PROTOCOL_FREE_217 = 217,
+  PROTOCOL_OCS = 218,
+  PROTOCOL_OFFICE_365 = 219,
+  PROTOCOL_CLOUDFLARE = 220,
+  PROTOCOL_MS_ONE_DRIVE = 221,
+  PROTOCOL_MQTT = 222,
+  PROTOCOL_RX = 223,
+  PROTOCOL_FREE_224 = 224,
+  PROTOCOL_OPENDNS = 225,
+  PROTOCOL_GIT = 226,
+  PROTOCOL_DRDA = 227,
+}
+T.PROTOCOL_NO_MASTER_PROTO = T.PROTOCOL_UNKNOWN
+return T
\ No newline at end of file
@@ -167,9 +167,27 @@ local function link (graph, from, to)
    )
 end
 
+-- Shards export at a low rate compared to the traffic they meter, so
+-- their interlinks to the merge worker can be small.
+local shard_queue_size = 1024
+
+local function shard_queue_name (observation_domain)
+   return "shard"..observation_domain
+end
+
 local function configure_ipfix_tap_instance (config, in_graph)
    local graph = in_graph or app_graph.new()
    local _, ipfix = configure_ipfix_instance(config, graph)
+   if config.shard then
+      -- Sharded instances forward data sets to a merge worker instead
+      -- of exporting them (see configure_merge_tap_instance).
+      local _, transmitter = configure_interlink_output(
+         {name=shard_queue_name(config.observation_domain),
+          size=shard_queue_size}, graph
+      )
+      link(graph, ipfix, transmitter)
+      return graph, ipfix
+   end
    local tap_args = {
       instance = config.instance,
       observation_domain = config.observation_domain,
@@ -190,6 +208,28 @@ function configure_interlink_ipfix_tap_instance (in_name, link_size, config)
    return graph
 end
 
+-- Configure a merge worker for a sharded exporter.  The list of
+-- shards is given as the observation domains of the shard instances.
+function configure_merge_tap_instance (name, config, tap_args, shards)
+   local graph = app_graph.new()
+
+   local merge_name = "merge_"..name
+   local merge = {name=merge_name, output='output'}
+   app_graph.app(graph, merge_name, ipfix.Merge, config)
+
+   for _, observation_domain in ipairs(shards) do
+      local queue = shard_queue_name(observation_domain)
+      local _, receiver = configure_interlink_input(
+         {name=queue, size=shard_queue_size}, graph
+      )
+      link(graph, receiver, {name=merge.name, input=queue})
+   end
+   local _, tap = configure_tap_output(tap_args, graph)
+   link(graph, merge, tap)
+
+   return graph
+end
+
 function configure_pci_ipfix_tap_instance (config, inputs, rss_group)
    local graph = app_graph.new()
 
@@ -124,6 +124,18 @@ for _, key in ipairs({
    ipfix_default_config[key] = nil
 end
 
+local ipfix_merge_config = lib.deepcopy(ipfix.Merge.config)
+for _, key in ipairs({
+      "collector_ip",
+      "collector_port",
+      "observation_domain",
+      "exporter_eth_src",
+      "exporter_eth_dst",
+      "log_date"
+}) do
+   ipfix_merge_config[key] = nil
+end
+
 local software_scaling_parser = path_data.parser_for_schema_by_name(
    probe_schema, '/snabbflow-config/rss/software-scaling/exporter[name=""]'
 )
@@ -185,6 +197,9 @@ function setup_workers (config)
    local workers = {}
    local worker_opts = {}
 
+   -- Merge workers of sharded exporters
+   local mergers = {}
+
    local mellanox = {}
 
    update_cpuset(rss.cpu_pool)
@@ -259,6 +274,39 @@ function setup_workers (config)
          if not software_scaling.embed then
             num_instances = software_scaling.instances
          end
+         if software_scaling.merge and config.sampling
+            and config.sampling.adaptive then
+            error(("Exporter '%s': adaptive sampling is not supported "..
+                   "with merge."):format(name))
+         end
+
+         -- Sharded exporters export all flows via a single merge
+         -- worker, which is created along with the first shard.
+         local function merger_for (name)
+            if not mergers[name] then
+               local mconfig = {}
+               for key in pairs(ipfix_merge_config) do
+                  mconfig[key] = config[key]
+               end
+               local collector = select_collector(config.collector_pool)
+               mconfig.collector_ip = collector.ip
+               mconfig.collector_port = collector.port
+               mconfig.observation_domain = next_observation_domain()
+               mconfig.log_date = ipfix.log_date
+               mergers[name] = {
+                  config = mconfig,
+                  tap_args = {
+                     instance = name,
+                     observation_domain = mconfig.observation_domain,
+                     mtu = config.mtu - 14,
+                     log_date = ipfix.log_date
+                  },
+                  software_scaling = software_scaling,
+                  shards = {}
+               }
+            end
+            return mergers[name]
+         end
          for i = 1, num_instances do
             -- Create a clone of the configuration for parameters
             -- specific to the instance
@@ -282,14 +330,25 @@ function setup_workers (config)
                break
             end
 
-            local collector = select_collector(config.collector_pool)
-            iconfig.collector_ip = collector.ip
-            iconfig.collector_port = collector.port
+            local merger = software_scaling.merge and merger_for(name)
+            if merger then
+               -- Shards do not export to the collector themselves.
+               iconfig.collector_ip = merger.config.collector_ip
+               iconfig.collector_port = merger.config.collector_port
+               iconfig.shard = true
+            else
+               local collector = select_collector(config.collector_pool)
+               iconfig.collector_ip = collector.ip
+               iconfig.collector_port = collector.port
+            end
             iconfig.collector_pool = nil
 
             iconfig.log_date = ipfix.log_date
             local od = next_observation_domain()
             iconfig.observation_domain = od
+            if merger then
+               table.insert(merger.shards, od)
+            end
             if ipfix.maps.log_directory then
                iconfig.maps_logfile =
                   ipfix.maps.log_directory.."/"..od..".log"
@@ -381,6 +440,19 @@ function setup_workers (config)
       end
    end
 
+   for name, merger in pairs(mergers) do
+      local merge_worker = "merge_"..name
+      workers[merge_worker] = probe.configure_merge_tap_instance(
+         name, merger.config, merger.tap_args, merger.shards
+      )
+      -- Merge workers are restartable just like dedicated exporters
+      worker_opts[merge_worker] = {
+         restart_intensity = merger.software_scaling.restart.intensity,
+         restart_period = merger.software_scaling.restart.period,
+         acquire_cpu = merger.software_scaling.acquire_cpu
+      }
+   end
+
    -- Create a trivial app graph that only contains the control apps
    -- for the Mellanox driver, which sets up the queues and
    -- maintains interface counters.
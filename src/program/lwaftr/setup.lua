@@ -7,6 +7,7 @@ local V4V6       = require("apps.lwaftr.V4V6").V4V6
 local VirtioNet  = require("apps.virtio_net.virtio_net").VirtioNet
 local lwaftr     = require("apps.lwaftr.lwaftr")
 local lwutil     = require("apps.lwaftr.lwutil")
+local binding_table = require("apps.lwaftr.binding_table")
 local basic_apps = require("apps.basic.basic_apps")
 local pcap       = require("apps.pcap.pcap")
 local ipv4_echo  = require("apps.ipv4.echo")
@@ -24,6 +25,7 @@ local ipv6       = require("lib.protocol.ipv6")
 local ethernet   = require("lib.protocol.ethernet")
 local ipv4_ntop  = require("lib.yang.util").ipv4_ntop
 local binary     = require("lib.yang.binary")
+local path_data  = require("lib.yang.path_data")
 local S          = require("syscall")
 local engine     = require("core.app")
 local lib        = require("core.lib")
@@ -76,12 +78,16 @@ function lwaftr_app(c, conf)
               { max_concurrent_reassemblies =
                    gexternal_interface.reassembly.max_packets,
                 max_fragments_per_reassembly =
-                   gexternal_interface.reassembly.max_fragments_per_packet })
+                   gexternal_interface.reassembly.max_fragments_per_packet,
+                max_reassemblies_per_source =
+                   gexternal_interface.reassembly.max_packets_per_source })
    config.app(c, "reassemblerv6", ipv6_reassemble.Reassembler,
               { max_concurrent_reassemblies =
                    ginternal_interface.reassembly.max_packets,
                 max_fragments_per_reassembly =
-                   ginternal_interface.reassembly.max_fragments_per_packet })
+                   ginternal_interface.reassembly.max_fragments_per_packet,
+                max_reassemblies_per_source =
+                   ginternal_interface.reassembly.max_packets_per_source })
    config.app(c, "icmpechov4", ipv4_echo.ICMPEcho,
               { address = convert_ipv4(iexternal_interface.ip) })
    config.app(c, "icmpechov6", ipv6_echo.ICMPEcho,
@@ -830,12 +836,43 @@ function load_soak_test_on_a_stick (c, conf, inv4_pcap, inv6_pcap)
    link_sink(c, unpack(sinks))
 end
 
+-- A shared binding table is published once by the manager (see
+-- apps.lwaftr.binding_table), so workers are configured without the
+-- softwires.
+local function without_shared_softwires(conf)
+   local bt_conf = conf.softwire_config.binding_table
+   if not bt_conf.shared then return conf end
+   local function shallow_copy(t)
+      local ret = {}
+      for k, v in pairs(t) do ret[k] = v end
+      return ret
+   end
+   local _, softwire_grammar = path_data.resolver(
+      path_data.grammar_for_schema_by_name('snabb-softwire-v3', '/', true),
+      '/softwire-config/binding-table/softwire')
+   local ret = shallow_copy(conf)
+   ret.softwire_config = shallow_copy(conf.softwire_config)
+   ret.softwire_config.binding_table = shallow_copy(bt_conf)
+   ret.softwire_config.binding_table.softwire = softwire_grammar.list.new()
+   return ret
+end
+
+local function publish_shared_binding_table(conf)
+   local publisher = binding_table.get_publisher()
+   local bt_conf = conf.softwire_config.binding_table
+   if bt_conf.shared then
+      publisher:sync(bt_conf)
+   else
+      publisher:invalidate()
+   end
+end
+
 -- Produces configuration for each worker.  Each queue on each device
 -- will get its own worker process.
 local function compute_worker_configs(conf)
    local ret = {}
    local copier = binary.config_copier_for_schema_by_name('snabb-softwire-v3')
-   local make_copy = copier(conf)
+   local make_copy = copier(without_shared_softwires(conf))
    for device, queues in pairs(conf.softwire_config.instance) do
       for id, _ in pairs(queues.queue) do
          local worker_id = string.format('%s/%s', device, id)
@@ -866,6 +903,7 @@ function ptree_manager(f, conf, manager_opts)
 
    local function setup_fn(conf)
       switch_names(conf)
+      publish_shared_binding_table(conf)
       local worker_app_graphs = {}
       for worker_id, worker_config in pairs(compute_worker_configs(conf)) do
          local app_graph = config.new()
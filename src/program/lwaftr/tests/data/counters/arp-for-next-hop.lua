@@ -1,6 +1,6 @@
 return {
-   ["memuse-ipv4-frag-reassembly-buffer"] = 728203264,
-   ["memuse-ipv6-frag-reassembly-buffer"] = 11378176,
+   ["memuse-ipv4-frag-reassembly-buffer"] = 6426824,
+   ["memuse-ipv6-frag-reassembly-buffer"] = 8329160,
    ["out-ipv4-frag-not"] = 1,
    ["out-arp-request-bytes"] = 42,
    ["out-arp-request-packets"] = 1,
@@ -1,4 +1,4 @@
 return {
-   ["memuse-ipv4-frag-reassembly-buffer"] = 728203264,
-   ["memuse-ipv6-frag-reassembly-buffer"] = 11378176,
+   ["memuse-ipv4-frag-reassembly-buffer"] = 6426824,
+   ["memuse-ipv6-frag-reassembly-buffer"] = 8329160,
 }
@@ -7,6 +7,6 @@ return {
    ["in-ipv4-bytes"] = 1494,
    ["in-ipv4-frag-reassembly-unneeded"] = 1,
    ["in-ipv4-packets"] = 1,
-   ["memuse-ipv4-frag-reassembly-buffer"] = 728203264,
-   ["memuse-ipv6-frag-reassembly-buffer"] = 11378176,
+   ["memuse-ipv4-frag-reassembly-buffer"] = 6426824,
+   ["memuse-ipv6-frag-reassembly-buffer"] = 8329160,
 }
@@ -4,8 +4,8 @@ return {
    ["in-ipv6-bytes"] = 6784,
    ["in-ipv6-frag-reassembly-unneeded"] = 64,
    ["in-ipv6-packets"] = 64,
-   ["memuse-ipv4-frag-reassembly-buffer"] = 728203264,
-   ["memuse-ipv6-frag-reassembly-buffer"] = 11378176,
+   ["memuse-ipv4-frag-reassembly-buffer"] = 6426824,
+   ["memuse-ipv6-frag-reassembly-buffer"] = 8329160,
    ["out-ipv6-bytes"] = 6784,
    ["out-ipv6-frag-not"] = 64,
    ["out-ipv6-packets"] = 64,
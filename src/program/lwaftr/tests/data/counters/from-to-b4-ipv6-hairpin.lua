@@ -4,8 +4,8 @@ return {
    ["in-ipv6-bytes"] = 106,
    ["in-ipv6-frag-reassembly-unneeded"] = 1,
    ["in-ipv6-packets"] = 1,
-   ["memuse-ipv4-frag-reassembly-buffer"] = 728203264,
-   ["memuse-ipv6-frag-reassembly-buffer"] = 11378176,
+   ["memuse-ipv4-frag-reassembly-buffer"] = 6426824,
+   ["memuse-ipv6-frag-reassembly-buffer"] = 8329160,
    ["out-ipv6-bytes"] = 106,
    ["out-ipv6-frag-not"] = 1,
    ["out-ipv6-packets"] = 1,
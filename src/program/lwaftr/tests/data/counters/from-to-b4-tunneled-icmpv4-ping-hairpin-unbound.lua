@@ -10,6 +10,6 @@ return {
    ["in-ipv6-bytes"] = 138,
    ["in-ipv6-frag-reassembly-unneeded"] = 1,
    ["in-ipv6-packets"] = 1,
-   ["memuse-ipv4-frag-reassembly-buffer"] = 728203264,
-   ["memuse-ipv6-frag-reassembly-buffer"] = 11378176,
+   ["memuse-ipv4-frag-reassembly-buffer"] = 6426824,
+   ["memuse-ipv6-frag-reassembly-buffer"] = 8329160,
 }
@@ -3,8 +3,8 @@ return {
    ["in-ipv4-frag-needs-reassembly"] = 3,
    ["in-ipv4-frag-reassembled"] = 1,
    ["in-ipv4-packets"] = 1,
-   ["memuse-ipv4-frag-reassembly-buffer"] = 728203264,
-   ["memuse-ipv6-frag-reassembly-buffer"] = 11378176,
+   ["memuse-ipv4-frag-reassembly-buffer"] = 6426824,
+   ["memuse-ipv6-frag-reassembly-buffer"] = 8329160,
    ["out-ipv6-bytes"] = 1500,
    ["out-ipv6-frag-not"] = 1,
    ["out-ipv6-packets"] = 1,
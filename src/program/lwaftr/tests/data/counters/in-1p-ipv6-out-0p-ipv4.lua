@@ -1,6 +1,6 @@
 return {
    ["drop-ipv6-frag-invalid-reassembly"] = 1,
    ["in-ipv6-frag-needs-reassembly"] = 2,
-   ["memuse-ipv4-frag-reassembly-buffer"] = 728203264,
-   ["memuse-ipv6-frag-reassembly-buffer"] = 3072,
+   ["memuse-ipv4-frag-reassembly-buffer"] = 6426824,
+   ["memuse-ipv6-frag-reassembly-buffer"] = 4600,
 }
@@ -4,8 +4,8 @@ return {
    ["in-ipv6-bytes"] = 212,
    ["in-ipv6-frag-reassembly-unneeded"] = 2,
    ["in-ipv6-packets"] = 2,
-   ["memuse-ipv4-frag-reassembly-buffer"] = 728203264,
-   ["memuse-ipv6-frag-reassembly-buffer"] = 11378176,
+   ["memuse-ipv4-frag-reassembly-buffer"] = 6426824,
+   ["memuse-ipv6-frag-reassembly-buffer"] = 8329160,
    ["out-ipv4-bytes"] = 66,
    ["out-ipv4-frag-not"] = 1,
    ["out-ipv4-packets"] = 1,
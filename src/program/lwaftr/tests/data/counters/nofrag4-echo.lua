@@ -1,7 +1,7 @@
 return {
    ["in-ipv4-frag-reassembly-unneeded"] = 1,
-   ["memuse-ipv4-frag-reassembly-buffer"] = 728203264,
-   ["memuse-ipv6-frag-reassembly-buffer"] = 11378176,
+   ["memuse-ipv4-frag-reassembly-buffer"] = 6426824,
+   ["memuse-ipv6-frag-reassembly-buffer"] = 8329160,
    ["out-ipv4-frag-not"] = 1,
    ["out-icmpv4-echo-packets"] = 1,
    ["out-icmpv4-echo-bytes"] = 54,
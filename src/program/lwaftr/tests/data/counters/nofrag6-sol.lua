@@ -1,7 +1,7 @@
 return {
    ["in-ipv6-frag-reassembly-unneeded"] = 1,
-   ["memuse-ipv4-frag-reassembly-buffer"] = 728203264,
-   ["memuse-ipv6-frag-reassembly-buffer"] = 11378176,
+   ["memuse-ipv4-frag-reassembly-buffer"] = 6426824,
+   ["memuse-ipv6-frag-reassembly-buffer"] = 8329160,
    ["out-ipv6-frag-not"] = 1,
    ["out-ndp-na-packets"] = 1,
    ["out-ndp-na-bytes"] = 86,
@@ -1,7 +1,7 @@
 return {
    ["in-ipv6-frag-reassembly-unneeded"] = 1,
-   ["memuse-ipv4-frag-reassembly-buffer"] = 728203264,
-   ["memuse-ipv6-frag-reassembly-buffer"] = 11378176,
+   ["memuse-ipv4-frag-reassembly-buffer"] = 6426824,
+   ["memuse-ipv6-frag-reassembly-buffer"] = 8329160,
    ["in-ndp-ns-packets"] = 1,
    ["in-ndp-ns-bytes"] = 86,
 }
@@ -4,6 +4,6 @@ return {
    ["drop-misplaced-not-ipv6-bytes"] = 66,
    ["drop-misplaced-not-ipv6-packets"] = 1,
    ["in-ipv6-frag-reassembly-unneeded"] = 1,
-   ["memuse-ipv4-frag-reassembly-buffer"] = 728203264,
-   ["memuse-ipv6-frag-reassembly-buffer"] = 11378176,
+   ["memuse-ipv4-frag-reassembly-buffer"] = 6426824,
+   ["memuse-ipv6-frag-reassembly-buffer"] = 8329160,
 }
@@ -4,6 +4,6 @@ return {
    ["drop-misplaced-not-ipv4-bytes"] = 106,
    ["drop-misplaced-not-ipv4-packets"] = 1,
    ["in-ipv4-frag-reassembly-unneeded"] = 1,
-   ["memuse-ipv4-frag-reassembly-buffer"] = 728203264,
-   ["memuse-ipv6-frag-reassembly-buffer"] = 11378176,
+   ["memuse-ipv4-frag-reassembly-buffer"] = 6426824,
+   ["memuse-ipv6-frag-reassembly-buffer"] = 8329160,
 }
@@ -2,8 +2,8 @@ return {
    ["in-ipv4-bytes"] = 5976,
    ["in-ipv4-frag-reassembly-unneeded"] = 4,
    ["in-ipv4-packets"] = 4,
-   ["memuse-ipv4-frag-reassembly-buffer"] = 728203264,
-   ["memuse-ipv6-frag-reassembly-buffer"] = 11378176,
+   ["memuse-ipv4-frag-reassembly-buffer"] = 6426824,
+   ["memuse-ipv6-frag-reassembly-buffer"] = 8329160,
    ["out-ipv6-bytes"] = 6136,
    ["out-ipv6-frag-not"] = 4,
    ["out-ipv6-packets"] = 4,
@@ -6,8 +6,8 @@ return {
    ["in-ipv4-bytes"] = 66,
    ["in-ipv4-frag-reassembly-unneeded"] = 1,
    ["in-ipv4-packets"] = 1,
-   ["memuse-ipv4-frag-reassembly-buffer"] = 728203264,
-   ["memuse-ipv6-frag-reassembly-buffer"] = 11378176,
+   ["memuse-ipv4-frag-reassembly-buffer"] = 6426824,
+   ["memuse-ipv6-frag-reassembly-buffer"] = 8329160,
    ["out-icmpv4-error-bytes"] = 94,
    ["out-icmpv4-error-packets"] = 1,
    ["out-ipv4-bytes"] = 94,
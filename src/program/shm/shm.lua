@@ -13,6 +13,7 @@ require("core.packet")
 local counter = require("core.counter")
 require("core.histogram")
 require("lib.interlink")
+require("lib.mpsc_interlink")
 
 local long_opts = {
    help = "h"
@@ -37,12 +37,20 @@ function run (args)
       intel1g(unpack(args))
    elseif command == 'esp' and #args >= 2 then
       esp(unpack(args))
+   elseif command == 'replay' and #args >= 1 and #args <= 4 then
+      replay_bench(unpack(args))
    elseif command == 'hash' and #args <= 1 then
       hash(unpack(args))
    elseif command == 'ctable' and #args == 0 then
       ctable(unpack(args))
-   elseif command == 'checksum' and #args == 0 then
+   elseif command == 'checksum' and #args <= 1 then
       checksum_bench(unpack(args))
+   elseif command == 'lwaftr' and #args >= 1 and #args <= 2 then
+      lwaftr_bench(unpack(args))
+   elseif command == 'reassembly' and #args >= 1 and #args <= 3 then
+      reassembly_bench(unpack(args))
+   elseif command == 'fragment' and #args >= 1 and #args <= 4 then
+      fragment_bench(unpack(args))
    else
       print(usage) 
       main.exit(1)
@@ -391,7 +399,7 @@ receive_device.interface= "rx1GE"
    end
 end
 
-function esp (npackets, packet_size, mode, direction, aead)
+function esp (npackets, packet_size, mode, direction, aead, batch)
    aead = aead or "aes-gcm-16-icv"
    local esp = require("lib.ipsec.esp")
    local ethernet = require("lib.protocol.ethernet")
@@ -400,6 +408,9 @@ function esp (npackets, packet_size, mode, direction, aead)
 
    npackets = assert(tonumber(npackets), "Invalid number of packets: " .. npackets)
    packet_size = assert(tonumber(packet_size), "Invalid packet size: " .. packet_size)
+   batch = assert(tonumber(batch or 1), "Invalid batch size: " .. tostring(batch))
+   assert(batch >= 1 and batch <= esp.max_batch,
+          "Batch size must be between 1 and " .. esp.max_batch)
    local payload_size = packet_size - ethernet:sizeof() - ipv6:sizeof()
    local payload = ffi.new("uint8_t[?]", payload_size)
    local d = datagram:new(packet.allocate())
@@ -418,18 +429,41 @@ function esp (npackets, packet_size, mode, direction, aead)
                         "00112233445566778899AABBCCDDEEFF",
                   salt = "00112233"}
    local enc, dec = esp.encrypt:new(conf), esp.decrypt:new(conf)
-   local encap, decap
+   local encap, decap, encap_batch, decap_batch
+   local input = ffi.new("struct packet *[?]", batch)
+   local output = ffi.new("struct packet *[?]", batch)
+   local next_header = ffi.new("uint8_t[?]", batch)
    if mode == "tunnel" then
       encap = function (p) return enc:encapsulate_tunnel(p, 41) end
       decap = function (p) return (dec:decapsulate_tunnel(p))   end
+      encap_batch = function (n)
+         enc:encapsulate_tunnel_batch(input, output, n, 41)
+      end
+      decap_batch = function (n)
+         dec:decapsulate_tunnel_batch(input, output, next_header, n)
+      end
    else
       encap = function (p) return enc:encapsulate_transport6(p) end
       decap = function (p) return dec:decapsulate_transport6(p) end
+      encap_batch = function (n)
+         enc:encapsulate_transport6_batch(input, output, n)
+      end
+      decap_batch = function (n)
+         dec:decapsulate_transport6_batch(input, output, n)
+      end
    end
    if direction == "encapsulate" then
       local function test_encapsulate ()
-         for i = 1, npackets do
-            packet.free(encap(packet.clone(plain)))
+         if batch == 1 then
+            for i = 1, npackets do
+               packet.free(encap(packet.clone(plain)))
+            end
+         else
+            for i = 1, npackets, batch do
+               for j = 0, batch - 1 do input[j] = packet.clone(plain) end
+               encap_batch(batch)
+               for j = 0, batch - 1 do packet.free(output[j]) end
+            end
          end
       end
       local start = C.get_monotonic_time()
@@ -440,15 +474,32 @@ function esp (npackets, packet_size, mode, direction, aead)
       end
       local finish = C.get_monotonic_time()
       local bps = (packet_size * npackets) / (finish - start)
-      print(("Encapsulation (packet size = %d): %.2f Gbit/s")
-            :format(packet_size, gbits(bps)))
+      print(("Encapsulation (packet size = %d, batch = %d): %.2f Gbit/s")
+            :format(packet_size, batch, gbits(bps)))
    else
-      local encapsulated = encap(packet.clone(plain))
+      -- Each packet in a batch needs a distinct sequence number to pass the
+      -- anti-replay check, so we encapsulate a batch worth of packets.
+      local encapsulated = {}
+      for j = 0, batch - 1 do
+         encapsulated[j] = encap(packet.clone(plain))
+      end
       local function test_decapsulate ()
-         for i = 1, npackets do
-            packet.free(decap(packet.clone(encapsulated)))
-            dec.seq.no = 0
-            dec.window[0] = 0
+         if batch == 1 then
+            for i = 1, npackets do
+               packet.free(decap(packet.clone(encapsulated[0])))
+               dec.seq.no = 0
+               dec.window[0] = 0
+            end
+         else
+            for i = 1, npackets, batch do
+               for j = 0, batch - 1 do
+                  input[j] = packet.clone(encapsulated[j])
+               end
+               decap_batch(batch)
+               for j = 0, batch - 1 do packet.free(output[j]) end
+               dec.seq.no = 0
+               ffi.fill(dec.window, dec.window_size / 8)
+            end
          end
       end
       local start = C.get_monotonic_time()
@@ -459,9 +510,106 @@ function esp (npackets, packet_size, mode, direction, aead)
       end
       local finish = C.get_monotonic_time()
       local bps = (packet_size * npackets) / (finish - start)
-      print(("Decapsulation (packet size = %d): %.2f Gbit/s")
-            :format(packet_size, gbits(bps)))
+      print(("Decapsulation (packet size = %d, batch = %d): %.2f Gbit/s")
+            :format(packet_size, batch, gbits(bps)))
+   end
+end
+
+function replay_bench (npackets, order, window_size, batch)
+   npackets = assert(tonumber(npackets), "Invalid number of packets: " .. npackets)
+   order = order or 'reorder'
+   window_size = assert(tonumber(window_size or 4096),
+                        "Invalid window size: " .. tostring(window_size))
+   batch = assert(tonumber(batch or 32), "Invalid batch size: " .. tostring(batch))
+   local esp = require("lib.ipsec.esp")
+   assert(batch >= 1 and batch <= esp.max_batch,
+          "Batch size must be between 1 and " .. esp.max_batch)
+   local dec = esp.decrypt:new{spi=0x0, aead="aes-gcm-16-icv",
+                               key="00112233445566778899AABBCCDDEEFF",
+                               salt="00112233", window_size=window_size}
+   local W = dec.window_size
+
+   -- Build a schedule of Sequence Numbers (relative to the start of a
+   -- round, which covers SPAN Sequence Numbers) in the requested order.
+   local length = 2^16
+   local schedule = ffi.new("uint32_t[?]", length)
+   local span = length
+   if order == 'inorder' then
+      for i = 0, length - 1 do schedule[i] = i end
+   elseif order == 'reorder' then
+      -- Shuffled within chunks of half the window size.
+      for i = 0, length - 1 do schedule[i] = i end
+      local chunk = math.min(W / 2, length)
+      for base = 0, length - 1, chunk do
+         for i = chunk - 1, 1, -1 do
+            local j = math.random(0, i)
+            schedule[base+i], schedule[base+j] =
+               schedule[base+j], schedule[base+i]
+         end
+      end
+   elseif order == 'loss' then
+      -- In order, with a burst of loss of up to twice the window size
+      -- every 64 packets.
+      local seq = 0
+      for i = 0, length - 1 do
+         if i % 64 == 0 then seq = seq + math.random(2 * W) end
+         schedule[i], seq = seq, seq + 1
+      end
+      span = seq
+   elseif order == 'duplicate' then
+      -- Every packet is replayed once, up to a quarter of the window
+      -- size later.
+      local events = {}
+      for seq = 0, length / 2 - 1 do
+         table.insert(events, {2 * seq, seq})
+         table.insert(events, {2 * (seq + math.random(0, W / 4)) + 1, seq})
+      end
+      table.sort(events, function (a, b) return a[1] < b[1] end)
+      for i = 0, length - 1 do schedule[i] = events[i+1][2] end
+   else
+      error("Invalid order: " .. order)
+   end
+
+   local accepted = 0
+   local function single (base)
+      for i = 0, length - 1 do
+         local seq = base + schedule[i]
+         local seq_high = dec:check_seq_no(seq)
+         if seq_high >= 0 then
+            dec:track_seq_no(seq, seq_high)
+            accepted = accepted + 1
+         end
+      end
+   end
+   local seq_low = ffi.new("uint32_t[?]", batch)
+   local seq_high = ffi.new("int64_t[?]", batch)
+   local function batched (base)
+      for i = 0, length - 1, batch do
+         local n = math.min(batch, length - i)
+         for j = 0, n - 1 do seq_low[j] = base + schedule[i+j] end
+         C.check_seq_no_batch(seq_low, seq_high, n, dec.seq.no, dec.window, W)
+         dec.seq.no = C.track_seq_no_batch(seq_low, seq_high, n,
+                                           dec.seq.no, dec.window, W)
+         for j = 0, n - 1 do
+            if seq_high[j] >= 0 then accepted = accepted + 1 end
+         end
+      end
+   end
+   local function run ()
+      local round = batch == 1 and single or batched
+      for base = 0, npackets - 1, length do round(base / length * span) end
    end
+   local start = C.get_monotonic_time()
+   if has_pmu_counters then pmu.profile(run) else run() end
+   local runtime = C.get_monotonic_time() - start
+   local total = math.ceil(npackets / length) * length
+
+   print(("Checked %.1f million Sequence Numbers in %.2f seconds "
+             .."(order = %s, window = %d, batch = %d)")
+         :format(total / 1e6, runtime, order, W, batch))
+   print(("Accepted %d, rejected %d"):format(accepted, total - accepted))
+   print(("Rate(Mpps):\t%.3f"):format(total / runtime / 1e6))
+   print(("ns per Sequence Number:\t%.1f"):format(runtime / total * 1e9))
 end
 
 local function measure(f, iterations)
@@ -631,9 +779,9 @@ function ctable ()
    until stride > 256
 end
 
-function checksum_bench ()
-   require("lib.checksum_h")
-   local checksum = require('arch.checksum').checksum
+function checksum_bench (sizes)
+   local checksum = require('lib.checksum')
+   local batch_size = 64
    local function create_packet (size)
       local pkt = {
          data = ffi.new("uint8_t[?]", size),
@@ -658,24 +806,354 @@ function checksum_bench ()
             ns, tostring(res)))
       return res, ns
    end
-   local function benchmark_report (size, mpps)
-      local times = mpps*10^6
+   local function benchmark_report (size)
+      -- Roughly 10^10 bytes per kernel, at least a million calls.
+      local times = math.max(1e6, math.floor(1e10/size))
       local pkt = create_packet(size)
-      local header = "Size=%d bytes; MPPS=%d M"
-      local _, ns = test_perf(function(times)
-         local ret
-         for i=1,times do ret = C.cksum_generic(pkt.data, pkt.length, 0) end
-         return ret
-      end, times, "C: "..header:format(size, mpps))
-      print(('; %.2f ns per byte'):format(ns/size))
+      local header = "Size=%d bytes; %s"
+      local kernels = {}
+      for _, name in ipairs(checksum.supported_kernels()) do
+         table.insert(kernels, {name, checksum.kernels[name].ipsum})
+      end
+      -- The ipsum entry point, which dispatches by length.
+      table.insert(kernels, {"ipsum", checksum.ipsum})
+      for _, kernel in ipairs(kernels) do
+         local name, f = unpack(kernel)
+         local _, ns = test_perf(function(times)
+            local ret
+            for i=1,times do ret = f(pkt.data, pkt.length, 0) end
+            return ret
+         end, times, header:format(size, name))
+         print(('; %.2f ns per byte'):format(ns/size))
+      end
+      -- The batched API over batch_size packets, reported per packet.
+      local pkts, ptrs = {}, ffi.new("uint8_t *[?]", batch_size)
+      local lengths = ffi.new("uint16_t[?]", batch_size)
+      local results = ffi.new("uint16_t[?]", batch_size)
+      for i=0,batch_size-1 do
+         pkts[i] = create_packet(size)
+         ptrs[i], lengths[i] = pkts[i].data, size
+      end
+      local batch = checksum.ipsum_batch
       local _, ns = test_perf(function(times)
-         local ret
-         for i=1,times do ret = checksum(pkt.data, pkt.length, 0) end
-         return ret
-      end, times, "ASM: "..header:format(size, mpps))
-      print(('; %.2f ns per byte'):format(ns/size))
-   end
-   benchmark_report(44, 14.4)
-   benchmark_report(550, 2)
-   benchmark_report(1516, 1)
+         for i=1,times do batch(ptrs, lengths, nil, results, batch_size) end
+         return results[0]
+      end, math.ceil(times/batch_size),
+         header:format(size, checksum.kernel.." batch of "..batch_size))
+      print(('; %.2f ns per packet'):format(ns/batch_size))
+   end
+   local default_sizes = "44,64,128,256,550,1024,1516,9000"
+   for size in (sizes or default_sizes):gmatch("[^,]+") do
+      benchmark_report(assert(tonumber(size), "bad size: "..size))
+   end
+end
+
+function lwaftr_bench (npackets, path)
+   npackets = tonumber(npackets) or error("Invalid number of packets: " .. npackets)
+   path = path or 'mixed'
+   local setup = require("program.lwaftr.setup")
+   local counter = require("core.counter")
+   local data = "program/lwaftr/tests/data/"
+   local empty = "empty.pcap"
+   -- IPv4 and IPv6 inputs that exercise the lwAFTR's hairpinning and
+   -- ICMP handling rather than plain encapsulation and decapsulation.
+   local paths = {
+      hairpin = { empty, "tcp-fromb4-tob4-ipv6.pcap" },
+      icmpv4 = { "incoming-icmpv4-echo-request.pcap", empty },
+      icmpv6 = { empty, "incoming-icmpv6-13dstaddressunreach-inet-OPE.pcap" },
+      mixed = { "incoming-icmpv4-echo-request.pcap",
+                "tcp-fromb4-tob4-ipv6.pcap" }
+   }
+   local inputs = paths[path] or error("Invalid lwaftr path: " .. path)
+   local conf = setup.read_config(data.."tunnel_icmp.conf")
+   local c = config.new()
+   setup.load_bench(c, conf, data..inputs[1], data..inputs[2],
+                    "sinkv4", "sinkv6")
+   engine.configure(c)
+   local lwaftr = engine.app_table.lwaftr
+   local function received ()
+      return counter.read(lwaftr.shm["in-ipv4-packets"])
+         + counter.read(lwaftr.shm["in-ipv6-packets"])
+   end
+   local start = C.get_monotonic_time()
+   engine.main({done = function () return received() >= npackets end,
+                no_report = true})
+   local finish = C.get_monotonic_time()
+   local runtime = finish - start
+   local packets = tonumber(received())
+   print(("Processed %.1f million packets in %.2f seconds (path = %s)")
+         :format(packets / 1e6, runtime, path))
+   print(("Rate(Mpps):\t%.3f"):format(packets / runtime / 1e6))
+   for _, name in ipairs({"hairpin-ipv4-packets", "out-icmpv4-error-packets",
+                          "out-ipv4-packets", "out-ipv6-packets"}) do
+      print(("%s:\t%d"):format(name, tonumber(counter.read(lwaftr.shm[name]))))
+   end
+end
+
+function reassembly_bench (npackets, order, version)
+   npackets = tonumber(npackets) or error("Invalid number of packets: " .. npackets)
+   order = order or 'random'
+   version = version or 'ipv4'
+   local shm = require("core.shm")
+   local link = require("core.link")
+   local datagram = require("lib.protocol.datagram")
+   local ipv4 = require("lib.protocol.ipv4")
+   local ipv6 = require("lib.protocol.ipv6")
+   local protocols = {
+      ipv4 = { header = ipv4, type = 0x0800, mtu = 1500,
+               fragment = require("apps.ipv4.fragment").Fragmenter,
+               reassemble = require("apps.ipv4.reassemble").Reassembler,
+               -- Identification field of the IPv4 header.
+               id_offset = 14 + 4, id_type = ffi.typeof("uint16_t *") },
+      ipv6 = { header = ipv6, type = 0x86dd, mtu = 1500,
+               fragment = require("apps.ipv6.fragment").Fragmenter,
+               reassemble = require("apps.ipv6.reassemble").Reassembler,
+               -- Identification field of the fragment header.
+               id_offset = 14 + 40 + 4, id_type = ffi.typeof("uint32_t *") }
+   }
+   local proto = protocols[version] or error("Invalid IP version: " .. version)
+   -- Number of datagrams that are fragmented, and of fragments that are
+   -- attempted to be reassembled, concurrently.
+   local ndatagrams, datagram_size = 256, 4000
+   -- Number of never-completed reassemblies started per legitimate
+   -- fragment in the "flood" order.
+   local nflood = 4
+
+   local function make_fragments ()
+      local pkt = packet.from_pointer(lib.random_bytes(datagram_size),
+                                      datagram_size)
+      local ip = { src = lib.random_bytes(version == 'ipv4' and 4 or 16),
+                   dst = lib.random_bytes(version == 'ipv4' and 4 or 16),
+                   ttl = 64, hop_limit = 64,
+                   protocol = 0xff, next_header = 0xff }
+      local ip_h = proto.header:new(ip)
+      if version == 'ipv4' then
+         ip_h:total_length(ip_h:sizeof() + datagram_size)
+         ip_h:checksum()
+      else
+         ip_h:payload_length(datagram_size)
+      end
+      local dgram = datagram:new(pkt)
+      dgram:push(ip_h)
+      dgram:push(ethernet:new({ src = lib.random_bytes(6),
+                                dst = lib.random_bytes(6),
+                                type = proto.type }))
+      local fragmenter = proto.fragment:new({mtu=proto.mtu})
+      fragmenter.shm = shm.create_frame("apps/fragmenter", fragmenter.shm)
+      fragmenter.input = { input = link.new("fragment input") }
+      fragmenter.output = { output = link.new("fragment output") }
+      link.transmit(fragmenter.input.input, dgram:packet())
+      fragmenter:push()
+      local ret = {}
+      while not link.empty(fragmenter.output.output) do
+         table.insert(ret, link.receive(fragmenter.output.output))
+      end
+      shm.delete_frame(fragmenter.shm)
+      link.free(fragmenter.input.input, "fragment input")
+      link.free(fragmenter.output.output, "fragment output")
+      return ret
+   end
+
+   -- Build the sequence of fragments sent in one round: every datagram
+   -- once, in the requested order.  Entries are { fragment, bogus },
+   -- where BOGUS fragments get a fresh fragment ID each time they are
+   -- sent, so that they start a reassembly that is never completed.
+   local schedule = {}
+   local templates = {}
+   for i = 1, ndatagrams do templates[i] = make_fragments() end
+   local nfragments = #templates[1]
+   if order == 'inorder' or order == 'flood' then
+      for _, fragments in ipairs(templates) do
+         for _, f in ipairs(fragments) do
+            table.insert(schedule, { f, false })
+            if order == 'flood' then
+               for _ = 1, nflood do
+                  table.insert(schedule, { fragments[1], true })
+               end
+            end
+         end
+      end
+   elseif order == 'reverse' then
+      for _, fragments in ipairs(templates) do
+         for j = #fragments, 1, -1 do
+            table.insert(schedule, { fragments[j], false })
+         end
+      end
+   elseif order == 'random' then
+      -- Interleave the fragments of all datagrams at random.
+      for _, fragments in ipairs(templates) do
+         for _, f in ipairs(fragments) do
+            table.insert(schedule, { f, false })
+         end
+      end
+      for i = #schedule, 2, -1 do
+         local j = math.random(i)
+         schedule[i], schedule[j] = schedule[j], schedule[i]
+      end
+   else
+      error("Invalid order: " .. order)
+   end
+
+   local id_offset, id_type = proto.id_offset, proto.id_type
+   local function run (app)
+      local input, output = app.input.input, app.output.output
+      local next_id, sent, received = 0, 0, 0
+      local start = C.get_monotonic_time()
+      while sent < npackets do
+         for _, entry in ipairs(schedule) do
+            local p = packet.clone(entry[1])
+            if entry[2] then
+               next_id = next_id + 1
+               ffi.cast(id_type, p.data + id_offset)[0] = next_id
+            end
+            link.transmit(input, p)
+            if link.full(input) then
+               app:push()
+               while not link.empty(output) do
+                  packet.free(link.receive(output))
+                  received = received + 1
+               end
+            end
+            sent = sent + 1
+         end
+      end
+      app:push()
+      while not link.empty(output) do
+         packet.free(link.receive(output))
+         received = received + 1
+      end
+      return C.get_monotonic_time() - start, sent, received
+   end
+
+   local function new_app (app)
+      app.shm = shm.create_frame("apps/reassembly_bench", app.shm or {})
+      app.input = { input = link.new("bench input") }
+      app.output = { output = link.new("bench output") }
+      return app
+   end
+   local function free_app (app)
+      shm.delete_frame(app.shm)
+      link.free(app.input.input, "bench input")
+      link.free(app.output.output, "bench output")
+   end
+
+   -- Measure the cost of copying the fragments, to subtract it.
+   local copy = new_app({})
+   function copy:push ()
+      for _ = 1, link.nreadable(self.input.input) do
+         packet.free(link.receive(self.input.input))
+      end
+   end
+   local copy_time = run(copy)
+   free_app(copy)
+
+   local reassembler = new_app(proto.reassemble:new({}))
+   local runtime, sent, received = run(reassembler)
+   free_app(reassembler)
+
+   print(("Sent %.1f million %s fragments in %.2f seconds (order = %s)")
+         :format(sent / 1e6, version, runtime, order))
+   print(("Reassembled %d datagrams of %d fragments"):format(
+         received, nfragments))
+   print(("Rate(Mpps):\t%.3f"):format(sent / runtime / 1e6))
+   print(("ns per fragment:\t%.1f"):format(runtime / sent * 1e9))
+   print(("ns per fragment (excluding copy):\t%.1f"):format(
+         (runtime - copy_time) / sent * 1e9))
+end
+
+function fragment_bench (npackets, version, size, mtu)
+   npackets = tonumber(npackets) or error("Invalid number of packets: " .. npackets)
+   version = version or 'ipv4'
+   size = tonumber(size or 9000) or error("Invalid packet size: " .. size)
+   mtu = tonumber(mtu or 1500) or error("Invalid MTU: " .. mtu)
+   local shm = require("core.shm")
+   local link = require("core.link")
+   local datagram = require("lib.protocol.datagram")
+   local protocols = {
+      ipv4 = { header = require("lib.protocol.ipv4"), type = 0x0800,
+               fragment = require("apps.ipv4.fragment").Fragmenter },
+      ipv6 = { header = require("lib.protocol.ipv6"), type = 0x86dd,
+               fragment = require("apps.ipv6.fragment").Fragmenter }
+   }
+   local proto = protocols[version] or error("Invalid IP version: " .. version)
+
+   -- SIZE is the size of the IP packet, not including the ethernet header.
+   local ip = { src = lib.random_bytes(version == 'ipv4' and 4 or 16),
+                dst = lib.random_bytes(version == 'ipv4' and 4 or 16),
+                ttl = 64, hop_limit = 64,
+                protocol = 0xff, next_header = 0xff }
+   local ip_h = proto.header:new(ip)
+   local payload_size = size - ip_h:sizeof()
+   if version == 'ipv4' then
+      ip_h:total_length(size)
+      ip_h:checksum()
+   else
+      ip_h:payload_length(payload_size)
+   end
+   local dgram = datagram:new(packet.from_pointer(
+                                 lib.random_bytes(payload_size), payload_size))
+   dgram:push(ip_h)
+   dgram:push(ethernet:new({ src = lib.random_bytes(6),
+                             dst = lib.random_bytes(6),
+                             type = proto.type }))
+   local template = dgram:packet()
+
+   -- Push a few packets at a time, so that all of their fragments fit
+   -- on the output link.
+   local batch = 32
+   local function run (app)
+      local input, output = app.input.input, app.output.output
+      local fragments = 0
+      local start = C.get_monotonic_time()
+      for _ = 1, npackets do
+         link.transmit(input, packet.clone(template))
+         if link.nreadable(input) >= batch then
+            app:push()
+            while not link.empty(output) do
+               packet.free(link.receive(output))
+               fragments = fragments + 1
+            end
+         end
+      end
+      app:push()
+      while not link.empty(output) do
+         packet.free(link.receive(output))
+         fragments = fragments + 1
+      end
+      return C.get_monotonic_time() - start, fragments
+   end
+
+   local function new_app (app)
+      app.shm = shm.create_frame("apps/fragment_bench", app.shm or {})
+      app.input = { input = link.new("bench input") }
+      app.output = { output = link.new("bench output") }
+      return app
+   end
+   local function free_app (app)
+      shm.delete_frame(app.shm)
+      link.free(app.input.input, "bench input")
+      link.free(app.output.output, "bench output")
+   end
+
+   -- Measure the cost of cloning the input packets, to subtract it.
+   local copy = new_app({})
+   function copy:push ()
+      for _ = 1, link.nreadable(self.input.input) do
+         link.transmit(self.output.output, link.receive(self.input.input))
+      end
+   end
+   local copy_time = run(copy)
+   free_app(copy)
+
+   local fragmenter = new_app(proto.fragment:new({mtu=mtu}))
+   local runtime, fragments = run(fragmenter)
+   free_app(fragmenter)
+
+   local bits = npackets * template.length * 8
+   print(("Fragmented %.1f million %d-byte %s packets into %.1f million fragments (MTU %d) in %.2f seconds")
+         :format(npackets / 1e6, size, version, fragments / 1e6, mtu, runtime))
+   print(("Rate(Mpps):\t%.3f"):format(npackets / runtime / 1e6))
+   print(("Rate(Gbps):\t%.3f"):format(bits / runtime / 1e9))
+   print(("Rate(Gbps) (excluding copy):\t%.3f"):format(
+         bits / (runtime - copy_time) / 1e9))
 end
@@ -0,0 +1,9 @@
+-- x64 ioctl differences
+
+local arch = {
+  ioctl = {
+  }
+}
+
+return arch
+